@@ -9,92 +9,610 @@
  *
  */
 
+#define _GNU_SOURCE //memfd_create
+
 #include "cave_crawler.h"
+#include "cc_protocol_decode.h" //generated from protocol/cc_protocol.json
 
 #include <stdint.h> //uint8_t, int16_t, int32_t
 #include <unistd.h> //read, close
 #include <fcntl.h> //O_RDWR file open flag
 #include <termios.h> //struct termios, tcgetattr, tcsetattr, cfsetispeed, tcflush
 #include <string.h> //memcpy
-#include <sys/select.h> //select
-#include <malloc.h> //malloc, free
+#include <poll.h> //poll
+#include <sys/epoll.h> //epoll_create1, epoll_ctl, epoll_wait
+#include <malloc.h> //malloc, free, memalign
 #include <errno.h> //errno
 #include <endian.h> //htobe32, be32toh
-#include <time.h> //time, difftime
+#include <time.h> //time, difftime, clock_gettime
+#include <math.h> //fabs, llround, INFINITY
+#include <sys/stat.h> //fstat
+#include <sys/uio.h> //writev
+#include <sys/mman.h> //mmap, munmap, memfd_create
+#include <sys/ioctl.h> //ioctl, TIOCGSERIAL, TIOCSSERIAL
+#include <linux/serial.h> //struct serial_struct, ASYNC_LOW_LATENCY
+#include <pthread.h> //pthread_create, pthread_join, pthread_attr_*
+#include <sched.h> //SCHED_FIFO, cpu_set_t
+#include <stdatomic.h> //atomic_load_explicit, atomic_store_explicit
+#include <limits.h> //INT_MAX
+#include <sys/syscall.h> //SYS_futex
+#include <linux/futex.h> //FUTEX_WAIT, FUTEX_WAKE
+
+#if defined(CC_HAVE_LZ4)
+#include <lz4.h> //LZ4_compress_default, LZ4_decompress_safe
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h> //_mm256_cmpeq_epi8, _mm256_movemask_epi8
+#elif defined(__SSE2__)
+#include <emmintrin.h> //_mm_cmpeq_epi8, _mm_movemask_epi8
+#endif
 
 /* TUNABLE CONSTANTS */
+
+// defaults for cc_init, may be changed at runtime with cc_init_ex
+
+// minimal ring buffer size, rounded up to page size at runtime
 enum {CC_BUFFER_SIZE=2048};
 
 // timeouts
 enum {CC_INIT_TIMEOUT_MS=5000, CC_READ_TIMEOUT_MS=100};
 
+// termios non-canonical read, return as soon as any byte is available
+enum {CC_VMIN=1, CC_VTIME=0};
+
+// device group, max devices reported ready by single epoll_wait
+enum {CC_GROUP_MAX_EVENTS=64};
+
 /* NON TUNABLE CONSTANTS */
 
+// The packet structure, message types and payload layouts are described
+// in protocol/cc_protocol.json. Framing, type and size constants,
+// type -> size table and payload decoders are generated to cc_protocol_decode.h
+
+// offsets
+enum {CC_START_OF_MESSAGE_OFFSET=0, CC_MESSAGE_SIZE_OFFSET=1, CC_MESSAGE_TYPE_OFFSET=2, CC_MSG_PAYLOAD_OFFSET=3};
+
+// validation return values
+enum {CC_INVALID_MESSAGE=-1, CC_NEED_MORE_DATA=0, CC_VAlID_MESSAGE=1};
+
+// message processing return values
+enum {CC_NO_SPACE_IN_USER_ARRAY=-1, CC_MESSAGE_PROCESSED=0};
+
+// asynchronous reading
+enum {CC_ASYNC_DEFAULT_CAPACITY=1024, CC_ASYNC_BATCH=64, CC_CACHE_LINE=64};
+// queue per message type, e.g. CC_ODOMETRY_QUEUE (also shared memory ring and merge stream index)
+#define CC_QUEUE_INDEX(NAME, name, type, size) CC_##NAME##_QUEUE,
+enum {CC_PROTOCOL_MESSAGES(CC_QUEUE_INDEX) CC_QUEUES};
+#undef CC_QUEUE_INDEX
+#define CC_QUEUE_ELEMENT_SIZE(NAME, name, type, size) sizeof(struct cc_##name##_data),
+static const uint32_t CC_QUEUE_ELEMENT_SIZES[CC_QUEUES]={CC_PROTOCOL_MESSAGES(CC_QUEUE_ELEMENT_SIZE)};
+#undef CC_QUEUE_ELEMENT_SIZE
+
+// device group
+enum {CC_GROUP_INITIAL_CAPACITY=8};
+
+// shared memory
+enum {CC_SHM_DEFAULT_CAPACITY=4096, CC_SHM_ALIGNMENT=8};
+
+// scan assembly, triple buffer middle index flag
+enum {CC_SCAN_BUFFERS=3, CC_SCAN_NEW=4};
+
+// RPLidar scan assembly
+enum {CC_RPLIDAR_SCAN_DEFAULT_POINTS=8192};
+enum {CC_RPLIDAR_SYNC_BIT=0x8000};
+
+// XV11 revolution assembly, microseconds per ray (degree) at 1 rpm
+static const double CC_XV11LIDAR_RPM_TO_RAY_US=60.0 * 1000000.0 / 360.0;
+
+// odometry history
+enum {CC_ODOMETRY_HISTORY_DEFAULT_CAPACITY=4096, CC_ODOMETRY_HISTORY_RETRIES=4};
+static const float CC_SLERP_LINEAR_THRESHOLD=0.9995f;
+
+// motion compensation
+// - sin/cos table for 16 bit angles (RPLidar angle_q14) reduced by CC_TRIGONOMETRY_SHIFT
+// - points are transformed in chunks with poses interpolated between knots
+enum {CC_TRIGONOMETRY_TABLE=16384, CC_TRIGONOMETRY_SHIFT=2};
+enum {CC_CLOUD_DEFAULT_KNOTS=8, CC_CLOUD_MAX_KNOTS=64, CC_CLOUD_CHUNK=256};
+
+static float trigonometry_sin[CC_TRIGONOMETRY_TABLE];
+static float trigonometry_cos[CC_TRIGONOMETRY_TABLE];
+static pthread_once_t trigonometry_once=PTHREAD_ONCE_INIT;
+
+// message timestamps
+struct cc_time
+{
+	uint64_t mcu_us; //unwrapped MCU time
+	uint64_t host_us; //MCU time mapped to host clock
+	uint32_t latency_us; //host receive time - host_us
+};
+
+// read-only view of validated message in the ring buffer
+struct cc_message
+{
+	const uint8_t *data;
+	struct cc_time time;
+};
+
+// clock synchronization
+// - MCU timestamps are unwrapped to 64 bits
+// - host receive time - MCU time is the true offset + transport latency
+// - latency is non-negative so we track lower envelope (minimum in window)
+// - line is fitted to lower envelope history (offset and drift)
+enum {CC_CLOCK_WINDOW_US=1000000, CC_CLOCK_WINDOWS=64, CC_CLOCK_RESET_US=1000000};
+enum {CC_CLOCK_MIN_OUTLIER_US=20};
+
+struct cc_clock
+{
+	int initialized;
+	uint32_t last_timestamp_us; //last raw MCU timestamp
+	uint64_t mcu_time_us; //last unwrapped MCU timestamp
+	uint64_t receive_time_us; //host time of the last read
+	//lower envelope of the current window
+	uint64_t window_end_us;
+	int64_t window_min_offset_us;
+	uint64_t window_min_mcu_us;
+	//lower envelope history (ring)
+	double minima_mcu_us[CC_CLOCK_WINDOWS];
+	double minima_offset_us[CC_CLOCK_WINDOWS];
+	int minima;
+	int minima_next;
+	//model host = mcu + offset + drift * (mcu - reference)
+	uint64_t reference_us;
+	double offset_us;
+	double drift;
+};
+
+// lock-free single producer single consumer ring queue
+// - head and tail are free running counters
+// - with CC_DROP_OLDEST producer may also advance tail (with CAS)
+struct cc_queue
+{
+	uint8_t *elements;
+	uint32_t element_size;
+	uint32_t capacity; //power of 2
+	int policy;
+	_Atomic uint64_t dropped;
+	_Alignas(CC_CACHE_LINE) _Atomic uint32_t head; //written by producer
+	_Alignas(CC_CACHE_LINE) _Atomic uint32_t tail; //written by consumer
+};
+
+// per device_id scan assembly published through triple buffer
+// - producer (reading thread) fills back buffer
+// - finished scan is exchanged with middle (marked new)
+// - consumer exchanges front with middle only if marked new
+struct cc_rplidar_scanner
+{
+	int max_points;
+	uint16_t *angle_q14[CC_SCAN_BUFFERS];
+	uint32_t *dist_mm_q2[CC_SCAN_BUFFERS];
+	struct cc_rplidar_scan scans[CC_SCAN_BUFFERS];
+	int back; //owned by producer
+	int front; //owned by consumer
+	_Atomic int middle; //buffer index | CC_SCAN_NEW
+	int started; //revolution wrap seen, back buffer holds scan from its start
+	uint32_t number; //next scan number
+	struct cc_rplidar_data previous; //capsule waiting for start angle of the next one
+	int previous_ready;
+};
+
+// XV11 revolution assembly published through triple buffer (like RPLidar)
+struct cc_xv11lidar_scanner
+{
+	struct cc_xv11lidar_scan scans[CC_SCAN_BUFFERS];
+	int back; //owned by producer
+	int front; //owned by consumer
+	_Atomic int middle; //buffer index | CC_SCAN_NEW
+	int started;
+	uint32_t number;
+	int previous_quad;
+	int previous_ready;
+	double ray_us; //microseconds per ray at the last reported speed
+	uint32_t speed64_sum; //for average revolution speed
+	uint32_t speed64_count;
+};
+
+// poses integrated from odometry in ring indexed by mcu_time_us
+// - head and first are free running sample counters
+// - single writer (reading thread), readers may be in other threads
+struct cc_odometry_history
+{
+	struct cc_pose *samples;
+	uint32_t capacity; //power of 2
+	double meters_per_count;
+	_Atomic uint64_t head; //next sample to write
+	_Atomic uint64_t first; //first sample after history reset
+	struct cc_pose pose; //current integrated pose
+	int32_t previous_left;
+	int32_t previous_right;
+	int previous_ready;
+};
+
+// rigid transform, rotation matrix and translation
+struct cc_transform
+{
+	float r[3][3];
+	float t[3];
+};
+
 /*
-## The packet structure
+## Recording format
 
-|          |  Start Byte   |  Size     | Type            |      Payload   | End Byte      |
-| ---------|---------------|-----------|-----------------|----------------|---------------|
-|   bytes  |    1          |      1    |    1            | type dependent |     1         |
-|   value  | fixed 0xFB    |  0-255    | defined set     | type dependent |   fixed 0xFC  |
+| Header        | Chunk                                | ... | Index                      | Footer         |
+|---------------|--------------------------------------|-----|----------------------------|----------------|
+| magic 8 bytes | chunk header, reads table, raw bytes | ... | chunks x (time, offset)    | index location |
 
-- CRC is already included in USB (not needed)
-- Start Byte, Size, Type, End Byte can all be used for sync
-- Size includes all the bytes ( payload bytes + 4)
-- Payload starts with 4 bytes timestamp in microseconds
+- all the fields are little endian (host order)
+- each chunk holds up to CC_RECORD_CHUNK_BYTES of raw stream bytes (padded to 8 bytes)
+- reads table holds host receive time and byte count of each read() in chunk
+- index holds receive time of first read and file offset of each chunk
+- index and footer are written when recording is stopped, if missing
+  (e.g. crash) replay rebuilds index by walking chunk headers
 */
 
+enum {CC_RECORD_CHUNK_BYTES=65536, CC_RECORD_CHUNK_READS=4096, CC_RECORD_ALIGNMENT=8};
+enum {CC_RECORD_CHUNK_MAGIC=0x48434343, CC_RECORD_FOOTER_MAGIC=0x58494343}; // "CCCH", "CCIX"
 
-// start end delimeters
-enum {CC_START_OF_MESSAGE=0xFB, CC_END_OF_MESSAGE=0xFC};
-// offsets
-enum {CC_START_OF_MESSAGE_OFFSET=0, CC_MESSAGE_SIZE_OFFSET=1, CC_MESSAGE_TYPE_OFFSET=2, CC_MSG_PAYLOAD_OFFSET=3};
+static const char CC_RECORD_MAGIC[8]={'C','C','R','E','C','0','1','\0'};
+
+struct cc_record_chunk
+{
+	uint32_t magic;
+	uint32_t reads;
+	uint32_t bytes; //raw bytes without padding
+	uint32_t reserved;
+};
+
+struct cc_record_read
+{
+	uint64_t receive_time_us;
+	uint32_t bytes;
+	uint32_t reserved;
+};
+
+struct cc_record_index
+{
+	uint64_t receive_time_us; //of the first read in chunk
+	uint64_t offset; //of the chunk in file
+};
+
+struct cc_record_footer
+{
+	uint32_t magic;
+	uint32_t reserved;
+	uint64_t index_offset;
+	uint64_t chunks;
+};
+
+struct cc_recorder
+{
+	int fd;
+	int error; //errno of the first failure, 0 otherwise
+	uint64_t offset; //file offset
+	struct cc_record_read reads[CC_RECORD_CHUNK_READS];
+	uint32_t read_count;
+	uint8_t data[CC_RECORD_CHUNK_BYTES];
+	uint32_t bytes;
+	struct cc_record_index *index;
+	uint64_t chunks;
+	uint64_t index_capacity;
+};
 
 /*
-## Types
+## Compressed log format
+
+| Header        | Block                                    | ... | Index                      | Footer         |
+|---------------|------------------------------------------|-----|----------------------------|----------------|
+| magic 8 bytes | block header, LZ4 compressed messages    | ... | blocks x (time, offset)    | index location |
+
+- index and footer are the same as in recording (different magic), rebuilt if missing
+- block is independent (codec state is reset), compressed data is padded to 8 bytes
+- block decodes to recording chunk (reads table and frames) which is replayed the same way
+- message is type, zigzag varint receive time delta (0 for the same read), then payload:
+  - timestamp_us as zigzag varint delta to previous timestamp of the same type
+  - odometry encoder counts and quaternion (bit patterns) as zigzag varint deltas
+  - xv11lidar angle_quad as is, speed64 and distances as zigzag varint deltas
+  - rplidar device_id, sequence delta, checksums as is, start angle as delta (per device)
+  - rplidar combined_x3 split into major (delta to previous cabin of device) and
+    signed 10 bit predict1, predict2 (zigzag varints)
+  - other types (without specialized codec) payload after timestamp as is
+- blocks are compressed in LZ4 block format or stored if incompressible
+*/
+
+enum {CC_LOG_BLOCK_BYTES=65536, CC_LOG_MESSAGE_MAX_ENCODED=2*UINT8_MAX+32};
+enum {CC_LOG_BLOCK_MAGIC=0x4B4C4343, CC_LOG_FOOTER_MAGIC=0x494C4343}; // "CCLK", "CCLI"
+enum {CC_LOG_STORED=0, CC_LOG_LZ4=1};
+
+// LZ4 block format constraints and built-in compressor hash table
+enum {CC_LZ4_MIN_MATCH=4, CC_LZ4_LAST_LITERALS=5, CC_LZ4_MATCH_LIMIT=12, CC_LZ4_MAX_OFFSET=65535};
+enum {CC_LZ4_HASH_BITS=12};
+#define CC_LZ4_BOUND(size) ((size) + (size)/255 + 16)
+
+static const char CC_LOG_MAGIC[8]={'C','C','L','O','G','0','1','\0'};
+
+struct cc_log_block
+{
+	uint32_t magic;
+	uint32_t codec; //CC_LOG_STORED or CC_LOG_LZ4
+	uint64_t receive_time_us; //of the first message
+	uint32_t messages;
+	uint32_t reads; //distinct receive times
+	uint32_t raw_bytes; //frames decoded from block
+	uint32_t encoded_bytes; //before compression
+	uint32_t compressed_bytes; //after header, without padding
+	uint32_t reserved;
+};
+
+// delta coding state, reset for each block
+struct cc_log_codec
+{
+	uint64_t receive_time_us;
+	uint32_t timestamp_us[UINT8_MAX+1]; //by message type
+	int32_t left_encoder_counts;
+	int32_t right_encoder_counts;
+	uint32_t quaternion[4];
+	uint16_t speed64;
+	uint16_t distances[CC_XV11LIDAR_READING_POINTS];
+	uint8_t rplidar_sequence[UINT8_MAX+1]; //by device_id
+	uint16_t rplidar_start_angle[UINT8_MAX+1];
+	uint16_t rplidar_major[UINT8_MAX+1];
+};
+
+struct cc_logger
+{
+	int fd;
+	int error; //errno of the first failure, 0 otherwise
+	uint64_t offset; //file offset
+	struct cc_log_codec codec;
+	uint64_t receive_time_us; //of the first message in block
+	uint32_t messages;
+	uint32_t reads;
+	uint32_t raw_bytes;
+	uint32_t encoded_bytes;
+	uint8_t encoded[CC_LOG_BLOCK_BYTES];
+	uint8_t compressed[CC_LZ4_BOUND(CC_LOG_BLOCK_BYTES)];
+	uint32_t hash_table[1 << CC_LZ4_HASH_BITS]; //built-in compressor
+	struct cc_record_index *index;
+	uint64_t blocks;
+	uint64_t index_capacity;
+};
+
+struct cc_replay
+{
+	const uint8_t *file; //whole file mapped or user buffer
+	size_t file_size;
+	int buffer; //user supplied raw stream without recording format
+	size_t buffer_offset; //position in user buffer
+	const struct cc_record_index *index; //mapped or rebuilt
+	struct cc_record_index *index_allocated; //if rebuilt
+	uint64_t chunks;
+	uint64_t chunk; //current chunk
+	uint64_t chunk_valid; //validated chunk + 1, 0 if none
+	uint32_t read; //current read in chunk
+	uint32_t data_offset; //offset of current read in chunk raw data
+	uint32_t read_offset; //bytes of current read already copied
+	double speed; //0 for as fast as possible
+	int paced; //pace anchored
+	uint64_t pace_host_us;
+	uint64_t pace_record_us;
+	int log; //compressed log, chunks are decoded from blocks
+	uint64_t log_chunk; //decoded block + 1, 0 if none
+	struct cc_record_chunk *log_decoded; //decoded block in recording chunk layout
+	size_t log_decoded_capacity;
+	uint8_t *log_encoded; //decompressed block
+	size_t log_encoded_capacity;
+};
+
+// parallel offline decoding
+// - stream is split in chunks at validated message starts after nominal boundaries
+// - chunks are scanned in parallel (message offsets, counts, MCU clock summary)
+// - scans are merged in order, chunk which started out of sync with sequential
+//   parsing (e.g. at false start in corrupted data) is scanned again from where
+//   the previous one ended, MCU clock state is carried between chunks
+// - messages are decoded in parallel directly to user arrays
+enum {CC_DECODE_CHUNK_BYTES=1 << 20, CC_DECODE_MIN_CHUNK_BYTES=4096, CC_DECODE_MAX_CHUNK_BYTES=1 << 30};
+enum {CC_DECODE_MAX_THREADS=256};
+enum {CC_DECODE_SCAN=0, CC_DECODE_MESSAGES=1};
+
+struct cc_decode_chunk
+{
+	size_t start; //the first message (or resynchronization) position
+	size_t boundary; //start of the next chunk
+	size_t end; //where parsing crossed boundary (the next message position)
+	uint32_t *offsets; //of messages relative to start
+	uint32_t messages;
+	uint32_t capacity;
+	struct cc_size counts;
+	//MCU clock summary
+	uint32_t first_timestamp_us;
+	uint32_t last_timestamp_us;
+	uint64_t local_mcu_us; //of the last message relative to the first one, absolute after reset
+	int reset; //MCU restarted within chunk
+	//set while merging, clock state before the first message and output positions
+	int initialized;
+	uint32_t previous_timestamp_us;
+	uint64_t previous_mcu_us;
+	struct cc_size first;
+};
+
+struct cc_decoder
+{
+	const uint8_t *stream;
+	size_t size;
+	size_t chunk_bytes;
+	struct cc_decode_chunk *chunks;
+	uint32_t count;
+	struct cc_data *data;
+	int pass; //CC_DECODE_SCAN or CC_DECODE_MESSAGES
+	_Atomic uint32_t next; //next chunk to process
+	_Atomic int error; //errno of the first failure, 0 otherwise
+};
+
+struct cc_group_device
+{
+	struct cc *c; //NULL for free slot
+	int error; //errno of failure after which device was removed from epoll, 0 otherwise
+	int read; //device was read in current cc_group_read_all call
+};
+
+struct cc_group
+{
+	int epoll_fd;
+	struct cc_group_device *devices; //indexed by source
+	int capacity;
+	int live; //devices registered in epoll
+};
+
+// cc_read_each handler adapter adding source
+struct cc_group_each
+{
+	cc_group_handler handler;
+	void *userdata;
+	int source;
+};
 
-Preliminary
+// time-ordered merge
+// - stream per source and message type, ring sorted by time (insertion from the newest end)
+// - messages mostly arrive in order, so insertion rarely moves anything
+// - watermark is the newest time seen minus reorder window (or flush time if later)
+// - ready messages are k-way merged from stream heads with binary heap
+enum {CC_MERGE_TYPES=CC_QUEUES, CC_MERGE_DEFAULT_CAPACITY=1024, CC_MERGE_DEFAULT_WINDOW_US=20000};
+
+struct cc_merge_stream
+{
+	struct cc_event *ring; //capacity elements
+	uint32_t head; //next element to write, free running
+	uint32_t tail; //the oldest element, free running
+};
+
+struct cc_merge
+{
+	struct cc_merge_stream *streams; //source * CC_MERGE_TYPES + type index
+	int count;
+	int sources;
+	uint32_t capacity; //power of 2
+	uint64_t window_us;
+	uint64_t newest_us; //the newest time seen
+	uint64_t flush_us; //messages not newer than this are ready regardless of window
+	uint64_t returned_us; //time of the last returned event
+	int *heap; //stream indices ordered by head time
+	struct cc_event *events; //single allocation for all streams
+	struct cc_merge_stats stats;
+};
+
+/*
+## Shared memory layout
 
-|  Type       | Value  | Payload bytes |  Info                                                         |
-| ------------|--------|---------------|-----------------------------------------|
-|  ODOMETRY   | 0x01   |      28       |  encoders and IMU quaternions           |
-|  XV11LIDAR  | 0x02   |      15       |  lidar data                             |
-|  RPLIDARA3  | 0x03   |     138       |  compressed ultra capsules, sequence    |
+| Header                                | Odometry ring | RPLidar ring | XV11Lidar ring |
+|---------------------------------------|---------------|--------------|----------------|
+| magic, flags, ring descriptors, heads | slots         | slots        | slots          |
 
+- ring holds capacity (power of 2) latest elements, head is free running count of published
+- slot is seqlock: sequence 2 * position + 1 while writing, 2 * position + 2 when written
+- reader copies slot and validates sequence before and after, mismatch means overwritten
+- generation is futex word incremented on publish, publisher wakes only if readers wait
 */
 
-// types
-enum {CC_ODOMETRY_TYPE=0x01, CC_XV11LIDAR_TYPE=0x02, CC_RPLIDAR_TYPE=0x03};
-// sizes
-enum {CC_ODOMETRY_SIZE=28+4, CC_XV11LIDAR_SIZE=15+4, CC_RPLIDAR_SIZE=138+4};
-enum {CC_NON_PAYLOAD_SIZE=4}; //TO DELETE?
+static const char CC_SHM_MAGIC[8]={'C','C','S','H','M','0','1','\0'};
 
+struct cc_shm_ring
+{
+	uint32_t element_size;
+	uint32_t capacity; //power of 2, 0 if not published
+	uint64_t offset; //of the first slot from the segment start
+	uint64_t stride; //slot size
+	_Alignas(CC_CACHE_LINE) _Atomic uint64_t head; //written by publisher
+};
 
-// validation return values
-enum {CC_INVALID_MESSAGE=-1, CC_NEED_MORE_DATA=0, CC_VAlID_MESSAGE=1};
+struct cc_shm_header
+{
+	char magic[8];
+	uint64_t size; //of the whole segment
+	_Atomic uint32_t closed; //set by publisher in cc_shm_close
+	_Alignas(CC_CACHE_LINE) _Atomic uint32_t generation; //futex word, incremented on publish
+	_Atomic uint32_t waiters; //readers waiting on generation
+	struct cc_shm_ring rings[CC_QUEUES];
+};
 
-// message processing return values
-enum {CC_NO_SPACE_IN_USER_ARRAY=-1, CC_MESSAGE_PROCESSED=0};
+struct cc_shm_slot
+{
+	_Atomic uint64_t sequence;
+	uint8_t data[]; //element
+};
+
+// process local part of publisher or reader
+struct cc_shm
+{
+	struct cc_shm_header *header; //mapped segment
+	size_t size; //of the mapping
+	int publisher;
+	char *name; //publisher only, for unlinking
+	uint64_t cursor[CC_QUEUES]; //reader position per ring
+	uint64_t dropped[CC_QUEUES]; //reader lost data per ring
+};
 
 // internal library data
 struct cc
 {
 	int fd;
 	int data_pending;
+	int init_timeout_ms;
+	int read_timeout_ms;
+	int input_ready; //set by cc_group when epoll reported fd readable
 	struct termios initial_termios;
 	struct termios actual_termios;
-	uint8_t buffer[CC_BUFFER_SIZE];
-	int buffer_bytes;
+	uint8_t *buffer; //ring buffer mapped twice back to back (mirrored)
+	int buffer_size; //size of single mapping
+	int buffer_start; //ring offset of the first pending byte
+	int buffer_bytes; //pending bytes
+	struct cc_stats stats; //updated by reading thread only
+	//previous capsule sequence per device_id for gap statistics
+	uint8_t rplidar_sequence[UINT8_MAX+1];
+	uint8_t rplidar_sequence_ready[UINT8_MAX+1];
+	struct cc_clock clock;
+	//previous capsule per device_id for decoding measurements
+	rplidar_response_ultra_capsule_measurement_nodes_t rplidar_previous[UINT8_MAX+1];
+	uint8_t rplidar_previous_ready[UINT8_MAX+1];
+	//scan assembly per device_id, NULL if not enabled
+	struct cc_rplidar_scanner *rplidar_scanners[UINT8_MAX+1];
+	int rplidar_scans_enabled;
+	//per device_id queues bypassing cc_data, NULL if not routed
+	struct cc_queue *rplidar_routes[UINT8_MAX+1];
+	int rplidar_routes_enabled;
+	struct cc_xv11lidar_scanner *xv11lidar_scanner; //NULL if not enabled
+	struct cc_odometry_history *odometry_history; //NULL if not enabled
+	//asynchronous reading
+	int async_running;
+	pthread_t async_thread;
+	atomic_int async_stop; //set by consumer to terminate reader
+	atomic_int async_errno; //set by reader on fatal error, 0 otherwise
+	struct cc_queue queues[CC_QUEUES];
+	//recording and replay
+	struct cc_recorder *recorder;
+	struct cc_replay *replay;
+	struct cc_logger *logger;
 };
 
 /* Init and teardown */
 
 struct cc *cc_init(const char *tty);
+struct cc *cc_init_ex(const char *tty, const struct cc_config *config);
+static struct cc *cc_alloc(int buffer_size);
+static int config_with_defaults(const struct cc_config *config, struct cc_config *out);
+static int termios_applied(int fd, const struct termios *requested);
+static int low_latency_set(int fd);
 static int wait_for_input(struct cc *c);
 
 int cc_close(struct cc *c);
 static struct cc *close_free_and_return_null(struct cc *c);
 
+/* Ring buffer */
+
+static int ring_init(struct cc *c, int min_size);
+static void ring_close(struct cc *c);
+static uint8_t *ring_data(struct cc *c);
+static void ring_consume(struct cc *c, int bytes);
+
 /* Data reading functions */
 
 int cc_odometry(struct cc *c, struct cc_odometry_data *data, int size);
@@ -102,50 +620,314 @@ int cc_rplidar(struct cc *c, struct cc_rplidar_data *data, int size);
 int cc_xv11lidar(struct cc *c, struct cc_xv11lidar_data *data, int size);
 
 int cc_read_all(struct cc *c, struct cc_data *data);
+int cc_read_columns(struct cc *c, struct cc_columns *columns);
+int cc_read_each(struct cc *c, cc_message_handler handler, void *userdata);
+
+/* Message views */
+
+int cc_message_type(const struct cc_message *msg);
+int cc_message_size(const struct cc_message *msg);
+const uint8_t *cc_message_bytes(const struct cc_message *msg);
+const uint8_t *cc_message_payload(const struct cc_message *msg);
+uint32_t cc_message_timestamp_us(const struct cc_message *msg);
+uint64_t cc_message_mcu_time_us(const struct cc_message *msg);
+uint64_t cc_message_host_time_us(const struct cc_message *msg);
+uint32_t cc_message_latency_us(const struct cc_message *msg);
+uint8_t cc_message_rplidar_device_id(const struct cc_message *msg);
+uint8_t cc_message_rplidar_sequence(const struct cc_message *msg);
+const rplidar_response_ultra_capsule_measurement_nodes_t *cc_message_rplidar_capsule(const struct cc_message *msg);
+int cc_message_odometry(const struct cc_message *msg, struct cc_odometry_data *data);
+int cc_message_rplidar(const struct cc_message *msg, struct cc_rplidar_data *data);
+int cc_message_xv11lidar(const struct cc_message *msg, struct cc_xv11lidar_data *data);
+
+/* Clock synchronization */
+
+uint64_t cc_host_time_us(struct cc *c, uint64_t mcu_time_us);
+
+static void clock_update(struct cc_clock *k, uint32_t timestamp_us, struct cc_time *time);
+static void clock_reset(struct cc_clock *k, uint32_t timestamp_us);
+static void clock_push_window(struct cc_clock *k);
+static void clock_fit(struct cc_clock *k);
+static uint64_t clock_host_time_us(const struct cc_clock *k, uint64_t mcu_time_us);
+static uint64_t host_clock_us(void);
+
+/* Recording */
+
+int cc_record_start(struct cc *c, const char *path);
+int cc_record_stop(struct cc *c);
+
+static void record_append(struct cc_recorder *r, const uint8_t *data, uint32_t bytes, uint64_t receive_time_us);
+static int record_flush(struct cc_recorder *r, const uint8_t *data, uint32_t bytes);
+static int record_write_index(struct cc_recorder *r);
+static int record_index_append(struct cc_record_index **index, uint64_t *count, uint64_t *capacity, uint64_t receive_time_us, uint64_t offset);
+static int write_all(int fd, const struct iovec *iov, int iovcnt);
+
+/* Replay */
+
+struct cc *cc_open_replay(const char *path, double speed);
+struct cc *cc_open_buffer(const uint8_t *data, size_t size);
+int cc_replay_seek(struct cc *c, uint64_t receive_time_us);
+
+static int replay_index(struct cc_replay *r);
+static uint64_t replay_chunk_size(const struct cc_replay *r, uint64_t offset, uint64_t *receive_time_us);
+static const struct cc_record_chunk *replay_chunk(struct cc_replay *r, uint64_t chunk);
+static const struct cc_record_read *replay_reads(const struct cc_record_chunk *chunk);
+static const uint8_t *replay_data(const struct cc_record_chunk *chunk);
+static int replay_recv(struct cc *c);
+static int replay_recv_buffer(struct cc *c);
+static void replay_pace(struct cc_replay *r, uint64_t receive_time_us);
+static void replay_close(struct cc_replay *r);
+
+/* Compressed logging */
+
+int cc_log_start(struct cc *c, const char *path);
+int cc_log_stop(struct cc *c);
+
+static void log_append(struct cc *c, const uint8_t *msg);
+static int log_flush(struct cc_logger *l, struct cc_stats *stats);
+static int log_write_index(struct cc_logger *l);
+static uint8_t *log_encode_message(struct cc_log_codec *k, const uint8_t *msg, uint64_t receive_time_us, uint8_t *out);
+static const uint8_t *log_decode_message(struct cc_log_codec *k, const uint8_t *in, const uint8_t *end, uint8_t *frame, uint64_t *receive_time_us);
+static uint8_t *log_encode_payload(uint8_t type, const uint8_t *payload, uint8_t *out);
+static const uint8_t *log_decode_payload(uint8_t type, uint32_t timestamp_us, const uint8_t *in, const uint8_t *end, uint8_t *payload);
+static const struct cc_record_chunk *log_decode_block(struct cc_replay *r, uint64_t chunk);
+static uint8_t *varint_put(uint8_t *out, uint64_t value);
+static const uint8_t *varint_get(const uint8_t *in, const uint8_t *end, uint64_t *value);
+static uint64_t zigzag_encode(int64_t value);
+static int64_t zigzag_decode(uint64_t value);
+
+/* LZ4 block compression */
+
+static int lz4_compress(const uint8_t *src, int size, uint8_t *dst, int capacity, uint32_t *hash_table);
+static int lz4_decompress(const uint8_t *src, int size, uint8_t *dst, int capacity);
+static uint8_t *lz4_put_length(uint8_t *out, uint32_t length);
 
 /* Message validation */
 
-static int validate_message(struct cc *c, int from);
+static int next_message(struct cc *c, const uint8_t *buffer, int *offset);
+static int validate_message(const uint8_t *data, int bytes, int from);
+static int find_message_start(const uint8_t *data, int bytes, int from);
 static int is_valid_message_start(uint8_t c);
 static int is_valid_message_start_end(uint8_t msg_start, uint8_t msg_end);
 static int is_valid_length_for_message_type(uint8_t msg_start,uint8_t msg_type, uint8_t msg_length);
 
 /* Message processing and decoding */
 
-static int process_message(uint8_t *msg, struct cc_data *data, struct cc_size *counters);
+static int process_message(struct cc *c, uint8_t *msg, const struct cc_time *time, struct cc_data *data, struct cc_size *counters);
+static int process_message_columns(struct cc *c, uint8_t *msg, const struct cc_time *time, struct cc_columns *columns, struct cc_size *counters);
+static void message_consumed(struct cc *c, const uint8_t *msg);
+
+/* Message hooks */
+
+static int message_routed(struct cc *c, const uint8_t *msg, const struct cc_time *time);
+static void message_hooks(struct cc *c, const uint8_t *msg, const struct cc_time *time, const void *decoded);
+
+// decode_message_odometry, decode_message_xv11lidar, decode_message_rplidar (and *_columns)
+#define CC_DECODE_MESSAGE_DECLARATION(NAME, name, type, size) \
+static void decode_message_##name(const uint8_t *msg, const struct cc_time *time, struct cc_##name##_data *data); \
+static void decode_message_##name##_columns(const uint8_t *msg, const struct cc_time *time, const struct cc_##name##_columns *columns, int i);
+CC_PROTOCOL_MESSAGES(CC_DECODE_MESSAGE_DECLARATION)
+#undef CC_DECODE_MESSAGE_DECLARATION
+
+static uint32_t decode_uint32(const uint8_t *encoded);
+
+/* RPLidar measurement decoding */
+
+int cc_rplidar_decode(struct cc *c, const struct cc_rplidar_data *capsules, int size, struct cc_rplidar_points *points);
+
+static void decode_rplidar_capsule(const rplidar_response_ultra_capsule_measurement_nodes_t *capsule,
+	const rplidar_response_ultra_capsule_measurement_nodes_t *next, struct cc_rplidar_points *points, int from);
+static void decode_rplidar_distances(const rplidar_response_ultra_capsule_measurement_nodes_t *capsule,
+	const rplidar_response_ultra_capsule_measurement_nodes_t *next, int32_t dist_q2[CC_RPLIDAR_CAPSULE_POINTS]);
+static void decode_rplidar_distances_scalar(const rplidar_response_ultra_capsule_measurement_nodes_t *capsule,
+	const rplidar_response_ultra_capsule_measurement_nodes_t *next, int32_t dist_q2[CC_RPLIDAR_CAPSULE_POINTS], int from);
+static void decode_rplidar_cabin(uint32_t combined_x3, uint32_t next_combined_x3, int32_t dist_q2[3]);
+static uint32_t varbitscale_decode(uint32_t scaled, uint32_t *scale_level);
+
+/* RPLidar scan assembly */
+
+int cc_rplidar_scan_enable(struct cc *c, uint8_t device_id, int max_points);
+int cc_rplidar_scan(struct cc *c, uint8_t device_id, struct cc_rplidar_scan *scan);
+
+static void rplidar_scan_message(struct cc *c, const uint8_t *msg, const struct cc_time *time);
+static void rplidar_scan_feed(struct cc_rplidar_scanner *s, const struct cc_rplidar_data *capsule);
+static void rplidar_scan_begin(struct cc_rplidar_scanner *s, const struct cc_rplidar_data *capsule, uint32_t missed_capsules);
+static void rplidar_scan_publish(struct cc_rplidar_scanner *s);
+static void stream_state_reset(struct cc *c);
+static void rplidar_scanners_free(struct cc *c);
+
+/* RPLidar routing */
+
+int cc_rplidar_route(struct cc *c, uint8_t device_id, int capacity, int policy);
+int cc_rplidar_read(struct cc *c, uint8_t device_id, struct cc_rplidar_data *data, int size);
+
+static void rplidar_route_message(struct cc *c, const uint8_t *msg, const struct cc_time *time);
+static void rplidar_routes_free(struct cc *c);
+
+/* XV11 measurement decoding */
+
+int cc_xv11lidar_decode(const struct cc_xv11lidar_data *readings, int size, struct cc_xv11lidar_points *points);
+
+static void decode_xv11lidar_reading(const struct cc_xv11lidar_data *reading, struct cc_xv11lidar_points *points, int from);
+
+/* XV11 revolution assembly */
 
-static void decode_message_odometry(uint8_t *msg, struct cc_odometry_data *data);
-static void decode_message_rplidar(uint8_t *msg, struct cc_rplidar_data *data);
-static void decode_message_xv11lidar(uint8_t *msg, struct cc_xv11lidar_data *data);
+int cc_xv11lidar_scan_enable(struct cc *c);
+int cc_xv11lidar_scan(struct cc *c, const struct cc_xv11lidar_scan **scan);
 
-static uint16_t decode_uint16(uint8_t *encoded);
-static int32_t decode_int32(uint8_t *encoded);
-static uint32_t decode_uint32(uint8_t *encoded);
-static float decode_float(uint8_t *encoded);
+static void xv11lidar_scan_message(struct cc *c, const uint8_t *msg, const struct cc_time *time);
+static void xv11lidar_scan_feed(struct cc_xv11lidar_scanner *s, const struct cc_xv11lidar_data *reading);
+static void xv11lidar_scan_begin(struct cc_xv11lidar_scanner *s, const struct cc_xv11lidar_data *reading);
+static void xv11lidar_scan_publish(struct cc_xv11lidar_scanner *s);
+
+/* Odometry history */
+
+int cc_odometry_history_enable(struct cc *c, const struct cc_odometry_history_config *config);
+int cc_pose_at(struct cc *c, uint64_t mcu_time_us, struct cc_pose *pose);
+
+static void odometry_history_message(struct cc *c, const uint8_t *msg, const struct cc_time *time);
+static void odometry_history_feed(struct cc_odometry_history *h, const struct cc_odometry_data *odometry);
+static void pose_interpolate(const struct cc_pose *a, const struct cc_pose *b, uint64_t mcu_time_us, struct cc_pose *pose);
+static void quaternion_forward(float qw, float qx, float qy, float qz, float forward[3]);
+static float quaternion_yaw(float qw, float qx, float qy, float qz);
+static void quaternion_normalize(float *qw, float *qx, float *qy, float *qz);
+static void odometry_history_free(struct cc *c);
+
+/* Motion compensation */
+
+int cc_rplidar_cloud(struct cc *c, const struct cc_rplidar_scan *scan, const struct cc_cloud_config *config, struct cc_cloud *cloud);
+int cc_xv11lidar_cloud(struct cc *c, const struct cc_xv11lidar_scan *scan, const struct cc_cloud_config *config, struct cc_cloud *cloud);
+
+static int cloud_knots(struct cc *c, uint64_t start_us, uint64_t end_us, const struct cc_cloud_config *config,
+	struct cc_transform *knots, uint64_t *knot_times);
+static void cloud_deskew(const struct cc_transform *knots, const uint64_t *knot_times, int knot_count,
+	const uint64_t *times, struct cc_cloud *cloud, int from, int size);
+static void cloud_transform(const struct cc_transform *a, const struct cc_transform *b, const float *weights,
+	float *x, float *y, float *z, int size);
+static void transform_from_pose(const struct cc_pose *p, struct cc_transform *m);
+static void transform_from_yaw(float yaw_rad, float x, float y, float z, struct cc_transform *m);
+static void transform_inverse(const struct cc_transform *m, struct cc_transform *inverse);
+static void transform_multiply(const struct cc_transform *a, const struct cc_transform *b, struct cc_transform *out);
+static void trigonometry_init(void);
+
+/* Asynchronous reading */
+
+int cc_start_async(struct cc *c, const struct cc_async_config *config);
+int cc_read_async(struct cc *c, struct cc_data *data);
+int cc_stop_async(struct cc *c);
+void cc_get_async_stats(struct cc *c, struct cc_async_stats *stats);
+
+static void *async_reader(void *arg);
+static int async_thread_attributes(pthread_attr_t *attr, const struct cc_async_config *config);
+static void async_free_queues(struct cc *c);
+
+/* Lock-free queues */
+
+static int queue_init(struct cc_queue *q, uint32_t element_size, int capacity, int policy);
+static void queue_close(struct cc_queue *q);
+static void queue_push(struct cc_queue *q, const void *elements, int size);
+static int queue_pop(struct cc_queue *q, void *elements, int size);
+static int queue_empty(struct cc_queue *q);
+
+/* Multiple devices */
+
+struct cc_group *cc_group_init(void);
+int cc_group_close(struct cc_group *g);
+int cc_group_add(struct cc_group *g, struct cc *c);
+int cc_group_remove(struct cc_group *g, int source);
+int cc_group_read_all(struct cc_group *g, struct cc_data *data, int timeout_ms);
+int cc_group_read_each(struct cc_group *g, cc_group_handler handler, void *userdata, int timeout_ms);
+int cc_group_error(struct cc_group *g, int source);
+
+static int group_wait(struct cc_group *g, struct epoll_event *events, int timeout_ms);
+static void group_fail(struct cc_group *g, int source);
+static int group_pending(const struct cc_group *g);
+static int group_each_handler(const struct cc_message *msg, void *userdata);
+
+/* Merged event stream */
+
+struct cc_merge *cc_merge_init(const struct cc_merge_config *config);
+void cc_merge_close(struct cc_merge *m);
+int cc_merge_push(struct cc_merge *m, int source, const struct cc_data *data);
+int cc_group_read_merged(struct cc_group *g, struct cc_merge *m, struct cc_events *events, int timeout_ms);
+int cc_merge_read(struct cc_merge *m, struct cc_events *events);
+void cc_merge_flush(struct cc_merge *m);
+void cc_merge_get_stats(struct cc_merge *m, struct cc_merge_stats *stats);
+
+static struct cc_event *merge_insert(struct cc_merge *m, int source, int type, uint64_t time_us);
+static int merge_group_handler(int source, const struct cc_message *msg, void *userdata);
+static uint64_t merge_head_time(const struct cc_merge *m, int stream);
+static void merge_sift_down(struct cc_merge *m, int size, int i);
+
+/* Shared memory */
+
+struct cc_shm *cc_shm_create(const char *name, const struct cc_size *capacity);
+int cc_shm_publish(struct cc_shm *shm, const struct cc_data *data);
+struct cc_shm *cc_shm_attach(const char *name);
+int cc_shm_read_all(struct cc_shm *shm, struct cc_data *data, int timeout_ms);
+void cc_shm_get_lag(struct cc_shm *shm, struct cc_shm_lag *lag);
+int cc_shm_close(struct cc_shm *shm);
+
+static struct cc_shm *shm_map(int fd, size_t size, int publisher);
+static int shm_valid(const struct cc_shm_header *h, size_t size);
+static struct cc_shm_slot *shm_slot(struct cc_shm_header *h, int ring, uint64_t position);
+static void shm_ring_publish(struct cc_shm_header *h, int ring, const void *elements, int size);
+static int shm_ring_read(struct cc_shm *shm, int ring, void *elements, int size);
+static int shm_ring_pending(const struct cc_shm *shm, int ring);
+static int shm_wait(struct cc_shm_header *h, uint32_t generation, uint64_t deadline_us);
+
+/* Offline decoding */
+
+int cc_decode_buffer(const uint8_t *stream, size_t size, const struct cc_decode_config *config, struct cc_data *data);
+
+static int decode_run(struct cc_decoder *d, int threads, int pass);
+static void *decode_worker(void *arg);
+static size_t decode_split(const struct cc_decoder *d, size_t nominal);
+static int decode_scan(const struct cc_decoder *d, struct cc_decode_chunk *chunk, size_t from);
+static int decode_merge(struct cc_decoder *d, struct cc_size *total);
+static void decode_chunk(const struct cc_decoder *d, const struct cc_decode_chunk *chunk);
+
+/* Statistics */
+
+void cc_get_stats(struct cc *c, struct cc_stats *stats);
+
+static void stats_recv(struct cc_stats *s, int bytes, uint64_t elapsed_us);
+static void stats_message(struct cc *c, const uint8_t *msg);
+static int log2_bucket(uint64_t value, int buckets);
 
 /* Stream settings functions */
 
 /* Low level IO */
 static int recv(struct cc *c);
+static int recv_device(struct cc *c);
+static int wait_readable(int fd, int timeout_ms);
 
 /* ---------------------- IMPLEMENTATION ----------------------------- */
 
 /* Init and teardown functions */
 
 struct cc *cc_init(const char *tty)
+{
+	return cc_init_ex(tty, NULL);
+}
+
+struct cc *cc_init_ex(const char *tty, const struct cc_config *config)
 {
 	struct cc *c;
+	struct cc_config cfg;
 
-	c = (struct cc*)malloc(sizeof(struct cc));
+	if(config_with_defaults(config, &cfg) != CC_OK)
+		return NULL;
 
-	if( c == NULL )
+	if( (c = cc_alloc(cfg.buffer_size)) == NULL )
 		return NULL;
 
-	c->buffer_bytes=0;
-	c->data_pending=0;
+	c->init_timeout_ms=cfg.init_timeout_ms;
+	c->read_timeout_ms=cfg.read_timeout_ms;
 
 	if ( (c->fd=open(tty, O_RDWR)) ==-1 )
 	{
+		ring_close(c);
 		free(c);
 		return NULL;
 	}
@@ -154,20 +936,23 @@ struct cc *cc_init(const char *tty)
 		return close_free_and_return_null(c);
 
 	cfmakeraw(&c->actual_termios);
-	c->actual_termios.c_cc[VMIN]=1;
-	c->actual_termios.c_cc[VTIME]=0;
+	c->actual_termios.c_cc[VMIN]=cfg.vmin;
+	c->actual_termios.c_cc[VTIME]=cfg.vtime;
 
 	if(tcsetattr(c->fd, TCSAFLUSH, &c->actual_termios) < 0)
 		return close_free_and_return_null(c);
 
-	// from man (TO DO)
+	// from man
 	// Note that tcsetattr() returns success if any of the  requested  changes
 	// could  be  successfully  carried  out.  Therefore, when making multiple
 	// changes it may be necessary to follow this call with a further call  to
 	// tcgetattr() to check that all changes have been performed successfully.
-	//
-	// this is still edge case to consider, some settings may have not been made
-	// solution tcgetattr and check settings we made for equality
+	if(termios_applied(c->fd, &c->actual_termios) != CC_OK)
+		return close_free_and_return_null(c);
+
+	//best effort, reported in cc_get_stats
+	if(cfg.low_latency)
+		c->stats.low_latency = low_latency_set(c->fd) == CC_OK;
 
 	//if device didn't produce any data in time fail
 	if(wait_for_input(c) < 0)
@@ -180,31 +965,138 @@ struct cc *cc_init(const char *tty)
 	return c;
 }
 
-static int wait_for_input(struct cc *c)
+// allocates and initializes everything but the device
+static struct cc *cc_alloc(int buffer_size)
 {
-	int ret;
-	struct timeval tv={0};
-	fd_set rfds;
+	struct cc *c;
+
+	c = (struct cc*)malloc(sizeof(struct cc));
+
+	if( c == NULL )
+		return NULL;
+
+	c->fd=-1;
+	c->init_timeout_ms=CC_INIT_TIMEOUT_MS;
+	c->read_timeout_ms=CC_READ_TIMEOUT_MS;
+	c->input_ready=0;
+	c->buffer_bytes=0;
+	c->data_pending=0;
+	memset(&c->stats, 0, sizeof(c->stats));
+	memset(c->rplidar_sequence_ready, 0, sizeof(c->rplidar_sequence_ready));
+	memset(c->rplidar_previous_ready, 0, sizeof(c->rplidar_previous_ready));
+	memset(c->rplidar_scanners, 0, sizeof(c->rplidar_scanners));
+	c->rplidar_scans_enabled=0;
+	memset(c->rplidar_routes, 0, sizeof(c->rplidar_routes));
+	c->rplidar_routes_enabled=0;
+	c->xv11lidar_scanner=NULL;
+	c->odometry_history=NULL;
+	c->async_running=0;
+	memset(c->queues, 0, sizeof(c->queues));
+	c->clock.initialized=0;
+	c->clock.receive_time_us=0;
+	c->recorder=NULL;
+	c->replay=NULL;
+	c->logger=NULL;
+
+	if( ring_init(c, buffer_size) != CC_OK )
+	{
+		free(c);
+		return NULL;
+	}
 
-	FD_ZERO(&rfds);
-	FD_SET(c->fd, &rfds);
+	return c;
+}
+
+// fills 0 fields with defaults, NULL config means all defaults
+static int config_with_defaults(const struct cc_config *config, struct cc_config *out)
+{
+	const struct cc_config defaults={CC_BUFFER_SIZE, CC_INIT_TIMEOUT_MS, CC_READ_TIMEOUT_MS, CC_VMIN, CC_VTIME, 0};
 
-	tv.tv_sec = CC_INIT_TIMEOUT_MS / 1000;
-	tv.tv_usec = (CC_INIT_TIMEOUT_MS % 1000) * 1000;
+	if(config == NULL)
+	{
+		*out=defaults;
+		return CC_OK;
+	}
 
-	if( (ret = select(c->fd+1, &rfds, NULL, NULL, &tv)) < 0 )
+	if(config->buffer_size < 0 || config->init_timeout_ms < 0 || config->read_timeout_ms < 0 ||
+		config->vmin < 0 || config->vmin > UINT8_MAX || config->vtime < 0 || config->vtime > UINT8_MAX)
+	{
+		errno=EINVAL;
 		return CC_ERROR;
+	}
 
-	//we failed to get input in CC_INIT_TIMEOUT_MS time
-	if (ret == 0) //timeout
+	*out=*config;
+
+	if(out->buffer_size == 0)
+		out->buffer_size=CC_BUFFER_SIZE;
+	//single message has to fit in ring buffer
+	if(out->buffer_size < UINT8_MAX)
+		out->buffer_size=UINT8_MAX;
+	if(out->init_timeout_ms == 0)
+		out->init_timeout_ms=CC_INIT_TIMEOUT_MS;
+	if(out->read_timeout_ms == 0)
+		out->read_timeout_ms=CC_READ_TIMEOUT_MS;
+	//VMIN=0 with VTIME=0 would only matter without select/poll
+	if(out->vmin == 0)
+		out->vmin=CC_VMIN;
+
+	return CC_OK;
+}
+
+// verify that tcsetattr really applied what we asked for
+// only bits set by cfmakeraw, speed and VMIN/VTIME, drivers may normalize the rest
+static int termios_applied(int fd, const struct termios *requested)
+{
+	const tcflag_t iflag=IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL|IXON;
+	const tcflag_t oflag=OPOST;
+	const tcflag_t cflag=CSIZE|PARENB;
+	const tcflag_t lflag=ECHO|ECHONL|ICANON|ISIG|IEXTEN;
+	struct termios actual;
+
+	if(tcgetattr(fd, &actual) < 0)
+		return CC_ERROR;
+
+	if((actual.c_iflag & iflag) != (requested->c_iflag & iflag) || (actual.c_oflag & oflag) != (requested->c_oflag & oflag) ||
+		(actual.c_cflag & cflag) != (requested->c_cflag & cflag) || (actual.c_lflag & lflag) != (requested->c_lflag & lflag) ||
+		cfgetispeed(&actual) != cfgetispeed(requested) || cfgetospeed(&actual) != cfgetospeed(requested) ||
+		actual.c_cc[VMIN] != requested->c_cc[VMIN] || actual.c_cc[VTIME] != requested->c_cc[VTIME])
 	{
-		errno = EAGAIN;
+		errno=EIO;
+		return CC_ERROR;
+	}
+
+	return CC_OK;
+}
+
+// ASYNC_LOW_LATENCY, e.g. ftdi_sio drops latency timer from 16 ms to 1 ms
+static int low_latency_set(int fd)
+{
+	struct serial_struct serial;
+
+	if(ioctl(fd, TIOCGSERIAL, &serial) < 0)
+		return CC_ERROR;
+
+	serial.flags |= ASYNC_LOW_LATENCY;
+
+	if(ioctl(fd, TIOCSSERIAL, &serial) < 0 || ioctl(fd, TIOCGSERIAL, &serial) < 0)
+		return CC_ERROR;
+
+	//some drivers (e.g. cdc_acm) accept the call but ignore the flag
+	if(!(serial.flags & ASYNC_LOW_LATENCY))
+	{
+		errno=EOPNOTSUPP;
 		return CC_ERROR;
 	}
 
 	return CC_OK;
 }
 
+static int wait_for_input(struct cc *c)
+{
+	//we failed to get input in init_timeout_ms time
+	return wait_readable(c->fd, c->init_timeout_ms);
+}
+
 int cc_close(struct cc *c)
 {
 	int error=0;
@@ -212,6 +1104,10 @@ int cc_close(struct cc *c)
 	if(c == NULL)
 		return CC_OK;
 
+	error |= cc_stop_async(c) != CC_OK;
+	error |= cc_record_stop(c) != CC_OK;
+	error |= cc_log_stop(c) != CC_OK;
+
 	// Note that tcsetattr() returns success if any of the  requested  changes
 	// could  be  successfully  carried  out.  Therefore, when making multiple
 	// changes it may be necessary to follow this call with a further call  to
@@ -221,8 +1117,16 @@ int cc_close(struct cc *c)
 	//during next try to open
 	//error |= tcsetattr(c->fd, TCSANOW, &c->initial_termios) < 0;
 
-	error |= close(c->fd) < 0;
+	if(c->replay)
+		replay_close(c->replay);
+	else
+		error |= close(c->fd) < 0;
 
+	rplidar_scanners_free(c);
+	rplidar_routes_free(c);
+	free(c->xv11lidar_scanner);
+	odometry_history_free(c);
+	ring_close(c);
 	free(c);
 
 	if(error)
@@ -234,312 +1138,5051 @@ int cc_close(struct cc *c)
 static struct cc *close_free_and_return_null(struct cc *c)
 {
 	close(c->fd);
+	ring_close(c);
 	free(c);
 	return NULL;
 }
 
-/* Data reading functions */
+/* Ring buffer */
 
-int cc_read_all(struct cc* c, struct cc_data *data)
+// The same memory is mapped twice, one mapping directly after the other.
+// This way any c->buffer_size long window starting in the first mapping
+// is contiguous in memory and messages wrapping around the end of
+// the ring may be validated and decoded in place without copying.
+
+static int ring_init(struct cc *c, int min_size)
 {
-	int valid, msg_process_status=CC_MESSAGE_PROCESSED, offset=0;
-	struct cc_size counters={0};
+	const long page_size=sysconf(_SC_PAGESIZE);
+	uint8_t *address;
+	int fd, size;
 
-	if( recv(c) == CC_ERROR )
+	if(page_size <= 0)
+		return CC_ERROR;
+
+	size = (int)(((min_size + page_size - 1) / page_size) * page_size);
+
+	if( (fd = memfd_create("cave-crawler", MFD_CLOEXEC)) == -1)
+		return CC_ERROR;
+
+	if(ftruncate(fd, size) == -1)
+	{
+		close(fd);
+		return CC_ERROR;
+	}
+	//reserve address space for both mappings
+	address = mmap(NULL, 2*size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if(address == MAP_FAILED)
+	{
+		close(fd);
+		return CC_ERROR;
+	}
+
+	if( mmap(address, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+		mmap(address + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED )
+	{
+		munmap(address, 2*size);
+		close(fd);
+		return CC_ERROR;
+	}
+
+	//mappings keep the memory alive
+	close(fd);
+
+	c->buffer=address;
+	c->buffer_size=size;
+	c->buffer_start=0;
+	c->buffer_bytes=0;
+
+	return CC_OK;
+}
+
+static void ring_close(struct cc *c)
+{
+	munmap(c->buffer, 2*c->buffer_size);
+}
+
+//contiguous view of pending bytes (up to c->buffer_size)
+static uint8_t *ring_data(struct cc *c)
+{
+	return c->buffer + c->buffer_start;
+}
+
+static void ring_consume(struct cc *c, int bytes)
+{
+	c->buffer_start = (c->buffer_start + bytes) % c->buffer_size;
+	c->buffer_bytes -= bytes;
+}
+
+/* Data reading functions */
+
+int cc_read_all(struct cc* c, struct cc_data *data)
+{
+	int msg_process_status=CC_MESSAGE_PROCESSED, offset=0;
+	struct cc_size counters={0};
+	uint8_t *buffer;
+
+	if( recv(c) == CC_ERROR )
 	{
 		data->size=counters;
 		return CC_ERROR;
 	}
 
-	while( (valid=validate_message(c, offset)) != CC_NEED_MORE_DATA  )
+	buffer=ring_data(c);
+
+	while( next_message(c, buffer, &offset) != CC_NEED_MORE_DATA )
+	{	//otherwise CC_VALID_MESSAGE
+		struct cc_time time;
+
+		clock_update(&c->clock, decode_uint32(buffer+offset+CC_MSG_PAYLOAD_OFFSET), &time);
+
+		if( (msg_process_status=process_message(c, buffer+offset, &time, data, &counters)) == CC_NO_SPACE_IN_USER_ARRAY)
+			break;
+		//otherwise CC_MESSAGE_PROCESSED, message left in buffer is counted when finally processed
+		message_consumed(c, buffer+offset);
+		offset+=buffer[offset+CC_MESSAGE_SIZE_OFFSET]; //TO DO - check if it is the right size
+	}
+
+	ring_consume(c, offset);
+
+	data->size = counters;
+
+	if(msg_process_status == CC_NO_SPACE_IN_USER_ARRAY)
+	{
+		++c->stats.user_array_full;
+		++c->stats.data_pending;
+		c->data_pending=1;
+		return CC_DATA_PENDING;
+	}
+	//otherwise valid == CC_NEED_MORE_DATA
+	c->data_pending=0;
+	return CC_OK;
+}
+
+int cc_read_columns(struct cc *c, struct cc_columns *columns)
+{
+	int msg_process_status=CC_MESSAGE_PROCESSED, offset=0;
+	struct cc_size counters={0};
+	uint8_t *buffer;
+
+	if( recv(c) == CC_ERROR )
+	{
+		columns->size=counters;
+		return CC_ERROR;
+	}
+
+	buffer=ring_data(c);
+
+	while( next_message(c, buffer, &offset) != CC_NEED_MORE_DATA )
+	{	//otherwise CC_VALID_MESSAGE
+		struct cc_time time;
+
+		clock_update(&c->clock, decode_uint32(buffer+offset+CC_MSG_PAYLOAD_OFFSET), &time);
+
+		if( (msg_process_status=process_message_columns(c, buffer+offset, &time, columns, &counters)) == CC_NO_SPACE_IN_USER_ARRAY)
+			break;
+
+		message_consumed(c, buffer+offset);
+		offset+=buffer[offset+CC_MESSAGE_SIZE_OFFSET];
+	}
+
+	ring_consume(c, offset);
+
+	columns->size = counters;
+
+	if(msg_process_status == CC_NO_SPACE_IN_USER_ARRAY)
+	{
+		++c->stats.user_array_full;
+		++c->stats.data_pending;
+		c->data_pending=1;
+		return CC_DATA_PENDING;
+	}
+
+	c->data_pending=0;
+	return CC_OK;
+}
+
+int cc_read_each(struct cc *c, cc_message_handler handler, void *userdata)
+{
+	int stop=0, offset=0;
+	uint8_t *buffer;
+
+	if( recv(c) == CC_ERROR )
+		return CC_ERROR;
+
+	buffer=ring_data(c);
+
+	while( !stop && next_message(c, buffer, &offset) != CC_NEED_MORE_DATA )
+	{
+		struct cc_message msg={buffer+offset, {0, 0, 0}};
+
+		clock_update(&c->clock, decode_uint32(buffer+offset+CC_MSG_PAYLOAD_OFFSET), &msg.time);
+		message_consumed(c, msg.data);
+
+		message_hooks(c, msg.data, &msg.time, NULL);
+
+		//message is consumed even if handler requests stop
+		stop=handler(&msg, userdata);
+		offset+=buffer[offset+CC_MESSAGE_SIZE_OFFSET];
+	}
+
+	c->data_pending = stop && next_message(c, buffer, &offset) == CC_VAlID_MESSAGE;
+
+	ring_consume(c, offset);
+
+	if(!c->data_pending)
+		return CC_OK;
+
+	++c->stats.data_pending;
+	return CC_DATA_PENDING;
+}
+
+/* Message views */
+
+int cc_message_type(const struct cc_message *msg)
+{
+	return msg->data[CC_MESSAGE_TYPE_OFFSET];
+}
+
+int cc_message_size(const struct cc_message *msg)
+{
+	return msg->data[CC_MESSAGE_SIZE_OFFSET];
+}
+
+const uint8_t *cc_message_bytes(const struct cc_message *msg)
+{
+	return msg->data;
+}
+
+const uint8_t *cc_message_payload(const struct cc_message *msg)
+{
+	return msg->data + CC_MSG_PAYLOAD_OFFSET;
+}
+
+uint32_t cc_message_timestamp_us(const struct cc_message *msg)
+{
+	return decode_uint32(msg->data + CC_MSG_PAYLOAD_OFFSET);
+}
+
+uint64_t cc_message_mcu_time_us(const struct cc_message *msg)
+{
+	return msg->time.mcu_us;
+}
+
+uint64_t cc_message_host_time_us(const struct cc_message *msg)
+{
+	return msg->time.host_us;
+}
+
+uint32_t cc_message_latency_us(const struct cc_message *msg)
+{
+	return msg->time.latency_us;
+}
+
+uint8_t cc_message_rplidar_device_id(const struct cc_message *msg)
+{
+	return msg->data[CC_MSG_PAYLOAD_OFFSET + 4];
+}
+
+uint8_t cc_message_rplidar_sequence(const struct cc_message *msg)
+{
+	return msg->data[CC_MSG_PAYLOAD_OFFSET + 5];
+}
+
+const rplidar_response_ultra_capsule_measurement_nodes_t *cc_message_rplidar_capsule(const struct cc_message *msg)
+{
+	return (const rplidar_response_ultra_capsule_measurement_nodes_t*)(msg->data + CC_MSG_PAYLOAD_OFFSET + 6);
+}
+
+// cc_message_odometry, cc_message_xv11lidar, cc_message_rplidar
+#define CC_MESSAGE_DECODE(NAME, name, type, size) \
+int cc_message_##name(const struct cc_message *msg, struct cc_##name##_data *data) \
+{ \
+	if(cc_message_type(msg) != CC_MESSAGE_##NAME) \
+		return CC_ERROR; \
+	decode_message_##name(msg->data, &msg->time, data); \
+	return CC_OK; \
+}
+
+CC_PROTOCOL_MESSAGES(CC_MESSAGE_DECODE)
+#undef CC_MESSAGE_DECODE
+
+/* Clock synchronization */
+
+uint64_t cc_host_time_us(struct cc *c, uint64_t mcu_time_us)
+{
+	return clock_host_time_us(&c->clock, mcu_time_us);
+}
+
+static void clock_update(struct cc_clock *k, uint32_t timestamp_us, struct cc_time *time)
+{
+	//signed difference handles wrap-around and slightly out of order timestamps
+	const int32_t elapsed_us=(int32_t)(timestamp_us - k->last_timestamp_us);
+	int64_t offset_us;
+
+	//the first message or MCU restarted
+	if(!k->initialized || elapsed_us < -CC_CLOCK_RESET_US)
+		clock_reset(k, timestamp_us);
+	else
+		k->mcu_time_us += elapsed_us;
+
+	k->last_timestamp_us=timestamp_us;
+
+	if(k->mcu_time_us >= k->window_end_us)
+		clock_push_window(k);
+
+	offset_us = (int64_t)(k->receive_time_us - k->mcu_time_us);
+
+	if(offset_us < k->window_min_offset_us)
+	{
+		k->window_min_offset_us=offset_us;
+		k->window_min_mcu_us=k->mcu_time_us;
+
+		//until the first window is complete use the lower envelope so far
+		if(k->minima == 0)
+		{
+			k->reference_us=k->mcu_time_us;
+			k->offset_us=(double)offset_us;
+			k->drift=0.0;
+		}
+	}
+
+	time->mcu_us=k->mcu_time_us;
+	time->host_us=clock_host_time_us(k, k->mcu_time_us);
+	time->latency_us = k->receive_time_us > time->host_us ? (uint32_t)(k->receive_time_us - time->host_us) : 0;
+}
+
+static void clock_reset(struct cc_clock *k, uint32_t timestamp_us)
+{
+	k->initialized=1;
+	k->mcu_time_us=timestamp_us;
+	k->window_end_us=timestamp_us + CC_CLOCK_WINDOW_US;
+	k->window_min_offset_us=INT64_MAX;
+	k->window_min_mcu_us=timestamp_us;
+	k->minima=k->minima_next=0;
+	k->reference_us=timestamp_us;
+	k->offset_us=0.0;
+	k->drift=0.0;
+}
+
+static void clock_push_window(struct cc_clock *k)
+{
+	if(k->window_min_offset_us != INT64_MAX)
+	{
+		k->minima_mcu_us[k->minima_next]=(double)k->window_min_mcu_us;
+		k->minima_offset_us[k->minima_next]=(double)k->window_min_offset_us;
+		k->minima_next=(k->minima_next + 1) % CC_CLOCK_WINDOWS;
+
+		if(k->minima < CC_CLOCK_WINDOWS)
+			++k->minima;
+
+		clock_fit(k);
+	}
+
+	k->window_end_us += CC_CLOCK_WINDOW_US;
+
+	//long gap in data
+	if(k->window_end_us <= k->mcu_time_us)
+		k->window_end_us = k->mcu_time_us + CC_CLOCK_WINDOW_US;
+
+	k->window_min_offset_us=INT64_MAX;
+}
+
+// least squares line fit to lower envelope history
+// with single pass of outlier rejection (median absolute deviation)
+static void clock_fit(struct cc_clock *k)
+{
+	double residuals[CC_CLOCK_WINDOWS], sorted[CC_CLOCK_WINDOWS];
+	double reference=k->minima_mcu_us[(k->minima_next + CC_CLOCK_WINDOWS - 1) % CC_CLOCK_WINDOWS];
+	double threshold=INFINITY;
+
+	for(int pass=0;pass<2;++pass)
+	{
+		double n=0, sx=0, sy=0, sxx=0, sxy=0, offset, drift=0.0;
+
+		for(int i=0;i<k->minima;++i)
+		{
+			const double x=k->minima_mcu_us[i] - reference, y=k->minima_offset_us[i];
+
+			if(pass == 1 && fabs(residuals[i]) > threshold)
+				continue;
+
+			n+=1; sx+=x; sy+=y; sxx+=x*x; sxy+=x*y;
+		}
+
+		if(n >= 2 && n*sxx - sx*sx > 0)
+			drift=(n*sxy - sx*sy) / (n*sxx - sx*sx);
+
+		//sanity check, typical crystal drift is tens of ppm
+		if(fabs(drift) > 1e-3)
+			drift=0.0;
+
+		offset=(sy - drift*sx) / n;
+
+		k->reference_us=(uint64_t)reference;
+		k->offset_us=offset;
+		k->drift=drift;
+
+		if(pass == 1 || k->minima < 3)
+			break;
+
+		for(int i=0;i<k->minima;++i)
+		{
+			residuals[i]=k->minima_offset_us[i] - (offset + drift*(k->minima_mcu_us[i] - reference));
+			sorted[i]=fabs(residuals[i]);
+		}
+
+		//insertion sort, small array
+		for(int i=1;i<k->minima;++i)
+			for(int j=i; j > 0 && sorted[j-1] > sorted[j]; --j)
+			{
+				const double temp=sorted[j];
+				sorted[j]=sorted[j-1];
+				sorted[j-1]=temp;
+			}
+
+		threshold=3.0 * 1.4826 * sorted[k->minima/2];
+
+		if(threshold < CC_CLOCK_MIN_OUTLIER_US)
+			threshold=CC_CLOCK_MIN_OUTLIER_US;
+	}
+}
+
+static uint64_t clock_host_time_us(const struct cc_clock *k, uint64_t mcu_time_us)
+{
+	const double mcu_elapsed_us=(double)((int64_t)(mcu_time_us - k->reference_us));
+
+	return (uint64_t)((int64_t)mcu_time_us + (int64_t)llround(k->offset_us + k->drift*mcu_elapsed_us));
+}
+
+static uint64_t host_clock_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Recording */
+
+int cc_record_start(struct cc *c, const char *path)
+{
+	struct cc_recorder *r;
+	struct iovec iov={(void*)CC_RECORD_MAGIC, sizeof(CC_RECORD_MAGIC)};
+
+	if(c->recorder)
+	{
+		errno=EBUSY;
+		return CC_ERROR;
+	}
+
+	if( (r=(struct cc_recorder*)malloc(sizeof(struct cc_recorder))) == NULL)
+		return CC_ERROR;
+
+	if( (r->fd=open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+	{
+		free(r);
+		return CC_ERROR;
+	}
+
+	if(write_all(r->fd, &iov, 1) != CC_OK)
+	{
+		close(r->fd);
+		free(r);
+		return CC_ERROR;
+	}
+
+	r->error=0;
+	r->offset=sizeof(CC_RECORD_MAGIC);
+	r->read_count=r->bytes=0;
+	r->index=NULL;
+	r->chunks=r->index_capacity=0;
+
+	c->recorder=r;
+
+	return CC_OK;
+}
+
+int cc_record_stop(struct cc *c)
+{
+	struct cc_recorder *r=c->recorder;
+	int error;
+
+	if(r == NULL)
+		return CC_OK;
+
+	if(!r->error)
+		record_flush(r, r->data, r->bytes);
+	if(!r->error)
+		record_write_index(r);
+
+	error=r->error;
+
+	if(close(r->fd) != 0 && !error)
+		error=errno;
+
+	free(r->index);
+	free(r);
+	c->recorder=NULL;
+
+	if(error)
+	{
+		errno=error;
+		return CC_ERROR;
+	}
+
+	return CC_OK;
+}
+
+// failures stop recording without affecting reading, reported by cc_record_stop
+static void record_append(struct cc_recorder *r, const uint8_t *data, uint32_t bytes, uint64_t receive_time_us)
+{
+	if(r->error)
+		return;
+
+	if(r->bytes + bytes > CC_RECORD_CHUNK_BYTES || r->read_count == CC_RECORD_CHUNK_READS)
+		if(record_flush(r, r->data, r->bytes) != CC_OK)
+			return;
+
+	r->reads[r->read_count].receive_time_us=receive_time_us;
+	r->reads[r->read_count].bytes=bytes;
+	r->reads[r->read_count].reserved=0;
+	++r->read_count;
+
+	//larger than chunk reads are written directly as single read chunk
+	if(bytes > CC_RECORD_CHUNK_BYTES)
+	{
+		record_flush(r, data, bytes);
+		return;
+	}
+
+	memcpy(r->data + r->bytes, data, bytes);
+	r->bytes += bytes;
+}
+
+static int record_flush(struct cc_recorder *r, const uint8_t *data, uint32_t bytes)
+{
+	static const uint8_t padding[CC_RECORD_ALIGNMENT]={0};
+	struct cc_record_chunk chunk={CC_RECORD_CHUNK_MAGIC, r->read_count, bytes, 0};
+	const uint32_t padding_bytes=(CC_RECORD_ALIGNMENT - bytes % CC_RECORD_ALIGNMENT) % CC_RECORD_ALIGNMENT;
+	struct iovec iov[4]={ {&chunk, sizeof(chunk)}, {r->reads, r->read_count*sizeof(struct cc_record_read)},
+		{(void*)data, bytes}, {(void*)padding, padding_bytes} };
+
+	if(r->read_count == 0)
+		return CC_OK;
+
+	if(write_all(r->fd, iov, 4) != CC_OK ||
+		record_index_append(&r->index, &r->chunks, &r->index_capacity, r->reads[0].receive_time_us, r->offset) != CC_OK)
+	{
+		r->error=errno;
+		return CC_ERROR;
+	}
+
+	r->offset += sizeof(chunk) + r->read_count*sizeof(struct cc_record_read) + bytes + padding_bytes;
+	r->read_count=r->bytes=0;
+
+	return CC_OK;
+}
+
+static int record_write_index(struct cc_recorder *r)
+{
+	struct cc_record_footer footer={CC_RECORD_FOOTER_MAGIC, 0, r->offset, r->chunks};
+	struct iovec iov[2]={ {r->index, r->chunks*sizeof(struct cc_record_index)}, {&footer, sizeof(footer)} };
+
+	if(write_all(r->fd, iov, 2) != CC_OK)
+	{
+		r->error=errno;
+		return CC_ERROR;
+	}
+
+	return CC_OK;
+}
+
+static int record_index_append(struct cc_record_index **index, uint64_t *count, uint64_t *capacity, uint64_t receive_time_us, uint64_t offset)
+{
+	if(*count == *capacity)
+	{
+		const uint64_t grown = *capacity ? 2 * *capacity : 1024;
+		struct cc_record_index *reallocated=(struct cc_record_index*)realloc(*index, grown*sizeof(struct cc_record_index));
+
+		if(reallocated == NULL)
+			return CC_ERROR;
+
+		*index=reallocated;
+		*capacity=grown;
+	}
+
+	(*index)[*count].receive_time_us=receive_time_us;
+	(*index)[*count].offset=offset;
+	++*count;
+
+	return CC_OK;
+}
+
+static int write_all(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct iovec pending[4];
+	ssize_t written;
+
+	memcpy(pending, iov, iovcnt*sizeof(struct iovec));
+
+	while(iovcnt > 0)
+	{
+		if( (written=writev(fd, pending, iovcnt)) < 0 )
+		{
+			if(errno == EINTR)
+				continue;
+			return CC_ERROR;
+		}
+
+		while(iovcnt > 0 && (size_t)written >= pending[0].iov_len)
+		{
+			written -= pending[0].iov_len;
+			memmove(pending, pending+1, (--iovcnt)*sizeof(struct iovec));
+		}
+
+		if(iovcnt > 0)
+		{
+			pending[0].iov_base = (uint8_t*)pending[0].iov_base + written;
+			pending[0].iov_len -= written;
+		}
+	}
+
+	return CC_OK;
+}
+
+/* Replay */
+
+struct cc *cc_open_replay(const char *path, double speed)
+{
+	struct cc *c;
+	struct cc_replay *r;
+	struct stat st;
+	int fd, error;
+
+	if( (fd=open(path, O_RDONLY | O_CLOEXEC)) == -1 )
+		return NULL;
+
+	if(fstat(fd, &st) == -1 || (r=(struct cc_replay*)calloc(1, sizeof(struct cc_replay))) == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	if( (size_t)st.st_size < sizeof(CC_RECORD_MAGIC) ||
+		(r->file=(const uint8_t*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED )
+	{
+		error = (size_t)st.st_size < sizeof(CC_RECORD_MAGIC) ? EINVAL : errno;
+		close(fd);
+		free(r);
+		errno=error;
+		return NULL;
+	}
+
+	//mapping keeps the file alive
+	close(fd);
+
+	r->file_size=st.st_size;
+	r->speed=speed;
+
+	r->log = memcmp(r->file, CC_LOG_MAGIC, sizeof(CC_LOG_MAGIC)) == 0;
+
+	if(!r->log && memcmp(r->file, CC_RECORD_MAGIC, sizeof(CC_RECORD_MAGIC)) != 0)
+	{
+		replay_close(r);
+		errno=EINVAL;
+		return NULL;
+	}
+
+	if(replay_index(r) != CC_OK || (c=cc_alloc(CC_BUFFER_SIZE)) == NULL)
+	{
+		error=errno;
+		replay_close(r);
+		errno=error;
+		return NULL;
+	}
+
+	c->replay=r;
+
+	return c;
+}
+
+struct cc *cc_open_buffer(const uint8_t *data, size_t size)
+{
+	struct cc *c;
+	struct cc_replay *r;
+
+	if( (r=(struct cc_replay*)calloc(1, sizeof(struct cc_replay))) == NULL )
+		return NULL;
+
+	r->file=data;
+	r->file_size=size;
+	r->buffer=1;
+
+	if( (c=cc_alloc(CC_BUFFER_SIZE)) == NULL )
+	{
+		free(r);
+		return NULL;
+	}
+
+	c->replay=r;
+
+	return c;
+}
+
+int cc_replay_seek(struct cc *c, uint64_t receive_time_us)
+{
+	struct cc_replay *r=c->replay;
+	uint64_t low=0, high;
+
+	if(r == NULL || r->buffer)
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	high=r->chunks;
+
+	//the last chunk with first read not after receive_time_us
+	while(high - low > 1)
+	{
+		const uint64_t mid = low + (high-low)/2;
+
+		if(r->index[mid].receive_time_us <= receive_time_us)
+			low=mid;
+		else
+			high=mid;
+	}
+
+	r->chunk=low;
+	r->read=r->data_offset=r->read_offset=0;
+
+	//the first read not before receive_time_us
+	if(r->chunk < r->chunks)
+	{
+		const struct cc_record_chunk *chunk=replay_chunk(r, r->chunk);
+		const struct cc_record_read *reads;
+
+		if(chunk == NULL)
+			return CC_ERROR;
+
+		reads=replay_reads(chunk);
+
+		while(r->read < chunk->reads && reads[r->read].receive_time_us < receive_time_us)
+			r->data_offset += reads[r->read++].bytes;
+
+		if(r->read == chunk->reads) //after the last read in chunk
+		{
+			++r->chunk;
+			r->read=r->data_offset=0;
+		}
+	}
+
+	//start over with new data
+	r->paced=0;
+	c->buffer_bytes=0;
+	c->data_pending=0;
+	c->clock.initialized=0;
+	memset(c->rplidar_previous_ready, 0, sizeof(c->rplidar_previous_ready));
+	stream_state_reset(c);
+
+	return CC_OK;
+}
+
+// uses index from the file or rebuilds it walking chunk (block) headers
+static int replay_index(struct cc_replay *r)
+{
+	const struct cc_record_footer *footer;
+	const uint32_t footer_magic = r->log ? CC_LOG_FOOTER_MAGIC : CC_RECORD_FOOTER_MAGIC;
+	uint64_t offset=sizeof(CC_RECORD_MAGIC), capacity=0, size, receive_time_us;
+
+	//footer is aligned unless file is truncated
+	if(r->file_size >= sizeof(CC_RECORD_MAGIC) + sizeof(struct cc_record_footer) && r->file_size % CC_RECORD_ALIGNMENT == 0)
+	{
+		footer=(const struct cc_record_footer*)(r->file + r->file_size - sizeof(struct cc_record_footer));
+
+		size = r->file_size - sizeof(struct cc_record_footer);
+
+		//index between file magic and footer, chunks are validated on use (replay_chunk)
+		if(footer->magic == footer_magic &&
+			footer->index_offset >= sizeof(CC_RECORD_MAGIC) && footer->index_offset <= size &&
+			footer->index_offset % CC_RECORD_ALIGNMENT == 0 &&
+			footer->chunks == (size - footer->index_offset) / sizeof(struct cc_record_index) &&
+			(size - footer->index_offset) % sizeof(struct cc_record_index) == 0)
+		{
+			r->index=(const struct cc_record_index*)(r->file + footer->index_offset);
+			r->chunks=footer->chunks;
+			return CC_OK;
+		}
+	}
+
+	while( (size=replay_chunk_size(r, offset, &receive_time_us)) != 0 )
+	{
+		if(record_index_append(&r->index_allocated, &r->chunks, &capacity, receive_time_us, offset) != CC_OK)
+			return CC_ERROR;
+
+		r->index=r->index_allocated;
+		offset += size;
+	}
+
+	return CC_OK;
+}
+
+// size of valid chunk (block) at offset with receive time of the first read, 0 if invalid or truncated
+static uint64_t replay_chunk_size(const struct cc_replay *r, uint64_t offset, uint64_t *receive_time_us)
+{
+	uint64_t size;
+
+	if(offset > r->file_size)
+		return 0;
+
+	if(r->log)
+	{
+		const struct cc_log_block *block=(const struct cc_log_block*)(r->file + offset);
+
+		if(r->file_size - offset < sizeof(struct cc_log_block) || block->magic != CC_LOG_BLOCK_MAGIC || block->messages == 0)
+			return 0;
+
+		size = sizeof(struct cc_log_block) +
+			((uint64_t)block->compressed_bytes + CC_RECORD_ALIGNMENT - 1) / CC_RECORD_ALIGNMENT * CC_RECORD_ALIGNMENT;
+		*receive_time_us=block->receive_time_us;
+	}
+	else
+	{
+		const struct cc_record_chunk *chunk=(const struct cc_record_chunk*)(r->file + offset);
+
+		if(r->file_size - offset < sizeof(struct cc_record_chunk) || chunk->magic != CC_RECORD_CHUNK_MAGIC || chunk->reads == 0)
+			return 0;
+
+		size = sizeof(struct cc_record_chunk) + (uint64_t)chunk->reads*sizeof(struct cc_record_read) +
+			((uint64_t)chunk->bytes + CC_RECORD_ALIGNMENT - 1) / CC_RECORD_ALIGNMENT * CC_RECORD_ALIGNMENT;
+
+		if(size <= r->file_size - offset)
+			*receive_time_us=replay_reads(chunk)[0].receive_time_us;
+	}
+
+	return size <= r->file_size - offset ? size : 0; //0 if truncated
+}
+
+// recording chunk from the file or decoded from compressed log block, NULL with EBADMSG if corrupted
+static const struct cc_record_chunk *replay_chunk(struct cc_replay *r, uint64_t chunk)
+{
+	const uint64_t offset=r->index[chunk].offset;
+	const struct cc_record_chunk *record;
+	const struct cc_record_read *reads;
+	uint64_t receive_time_us, bytes=0;
+
+	//index may come from file, chunk (block) has to fit in file
+	if(offset % CC_RECORD_ALIGNMENT != 0 || replay_chunk_size(r, offset, &receive_time_us) == 0)
+	{
+		errno=EBADMSG;
+		return NULL;
+	}
+
+	if(r->log)
+		return log_decode_block(r, chunk);
+
+	record=(const struct cc_record_chunk*)(r->file + offset);
+
+	if(r->chunk_valid == chunk + 1)
+		return record;
+
+	//reads have to cover exactly chunk raw data
+	reads=replay_reads(record);
+
+	for(uint32_t i=0;i<record->reads;++i)
+		bytes += reads[i].bytes;
+
+	if(bytes != record->bytes)
+	{
+		errno=EBADMSG;
+		return NULL;
+	}
+
+	r->chunk_valid=chunk + 1;
+
+	return record;
+}
+
+static const struct cc_record_read *replay_reads(const struct cc_record_chunk *chunk)
+{
+	return (const struct cc_record_read*)(chunk + 1);
+}
+
+static const uint8_t *replay_data(const struct cc_record_chunk *chunk)
+{
+	return (const uint8_t*)(replay_reads(chunk) + chunk->reads);
+}
+
+// feeds the ring buffer with the next recorded read (as recv does from device)
+static int replay_recv(struct cc *c)
+{
+	struct cc_replay *r=c->replay;
+	const struct cc_record_chunk *chunk;
+	const struct cc_record_read *read;
+	uint32_t bytes;
+
+	if(r->buffer)
+		return replay_recv_buffer(c);
+
+	if(r->chunk >= r->chunks)
+	{ //end of recording - same as unplugged device
+		errno = ENODEV;
+		return CC_ERROR;
+	}
+
+	if( (chunk=replay_chunk(r, r->chunk)) == NULL )
+		return CC_ERROR;
+
+	read=replay_reads(chunk) + r->read;
+
+	if(r->read_offset == 0)
+		replay_pace(r, read->receive_time_us);
+
+	bytes = read->bytes - r->read_offset;
+
+	if(bytes > (uint32_t)(c->buffer_size - c->buffer_bytes))
+		bytes = c->buffer_size - c->buffer_bytes;
+
+	memcpy(ring_data(c) + c->buffer_bytes, replay_data(chunk) + r->data_offset + r->read_offset, bytes);
+
+	c->buffer_bytes += bytes;
+	c->clock.receive_time_us = read->receive_time_us;
+	r->read_offset += bytes;
+
+	if(r->read_offset == read->bytes)
+	{
+		r->data_offset += read->bytes;
+		r->read_offset=0;
+
+		if(++r->read == chunk->reads)
+		{
+			++r->chunk;
+			r->read=r->data_offset=0;
+		}
+	}
+
+	return CC_OK;
+}
+
+// feeds the ring buffer with as much of user buffer as fits
+static int replay_recv_buffer(struct cc *c)
+{
+	struct cc_replay *r=c->replay;
+	size_t bytes = r->file_size - r->buffer_offset;
+
+	if(bytes == 0)
+	{ //end of buffer - same as unplugged device
+		errno = ENODEV;
+		return CC_ERROR;
+	}
+
+	if(bytes > (size_t)(c->buffer_size - c->buffer_bytes))
+		bytes = c->buffer_size - c->buffer_bytes;
+
+	memcpy(ring_data(c) + c->buffer_bytes, r->file + r->buffer_offset, bytes);
+
+	c->buffer_bytes += bytes;
+	c->clock.receive_time_us = host_clock_us();
+	r->buffer_offset += bytes;
+
+	return CC_OK;
+}
+
+static void replay_pace(struct cc_replay *r, uint64_t receive_time_us)
+{
+	uint64_t target_us;
+	struct timespec ts;
+
+	if(r->speed <= 0.0)
+		return;
+
+	if(!r->paced)
+	{
+		r->paced=1;
+		r->pace_host_us=host_clock_us();
+		r->pace_record_us=receive_time_us;
+		return;
+	}
+
+	target_us = r->pace_host_us + (uint64_t)((receive_time_us - r->pace_record_us) / r->speed);
+
+	ts.tv_sec = target_us / 1000000;
+	ts.tv_nsec = (target_us % 1000000) * 1000;
+
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static void replay_close(struct cc_replay *r)
+{
+	if(!r->buffer)
+		munmap((void*)r->file, r->file_size);
+	free(r->index_allocated);
+	free(r->log_decoded);
+	free(r->log_encoded);
+	free(r);
+}
+
+/* Compressed logging */
+
+int cc_log_start(struct cc *c, const char *path)
+{
+	struct cc_logger *l;
+	struct iovec iov={(void*)CC_LOG_MAGIC, sizeof(CC_LOG_MAGIC)};
+
+	//logging is done by reading thread, asynchronous reader would race with us
+	if(c->logger || c->async_running)
+	{
+		errno=EBUSY;
+		return CC_ERROR;
+	}
+
+	if( (l=(struct cc_logger*)malloc(sizeof(struct cc_logger))) == NULL)
+		return CC_ERROR;
+
+	if( (l->fd=open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+	{
+		free(l);
+		return CC_ERROR;
+	}
+
+	if(write_all(l->fd, &iov, 1) != CC_OK)
+	{
+		close(l->fd);
+		free(l);
+		return CC_ERROR;
+	}
+
+	l->error=0;
+	l->offset=sizeof(CC_LOG_MAGIC);
+	l->messages=l->reads=l->raw_bytes=l->encoded_bytes=0;
+	l->index=NULL;
+	l->blocks=l->index_capacity=0;
+
+	c->logger=l;
+
+	return CC_OK;
+}
+
+int cc_log_stop(struct cc *c)
+{
+	struct cc_logger *l=c->logger;
+	int error;
+
+	if(l == NULL)
+		return CC_OK;
+
+	if(!l->error)
+		log_flush(l, &c->stats);
+	if(!l->error)
+		log_write_index(l);
+
+	error=l->error;
+
+	if(close(l->fd) != 0 && !error)
+		error=errno;
+
+	free(l->index);
+	free(l);
+	c->logger=NULL;
+
+	if(error)
+	{
+		errno=error;
+		return CC_ERROR;
+	}
+
+	return CC_OK;
+}
+
+// failures stop logging without affecting reading, reported by cc_log_stop
+static void log_append(struct cc *c, const uint8_t *msg)
+{
+	struct cc_logger *l=c->logger;
+	const uint64_t receive_time_us=c->clock.receive_time_us;
+
+	if(l->error)
+		return;
+
+	if(l->encoded_bytes + CC_LOG_MESSAGE_MAX_ENCODED > CC_LOG_BLOCK_BYTES)
+		if(log_flush(l, &c->stats) != CC_OK)
+			return;
+
+	//block is independent, start delta coding from scratch
+	if(l->messages == 0)
+	{
+		memset(&l->codec, 0, sizeof(l->codec));
+		l->codec.receive_time_us=l->receive_time_us=receive_time_us;
+	}
+
+	if(l->messages == 0 || receive_time_us != l->codec.receive_time_us)
+		++l->reads;
+
+	l->encoded_bytes = log_encode_message(&l->codec, msg, receive_time_us, l->encoded + l->encoded_bytes) - l->encoded;
+	l->raw_bytes += msg[CC_MESSAGE_SIZE_OFFSET];
+	++l->messages;
+	++c->stats.log_messages;
+}
+
+static int log_flush(struct cc_logger *l, struct cc_stats *stats)
+{
+	static const uint8_t padding[CC_RECORD_ALIGNMENT]={0};
+	struct cc_log_block block={CC_LOG_BLOCK_MAGIC, CC_LOG_LZ4, l->receive_time_us, l->messages, l->reads, l->raw_bytes, l->encoded_bytes, 0, 0};
+	const uint8_t *data=l->compressed;
+	uint32_t padding_bytes;
+	int compressed;
+
+	if(l->messages == 0)
+		return CC_OK;
+
+	compressed=lz4_compress(l->encoded, l->encoded_bytes, l->compressed, sizeof(l->compressed), l->hash_table);
+
+	if(compressed <= 0 || (uint32_t)compressed >= l->encoded_bytes)
+	{
+		block.codec=CC_LOG_STORED;
+		data=l->encoded;
+		compressed=l->encoded_bytes;
+	}
+
+	block.compressed_bytes=compressed;
+	padding_bytes=(CC_RECORD_ALIGNMENT - block.compressed_bytes % CC_RECORD_ALIGNMENT) % CC_RECORD_ALIGNMENT;
+
+	{
+		struct iovec iov[3]={ {&block, sizeof(block)}, {(void*)data, block.compressed_bytes}, {(void*)padding, padding_bytes} };
+
+		if(write_all(l->fd, iov, 3) != CC_OK ||
+			record_index_append(&l->index, &l->blocks, &l->index_capacity, l->receive_time_us, l->offset) != CC_OK)
+		{
+			l->error=errno;
+			return CC_ERROR;
+		}
+	}
+
+	l->offset += sizeof(block) + block.compressed_bytes + padding_bytes;
+	stats->log_raw_bytes += l->raw_bytes;
+	stats->log_written_bytes += sizeof(block) + block.compressed_bytes + padding_bytes;
+	l->messages=l->reads=l->raw_bytes=l->encoded_bytes=0;
+
+	return CC_OK;
+}
+
+static int log_write_index(struct cc_logger *l)
+{
+	struct cc_record_footer footer={CC_LOG_FOOTER_MAGIC, 0, l->offset, l->blocks};
+	struct iovec iov[2]={ {l->index, l->blocks*sizeof(struct cc_record_index)}, {&footer, sizeof(footer)} };
+
+	if(write_all(l->fd, iov, 2) != CC_OK)
+	{
+		l->error=errno;
+		return CC_ERROR;
+	}
+
+	return CC_OK;
+}
+
+// returns position after encoded message
+static uint8_t *log_encode_message(struct cc_log_codec *k, const uint8_t *msg, uint64_t receive_time_us, uint8_t *out)
+{
+	const uint8_t type=msg[CC_MESSAGE_TYPE_OFFSET];
+	const uint8_t *payload=msg+CC_MSG_PAYLOAD_OFFSET;
+	const uint32_t timestamp_us=decode_uint32(payload);
+
+	*out++=type;
+	out=varint_put(out, zigzag_encode((int64_t)(receive_time_us - k->receive_time_us)));
+	out=varint_put(out, zigzag_encode((int32_t)(timestamp_us - k->timestamp_us[type])));
+	k->receive_time_us=receive_time_us;
+	k->timestamp_us[type]=timestamp_us;
+
+	switch(type)
+	{
+		case CC_ODOMETRY_TYPE:
+		{
+			struct cc_odometry_data o;
+			uint32_t quaternion[4];
+
+			decode_payload_odometry(payload, &o);
+			memcpy(&quaternion[0], &o.qw, sizeof(float));
+			memcpy(&quaternion[1], &o.qx, sizeof(float));
+			memcpy(&quaternion[2], &o.qy, sizeof(float));
+			memcpy(&quaternion[3], &o.qz, sizeof(float));
+
+			out=varint_put(out, zigzag_encode((int32_t)((uint32_t)o.left_encoder_counts - (uint32_t)k->left_encoder_counts)));
+			out=varint_put(out, zigzag_encode((int32_t)((uint32_t)o.right_encoder_counts - (uint32_t)k->right_encoder_counts)));
+			k->left_encoder_counts=o.left_encoder_counts;
+			k->right_encoder_counts=o.right_encoder_counts;
+
+			//close floats with the same exponent have close bit patterns
+			for(int i=0;i<4;++i)
+			{
+				out=varint_put(out, zigzag_encode((int32_t)(quaternion[i] - k->quaternion[i])));
+				k->quaternion[i]=quaternion[i];
+			}
+			break;
+		}
+		case CC_XV11LIDAR_TYPE:
+		{
+			struct cc_xv11lidar_data x;
+
+			decode_payload_xv11lidar(payload, &x);
+
+			*out++=x.angle_quad;
+			out=varint_put(out, zigzag_encode((int16_t)(x.speed64 - k->speed64)));
+			k->speed64=x.speed64;
+
+			//neighbouring readings are close
+			for(int i=0;i<CC_XV11LIDAR_READING_POINTS;++i)
+			{
+				out=varint_put(out, zigzag_encode((int16_t)(x.distances[i] - k->distances[i])));
+				k->distances[i]=x.distances[i];
+			}
+			break;
+		}
+		case CC_RPLIDAR_TYPE:
+		{
+			struct cc_rplidar_data r;
+			uint16_t *major;
+
+			decode_payload_rplidar(payload, &r);
+			major=&k->rplidar_major[r.device_id];
+
+			*out++=r.device_id;
+			*out++=(uint8_t)(r.sequence - k->rplidar_sequence[r.device_id]);
+			*out++=r.capsule.s_checksum_1;
+			*out++=r.capsule.s_checksum_2;
+			out=varint_put(out, zigzag_encode((int16_t)(r.capsule.start_angle_sync_q6 - k->rplidar_start_angle[r.device_id])));
+			k->rplidar_sequence[r.device_id]=r.sequence;
+			k->rplidar_start_angle[r.device_id]=r.capsule.start_angle_sync_q6;
+
+			// | predict2 10bit | predict1 10bit | major 12bit |
+			// major distance follows previous cabin, predicts are small signed corrections
+			for(int i=0;i<32;++i)
+			{
+				const uint32_t combined_x3=r.capsule.ultra_cabins[i].combined_x3;
+				const uint16_t cabin_major=combined_x3 & 0xFFF;
+				const int32_t predict1=(int32_t)(combined_x3 << 10) >> 22;
+				const int32_t predict2=(int32_t)combined_x3 >> 22;
+
+				out=varint_put(out, zigzag_encode((int16_t)(cabin_major - *major)));
+				out=varint_put(out, zigzag_encode(predict1));
+				out=varint_put(out, zigzag_encode(predict2));
+				*major=cabin_major;
+			}
+			break;
+		}
+		default:
+			//type without specialized codec
+			out=log_encode_payload(type, payload, out);
+	}
+
+	return out;
+}
+
+// decodes single message to frame, returns position after message or NULL if corrupted
+static const uint8_t *log_decode_message(struct cc_log_codec *k, const uint8_t *in, const uint8_t *end, uint8_t *frame, uint64_t *receive_time_us)
+{
+	uint8_t *payload=frame+CC_MSG_PAYLOAD_OFFSET;
+	uint64_t value;
+	uint8_t type;
+
+	if(in >= end)
+		return NULL;
+
+	type=*in++;
+
+	if(CC_MESSAGE_SIZES[type] == 0)
+		return NULL;
+
+	if( (in=varint_get(in, end, &value)) == NULL )
+		return NULL;
+
+	k->receive_time_us += (uint64_t)zigzag_decode(value);
+	*receive_time_us=k->receive_time_us;
+
+	if( (in=varint_get(in, end, &value)) == NULL )
+		return NULL;
+
+	k->timestamp_us[type] += (uint32_t)zigzag_decode(value);
+
+	frame[CC_START_OF_MESSAGE_OFFSET]=CC_START_OF_MESSAGE;
+	frame[CC_MESSAGE_SIZE_OFFSET]=CC_MESSAGE_SIZES[type];
+	frame[CC_MESSAGE_TYPE_OFFSET]=type;
+	frame[CC_MESSAGE_SIZES[type]-1]=CC_END_OF_MESSAGE;
+
+	switch(type)
+	{
+		case CC_ODOMETRY_TYPE:
+		{
+			struct cc_odometry_data o;
+			uint64_t left, right, quaternion[4];
+
+			if( (in=varint_get(in, end, &left)) == NULL || (in=varint_get(in, end, &right)) == NULL )
+				return NULL;
+
+			for(int i=0;i<4;++i)
+				if( (in=varint_get(in, end, &quaternion[i])) == NULL )
+					return NULL;
+
+			k->left_encoder_counts=(int32_t)((uint32_t)k->left_encoder_counts + (uint32_t)zigzag_decode(left));
+			k->right_encoder_counts=(int32_t)((uint32_t)k->right_encoder_counts + (uint32_t)zigzag_decode(right));
+
+			for(int i=0;i<4;++i)
+				k->quaternion[i] += (uint32_t)zigzag_decode(quaternion[i]);
+
+			o.timestamp_us=k->timestamp_us[type];
+			o.left_encoder_counts=k->left_encoder_counts;
+			o.right_encoder_counts=k->right_encoder_counts;
+			memcpy(&o.qw, &k->quaternion[0], sizeof(float));
+			memcpy(&o.qx, &k->quaternion[1], sizeof(float));
+			memcpy(&o.qy, &k->quaternion[2], sizeof(float));
+			memcpy(&o.qz, &k->quaternion[3], sizeof(float));
+
+			encode_payload_odometry(&o, payload);
+			break;
+		}
+		case CC_XV11LIDAR_TYPE:
+		{
+			struct cc_xv11lidar_data x;
+
+			if(in >= end)
+				return NULL;
+
+			x.timestamp_us=k->timestamp_us[type];
+			x.angle_quad=*in++;
+
+			if( (in=varint_get(in, end, &value)) == NULL )
+				return NULL;
+
+			x.speed64 = k->speed64 += (uint16_t)zigzag_decode(value);
+
+			for(int i=0;i<CC_XV11LIDAR_READING_POINTS;++i)
+			{
+				if( (in=varint_get(in, end, &value)) == NULL )
+					return NULL;
+
+				x.distances[i] = k->distances[i] += (uint16_t)zigzag_decode(value);
+			}
+
+			encode_payload_xv11lidar(&x, payload);
+			break;
+		}
+		case CC_RPLIDAR_TYPE:
+		{
+			struct cc_rplidar_data r;
+			uint16_t *major;
+
+			if(end - in < 4)
+				return NULL;
+
+			r.timestamp_us=k->timestamp_us[type];
+			r.device_id=*in++;
+			r.sequence = k->rplidar_sequence[r.device_id] += *in++;
+			r.capsule.s_checksum_1=*in++;
+			r.capsule.s_checksum_2=*in++;
+
+			if( (in=varint_get(in, end, &value)) == NULL )
+				return NULL;
+
+			r.capsule.start_angle_sync_q6 = k->rplidar_start_angle[r.device_id] += (uint16_t)zigzag_decode(value);
+			major=&k->rplidar_major[r.device_id];
+
+			for(int i=0;i<32;++i)
+			{
+				uint64_t major_delta, predict1, predict2;
+
+				if( (in=varint_get(in, end, &major_delta)) == NULL ||
+					(in=varint_get(in, end, &predict1)) == NULL ||
+					(in=varint_get(in, end, &predict2)) == NULL )
+					return NULL;
+
+				*major = (*major + (uint16_t)zigzag_decode(major_delta)) & 0xFFF;
+
+				r.capsule.ultra_cabins[i].combined_x3 = *major |
+					((uint32_t)zigzag_decode(predict1) & 0x3FF) << 12 |
+					((uint32_t)zigzag_decode(predict2) & 0x3FF) << 22;
+			}
+
+			encode_payload_rplidar(&r, payload);
+			break;
+		}
+		default:
+			//type without specialized codec
+			in=log_decode_payload(type, k->timestamp_us[type], in, end, payload);
+	}
+
+	return in;
+}
+
+// stores payload after timestamp as is, returns position after encoded payload
+static uint8_t *log_encode_payload(uint8_t type, const uint8_t *payload, uint8_t *out)
+{
+	const uint8_t bytes=CC_MESSAGE_SIZES[type] - CC_NON_PAYLOAD_SIZE - sizeof(uint32_t);
+
+	memcpy(out, payload + sizeof(uint32_t), bytes);
+
+	return out + bytes;
+}
+
+// inverse of log_encode_payload, returns position after encoded payload or NULL if truncated
+static const uint8_t *log_decode_payload(uint8_t type, uint32_t timestamp_us, const uint8_t *in, const uint8_t *end, uint8_t *payload)
+{
+	const uint8_t bytes=CC_MESSAGE_SIZES[type] - CC_NON_PAYLOAD_SIZE - sizeof(uint32_t);
+
+	if(end - in < bytes)
+		return NULL;
+
+	memcpy(payload, &timestamp_us, sizeof(uint32_t));
+	memcpy(payload + sizeof(uint32_t), in, bytes);
+
+	return in + bytes;
+}
+
+// decodes block to recording chunk layout (cached), NULL with EBADMSG if corrupted
+static const struct cc_record_chunk *log_decode_block(struct cc_replay *r, uint64_t chunk)
+{
+	const struct cc_log_block *block=(const struct cc_log_block*)(r->file + r->index[chunk].offset);
+	const uint8_t *compressed=(const uint8_t*)(block + 1);
+	const uint8_t *in, *end;
+	struct cc_record_read *reads;
+	struct cc_log_codec *k;
+	uint8_t *frames;
+	size_t size;
+	uint32_t read=0, read_started=UINT32_MAX, bytes=0;
+
+	if(r->log_chunk == chunk + 1)
+		return r->log_decoded;
+
+	r->log_chunk=0;
+
+	if(r->index[chunk].offset + sizeof(struct cc_log_block) + block->compressed_bytes > r->file_size ||
+		block->reads == 0 || block->reads > block->messages ||
+		block->raw_bytes > (uint64_t)block->messages * UINT8_MAX || block->encoded_bytes > CC_LOG_BLOCK_BYTES ||
+		(block->codec != CC_LOG_STORED && block->codec != CC_LOG_LZ4))
+	{
+		errno=EBADMSG;
+		return NULL;
+	}
+
+	size=sizeof(struct cc_record_chunk) + block->reads*sizeof(struct cc_record_read) + block->raw_bytes;
+
+	if(size > r->log_decoded_capacity)
+	{
+		void *decoded=realloc(r->log_decoded, size);
+
+		if(decoded == NULL)
+			return NULL;
+
+		r->log_decoded=(struct cc_record_chunk*)decoded;
+		r->log_decoded_capacity=size;
+	}
+
+	if(block->codec == CC_LOG_STORED)
+	{
+		if(block->compressed_bytes != block->encoded_bytes)
+		{
+			errno=EBADMSG;
+			return NULL;
+		}
+		in=compressed;
+	}
+	else
+	{
+		if(r->log_encoded == NULL && (r->log_encoded=(uint8_t*)malloc(CC_LOG_BLOCK_BYTES)) == NULL)
+			return NULL;
+
+		r->log_encoded_capacity=CC_LOG_BLOCK_BYTES;
+
+		if(lz4_decompress(compressed, block->compressed_bytes, r->log_encoded, r->log_encoded_capacity) != (int)block->encoded_bytes)
+		{
+			errno=EBADMSG;
+			return NULL;
+		}
+		in=r->log_encoded;
+	}
+
+	end=in + block->encoded_bytes;
+	reads=(struct cc_record_read*)(r->log_decoded + 1);
+	frames=(uint8_t*)(reads + block->reads);
+
+	//codec state is large, not on stack
+	k=(struct cc_log_codec*)calloc(1, sizeof(struct cc_log_codec));
+
+	if(k == NULL)
+		return NULL;
+
+	k->receive_time_us=block->receive_time_us;
+
+	for(uint32_t m=0;m<block->messages;++m)
+	{
+		uint64_t receive_time_us;
+		uint8_t frame[UINT8_MAX];
+
+		if( (in=log_decode_message(k, in, end, frame, &receive_time_us)) == NULL ||
+			bytes + frame[CC_MESSAGE_SIZE_OFFSET] > block->raw_bytes )
+			break;
+
+		//the next read starts with the first message with different receive time
+		if(m > 0 && receive_time_us != reads[read].receive_time_us && ++read == block->reads)
+			break;
+
+		if(read_started != read)
+		{
+			read_started=read;
+			reads[read].receive_time_us=receive_time_us;
+			reads[read].bytes=0;
+			reads[read].reserved=0;
+		}
+
+		memcpy(frames + bytes, frame, frame[CC_MESSAGE_SIZE_OFFSET]);
+		bytes += frame[CC_MESSAGE_SIZE_OFFSET];
+		reads[read].bytes += frame[CC_MESSAGE_SIZE_OFFSET];
+	}
+
+	free(k);
+
+	if(in != end || read + 1 != block->reads || bytes != block->raw_bytes)
+	{
+		errno=EBADMSG;
+		return NULL;
+	}
+
+	r->log_decoded->magic=CC_RECORD_CHUNK_MAGIC;
+	r->log_decoded->reads=block->reads;
+	r->log_decoded->bytes=block->raw_bytes;
+	r->log_decoded->reserved=0;
+	r->log_chunk=chunk + 1;
+
+	return r->log_decoded;
+}
+
+static uint8_t *varint_put(uint8_t *out, uint64_t value)
+{
+	while(value >= 0x80)
+	{
+		*out++ = (uint8_t)value | 0x80;
+		value >>= 7;
+	}
+
+	*out++ = (uint8_t)value;
+
+	return out;
+}
+
+// returns position after varint or NULL if truncated
+static const uint8_t *varint_get(const uint8_t *in, const uint8_t *end, uint64_t *value)
+{
+	uint64_t result=0;
+
+	for(int shift=0; in < end && shift < 64; shift += 7)
+	{
+		const uint8_t byte=*in++;
+
+		result |= (uint64_t)(byte & 0x7F) << shift;
+
+		if(!(byte & 0x80))
+		{
+			*value=result;
+			return in;
+		}
+	}
+
+	return NULL;
+}
+
+// small magnitude signed values to small unsigned values
+static uint64_t zigzag_encode(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/* LZ4 block compression */
+
+// LZ4 block format, liblz4 if available at build time, built-in otherwise
+// Built-in compressor is simple greedy one (single hash table probe),
+// both produce data decodable by either decompressor.
+
+static int lz4_compress(const uint8_t *src, int size, uint8_t *dst, int capacity, uint32_t *hash_table)
+{
+#if defined(CC_HAVE_LZ4)
+	return LZ4_compress_default((const char*)src, (char*)dst, size, capacity);
+#else
+	const uint8_t *anchor=src, *ip=src;
+	const uint8_t *const match_limit=src + size - CC_LZ4_MATCH_LIMIT;
+	const uint8_t *const literals_limit=src + size - CC_LZ4_LAST_LITERALS;
+	uint8_t *op=dst, *const op_end=dst + capacity;
+
+	//positions + 1, 0 for empty
+	memset(hash_table, 0, sizeof(uint32_t) << CC_LZ4_HASH_BITS);
+
+	while(size > CC_LZ4_MATCH_LIMIT && ip < match_limit)
+	{
+		uint32_t sequence, hash;
+		const uint8_t *match;
+		uint32_t literals, match_length;
+
+		memcpy(&sequence, ip, sizeof(sequence));
+		hash=(sequence * 2654435761U) >> (32 - CC_LZ4_HASH_BITS);
+		match = hash_table[hash] ? src + hash_table[hash] - 1 : NULL;
+		hash_table[hash]=ip - src + 1;
+
+		if(match == NULL || ip - match > CC_LZ4_MAX_OFFSET || memcmp(match, ip, CC_LZ4_MIN_MATCH) != 0)
+		{
+			++ip;
+			continue;
+		}
+
+		//extend backwards over pending literals and forward up to last literals
+		while(ip > anchor && match > src && ip[-1] == match[-1])
+			--ip, --match;
+
+		match_length=CC_LZ4_MIN_MATCH;
+
+		while(ip + match_length < literals_limit && ip[match_length] == match[match_length])
+			++match_length;
+
+		literals=ip - anchor;
+
+		//token, lengths (1 + n/255 bytes each), literals, offset
+		if(op + 1 + literals + literals/255 + 2 + (match_length - CC_LZ4_MIN_MATCH)/255 + 2 > op_end)
+			return 0;
+
+		*op = (literals < 15 ? literals : 15) << 4 | (match_length - CC_LZ4_MIN_MATCH < 15 ? match_length - CC_LZ4_MIN_MATCH : 15);
+		++op;
+
+		if(literals >= 15)
+			op=lz4_put_length(op, literals - 15);
+
+		memcpy(op, anchor, literals);
+		op += literals;
+
+		*op++ = (uint8_t)(ip - match);
+		*op++ = (uint8_t)((ip - match) >> 8);
+
+		if(match_length - CC_LZ4_MIN_MATCH >= 15)
+			op=lz4_put_length(op, match_length - CC_LZ4_MIN_MATCH - 15);
+
+		ip += match_length;
+		anchor=ip;
+	}
+
+	//last literals
+	{
+		const uint32_t literals=src + size - anchor;
+
+		if(op + 1 + literals + literals/255 + 1 > op_end)
+			return 0;
+
+		*op++ = (literals < 15 ? literals : 15) << 4;
+
+		if(literals >= 15)
+			op=lz4_put_length(op, literals - 15);
+
+		memcpy(op, anchor, literals);
+		op += literals;
+	}
+
+	return op - dst;
+#endif
+}
+
+// returns decompressed size or negative value if corrupted
+static int lz4_decompress(const uint8_t *src, int size, uint8_t *dst, int capacity)
+{
+#if defined(CC_HAVE_LZ4)
+	return LZ4_decompress_safe((const char*)src, (char*)dst, size, capacity);
+#else
+	const uint8_t *ip=src, *const ip_end=src + size;
+	uint8_t *op=dst, *const op_end=dst + capacity;
+
+	while(ip < ip_end)
+	{
+		const uint8_t token=*ip++;
+		size_t literals=token >> 4, match_length=token & 15, offset;
+
+		if(literals == 15)
+		{
+			uint8_t byte;
+			do
+			{
+				if(ip >= ip_end)
+					return -1;
+				byte=*ip++;
+				literals += byte;
+			} while(byte == 255);
+		}
+
+		if(literals > (size_t)(ip_end - ip) || literals > (size_t)(op_end - op))
+			return -1;
+
+		memcpy(op, ip, literals);
+		ip += literals;
+		op += literals;
+
+		if(ip == ip_end) //the last sequence has only literals
+			break;
+
+		if(ip_end - ip < 2)
+			return -1;
+
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+
+		if(offset == 0 || offset > (size_t)(op - dst))
+			return -1;
+
+		if(match_length == 15)
+		{
+			uint8_t byte;
+			do
+			{
+				if(ip >= ip_end)
+					return -1;
+				byte=*ip++;
+				match_length += byte;
+			} while(byte == 255);
+		}
+
+		match_length += CC_LZ4_MIN_MATCH;
+
+		if(match_length > (size_t)(op_end - op))
+			return -1;
+
+		//overlapping copy repeats pattern
+		if(offset >= match_length)
+			memcpy(op, op - offset, match_length);
+		else
+			for(size_t i=0;i<match_length;++i)
+				op[i]=op[i - offset];
+
+		op += match_length;
+	}
+
+	return op - dst;
+#endif
+}
+
+static uint8_t *lz4_put_length(uint8_t *out, uint32_t length)
+{
+	for(; length >= 255; length -= 255)
+		*out++ = 255;
+
+	*out++ = (uint8_t)length;
+
+	return out;
+}
+
+/* Message validation */
+
+// skips invalid data, returns CC_VALID_MESSAGE at *offset or CC_NEED_MORE_DATA
+static int next_message(struct cc *c, const uint8_t *buffer, int *offset)
+{
+	int valid;
+
+	while( (valid=validate_message(buffer, c->buffer_bytes, *offset)) == CC_INVALID_MESSAGE )
+	{	//try luck starting from the next possible message start
+		const int next=find_message_start(buffer, c->buffer_bytes, *offset+1);
+		c->stats.skipped_bytes += next - *offset;
+		*offset = next;
+	}
+
+	return valid;
+}
+
+// returns CC_INVALID_MESSAGE or CC_NEED_MORE_DATA or CC_VALID_MESSAGE
+static int validate_message(const uint8_t *data, int bytes, int from)
+{
+	int pending_bytes=bytes-from;
+	uint8_t msg_start, msg_size=UINT8_MAX, msg_end, msg_type;
+
+	if(pending_bytes == 0)
+		return CC_NEED_MORE_DATA;
+
+	if(pending_bytes >= 1)
+	{
+		msg_start=data[from];
+		if(!is_valid_message_start(msg_start))
+			return CC_INVALID_MESSAGE;
+	}
+
+	if(pending_bytes >= 3)
+	{
+		msg_size=data[from+1];
+		msg_type=data[from+2];
+
+		if(!is_valid_length_for_message_type(msg_start, msg_type, msg_size))
+			return CC_INVALID_MESSAGE;
+	}
+
+	if(pending_bytes >= msg_size ) //start, length, type/reserved, end so we have end of message
+	{
+		msg_end=data[from + msg_size -1];
+
+		if(!is_valid_message_start_end(msg_start, msg_end))
+			return CC_INVALID_MESSAGE;
+
+		// if we got that far:
+		// - message has correct start
+		// - message has valid length for start/type
+		// - message end delimter matches start delimeter
+		// we conclude that it is a valid message
+		return CC_VAlID_MESSAGE;
+	}
+
+	return CC_NEED_MORE_DATA;
+}
+
+// Returns offset of the first candidate message start at or after from
+// or bytes if there is none. The candidate is either a valid message
+// or a message start which needs more data to be validated.
+//
+// Vectorized code checks start byte, size and type for 16 (SSE2)
+// or 32 (AVX2) consecutive candidates at once. The end byte is checked
+// with validate_message only for the candidates that pass.
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#if defined(__AVX2__)
+typedef __m256i cc_vector;
+#define CC_VECTOR_BYTES 32
+#define cc_vector_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define cc_vector_set1(b) _mm256_set1_epi8((char)(b))
+#define cc_vector_zero _mm256_setzero_si256
+#define cc_vector_cmpeq _mm256_cmpeq_epi8
+#define cc_vector_and _mm256_and_si256
+#define cc_vector_or _mm256_or_si256
+#define cc_vector_movemask(v) ((uint32_t)_mm256_movemask_epi8(v))
+#else
+typedef __m128i cc_vector;
+#define CC_VECTOR_BYTES 16
+#define cc_vector_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define cc_vector_set1(b) _mm_set1_epi8((char)(b))
+#define cc_vector_zero _mm_setzero_si128
+#define cc_vector_cmpeq _mm_cmpeq_epi8
+#define cc_vector_and _mm_and_si128
+#define cc_vector_or _mm_or_si128
+#define cc_vector_movemask(v) ((uint32_t)_mm_movemask_epi8(v))
+#endif
+
+static int find_message_start(const uint8_t *data, int bytes, int from)
+{
+	const cc_vector start=cc_vector_set1(CC_START_OF_MESSAGE);
+	int i=from;
+
+	//start at i, size at i+1, type at i+2
+	for(; i + CC_VECTOR_BYTES + CC_MESSAGE_TYPE_OFFSET <= bytes; i += CC_VECTOR_BYTES)
+	{
+		const cc_vector msg_start=cc_vector_load(data + i);
+		const cc_vector msg_size=cc_vector_load(data + i + CC_MESSAGE_SIZE_OFFSET);
+		const cc_vector msg_type=cc_vector_load(data + i + CC_MESSAGE_TYPE_OFFSET);
+
+		cc_vector type_size=cc_vector_zero();
+
+		//type and size pair matches one of protocol messages
+		#define CC_MATCH_TYPE_SIZE(NAME, name, type, size) \
+			type_size=cc_vector_or(type_size, cc_vector_and(cc_vector_cmpeq(msg_type, cc_vector_set1(type)), cc_vector_cmpeq(msg_size, cc_vector_set1(size))));
+		CC_PROTOCOL_MESSAGES(CC_MATCH_TYPE_SIZE)
+		#undef CC_MATCH_TYPE_SIZE
+
+		uint32_t candidates=cc_vector_movemask(cc_vector_and(cc_vector_cmpeq(msg_start, start), type_size));
+
+		for(; candidates; candidates &= candidates - 1)
+		{
+			const int candidate=i + __builtin_ctz(candidates);
+
+			if(validate_message(data, bytes, candidate) != CC_INVALID_MESSAGE)
+				return candidate;
+		}
+	}
+
+	//the tail with less than vector of data
+	for(; i < bytes; ++i)
+		if(data[i] == CC_START_OF_MESSAGE && validate_message(data, bytes, i) != CC_INVALID_MESSAGE)
+			return i;
+
+	return bytes;
+}
+
+#else
+
+static int find_message_start(const uint8_t *data, int bytes, int from)
+{
+	const uint8_t *candidate;
+
+	for(; from < bytes; ++from)
+	{
+		if( (candidate=memchr(data + from, CC_START_OF_MESSAGE, bytes - from)) == NULL)
+			return bytes;
+
+		from = candidate - data;
+
+		if(validate_message(data, bytes, from) != CC_INVALID_MESSAGE)
+			return from;
+	}
+
+	return bytes;
+}
+
+#endif
+
+static int is_valid_message_start(uint8_t c)
+{
+	return c == CC_START_OF_MESSAGE;
+}
+
+static int is_valid_message_start_end(uint8_t msg_start, uint8_t msg_end)
+{
+	return  (msg_start == CC_START_OF_MESSAGE && msg_end == CC_END_OF_MESSAGE);
+}
+
+static int is_valid_length_for_message_type(uint8_t msg_start,uint8_t msg_type, uint8_t msg_length)
+{
+	//unknown types have size 0 which is never valid
+	return msg_start == CC_START_OF_MESSAGE && msg_length != 0 && CC_MESSAGE_SIZES[msg_type] == msg_length;
+}
+
+/* Message processing and decoding */
+
+//returns CC_MESSAGE_PROCESSED or CC_NO_SPACE_IN_USER_ARRAY
+static int process_message(struct cc *c, uint8_t *msg, const struct cc_time *time, struct cc_data *data, struct cc_size *counters)
+{
+	const uint8_t msg_type=msg[CC_MESSAGE_TYPE_OFFSET];
+
+	//routed messages never fill the shared array
+	if(message_routed(c, msg, time))
+		return CC_MESSAGE_PROCESSED;
+
+	switch(msg_type)
+	{
+		//hooks decode on their own if user doesn't read the type (e.g. scans are assembled anyway)
+		#define CC_PROCESS_MESSAGE(NAME, name, type, bytes) \
+		case CC_##NAME##_TYPE: \
+			if(data->size.name == 0) \
+			{ \
+				message_hooks(c, msg, time, NULL); \
+				return CC_MESSAGE_PROCESSED; \
+			} \
+			if(counters->name >= data->size.name) \
+				return CC_NO_SPACE_IN_USER_ARRAY; \
+			decode_message_##name(msg, time, data->name + counters->name); \
+			message_hooks(c, msg, time, data->name + counters->name++); \
+			break;
+		CC_PROTOCOL_MESSAGES(CC_PROCESS_MESSAGE)
+		#undef CC_PROCESS_MESSAGE
+		default:
+			;//fprintf(stderr, "unsupported message type: %c\n", msg_type);
+	}
+
+	//if we got that far the message was processed or is of unsupported type
+	return CC_MESSAGE_PROCESSED;
+}
+
+// called once for each message consumed by reading functions
+static void message_consumed(struct cc *c, const uint8_t *msg)
+{
+	stats_message(c, msg);
+
+	if(c->logger)
+		log_append(c, msg);
+}
+
+//the same as process_message but decodes to columns
+//hooks decode on their own (only if enabled)
+static int process_message_columns(struct cc *c, uint8_t *msg, const struct cc_time *time, struct cc_columns *columns, struct cc_size *counters)
+{
+	const uint8_t msg_type=msg[CC_MESSAGE_TYPE_OFFSET];
+
+	//routed messages never fill the shared columns
+	if(message_routed(c, msg, time))
+		return CC_MESSAGE_PROCESSED;
+
+	switch(msg_type)
+	{
+		#define CC_PROCESS_MESSAGE_COLUMNS(NAME, name, type, bytes) \
+		case CC_##NAME##_TYPE: \
+			if(columns->size.name != 0) \
+			{ \
+				if(counters->name >= columns->size.name) \
+					return CC_NO_SPACE_IN_USER_ARRAY; \
+				decode_message_##name##_columns(msg, time, &columns->name, counters->name++); \
+			} \
+			message_hooks(c, msg, time, NULL); \
+			break;
+		CC_PROTOCOL_MESSAGES(CC_PROCESS_MESSAGE_COLUMNS)
+		#undef CC_PROCESS_MESSAGE_COLUMNS
+		default:
+			;
+	}
+
+	return CC_MESSAGE_PROCESSED;
+}
+
+/* Message hooks */
+
+// Per type processing is expanded from CC_PROTOCOL_MESSAGES, only optional
+// processing enabled by user is written by hand here.
+
+// rplidar messages of devices with enabled route go only to per device queue
+static int message_routed(struct cc *c, const uint8_t *msg, const struct cc_time *time)
+{
+	if(!c->rplidar_routes_enabled || msg[CC_MESSAGE_TYPE_OFFSET] != CC_RPLIDAR_TYPE ||
+		!c->rplidar_routes[msg[CC_MSG_PAYLOAD_OFFSET+4]])
+		return 0;
+
+	rplidar_route_message(c, msg, time);
+	return 1;
+}
+
+// scan assembly and odometry history, decoded is user data of message type or NULL if not decoded
+static void message_hooks(struct cc *c, const uint8_t *msg, const struct cc_time *time, const void *decoded)
+{
+	switch(msg[CC_MESSAGE_TYPE_OFFSET])
+	{
+		case CC_ODOMETRY_TYPE:
+			if(c->odometry_history == NULL)
+				break;
+			if(decoded)
+				odometry_history_feed(c->odometry_history, (const struct cc_odometry_data*)decoded);
+			else
+				odometry_history_message(c, msg, time);
+			break;
+		case CC_RPLIDAR_TYPE:
+			if(!c->rplidar_scans_enabled)
+				break;
+			if(decoded)
+			{
+				const struct cc_rplidar_data *rplidar=(const struct cc_rplidar_data*)decoded;
+
+				if(c->rplidar_scanners[rplidar->device_id])
+					rplidar_scan_feed(c->rplidar_scanners[rplidar->device_id], rplidar);
+			}
+			else
+				rplidar_scan_message(c, msg, time);
+			break;
+		case CC_XV11LIDAR_TYPE:
+			if(c->xv11lidar_scanner == NULL)
+				break;
+			if(decoded)
+				xv11lidar_scan_feed(c->xv11lidar_scanner, (const struct cc_xv11lidar_data*)decoded);
+			else
+				xv11lidar_scan_message(c, msg, time);
+			break;
+	}
+}
+
+/* Message level decoding */
+
+// Payload layouts are in protocol/cc_protocol.json (and as tables in generated cc_protocol_decode.h).
+// Payload is decoded with generated straight-line decode_payload_* functions,
+// MCU timestamp is extended with clock synchronization result.
+
+// decode_message_odometry, decode_message_xv11lidar, decode_message_rplidar
+#define CC_DECODE_MESSAGE(NAME, name, type, size) \
+static void decode_message_##name(const uint8_t *msg, const struct cc_time *time, struct cc_##name##_data *data) \
+{ \
+	decode_payload_##name(msg + CC_MSG_PAYLOAD_OFFSET, data); \
+	data->mcu_time_us = time->mcu_us; \
+	data->host_time_us = time->host_us; \
+	data->latency_us = time->latency_us; \
+}
+
+CC_PROTOCOL_MESSAGES(CC_DECODE_MESSAGE)
+#undef CC_DECODE_MESSAGE
+
+// decode_message_odometry_columns, decode_message_xv11lidar_columns, decode_message_rplidar_columns
+#define CC_DECODE_MESSAGE_COLUMNS(NAME, name, type, size) \
+static void decode_message_##name##_columns(const uint8_t *msg, const struct cc_time *time, const struct cc_##name##_columns *columns, int i) \
+{ \
+	decode_payload_##name##_columns(msg + CC_MSG_PAYLOAD_OFFSET, columns, i); \
+	if(columns->mcu_time_us) \
+		columns->mcu_time_us[i] = time->mcu_us; \
+	if(columns->host_time_us) \
+		columns->host_time_us[i] = time->host_us; \
+	if(columns->latency_us) \
+		columns->latency_us[i] = time->latency_us; \
+}
+
+CC_PROTOCOL_MESSAGES(CC_DECODE_MESSAGE_COLUMNS)
+#undef CC_DECODE_MESSAGE_COLUMNS
+
+/* Data type level decoding */
+
+// note - the communication is currently simple little endian
+// so the functions just copy memory
+// TO DO - consider using network order/consider host byte order
+
+static uint32_t decode_uint32(const uint8_t *encoded)
+{
+	uint32_t temp;
+	memcpy(&temp, encoded, sizeof(temp));
+	return temp;
+}
+
+/* RPLidar measurement decoding */
+
+// constants from RPLidar SDK
+enum {	CC_VARBITSCALE_X2_SRC_BIT=9, CC_VARBITSCALE_X4_SRC_BIT=11,
+		CC_VARBITSCALE_X8_SRC_BIT=12, CC_VARBITSCALE_X16_SRC_BIT=14 };
+enum {	CC_VARBITSCALE_X2_DEST_VAL=512, CC_VARBITSCALE_X4_DEST_VAL=1280,
+		CC_VARBITSCALE_X8_DEST_VAL=1792, CC_VARBITSCALE_X16_DEST_VAL=3328 };
+enum {CC_RPLIDAR_CABINS=32};
+
+int cc_rplidar_decode(struct cc *c, const struct cc_rplidar_data *capsules, int size, struct cc_rplidar_points *points)
+{
+	int decoded=0;
+
+	if(points->size < size * CC_RPLIDAR_CAPSULE_POINTS)
+	{
+		points->size=0;
+		errno=ENOBUFS;
+		return CC_ERROR;
+	}
+
+	for(int i=0;i<size;++i)
+	{
+		const uint8_t id=capsules[i].device_id;
+
+		// measurements of the previous capsule are decoded with start angle of the current one
+		if(c->rplidar_previous_ready[id])
+		{
+			decode_rplidar_capsule(&c->rplidar_previous[id], &capsules[i].capsule, points, decoded);
+			decoded += CC_RPLIDAR_CAPSULE_POINTS;
+		}
+
+		c->rplidar_previous[id] = capsules[i].capsule;
+		c->rplidar_previous_ready[id] = 1;
+	}
+
+	points->size=decoded;
+
+	return CC_OK;
+}
+
+// port of _ultraCapsuleToNormal from RPLidar SDK
+static void decode_rplidar_capsule(const rplidar_response_ultra_capsule_measurement_nodes_t *capsule,
+	const rplidar_response_ultra_capsule_measurement_nodes_t *next, struct cc_rplidar_points *points, int from)
+{
+	int32_t dist_q2[CC_RPLIDAR_CAPSULE_POINTS];
+	const int start_angle_q8 = (capsule->start_angle_sync_q6 & 0x7FFF) << 2;
+	const int next_start_angle_q8 = (next->start_angle_sync_q6 & 0x7FFF) << 2;
+	int diff_angle_q8 = next_start_angle_q8 - start_angle_q8;
+
+	if(start_angle_q8 > next_start_angle_q8)
+		diff_angle_q8 += 360 << 8;
+
+	const int angle_inc_q16 = (diff_angle_q8 << 3) / 3;
+	int angle_raw_q16 = start_angle_q8 << 8;
+
+	decode_rplidar_distances(capsule, next, dist_q2);
+
+	for(int i=0;i<CC_RPLIDAR_CAPSULE_POINTS;++i)
+	{
+		int offset_angle_mean_q16 = (int)(7.5 * 3.1415926535 * (1 << 16) / 180.0);
+		int angle_q6;
+
+		if(dist_q2[i] >= 50 * 4)
+		{
+			const int k1 = 98361;
+			const int k2 = k1 / dist_q2[i];
+
+			offset_angle_mean_q16 = (int)(8 * 3.1415926535 * (1 << 16) / 180) - (k2 << 6) - (k2 * k2 * k2) / 98304;
+		}
+
+		if(points->sync)
+			points->sync[from + i] = ((angle_raw_q16 + angle_inc_q16) % (360 << 16)) < angle_inc_q16;
+
+		angle_q6 = (angle_raw_q16 - (int)(offset_angle_mean_q16 * 180 / 3.14159265)) >> 10;
+		angle_raw_q16 += angle_inc_q16;
+
+		if(angle_q6 < 0)
+			angle_q6 += 360 << 6;
+		if(angle_q6 >= (360 << 6))
+			angle_q6 -= 360 << 6;
+
+		points->angle_q14[from + i] = (uint16_t)((angle_q6 << 8) / 90);
+		points->dist_mm_q2[from + i] = (uint32_t)dist_q2[i];
+	}
+}
+
+#if defined(__SSE2__)
+
+// vectorized varbitscale_decode for 4 cabins at once
+static inline __m128i varbitscale_decode_sse2(__m128i scaled, __m128i *scale_level)
+{
+	__m128i decoded=scaled, level=_mm_setzero_si128(), mask;
+
+	mask=_mm_cmpgt_epi32(scaled, _mm_set1_epi32(CC_VARBITSCALE_X2_DEST_VAL - 1));
+	decoded=_mm_or_si128(_mm_andnot_si128(mask, decoded), _mm_and_si128(mask,
+		_mm_add_epi32(_mm_set1_epi32(1 << CC_VARBITSCALE_X2_SRC_BIT), _mm_slli_epi32(_mm_sub_epi32(scaled, _mm_set1_epi32(CC_VARBITSCALE_X2_DEST_VAL)), 1))));
+	level=_mm_or_si128(_mm_andnot_si128(mask, level), _mm_and_si128(mask, _mm_set1_epi32(1)));
+
+	mask=_mm_cmpgt_epi32(scaled, _mm_set1_epi32(CC_VARBITSCALE_X4_DEST_VAL - 1));
+	decoded=_mm_or_si128(_mm_andnot_si128(mask, decoded), _mm_and_si128(mask,
+		_mm_add_epi32(_mm_set1_epi32(1 << CC_VARBITSCALE_X4_SRC_BIT), _mm_slli_epi32(_mm_sub_epi32(scaled, _mm_set1_epi32(CC_VARBITSCALE_X4_DEST_VAL)), 2))));
+	level=_mm_or_si128(_mm_andnot_si128(mask, level), _mm_and_si128(mask, _mm_set1_epi32(2)));
+
+	mask=_mm_cmpgt_epi32(scaled, _mm_set1_epi32(CC_VARBITSCALE_X8_DEST_VAL - 1));
+	decoded=_mm_or_si128(_mm_andnot_si128(mask, decoded), _mm_and_si128(mask,
+		_mm_add_epi32(_mm_set1_epi32(1 << CC_VARBITSCALE_X8_SRC_BIT), _mm_slli_epi32(_mm_sub_epi32(scaled, _mm_set1_epi32(CC_VARBITSCALE_X8_DEST_VAL)), 3))));
+	level=_mm_or_si128(_mm_andnot_si128(mask, level), _mm_and_si128(mask, _mm_set1_epi32(3)));
+
+	mask=_mm_cmpgt_epi32(scaled, _mm_set1_epi32(CC_VARBITSCALE_X16_DEST_VAL - 1));
+	decoded=_mm_or_si128(_mm_andnot_si128(mask, decoded), _mm_and_si128(mask,
+		_mm_add_epi32(_mm_set1_epi32(1 << CC_VARBITSCALE_X16_SRC_BIT), _mm_slli_epi32(_mm_sub_epi32(scaled, _mm_set1_epi32(CC_VARBITSCALE_X16_DEST_VAL)), 4))));
+	level=_mm_or_si128(_mm_andnot_si128(mask, level), _mm_and_si128(mask, _mm_set1_epi32(4)));
+
+	*scale_level=level;
+	return decoded;
+}
+
+// predict << level for per lane level in range 0-4 (SSE2 has no variable shifts)
+static inline __m128i shift_left_by_level_sse2(__m128i predict, __m128i level)
+{
+	__m128i shifted=predict, mask;
+
+	mask=_mm_cmpeq_epi32(level, _mm_set1_epi32(1));
+	shifted=_mm_or_si128(_mm_andnot_si128(mask, shifted), _mm_and_si128(mask, _mm_slli_epi32(predict, 1)));
+	mask=_mm_cmpeq_epi32(level, _mm_set1_epi32(2));
+	shifted=_mm_or_si128(_mm_andnot_si128(mask, shifted), _mm_and_si128(mask, _mm_slli_epi32(predict, 2)));
+	mask=_mm_cmpeq_epi32(level, _mm_set1_epi32(3));
+	shifted=_mm_or_si128(_mm_andnot_si128(mask, shifted), _mm_and_si128(mask, _mm_slli_epi32(predict, 3)));
+	mask=_mm_cmpeq_epi32(level, _mm_set1_epi32(4));
+	shifted=_mm_or_si128(_mm_andnot_si128(mask, shifted), _mm_and_si128(mask, _mm_slli_epi32(predict, 4)));
+
+	return shifted;
+}
+
+// (predict << level + base) << 2 or 0 for predict marking invalid measurement
+static inline __m128i predict_distance_sse2(__m128i predict, __m128i base, __m128i level)
+{
+	const __m128i invalid=_mm_or_si128(_mm_cmpeq_epi32(predict, _mm_set1_epi32(-512)), _mm_cmpeq_epi32(predict, _mm_set1_epi32(0x1FF)));
+	const __m128i dist_q2=_mm_slli_epi32(_mm_add_epi32(shift_left_by_level_sse2(predict, level), base), 2);
+
+	return _mm_andnot_si128(invalid, dist_q2);
+}
+
+// vectorized kernel, 4 cabins (12 measurements) at once, the last 4 cabins need next capsule
+static void decode_rplidar_distances(const rplidar_response_ultra_capsule_measurement_nodes_t *capsule,
+	const rplidar_response_ultra_capsule_measurement_nodes_t *next, int32_t dist_q2[CC_RPLIDAR_CAPSULE_POINTS])
+{
+	const __m128i major_mask=_mm_set1_epi32(0xFFF);
+	const uint8_t *cabins=(const uint8_t*)capsule->ultra_cabins;
+	int32_t out[3][4] __attribute__((aligned(16)));
+	int pos;
+
+	for(pos=0; pos < CC_RPLIDAR_CABINS - 4; pos += 4)
+	{
+		const __m128i combined=_mm_loadu_si128((const __m128i*)(cabins + pos*sizeof(uint32_t)));
+		const __m128i next_combined=_mm_loadu_si128((const __m128i*)(cabins + (pos+1)*sizeof(uint32_t)));
+		__m128i level1, level2;
+
+		const __m128i major=varbitscale_decode_sse2(_mm_and_si128(combined, major_mask), &level1);
+		const __m128i major2=varbitscale_decode_sse2(_mm_and_si128(next_combined, major_mask), &level2);
+		const __m128i predict1=_mm_srai_epi32(_mm_slli_epi32(combined, 10), 22);
+		const __m128i predict2=_mm_srai_epi32(combined, 22);
+
+		// if major is 0 and major2 is not, predict1 is relative to major2
+		const __m128i use_major2=_mm_andnot_si128(_mm_cmpeq_epi32(major2, _mm_setzero_si128()), _mm_cmpeq_epi32(major, _mm_setzero_si128()));
+		const __m128i base1=_mm_or_si128(_mm_andnot_si128(use_major2, major), _mm_and_si128(use_major2, major2));
+		level1=_mm_or_si128(_mm_andnot_si128(use_major2, level1), _mm_and_si128(use_major2, level2));
+
+		_mm_store_si128((__m128i*)out[0], _mm_slli_epi32(major, 2));
+		_mm_store_si128((__m128i*)out[1], predict_distance_sse2(predict1, base1, level1));
+		_mm_store_si128((__m128i*)out[2], predict_distance_sse2(predict2, major2, level2));
+
+		for(int i=0;i<4;++i)
+		{
+			dist_q2[3*(pos+i)] = out[0][i];
+			dist_q2[3*(pos+i)+1] = out[1][i];
+			dist_q2[3*(pos+i)+2] = out[2][i];
+		}
+	}
+
+	decode_rplidar_distances_scalar(capsule, next, dist_q2, pos);
+}
+
+#else
+
+static void decode_rplidar_distances(const rplidar_response_ultra_capsule_measurement_nodes_t *capsule,
+	const rplidar_response_ultra_capsule_measurement_nodes_t *next, int32_t dist_q2[CC_RPLIDAR_CAPSULE_POINTS])
+{
+	decode_rplidar_distances_scalar(capsule, next, dist_q2, 0);
+}
+
+#endif
+
+// scalar reference from cabin, always compiled (vectorized kernel tail, tests/cc_rplidar_test.c)
+static void decode_rplidar_distances_scalar(const rplidar_response_ultra_capsule_measurement_nodes_t *capsule,
+	const rplidar_response_ultra_capsule_measurement_nodes_t *next, int32_t dist_q2[CC_RPLIDAR_CAPSULE_POINTS], int from)
+{
+	int pos;
+
+	for(pos=from; pos < CC_RPLIDAR_CABINS - 1; ++pos)
+		decode_rplidar_cabin(capsule->ultra_cabins[pos].combined_x3, capsule->ultra_cabins[pos+1].combined_x3, dist_q2 + 3*pos);
+
+	decode_rplidar_cabin(capsule->ultra_cabins[pos].combined_x3, next->ultra_cabins[0].combined_x3, dist_q2 + 3*pos);
+}
+
+// scalar reference of cabin decoding
+// combined_x3 - | predict2 10bit | predict1 10bit | major 12bit |
+static void decode_rplidar_cabin(uint32_t combined_x3, uint32_t next_combined_x3, int32_t dist_q2[3])
+{
+	uint32_t level1, level2;
+	const int32_t major = varbitscale_decode(combined_x3 & 0xFFF, &level1);
+	const int32_t major2 = varbitscale_decode(next_combined_x3 & 0xFFF, &level2);
+	//signed 10 bit predictions
+	const int32_t predict1 = ((int32_t)(combined_x3 << 10)) >> 22;
+	const int32_t predict2 = ((int32_t)combined_x3) >> 22;
+	int32_t base1 = major;
+
+	if(!major && major2)
+	{
+		base1 = major2;
+		level1 = level2;
+	}
+
+	dist_q2[0] = major << 2;
+
+	if(predict1 == -512 || predict1 == 0x1FF)
+		dist_q2[1] = 0;
+	else
+		dist_q2[1] = (int32_t)((uint32_t)(predict1 * (1 << level1) + base1) << 2);
+
+	if(predict2 == -512 || predict2 == 0x1FF)
+		dist_q2[2] = 0;
+	else
+		dist_q2[2] = (int32_t)((uint32_t)(predict2 * (1 << level2) + major2) << 2);
+}
+
+static uint32_t varbitscale_decode(uint32_t scaled, uint32_t *scale_level)
+{
+	static const uint32_t scaled_base[] = {CC_VARBITSCALE_X16_DEST_VAL, CC_VARBITSCALE_X8_DEST_VAL,
+		CC_VARBITSCALE_X4_DEST_VAL, CC_VARBITSCALE_X2_DEST_VAL, 0};
+	static const uint32_t scaled_level[] = {4, 3, 2, 1, 0};
+	static const uint32_t target_base[] = {1 << CC_VARBITSCALE_X16_SRC_BIT, 1 << CC_VARBITSCALE_X8_SRC_BIT,
+		1 << CC_VARBITSCALE_X4_SRC_BIT, 1 << CC_VARBITSCALE_X2_SRC_BIT, 0};
+
+	for(int i=0;i<5;++i)
+	{
+		const int remain = (int)scaled - (int)scaled_base[i];
+
+		if(remain >= 0)
+		{
+			*scale_level = scaled_level[i];
+			return target_base[i] + (remain << scaled_level[i]);
+		}
+	}
+
+	*scale_level = 0;
+	return 0;
+}
+
+/* RPLidar scan assembly */
+
+int cc_rplidar_scan_enable(struct cc *c, uint8_t device_id, int max_points)
+{
+	struct cc_rplidar_scanner *s;
+
+	if(c->rplidar_scanners[device_id])
+		return CC_OK;
+
+	if(max_points < 0)
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	if( (s = (struct cc_rplidar_scanner*)calloc(1, sizeof(struct cc_rplidar_scanner))) == NULL )
+		return CC_ERROR;
+
+	s->max_points = max_points ? max_points : CC_RPLIDAR_SCAN_DEFAULT_POINTS;
+
+	//all the memory is allocated upfront, assembly never allocates
+	for(int i=0;i<CC_SCAN_BUFFERS;++i)
+	{
+		s->angle_q14[i]=(uint16_t*)malloc(s->max_points * sizeof(uint16_t));
+		s->dist_mm_q2[i]=(uint32_t*)malloc(s->max_points * sizeof(uint32_t));
+
+		s->scans[i].device_id=device_id;
+		s->scans[i].angle_q14=s->angle_q14[i];
+		s->scans[i].dist_mm_q2=s->dist_mm_q2[i];
+	}
+
+	s->back=0;
+	s->front=1;
+	atomic_init(&s->middle, 2);
+
+	c->rplidar_scanners[device_id]=s;
+	c->rplidar_scans_enabled=1;
+
+	for(int i=0;i<CC_SCAN_BUFFERS;++i)
+		if(s->angle_q14[i] == NULL || s->dist_mm_q2[i] == NULL)
+		{
+			rplidar_scanners_free(c);
+			errno=ENOMEM;
+			return CC_ERROR;
+		}
+
+	return CC_OK;
+}
+
+int cc_rplidar_scan(struct cc *c, uint8_t device_id, struct cc_rplidar_scan *scan)
+{
+	struct cc_rplidar_scanner *s=c->rplidar_scanners[device_id];
+
+	if(s == NULL)
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	if( !(atomic_load_explicit(&s->middle, memory_order_acquire) & CC_SCAN_NEW) )
+	{
+		errno=EAGAIN;
+		return CC_ERROR;
+	}
+
+	s->front = atomic_exchange_explicit(&s->middle, s->front, memory_order_acq_rel) & ~CC_SCAN_NEW;
+	*scan = s->scans[s->front];
+
+	return CC_OK;
+}
+
+// capsule not decoded for user, decode only if scan is enabled for its device
+static void rplidar_scan_message(struct cc *c, const uint8_t *msg, const struct cc_time *time)
+{
+	struct cc_rplidar_data capsule;
+	const uint8_t device_id=msg[CC_MSG_PAYLOAD_OFFSET+4];
+
+	if(c->rplidar_scanners[device_id] == NULL)
+		return;
+
+	decode_message_rplidar(msg, time, &capsule);
+	rplidar_scan_feed(c->rplidar_scanners[device_id], &capsule);
+}
+
+// Measurements of capsule are decoded with start angle of the next one.
+// Scan boundary is where decoded angle wraps around (sync flag of measurement).
+// The first partial revolution is discarded. Sequence gap drops previous
+// capsule (no valid next start angle) and is counted in missed_capsules.
+static void rplidar_scan_feed(struct cc_rplidar_scanner *s, const struct cc_rplidar_data *capsule)
+{
+	uint16_t angle_q14[CC_RPLIDAR_CAPSULE_POINTS];
+	uint32_t dist_mm_q2[CC_RPLIDAR_CAPSULE_POINTS];
+	uint8_t sync[CC_RPLIDAR_CAPSULE_POINTS];
+	struct cc_rplidar_points points={angle_q14, dist_mm_q2, sync, CC_RPLIDAR_CAPSULE_POINTS};
+	const uint8_t missed = capsule->sequence - s->previous.sequence - 1;
+
+	//new measurement stream (e.g. lidar restarted), discard partial scan
+	if(capsule->capsule.start_angle_sync_q6 & CC_RPLIDAR_SYNC_BIT)
+		s->started = s->previous_ready = 0;
+
+	if(s->previous_ready && missed)
+	{
+		const uint16_t previous_angle_q6=s->previous.capsule.start_angle_sync_q6 & 0x7FFF;
+		const uint16_t angle_q6=capsule->capsule.start_angle_sync_q6 & 0x7FFF;
+
+		if(s->started)
+		{
+			s->scans[s->back].missed_capsules += missed + 1;
+
+			//revolution wrapped during the gap, lost capsules are counted in both scans
+			if(angle_q6 < previous_angle_q6)
+			{
+				rplidar_scan_publish(s);
+				rplidar_scan_begin(s, capsule, missed + 1);
+			}
+		}
+	}
+	else if(s->previous_ready)
+	{
+		decode_rplidar_capsule(&s->previous.capsule, &capsule->capsule, &points, 0);
+
+		for(int i=0;i<CC_RPLIDAR_CAPSULE_POINTS;++i)
+		{
+			struct cc_rplidar_scan *scan;
+
+			if(sync[i])
+			{
+				if(s->started)
+					rplidar_scan_publish(s);
+
+				rplidar_scan_begin(s, &s->previous, 0);
+			}
+
+			if(!s->started)
+				continue;
+
+			scan=&s->scans[s->back];
+
+			if(scan->size == s->max_points)
+			{
+				++scan->dropped_points;
+				continue;
+			}
+
+			s->angle_q14[s->back][scan->size]=angle_q14[i];
+			s->dist_mm_q2[s->back][scan->size]=dist_mm_q2[i];
+			++scan->size;
+		}
+
+		if(s->started)
+		{
+			s->scans[s->back].end_mcu_time_us=s->previous.mcu_time_us;
+			s->scans[s->back].end_host_time_us=s->previous.host_time_us;
+		}
+	}
+
+	s->previous=*capsule;
+	s->previous_ready=1;
+}
+
+static void rplidar_scan_begin(struct cc_rplidar_scanner *s, const struct cc_rplidar_data *capsule, uint32_t missed_capsules)
+{
+	struct cc_rplidar_scan *scan=&s->scans[s->back];
+
+	scan->number=s->number++;
+	scan->start_mcu_time_us=scan->end_mcu_time_us=capsule->mcu_time_us;
+	scan->start_host_time_us=scan->end_host_time_us=capsule->host_time_us;
+	scan->missed_capsules=missed_capsules;
+	scan->dropped_points=0;
+	scan->size=0;
+
+	s->started=1;
+}
+
+static void rplidar_scan_publish(struct cc_rplidar_scanner *s)
+{
+	s->back = atomic_exchange_explicit(&s->middle, s->back | CC_SCAN_NEW, memory_order_acq_rel) & ~CC_SCAN_NEW;
+	s->started=0;
+}
+
+// stream discontinuity (e.g. replay seek), discard partial scans and odometry history
+static void stream_state_reset(struct cc *c)
+{
+	memset(c->rplidar_sequence_ready, 0, sizeof(c->rplidar_sequence_ready));
+
+	for(int id=0;id<=UINT8_MAX;++id)
+		if(c->rplidar_scanners[id])
+			c->rplidar_scanners[id]->started = c->rplidar_scanners[id]->previous_ready = 0;
+
+	if(c->xv11lidar_scanner)
+		c->xv11lidar_scanner->started = c->xv11lidar_scanner->previous_ready = 0;
+
+	if(c->odometry_history)
+	{
+		c->odometry_history->previous_ready=0;
+		atomic_store(&c->odometry_history->first, atomic_load(&c->odometry_history->head));
+	}
+}
+
+static void rplidar_scanners_free(struct cc *c)
+{
+	for(int id=0;id<=UINT8_MAX;++id)
+	{
+		struct cc_rplidar_scanner *s=c->rplidar_scanners[id];
+
+		if(s == NULL)
+			continue;
+
+		for(int i=0;i<CC_SCAN_BUFFERS;++i)
+		{
+			free(s->angle_q14[i]);
+			free(s->dist_mm_q2[i]);
+		}
+
+		free(s);
+		c->rplidar_scanners[id]=NULL;
+	}
+
+	c->rplidar_scans_enabled=0;
+}
+
+/* RPLidar routing */
+
+int cc_rplidar_route(struct cc *c, uint8_t device_id, int capacity, int policy)
+{
+	struct cc_queue *q;
+
+	if(c->rplidar_routes[device_id])
+		return CC_OK;
+
+	if(capacity <= 0)
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	//queue head and tail are on separate cache lines
+	if( (q = (struct cc_queue*)memalign(CC_CACHE_LINE, sizeof(struct cc_queue))) == NULL )
+		return CC_ERROR;
+
+	if(queue_init(q, sizeof(struct cc_rplidar_data), capacity, policy) != CC_OK)
+	{
+		free(q);
+		return CC_ERROR;
+	}
+
+	c->rplidar_routes[device_id]=q;
+	c->rplidar_routes_enabled=1;
+
+	return CC_OK;
+}
+
+int cc_rplidar_read(struct cc *c, uint8_t device_id, struct cc_rplidar_data *data, int size)
+{
+	if(c->rplidar_routes[device_id] == NULL)
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	return queue_pop(c->rplidar_routes[device_id], data, size);
+}
+
+// routed capsule is queued for its device, full queue never stops reading
+static void rplidar_route_message(struct cc *c, const uint8_t *msg, const struct cc_time *time)
+{
+	struct cc_rplidar_data capsule;
+
+	decode_message_rplidar(msg, time, &capsule);
+
+	if(c->rplidar_scanners[capsule.device_id])
+		rplidar_scan_feed(c->rplidar_scanners[capsule.device_id], &capsule);
+
+	queue_push(c->rplidar_routes[capsule.device_id], &capsule, 1);
+}
+
+static void rplidar_routes_free(struct cc *c)
+{
+	for(int id=0;id<=UINT8_MAX;++id)
+	{
+		if(c->rplidar_routes[id] == NULL)
+			continue;
+
+		queue_close(c->rplidar_routes[id]);
+		free(c->rplidar_routes[id]);
+		c->rplidar_routes[id]=NULL;
+	}
+
+	c->rplidar_routes_enabled=0;
+}
+
+/* XV11 measurement decoding */
+
+// distance field - | invalid_data 1bit | strength_warning 1bit | distance or error code 14bit |
+enum {CC_XV11LIDAR_DISTANCE_MASK=0x3FFF, CC_XV11LIDAR_STRENGTH_WARNING=0x4000, CC_XV11LIDAR_INVALID_DATA=0x8000};
+
+int cc_xv11lidar_decode(const struct cc_xv11lidar_data *readings, int size, struct cc_xv11lidar_points *points)
+{
+	if(points->size < size * CC_XV11LIDAR_READING_POINTS)
+	{
+		points->size=0;
+		errno=ENOBUFS;
+		return CC_ERROR;
+	}
+
+	for(int i=0;i<size;++i)
+		decode_xv11lidar_reading(readings + i, points, i * CC_XV11LIDAR_READING_POINTS);
+
+	points->size = size * CC_XV11LIDAR_READING_POINTS;
+
+	return CC_OK;
+}
+
+#if defined(__SSE2__)
+
+// vectorized, all 4 measurements at once
+static void decode_xv11lidar_reading(const struct cc_xv11lidar_data *reading, struct cc_xv11lidar_points *points, int from)
+{
+	const __m128i distances=_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)reading->distances), _mm_setzero_si128());
+	const __m128i distance=_mm_and_si128(distances, _mm_set1_epi32(CC_XV11LIDAR_DISTANCE_MASK));
+	const __m128i invalid=_mm_cmpeq_epi32(_mm_and_si128(distances, _mm_set1_epi32(CC_XV11LIDAR_INVALID_DATA)), _mm_set1_epi32(CC_XV11LIDAR_INVALID_DATA));
+	const __m128i angle=_mm_add_epi32(_mm_set1_epi32(reading->angle_quad * 4), _mm_setr_epi32(0, 1, 2, 3));
+	const __m128 range=_mm_mul_ps(_mm_cvtepi32_ps(_mm_andnot_si128(invalid, distance)), _mm_set1_ps(0.001f));
+	const __m128i valid=_mm_andnot_si128(invalid, _mm_set1_epi32(1));
+	const __m128i error=_mm_packs_epi32(_mm_and_si128(invalid, distance), _mm_setzero_si128());
+	const int valid_bytes=_mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(valid, _mm_setzero_si128()), _mm_setzero_si128()));
+
+	_mm_storeu_ps(points->angle_deg + from, _mm_cvtepi32_ps(angle));
+	_mm_storeu_ps(points->range_m + from, range);
+	memcpy(points->valid + from, &valid_bytes, 4);
+	_mm_storel_epi64((__m128i*)(points->error_code + from), error);
+}
+
+#else
+
+static void decode_xv11lidar_reading(const struct cc_xv11lidar_data *reading, struct cc_xv11lidar_points *points, int from)
+{
+	for(int i=0;i<CC_XV11LIDAR_READING_POINTS;++i)
+	{
+		const uint16_t distance = reading->distances[i] & CC_XV11LIDAR_DISTANCE_MASK;
+		const int invalid = (reading->distances[i] & CC_XV11LIDAR_INVALID_DATA) != 0;
+
+		points->angle_deg[from + i] = (float)(reading->angle_quad * 4 + i);
+		points->range_m[from + i] = invalid ? 0.0f : distance * 0.001f;
+		points->valid[from + i] = !invalid;
+		points->error_code[from + i] = invalid ? distance : 0;
+	}
+}
+
+#endif
+
+/* XV11 revolution assembly */
+
+int cc_xv11lidar_scan_enable(struct cc *c)
+{
+	struct cc_xv11lidar_scanner *s;
+
+	if(c->xv11lidar_scanner)
+		return CC_OK;
+
+	//all the memory is allocated upfront, assembly never allocates
+	if( (s = (struct cc_xv11lidar_scanner*)calloc(1, sizeof(struct cc_xv11lidar_scanner))) == NULL )
+		return CC_ERROR;
+
+	s->back=0;
+	s->front=1;
+	atomic_init(&s->middle, 2);
+
+	c->xv11lidar_scanner=s;
+
+	return CC_OK;
+}
+
+int cc_xv11lidar_scan(struct cc *c, const struct cc_xv11lidar_scan **scan)
+{
+	struct cc_xv11lidar_scanner *s=c->xv11lidar_scanner;
+
+	if(s == NULL)
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	if( !(atomic_load_explicit(&s->middle, memory_order_acquire) & CC_SCAN_NEW) )
+	{
+		errno=EAGAIN;
+		return CC_ERROR;
+	}
+
+	s->front = atomic_exchange_explicit(&s->middle, s->front, memory_order_acq_rel) & ~CC_SCAN_NEW;
+	*scan = &s->scans[s->front];
+
+	return CC_OK;
+}
+
+// reading not decoded for user
+static void xv11lidar_scan_message(struct cc *c, const uint8_t *msg, const struct cc_time *time)
+{
+	struct cc_xv11lidar_data reading;
+
+	decode_message_xv11lidar(msg, time, &reading);
+	xv11lidar_scan_feed(c->xv11lidar_scanner, &reading);
+}
+
+// Revolution boundary is where angle_quad decreases. The first partial
+// revolution is discarded. Readings with the same angle_quad overwrite.
+static void xv11lidar_scan_feed(struct cc_xv11lidar_scanner *s, const struct cc_xv11lidar_data *reading)
+{
+	float angle_deg[CC_XV11LIDAR_READING_POINTS];
+	struct cc_xv11lidar_scan *scan;
+	struct cc_xv11lidar_points points;
+	const int quad=reading->angle_quad;
+
+	if(quad >= CC_XV11LIDAR_SCAN_RAYS / CC_XV11LIDAR_READING_POINTS)
+		return;
+
+	if(s->previous_ready && quad < s->previous_quad)
+	{
+		if(s->started)
+			xv11lidar_scan_publish(s);
+
+		xv11lidar_scan_begin(s, reading);
+	}
+
+	s->previous_quad=quad;
+	s->previous_ready=1;
+
+	if(!s->started)
+		return;
+
+	scan=&s->scans[s->back];
+
+	//decode straight to rays of the quad
+	points.angle_deg=angle_deg;
+	points.range_m=scan->range_m + quad * CC_XV11LIDAR_READING_POINTS;
+	points.valid=scan->valid + quad * CC_XV11LIDAR_READING_POINTS;
+	points.error_code=scan->error_code + quad * CC_XV11LIDAR_READING_POINTS;
+	points.size=CC_XV11LIDAR_READING_POINTS;
+
+	decode_xv11lidar_reading(reading, &points, 0);
+
+	if(reading->speed64)
+		s->ray_us = CC_XV11LIDAR_RPM_TO_RAY_US * 64.0 / reading->speed64;
+
+	//timestamp is taken after the last ray of reading was measured
+	for(int i=0;i<CC_XV11LIDAR_READING_POINTS;++i)
+	{
+		const int ray=quad * CC_XV11LIDAR_READING_POINTS + i;
+
+		scan->mcu_time_us[ray] = reading->mcu_time_us - (uint64_t)llround((CC_XV11LIDAR_READING_POINTS - 1 - i) * s->ray_us);
+		scan->missing[ray] = 0;
+	}
+
+	if(reading->speed64)
+	{
+		s->speed64_sum += reading->speed64;
+		++s->speed64_count;
+	}
+
+	scan->end_mcu_time_us=reading->mcu_time_us;
+	scan->end_host_time_us=reading->host_time_us;
+}
+
+static void xv11lidar_scan_begin(struct cc_xv11lidar_scanner *s, const struct cc_xv11lidar_data *reading)
+{
+	struct cc_xv11lidar_scan *scan=&s->scans[s->back];
+
+	scan->number=s->number++;
+	scan->start_mcu_time_us=scan->end_mcu_time_us=reading->mcu_time_us;
+	scan->start_host_time_us=scan->end_host_time_us=reading->host_time_us;
+
+	memset(scan->range_m, 0, sizeof(scan->range_m));
+	memset(scan->valid, 0, sizeof(scan->valid));
+	memset(scan->error_code, 0, sizeof(scan->error_code));
+	memset(scan->missing, 1, sizeof(scan->missing));
+
+	s->speed64_sum=0;
+	s->speed64_count=0;
+	s->started=1;
+}
+
+// fills in summary and times of missing rays, then exchanges back buffer
+static void xv11lidar_scan_publish(struct cc_xv11lidar_scanner *s)
+{
+	struct cc_xv11lidar_scan *scan=&s->scans[s->back];
+	int previous=-1, first=-1;
+
+	scan->rpm = s->speed64_count ? s->speed64_sum / 64.0f / s->speed64_count : 0.0f;
+	scan->missing_quads=0;
+
+	for(int quad=0;quad<CC_XV11LIDAR_SCAN_RAYS / CC_XV11LIDAR_READING_POINTS;++quad)
+		scan->missing_quads += scan->missing[quad * CC_XV11LIDAR_READING_POINTS];
+
+	//missing rays are timed from the nearest preceding (or the first) received ray
+	for(int ray=0;ray<CC_XV11LIDAR_SCAN_RAYS;++ray)
+	{
+		if(!scan->missing[ray])
+		{
+			if(first == -1)
+				first=ray;
+			previous=ray;
+			continue;
+		}
+
+		if(previous != -1)
+			scan->mcu_time_us[ray] = scan->mcu_time_us[previous] + (uint64_t)llround((ray - previous) * s->ray_us);
+	}
+
+	for(int ray=0;ray<first;++ray)
+		scan->mcu_time_us[ray] = scan->mcu_time_us[first] - (uint64_t)llround((first - ray) * s->ray_us);
+
+	s->back = atomic_exchange_explicit(&s->middle, s->back | CC_SCAN_NEW, memory_order_acq_rel) & ~CC_SCAN_NEW;
+	s->started=0;
+}
+
+/* Odometry history */
+
+int cc_odometry_history_enable(struct cc *c, const struct cc_odometry_history_config *config)
+{
+	struct cc_odometry_history *h;
+	uint32_t capacity=CC_ODOMETRY_HISTORY_DEFAULT_CAPACITY;
+
+	if(c->odometry_history)
+		return CC_OK;
+
+	if(config->capacity < 0 || !(config->meters_per_count > 0))
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	if(config->capacity)
+		for(capacity=1;capacity < (uint32_t)config->capacity;capacity <<= 1)
+			;
+
+	if( (h = (struct cc_odometry_history*)calloc(1, sizeof(struct cc_odometry_history))) == NULL )
+		return CC_ERROR;
+
+	if( (h->samples = (struct cc_pose*)malloc(capacity * sizeof(struct cc_pose))) == NULL )
+	{
+		free(h);
+		return CC_ERROR;
+	}
+
+	h->capacity=capacity;
+	h->meters_per_count=config->meters_per_count;
+	atomic_init(&h->head, 0);
+	atomic_init(&h->first, 0);
+
+	c->odometry_history=h;
+
+	return CC_OK;
+}
+
+// Samples are overwritten only when head advances capacity past them.
+// Reader validates after the search that none of the samples it read
+// (the oldest touched) was overwritten meanwhile and that history was not
+// reset, retries otherwise (seqlock-like).
+int cc_pose_at(struct cc *c, uint64_t mcu_time_us, struct cc_pose *pose)
+{
+	struct cc_odometry_history *h=c->odometry_history;
+	const uint32_t mask = h ? h->capacity - 1 : 0;
+
+	if(h == NULL)
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	for(int attempt=0;attempt<CC_ODOMETRY_HISTORY_RETRIES;++attempt)
+	{
+		const uint64_t head=atomic_load_explicit(&h->head, memory_order_acquire);
+		const uint64_t first=atomic_load_explicit(&h->first, memory_order_acquire);
+		//slot of head - capacity is the next to be overwritten
+		const uint64_t oldest = head - first >= h->capacity ? head - h->capacity + 1 : first;
+		uint64_t lo=oldest, hi=head, touched=head;
+		struct cc_pose before, after;
+
+		if(lo == hi)
+		{
+			errno=ERANGE;
+			return CC_ERROR;
+		}
+
+		//the first sample with time >= mcu_time_us in [lo, hi)
+		while(lo < hi)
+		{
+			const uint64_t mid = lo + (hi - lo) / 2;
+
+			if(mid < touched)
+				touched = mid;
+
+			if(h->samples[mid & mask].mcu_time_us < mcu_time_us)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if(lo == head)
+		{
+			errno=ERANGE;
+			return CC_ERROR;
+		}
+
+		after=h->samples[lo & mask];
+		before = lo > oldest ? h->samples[(lo-1) & mask] : after;
+
+		if(lo - (lo > oldest) < touched)
+			touched = lo - (lo > oldest);
+
+		atomic_thread_fence(memory_order_acquire);
+
+		//writer may be overwriting sample head - capacity right now, comparisons above may have used torn samples
+		if(touched + h->capacity <= atomic_load_explicit(&h->head, memory_order_relaxed) ||
+			first != atomic_load_explicit(&h->first, memory_order_relaxed))
+			continue;
+
+		if(after.mcu_time_us == mcu_time_us)
+		{
+			*pose=after;
+			return CC_OK;
+		}
+
+		//older than history
+		if(lo == oldest || before.mcu_time_us > mcu_time_us)
+		{
+			errno=ERANGE;
+			return CC_ERROR;
+		}
+
+		pose_interpolate(&before, &after, mcu_time_us, pose);
+		return CC_OK;
+	}
+
+	//history overwritten faster than we could read it
+	errno=EAGAIN;
+	return CC_ERROR;
+}
+
+// reading not decoded for user
+static void odometry_history_message(struct cc *c, const uint8_t *msg, const struct cc_time *time)
+{
+	struct cc_odometry_data odometry;
+
+	decode_message_odometry(msg, time, &odometry);
+	odometry_history_feed(c->odometry_history, &odometry);
+}
+
+// Distance travelled is the mean of wheel distances, applied along body
+// forward (x) axis averaged between previous and current orientation.
+static void odometry_history_feed(struct cc_odometry_history *h, const struct cc_odometry_data *odometry)
+{
+	const uint64_t head=atomic_load_explicit(&h->head, memory_order_relaxed);
+	struct cc_pose *p=&h->pose;
+
+	//MCU time went back (e.g. clock reset), start over
+	if(h->previous_ready && odometry->mcu_time_us < p->mcu_time_us)
+	{
+		h->previous_ready=0;
+		atomic_store_explicit(&h->first, head, memory_order_release);
+	}
+
+	if(h->previous_ready)
+	{	//encoder counters may wrap around
+		const int32_t left = (int32_t)((uint32_t)odometry->left_encoder_counts - (uint32_t)h->previous_left);
+		const int32_t right = (int32_t)((uint32_t)odometry->right_encoder_counts - (uint32_t)h->previous_right);
+		const double distance = 0.5 * ((double)left + right) * h->meters_per_count;
+		float previous_forward[3], forward[3];
+
+		quaternion_forward(p->qw, p->qx, p->qy, p->qz, previous_forward);
+		quaternion_forward(odometry->qw, odometry->qx, odometry->qy, odometry->qz, forward);
+
+		p->x += distance * 0.5 * (previous_forward[0] + forward[0]);
+		p->y += distance * 0.5 * (previous_forward[1] + forward[1]);
+		p->z += distance * 0.5 * (previous_forward[2] + forward[2]);
+	}
+	else
+		p->x = p->y = p->z = 0.0;
+
+	p->mcu_time_us=odometry->mcu_time_us;
+	p->qw=odometry->qw;
+	p->qx=odometry->qx;
+	p->qy=odometry->qy;
+	p->qz=odometry->qz;
+	p->yaw_rad=quaternion_yaw(p->qw, p->qx, p->qy, p->qz);
+
+	h->previous_left=odometry->left_encoder_counts;
+	h->previous_right=odometry->right_encoder_counts;
+	h->previous_ready=1;
+
+	h->samples[head & (h->capacity - 1)] = *p;
+	atomic_store_explicit(&h->head, head + 1, memory_order_release);
+}
+
+// linear position, spherical orientation
+static void pose_interpolate(const struct cc_pose *a, const struct cc_pose *b, uint64_t mcu_time_us, struct cc_pose *pose)
+{
+	const double t = (double)(mcu_time_us - a->mcu_time_us) / (b->mcu_time_us - a->mcu_time_us);
+	float cos_theta = a->qw*b->qw + a->qx*b->qx + a->qy*b->qy + a->qz*b->qz;
+	float sign=1.0f, wa=1.0f - (float)t, wb=(float)t;
+
+	pose->mcu_time_us = mcu_time_us;
+	pose->x = a->x + (b->x - a->x) * t;
+	pose->y = a->y + (b->y - a->y) * t;
+	pose->z = a->z + (b->z - a->z) * t;
+
+	//q and -q are the same rotation, take shorter path
+	if(cos_theta < 0.0f)
+	{
+		cos_theta = -cos_theta;
+		sign = -1.0f;
+	}
+
+	//for close orientations slerp degenerates to linear interpolation
+	if(cos_theta < CC_SLERP_LINEAR_THRESHOLD)
+	{
+		const float theta=acosf(cos_theta), sin_theta=sinf(theta);
+
+		wa = sinf((1.0f - (float)t) * theta) / sin_theta;
+		wb = sinf((float)t * theta) / sin_theta;
+	}
+
+	wb *= sign;
+
+	pose->qw = wa * a->qw + wb * b->qw;
+	pose->qx = wa * a->qx + wb * b->qx;
+	pose->qy = wa * a->qy + wb * b->qy;
+	pose->qz = wa * a->qz + wb * b->qz;
+
+	quaternion_normalize(&pose->qw, &pose->qx, &pose->qy, &pose->qz);
+
+	pose->yaw_rad=quaternion_yaw(pose->qw, pose->qx, pose->qy, pose->qz);
+}
+
+// rotated x axis
+static void quaternion_forward(float qw, float qx, float qy, float qz, float forward[3])
+{
+	forward[0] = 1.0f - 2.0f * (qy*qy + qz*qz);
+	forward[1] = 2.0f * (qx*qy + qw*qz);
+	forward[2] = 2.0f * (qx*qz - qw*qy);
+}
+
+static float quaternion_yaw(float qw, float qx, float qy, float qz)
+{
+	return atan2f(2.0f * (qw*qz + qx*qy), 1.0f - 2.0f * (qy*qy + qz*qz));
+}
+
+static void quaternion_normalize(float *qw, float *qx, float *qy, float *qz)
+{
+	const float norm=sqrtf(*qw * *qw + *qx * *qx + *qy * *qy + *qz * *qz);
+
+	if(norm <= 0.0f)
+		return;
+
+	*qw /= norm;
+	*qx /= norm;
+	*qy /= norm;
+	*qz /= norm;
+}
+
+static void odometry_history_free(struct cc *c)
+{
+	if(c->odometry_history == NULL)
+		return;
+
+	free(c->odometry_history->samples);
+	free(c->odometry_history);
+	c->odometry_history=NULL;
+}
+
+/* Motion compensation */
+
+int cc_rplidar_cloud(struct cc *c, const struct cc_rplidar_scan *scan, const struct cc_cloud_config *config, struct cc_cloud *cloud)
+{
+	struct cc_transform knots[CC_CLOUD_MAX_KNOTS];
+	uint64_t knot_times[CC_CLOUD_MAX_KNOTS], times[CC_CLOUD_CHUNK];
+	const double duration_us = (double)(scan->end_mcu_time_us - scan->start_mcu_time_us);
+	int knot_count, size=0, chunk=0;
+
+	if(cloud->size < scan->size)
+	{
+		cloud->size=0;
+		errno=ENOBUFS;
+		return CC_ERROR;
+	}
+
+	if( (knot_count = cloud_knots(c, scan->start_mcu_time_us, scan->end_mcu_time_us, config, knots, knot_times)) == CC_ERROR )
+	{
+		cloud->size=0;
+		return CC_ERROR;
+	}
+
+	pthread_once(&trigonometry_once, trigonometry_init);
+
+	//measurements are evenly spread in time between the first and the last capsule
+	for(int i=0;i<scan->size;++i)
+	{
+		const float range_m = scan->dist_mm_q2[i] * 0.00025f;
+		const int index = scan->angle_q14[i] >> CC_TRIGONOMETRY_SHIFT;
+
+		if(scan->dist_mm_q2[i] == 0)
+			continue;
+
+		//clockwise angles
+		cloud->x[size + chunk] = range_m * trigonometry_cos[index];
+		cloud->y[size + chunk] = -range_m * trigonometry_sin[index];
+		times[chunk] = scan->start_mcu_time_us + (uint64_t)(duration_us * i / (scan->size > 1 ? scan->size - 1 : 1));
+
+		if(++chunk == CC_CLOUD_CHUNK)
+		{
+			cloud_deskew(knots, knot_times, knot_count, times, cloud, size, chunk);
+			size += chunk;
+			chunk = 0;
+		}
+	}
+
+	cloud_deskew(knots, knot_times, knot_count, times, cloud, size, chunk);
+	cloud->size = size + chunk;
+
+	return CC_OK;
+}
+
+int cc_xv11lidar_cloud(struct cc *c, const struct cc_xv11lidar_scan *scan, const struct cc_cloud_config *config, struct cc_cloud *cloud)
+{
+	struct cc_transform knots[CC_CLOUD_MAX_KNOTS];
+	uint64_t knot_times[CC_CLOUD_MAX_KNOTS], times[CC_CLOUD_CHUNK];
+	int knot_count, size=0, chunk=0;
+
+	if(cloud->size < CC_XV11LIDAR_SCAN_RAYS)
+	{
+		cloud->size=0;
+		errno=ENOBUFS;
+		return CC_ERROR;
+	}
+
+	//ray times span more than readings (the first reading ends at ray 3)
+	if( (knot_count = cloud_knots(c, scan->mcu_time_us[0], scan->mcu_time_us[CC_XV11LIDAR_SCAN_RAYS-1], config, knots, knot_times)) == CC_ERROR )
+	{
+		cloud->size=0;
+		return CC_ERROR;
+	}
+
+	pthread_once(&trigonometry_once, trigonometry_init);
+
+	for(int ray=0;ray<CC_XV11LIDAR_SCAN_RAYS;++ray)
+	{
+		const int index = (ray * CC_TRIGONOMETRY_TABLE + CC_XV11LIDAR_SCAN_RAYS / 2) / CC_XV11LIDAR_SCAN_RAYS % CC_TRIGONOMETRY_TABLE;
+
+		if(!scan->valid[ray] || scan->missing[ray] || scan->range_m[ray] <= 0.0f)
+			continue;
+
+		//clockwise angles
+		cloud->x[size + chunk] = scan->range_m[ray] * trigonometry_cos[index];
+		cloud->y[size + chunk] = -scan->range_m[ray] * trigonometry_sin[index];
+		times[chunk] = scan->mcu_time_us[ray];
+
+		if(++chunk == CC_CLOUD_CHUNK)
+		{
+			cloud_deskew(knots, knot_times, knot_count, times, cloud, size, chunk);
+			size += chunk;
+			chunk = 0;
+		}
+	}
+
+	cloud_deskew(knots, knot_times, knot_count, times, cloud, size, chunk);
+	cloud->size = size + chunk;
+
+	return CC_OK;
+}
+
+// Sensor to output frame transforms at evenly spaced knot times,
+// K = F * P(t) * mount, where P(t) is odometry pose and F output frame inverse.
+// Returns number of knots or CC_ERROR.
+static int cloud_knots(struct cc *c, uint64_t start_us, uint64_t end_us, const struct cc_cloud_config *config,
+	struct cc_transform *knots, uint64_t *knot_times)
+{
+	const struct cc_cloud_config defaults={CC_CLOUD_FRAME_SCAN_END, CC_CLOUD_DEFAULT_KNOTS, 0.0f, 0.0f, 0.0f, 0.0f};
+	struct cc_transform mount, frame, body;
+	int count;
+
+	if(config == NULL)
+		config=&defaults;
+
+	count = config->knots ? config->knots : CC_CLOUD_DEFAULT_KNOTS;
+
+	if(count < 2 || count > CC_CLOUD_MAX_KNOTS || end_us < start_us ||
+		config->frame < CC_CLOUD_FRAME_SCAN_END || config->frame > CC_CLOUD_FRAME_ODOMETRY)
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	for(int k=0;k<count;++k)
+	{
+		struct cc_pose pose;
+
+		knot_times[k] = start_us + (end_us - start_us) * k / (count - 1);
+
+		if(cc_pose_at(c, knot_times[k], &pose) != CC_OK)
+			return CC_ERROR;
+
+		transform_from_pose(&pose, &knots[k]);
+	}
+
+	if(config->frame == CC_CLOUD_FRAME_SCAN_END)
+		transform_inverse(&knots[count-1], &frame);
+	else if(config->frame == CC_CLOUD_FRAME_SCAN_START)
+		transform_inverse(&knots[0], &frame);
+
+	transform_from_yaw(config->mount_yaw_rad, config->mount_x, config->mount_y, config->mount_z, &mount);
+
+	for(int k=0;k<count;++k)
+	{
+		transform_multiply(&knots[k], &mount, &body);
+
+		if(config->frame == CC_CLOUD_FRAME_ODOMETRY)
+			knots[k]=body;
+		else
+			transform_multiply(&frame, &body, &knots[k]);
+	}
+
+	return count;
+}
+
+// transforms chunk of points from sensor to output frame in place,
+// consecutive points with the same knot segment are transformed together
+static void cloud_deskew(const struct cc_transform *knots, const uint64_t *knot_times, int knot_count,
+	const uint64_t *times, struct cc_cloud *cloud, int from, int size)
+{
+	float weights[CC_CLOUD_CHUNK];
+	int segment=0;
+
+	for(int i=0;i<size;)
+	{
+		int j=i;
+		double span;
+
+		while(segment < knot_count - 2 && times[i] > knot_times[segment+1])
+			++segment;
+
+		span = (double)(knot_times[segment+1] - knot_times[segment]);
+
+		for(;j<size && (segment == knot_count - 2 || times[j] <= knot_times[segment+1]);++j)
+		{
+			const double w = span > 0 ? ((double)times[j] - (double)knot_times[segment]) / span : 0.0;
+			weights[j] = w < 0.0 ? 0.0f : (w > 1.0 ? 1.0f : (float)w);
+		}
+
+		cloud_transform(&knots[segment], &knots[segment+1], weights + i,
+			cloud->x + from + i, cloud->y + from + i, cloud->z ? cloud->z + from + i : NULL, j - i);
+
+		i=j;
+	}
+}
+
+#if defined(__SSE2__)
+
+// vectorized, 4 points at once, transform linearly interpolated between knots a and b
+static void cloud_transform(const struct cc_transform *a, const struct cc_transform *b, const float *weights,
+	float *x, float *y, float *z, int size)
+{
+	int i=0;
+
+	for(;i+4<=size;i+=4)
+	{
+		const __m128 w=_mm_loadu_ps(weights+i);
+		const __m128 xs=_mm_loadu_ps(x+i);
+		const __m128 ys=_mm_loadu_ps(y+i);
+		__m128 out[3];
+
+		//sensor points are planar, third rotation column is not needed
+		for(int r=0;r<3;++r)
+		{
+			const __m128 r0=_mm_add_ps(_mm_set1_ps(a->r[r][0]), _mm_mul_ps(w, _mm_set1_ps(b->r[r][0] - a->r[r][0])));
+			const __m128 r1=_mm_add_ps(_mm_set1_ps(a->r[r][1]), _mm_mul_ps(w, _mm_set1_ps(b->r[r][1] - a->r[r][1])));
+			const __m128 t=_mm_add_ps(_mm_set1_ps(a->t[r]), _mm_mul_ps(w, _mm_set1_ps(b->t[r] - a->t[r])));
+
+			out[r]=_mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, xs), _mm_mul_ps(r1, ys)), t);
+		}
+
+		_mm_storeu_ps(x+i, out[0]);
+		_mm_storeu_ps(y+i, out[1]);
+
+		if(z)
+			_mm_storeu_ps(z+i, out[2]);
+	}
+
+	for(;i<size;++i)
+	{
+		const float w=weights[i], xs=x[i], ys=y[i];
+		float out[3];
+
+		for(int r=0;r<3;++r)
+			out[r] = (a->r[r][0] + w * (b->r[r][0] - a->r[r][0])) * xs +
+				(a->r[r][1] + w * (b->r[r][1] - a->r[r][1])) * ys +
+				a->t[r] + w * (b->t[r] - a->t[r]);
+
+		x[i]=out[0];
+		y[i]=out[1];
+
+		if(z)
+			z[i]=out[2];
+	}
+}
+
+#else
+
+static void cloud_transform(const struct cc_transform *a, const struct cc_transform *b, const float *weights,
+	float *x, float *y, float *z, int size)
+{
+	for(int i=0;i<size;++i)
+	{
+		const float w=weights[i], xs=x[i], ys=y[i];
+		float out[3];
+
+		//sensor points are planar, third rotation column is not needed
+		for(int r=0;r<3;++r)
+			out[r] = (a->r[r][0] + w * (b->r[r][0] - a->r[r][0])) * xs +
+				(a->r[r][1] + w * (b->r[r][1] - a->r[r][1])) * ys +
+				a->t[r] + w * (b->t[r] - a->t[r]);
+
+		x[i]=out[0];
+		y[i]=out[1];
+
+		if(z)
+			z[i]=out[2];
+	}
+}
+
+#endif
+
+static void transform_from_pose(const struct cc_pose *p, struct cc_transform *m)
+{
+	const float w=p->qw, x=p->qx, y=p->qy, z=p->qz;
+
+	m->r[0][0] = 1 - 2*(y*y + z*z); m->r[0][1] = 2*(x*y - w*z);     m->r[0][2] = 2*(x*z + w*y);
+	m->r[1][0] = 2*(x*y + w*z);     m->r[1][1] = 1 - 2*(x*x + z*z); m->r[1][2] = 2*(y*z - w*x);
+	m->r[2][0] = 2*(x*z - w*y);     m->r[2][1] = 2*(y*z + w*x);     m->r[2][2] = 1 - 2*(x*x + y*y);
+
+	m->t[0]=(float)p->x;
+	m->t[1]=(float)p->y;
+	m->t[2]=(float)p->z;
+}
+
+static void transform_from_yaw(float yaw_rad, float x, float y, float z, struct cc_transform *m)
+{
+	const float c=cosf(yaw_rad), s=sinf(yaw_rad);
+
+	m->r[0][0]=c; m->r[0][1]=-s; m->r[0][2]=0;
+	m->r[1][0]=s; m->r[1][1]=c;  m->r[1][2]=0;
+	m->r[2][0]=0; m->r[2][1]=0;  m->r[2][2]=1;
+
+	m->t[0]=x;
+	m->t[1]=y;
+	m->t[2]=z;
+}
+
+// rigid transform inverse, R^T and -R^T t
+static void transform_inverse(const struct cc_transform *m, struct cc_transform *inverse)
+{
+	for(int r=0;r<3;++r)
+		for(int k=0;k<3;++k)
+			inverse->r[r][k]=m->r[k][r];
+
+	for(int r=0;r<3;++r)
+		inverse->t[r] = -(inverse->r[r][0]*m->t[0] + inverse->r[r][1]*m->t[1] + inverse->r[r][2]*m->t[2]);
+}
+
+// out = a * b
+static void transform_multiply(const struct cc_transform *a, const struct cc_transform *b, struct cc_transform *out)
+{
+	for(int r=0;r<3;++r)
+	{
+		for(int k=0;k<3;++k)
+			out->r[r][k] = a->r[r][0]*b->r[0][k] + a->r[r][1]*b->r[1][k] + a->r[r][2]*b->r[2][k];
+
+		out->t[r] = a->r[r][0]*b->t[0] + a->r[r][1]*b->t[1] + a->r[r][2]*b->t[2] + a->t[r];
+	}
+}
+
+static void trigonometry_init(void)
+{
+	for(int i=0;i<CC_TRIGONOMETRY_TABLE;++i)
+	{
+		const double angle = 2.0 * M_PI * i / CC_TRIGONOMETRY_TABLE;
+
+		trigonometry_sin[i]=(float)sin(angle);
+		trigonometry_cos[i]=(float)cos(angle);
+	}
+}
+
+/* Asynchronous reading */
+
+int cc_start_async(struct cc *c, const struct cc_async_config *config)
+{
+	const struct cc_async_config defaults={ {CC_ASYNC_DEFAULT_CAPACITY, CC_ASYNC_DEFAULT_CAPACITY, CC_ASYNC_DEFAULT_CAPACITY}, CC_DROP_NEWEST, -1, 0 };
+	pthread_attr_t attr;
+	int ret;
+
+	if(c->async_running)
+	{
+		errno=EBUSY;
+		return CC_ERROR;
+	}
+
+	if(config == NULL)
+		config=&defaults;
+
+	memset(c->queues, 0, sizeof(c->queues));
+
+	#define CC_ASYNC_QUEUE_INIT(NAME, name, type, bytes) \
+		queue_init(&c->queues[CC_##NAME##_QUEUE], sizeof(struct cc_##name##_data), config->capacity.name, config->policy) != CC_OK ||
+	if(CC_PROTOCOL_MESSAGES(CC_ASYNC_QUEUE_INIT) 0)
+	#undef CC_ASYNC_QUEUE_INIT
+	{
+		async_free_queues(c);
+		return CC_ERROR;
+	}
+
+	if( (ret=pthread_attr_init(&attr)) != 0 )
+	{
+		async_free_queues(c);
+		errno=ret;
+		return CC_ERROR;
+	}
+
+	atomic_store(&c->async_stop, 0);
+	atomic_store(&c->async_errno, 0);
+
+	if( (ret=async_thread_attributes(&attr, config)) != 0 ||
+		(ret=pthread_create(&c->async_thread, &attr, async_reader, c)) != 0 )
+	{
+		pthread_attr_destroy(&attr);
+		async_free_queues(c);
+		errno=ret;
+		return CC_ERROR;
+	}
+
+	pthread_attr_destroy(&attr);
+	c->async_running=1;
+
+	return CC_OK;
+}
+
+// returns 0 or error number
+static int async_thread_attributes(pthread_attr_t *attr, const struct cc_async_config *config)
+{
+	int ret;
+
+	if(config->cpu >= 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(config->cpu, &cpus);
+
+		if( (ret=pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus)) != 0 )
+			return ret;
+	}
+
+	if(config->priority > 0)
+	{
+		struct sched_param param={0};
+		param.sched_priority=config->priority;
+
+		if( (ret=pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED)) != 0 ||
+			(ret=pthread_attr_setschedpolicy(attr, SCHED_FIFO)) != 0 ||
+			(ret=pthread_attr_setschedparam(attr, &param)) != 0 )
+			return ret;
+	}
+
+	return 0;
+}
+
+static void *async_reader(void *arg)
+{
+	struct cc *c=(struct cc*)arg;
+	struct cc_data data;
+	struct cc_size size;
+
+	//batch per type, e.g. struct cc_odometry_data odometry[CC_ASYNC_BATCH]
+	#define CC_ASYNC_BATCH_ARRAY(NAME, name, type, bytes) struct cc_##name##_data name[CC_ASYNC_BATCH];
+	CC_PROTOCOL_MESSAGES(CC_ASYNC_BATCH_ARRAY)
+	#undef CC_ASYNC_BATCH_ARRAY
+
+	//types without queue are discarded without parsing
+	#define CC_ASYNC_BATCH_SIZE(NAME, name, type, bytes) \
+		data.name = name; \
+		size.name = c->queues[CC_##NAME##_QUEUE].capacity ? CC_ASYNC_BATCH : 0;
+	CC_PROTOCOL_MESSAGES(CC_ASYNC_BATCH_SIZE)
+	#undef CC_ASYNC_BATCH_SIZE
+
+	while(!atomic_load_explicit(&c->async_stop, memory_order_relaxed))
+	{
+		data.size=size;
+
+		if(cc_read_all(c, &data) == CC_ERROR)
+		{
+			if(errno == EAGAIN) //device not sending data, check stop flag and retry
+				continue;
+
+			atomic_store(&c->async_errno, errno);
+			break;
+		}
+
+		#define CC_ASYNC_QUEUE_PUSH(NAME, name, type, bytes) \
+			queue_push(&c->queues[CC_##NAME##_QUEUE], name, data.size.name);
+		CC_PROTOCOL_MESSAGES(CC_ASYNC_QUEUE_PUSH)
+		#undef CC_ASYNC_QUEUE_PUSH
+	}
+
+	return NULL;
+}
+
+int cc_read_async(struct cc *c, struct cc_data *data)
+{
+	const int error=atomic_load(&c->async_errno);
+	const struct cc_size size=data->size;
+	int pending=0, popped=0;
+
+	//reader thread error is reported only after consumer drained the queues it reads
+	//as in cc_read_all types with 0 size are not read
+	#define CC_ASYNC_QUEUE_POP(NAME, name, type, bytes) \
+		data->size.name = queue_pop(&c->queues[CC_##NAME##_QUEUE], data->name, size.name); \
+		pending |= size.name > 0 && !queue_empty(&c->queues[CC_##NAME##_QUEUE]); \
+		popped |= data->size.name > 0;
+	CC_PROTOCOL_MESSAGES(CC_ASYNC_QUEUE_POP)
+	#undef CC_ASYNC_QUEUE_POP
+
+	if(pending)
+		return CC_DATA_PENDING;
+
+	if(error && !popped)
+	{
+		errno=error;
+		return CC_ERROR;
+	}
+
+	return CC_OK;
+}
+
+int cc_stop_async(struct cc *c)
+{
+	int ret;
+
+	if(!c->async_running)
+		return CC_OK;
+
+	atomic_store(&c->async_stop, 1);
+
+	//reader wakes up at most after read timeout
+	ret=pthread_join(c->async_thread, NULL);
+
+	async_free_queues(c);
+	c->async_running=0;
+
+	if(ret != 0)
+	{
+		errno=ret;
+		return CC_ERROR;
+	}
+
+	return CC_OK;
+}
+
+void cc_get_async_stats(struct cc *c, struct cc_async_stats *stats)
+{
+	#define CC_ASYNC_DROPPED(NAME, name, type, bytes) \
+		stats->dropped_##name=atomic_load(&c->queues[CC_##NAME##_QUEUE].dropped);
+	CC_PROTOCOL_MESSAGES(CC_ASYNC_DROPPED)
+	#undef CC_ASYNC_DROPPED
+}
+
+static void async_free_queues(struct cc *c)
+{
+	for(int i=0;i<CC_QUEUES;++i)
+		queue_close(&c->queues[i]);
+}
+
+/* Lock-free queues */
+
+static int queue_init(struct cc_queue *q, uint32_t element_size, int capacity, int policy)
+{
+	uint32_t size=1;
+
+	if(capacity < 0 || capacity > (1 << 30) || (policy != CC_DROP_NEWEST && policy != CC_DROP_OLDEST))
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	q->elements=NULL;
+	q->element_size=element_size;
+	q->capacity=0;
+	q->policy=policy;
+	atomic_init(&q->dropped, 0);
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+
+	if(capacity == 0) //data type not queued
+		return CC_OK;
+
+	while(size < (uint32_t)capacity)
+		size <<= 1;
+
+	if( (q->elements=(uint8_t*)malloc((size_t)size * element_size)) == NULL)
+		return CC_ERROR;
+
+	q->capacity=size;
+
+	return CC_OK;
+}
+
+static void queue_close(struct cc_queue *q)
+{
+	free(q->elements);
+	q->elements=NULL;
+	q->capacity=0;
+}
+
+// producer side
+static void queue_push(struct cc_queue *q, const void *elements, int size)
+{
+	const uint8_t *src=(const uint8_t*)elements;
+	uint32_t head=atomic_load_explicit(&q->head, memory_order_relaxed);
+	int i;
+
+	for(i=0;i<size;++i)
+	{
+		uint32_t tail=atomic_load_explicit(&q->tail, memory_order_acquire);
+
+		if(head - tail == q->capacity)
+		{
+			if(q->policy == CC_DROP_NEWEST)
+				break;
+			//CC_DROP_OLDEST, failure means consumer just made space
+			if(atomic_compare_exchange_strong_explicit(&q->tail, &tail, tail+1, memory_order_acq_rel, memory_order_acquire))
+				atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+		}
+
+		memcpy(q->elements + (size_t)(head & (q->capacity-1)) * q->element_size, src + (size_t)i * q->element_size, q->element_size);
+		++head;
+	}
+
+	if(i < size)
+		atomic_fetch_add_explicit(&q->dropped, size-i, memory_order_relaxed);
+
+	atomic_store_explicit(&q->head, head, memory_order_release);
+}
+
+// consumer side, returns number of popped elements
+static int queue_pop(struct cc_queue *q, void *elements, int size)
+{
+	uint8_t *dst=(uint8_t*)elements;
+	uint32_t head, tail, count, first;
+
+	if(q->capacity == 0 || size <= 0)
+		return 0;
+
+	tail=atomic_load_explicit(&q->tail, memory_order_acquire);
+
+	//with CC_DROP_OLDEST producer may have overwritten the elements during copy
+	//in such case tail was also advanced and CAS fails, copy is retried
+	do
+	{
+		head=atomic_load_explicit(&q->head, memory_order_acquire);
+		count = head - tail < (uint32_t)size ? head - tail : (uint32_t)size;
+		first = q->capacity - (tail & (q->capacity-1));
+		first = first < count ? first : count;
+
+		memcpy(dst, q->elements + (size_t)(tail & (q->capacity-1)) * q->element_size, (size_t)first * q->element_size);
+		memcpy(dst + (size_t)first * q->element_size, q->elements, (size_t)(count-first) * q->element_size);
+	}
+	while(!atomic_compare_exchange_weak_explicit(&q->tail, &tail, tail+count, memory_order_acq_rel, memory_order_acquire));
+
+	return count;
+}
+
+static int queue_empty(struct cc_queue *q)
+{
+	return atomic_load_explicit(&q->head, memory_order_acquire) == atomic_load_explicit(&q->tail, memory_order_acquire);
+}
+
+/* Multiple devices */
+
+// The group doesn't own devices, it only waits for all of them at once
+// with single level-triggered epoll and reads from those which are ready.
+// Source is index of device in the group, stable until cc_group_remove.
+
+struct cc_group *cc_group_init(void)
+{
+	struct cc_group *g;
+
+	if( (g = (struct cc_group*)malloc(sizeof(struct cc_group))) == NULL )
+		return NULL;
+
+	g->capacity=CC_GROUP_INITIAL_CAPACITY;
+	g->live=0;
+
+	if( (g->devices = (struct cc_group_device*)calloc(g->capacity, sizeof(struct cc_group_device))) == NULL )
+	{
+		free(g);
+		return NULL;
+	}
+
+	if( (g->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 )
+	{
+		free(g->devices);
+		free(g);
+		return NULL;
+	}
+
+	return g;
+}
+
+int cc_group_close(struct cc_group *g)
+{
+	int error;
+
+	if(g == NULL)
+		return CC_OK;
+
+	error = close(g->epoll_fd) < 0;
+
+	free(g->devices);
+	free(g);
+
+	return error ? CC_ERROR : CC_OK;
+}
+
+int cc_group_add(struct cc_group *g, struct cc *c)
+{
+	struct epoll_event event={0};
+	int source;
+
+	//replay has no descriptor, async reader already owns the device
+	if(c == NULL || c->fd == -1 || c->async_running)
+	{
+		errno = c && c->async_running ? EBUSY : EINVAL;
+		return CC_ERROR;
+	}
+
+	for(source=0;source<g->capacity && g->devices[source].c;++source)
+		;
+
+	if(source == g->capacity)
+	{
+		struct cc_group_device *devices=(struct cc_group_device*)realloc(g->devices, 2*g->capacity*sizeof(struct cc_group_device));
+
+		if(devices == NULL)
+			return CC_ERROR;
+
+		memset(devices+g->capacity, 0, g->capacity*sizeof(struct cc_group_device));
+		g->devices=devices;
+		g->capacity *= 2;
+	}
+
+	event.events=EPOLLIN;
+	event.data.u32=source;
+
+	if(epoll_ctl(g->epoll_fd, EPOLL_CTL_ADD, c->fd, &event) == -1)
+		return CC_ERROR;
+
+	g->devices[source].c=c;
+	g->devices[source].error=0;
+	++g->live;
+
+	return source;
+}
+
+int cc_group_remove(struct cc_group *g, int source)
+{
+	struct cc_group_device *d;
+
+	if(source < 0 || source >= g->capacity || g->devices[source].c == NULL)
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	d=&g->devices[source];
+
+	if(d->error == 0)
+	{
+		--g->live;
+		if(epoll_ctl(g->epoll_fd, EPOLL_CTL_DEL, d->c->fd, NULL) == -1)
+			return CC_ERROR;
+	}
+
+	d->c->input_ready=0;
+	d->c=NULL;
+	d->error=0;
+
+	return CC_OK;
+}
+
+int cc_group_read_all(struct cc_group *g, struct cc_data *data, int timeout_ms)
+{
+	struct epoll_event events[CC_GROUP_MAX_EVENTS];
+	int processed=0, ready;
+
+	//first data left from previous call, each device is read at most once per call
+	for(int source=0;source<g->capacity;++source)
+	{
+		struct cc_group_device *d=&g->devices[source];
+
+		if( (d->read = d->c && d->c->data_pending) )
+		{
+			if(cc_read_all(d->c, &data[source]) == CC_ERROR)
+				group_fail(g, source);
+			processed=1;
+		}
+	}
+
+	if( (ready = group_wait(g, events, processed ? 0 : timeout_ms)) == CC_ERROR && !processed )
+		return CC_ERROR;
+
+	for(int i=0;i<ready;++i)
+	{
+		const int source=events[i].data.u32;
+		struct cc_group_device *d=&g->devices[source];
+
+		//processed pending data above, epoll is level-triggered so we get it next time
+		if(d->read)
+			continue;
+
+		d->c->input_ready=1;
+		d->read=1;
+
+		if(cc_read_all(d->c, &data[source]) == CC_ERROR)
+			group_fail(g, source);
+	}
+
+	//no data from devices which were not ready
+	for(int source=0;source<g->capacity;++source)
+		if(g->devices[source].c && !g->devices[source].read)
+			data[source].size=(struct cc_size){0};
+
+	return group_pending(g);
+}
+
+int cc_group_read_each(struct cc_group *g, cc_group_handler handler, void *userdata, int timeout_ms)
+{
+	struct epoll_event events[CC_GROUP_MAX_EVENTS];
+	struct cc_group_each each={handler, userdata, 0};
+	int processed=0, ready;
+
+	for(int source=0;source<g->capacity;++source)
+	{
+		struct cc *c=g->devices[source].c;
+		int ret;
+
+		if(c == NULL || !c->data_pending || g->devices[source].error)
+			continue;
+
+		each.source=source;
+		processed=1;
+
+		if( (ret=cc_read_each(c, group_each_handler, &each)) == CC_ERROR )
+			group_fail(g, source);
+		else if(ret == CC_DATA_PENDING) //handler requested stop
+			return CC_DATA_PENDING;
+	}
+
+	if( (ready = group_wait(g, events, processed ? 0 : timeout_ms)) == CC_ERROR )
+		return processed ? CC_OK : CC_ERROR;
+
+	for(int i=0;i<ready;++i)
+	{
+		const int source=events[i].data.u32;
+		struct cc *c=g->devices[source].c;
+		int ret;
+
+		if(c->data_pending)
+			continue;
+
+		c->input_ready=1;
+		each.source=source;
+
+		if( (ret=cc_read_each(c, group_each_handler, &each)) == CC_ERROR )
+			group_fail(g, source);
+		else if(ret == CC_DATA_PENDING)
+			return CC_DATA_PENDING;
+	}
+
+	return CC_OK;
+}
+
+int cc_group_error(struct cc_group *g, int source)
+{
+	if(source < 0 || source >= g->capacity || g->devices[source].c == NULL)
+		return EINVAL;
+
+	return g->devices[source].error;
+}
+
+// returns number of ready devices or CC_ERROR (EAGAIN on timeout, ENODEV if no device left)
+static int group_wait(struct cc_group *g, struct epoll_event *events, int timeout_ms)
+{
+	int ready;
+
+	if(g->live == 0)
+	{
+		errno=ENODEV;
+		return CC_ERROR;
+	}
+
+	if( (ready = epoll_wait(g->epoll_fd, events, CC_GROUP_MAX_EVENTS, timeout_ms)) == -1 )
+		return CC_ERROR;
+
+	if(ready == 0)
+	{
+		errno=EAGAIN;
+		return CC_ERROR;
+	}
+
+	return ready;
+}
+
+// device is kept in the group for cc_group_error until cc_group_remove
+static void group_fail(struct cc_group *g, int source)
+{
+	struct cc_group_device *d=&g->devices[source];
+
+	d->error = errno ? errno : EIO;
+	d->c->input_ready=0;
+	d->c->data_pending=0;
+	--g->live;
+
+	epoll_ctl(g->epoll_fd, EPOLL_CTL_DEL, d->c->fd, NULL);
+}
+
+static int group_pending(const struct cc_group *g)
+{
+	for(int source=0;source<g->capacity;++source)
+		if(g->devices[source].c && g->devices[source].c->data_pending)
+			return CC_DATA_PENDING;
+
+	return CC_OK;
+}
+
+static int group_each_handler(const struct cc_message *msg, void *userdata)
+{
+	struct cc_group_each *each=(struct cc_group_each*)userdata;
+	return each->handler(each->source, msg, each->userdata);
+}
+
+/* Merged event stream */
+
+struct cc_merge *cc_merge_init(const struct cc_merge_config *config)
+{
+	struct cc_merge *m;
+	int sources=1, capacity=CC_MERGE_DEFAULT_CAPACITY;
+	uint32_t window_us=CC_MERGE_DEFAULT_WINDOW_US, size=1;
+
+	if(config && (config->sources < 0 || config->sources > UINT8_MAX+1 || config->capacity < 0 || config->capacity > (1 << 30)))
+	{
+		errno=EINVAL;
+		return NULL;
+	}
+
+	if(config && config->sources)
+		sources=config->sources;
+	if(config && config->capacity)
+		capacity=config->capacity;
+	if(config && config->window_us)
+		window_us=config->window_us;
+
+	//power of 2 so that free running head and tail wrap around consistently
+	while(size < (uint32_t)capacity)
+		size <<= 1;
+
+	capacity=size;
+
+	if( (m = (struct cc_merge*)calloc(1, sizeof(struct cc_merge))) == NULL )
+		return NULL;
+
+	m->sources=sources;
+	m->count=sources * CC_MERGE_TYPES;
+	m->capacity=capacity;
+	m->window_us=window_us;
+
+	m->streams=(struct cc_merge_stream*)calloc(m->count, sizeof(struct cc_merge_stream));
+	m->heap=(int*)malloc(m->count * sizeof(int));
+	m->events=(struct cc_event*)malloc((size_t)m->count * capacity * sizeof(struct cc_event));
+
+	if(m->streams == NULL || m->heap == NULL || m->events == NULL)
+	{
+		cc_merge_close(m);
+		errno=ENOMEM;
+		return NULL;
+	}
+
+	for(int i=0;i<m->count;++i)
+		m->streams[i].ring=m->events + (size_t)i * capacity;
+
+	return m;
+}
+
+void cc_merge_close(struct cc_merge *m)
+{
+	if(m == NULL)
+		return;
+
+	free(m->streams);
+	free(m->heap);
+	free(m->events);
+	free(m);
+}
+
+int cc_merge_push(struct cc_merge *m, int source, const struct cc_data *data)
+{
+	struct cc_event *event;
+
+	if(source < 0 || source >= m->sources)
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	#define CC_MERGE_PUSH(NAME, name, type, bytes) \
+		for(int i=0;i<data->size.name;++i) \
+			if( (event=merge_insert(m, source, CC_##NAME##_TYPE, data->name[i].host_time_us)) ) \
+				event->data.name=data->name[i];
+	CC_PROTOCOL_MESSAGES(CC_MERGE_PUSH)
+	#undef CC_MERGE_PUSH
+
+	return CC_OK;
+}
+
+int cc_group_read_merged(struct cc_group *g, struct cc_merge *m, struct cc_events *events, int timeout_ms)
+{
+	if(cc_group_read_each(g, merge_group_handler, m, timeout_ms) == CC_ERROR)
+	{
+		events->size=0;
+		return CC_ERROR;
+	}
+
+	return cc_merge_read(m, events);
+}
+
+int cc_merge_read(struct cc_merge *m, struct cc_events *events)
+{
+	const uint64_t window_us = m->newest_us > m->window_us ? m->newest_us - m->window_us : 0;
+	const uint64_t watermark_us = window_us > m->flush_us ? window_us : m->flush_us;
+	int size=0, count=0;
+
+	//heap of non-empty streams by head time
+	for(int i=0;i<m->count;++i)
+		if(m->streams[i].head != m->streams[i].tail)
+			m->heap[size++]=i;
+
+	for(int i=size/2-1;i>=0;--i)
+		merge_sift_down(m, size, i);
+
+	while(size > 0 && merge_head_time(m, m->heap[0]) <= watermark_us)
+	{
+		struct cc_merge_stream *stream=m->streams + m->heap[0];
+
+		if(count == events->size)
+		{
+			events->size=count;
+			return CC_DATA_PENDING;
+		}
+
+		events->events[count++]=stream->ring[stream->tail++ & (m->capacity - 1)];
+		m->returned_us=events->events[count-1].time_us;
+		++m->stats.events;
+
+		//replace exhausted stream with the last one
+		if(stream->head == stream->tail)
+			m->heap[0]=m->heap[--size];
+
+		merge_sift_down(m, size, 0);
+	}
+
+	events->size=count;
+	return CC_OK;
+}
+
+void cc_merge_flush(struct cc_merge *m)
+{
+	m->flush_us=m->newest_us;
+}
+
+void cc_merge_get_stats(struct cc_merge *m, struct cc_merge_stats *stats)
+{
+	*stats=m->stats;
+}
+
+// returns slot for the message in time order or NULL if message is dropped
+static struct cc_event *merge_insert(struct cc_merge *m, int source, int type, uint64_t time_us)
+{
+	struct cc_merge_stream *stream;
+	struct cc_event *event;
+	uint32_t position;
+	int index;
+
+	switch(type)
+	{
+		#define CC_MERGE_STREAM_INDEX(NAME, name, type, bytes) \
+		case CC_##NAME##_TYPE: index=CC_##NAME##_QUEUE; break;
+		CC_PROTOCOL_MESSAGES(CC_MERGE_STREAM_INDEX)
+		#undef CC_MERGE_STREAM_INDEX
+		default: return NULL;
+	}
+
+	//order of returned events is never broken
+	if(time_us < m->returned_us && m->stats.events)
+	{
+		++m->stats.late;
+		return NULL;
+	}
+
+	stream=m->streams + source * CC_MERGE_TYPES + index;
+
+	if(stream->head - stream->tail == m->capacity)
+	{
+		++stream->tail;
+		++m->stats.dropped;
+	}
+
+	//insertion from the newest end, usually no moves
+	for(position=stream->head; position != stream->tail && stream->ring[(position-1) & (m->capacity - 1)].time_us > time_us; --position)
+		stream->ring[position & (m->capacity - 1)]=stream->ring[(position-1) & (m->capacity - 1)];
+
+	++stream->head;
+
+	if(time_us > m->newest_us)
+		m->newest_us=time_us;
+
+	event=stream->ring + (position & (m->capacity - 1));
+	event->time_us=time_us;
+	event->type=type;
+	event->source=source;
+
+	return event;
+}
+
+static int merge_group_handler(int source, const struct cc_message *msg, void *userdata)
+{
+	struct cc_merge *m=(struct cc_merge*)userdata;
+	const uint8_t type=msg->data[CC_MESSAGE_TYPE_OFFSET];
+	struct cc_event *event;
+
+	if(source >= m->sources)
+	{
+		++m->stats.dropped;
+		return 0;
+	}
+
+	if( (event=merge_insert(m, source, type, msg->time.host_us)) == NULL )
+		return 0;
+
+	switch(type)
+	{
+		#define CC_MERGE_DECODE_MESSAGE(NAME, name, type, bytes) \
+		case CC_##NAME##_TYPE: decode_message_##name(msg->data, &msg->time, &event->data.name); break;
+		CC_PROTOCOL_MESSAGES(CC_MERGE_DECODE_MESSAGE)
+		#undef CC_MERGE_DECODE_MESSAGE
+	}
+
+	return 0;
+}
+
+static uint64_t merge_head_time(const struct cc_merge *m, int stream)
+{
+	const struct cc_merge_stream *s=m->streams + stream;
+	return s->ring[s->tail & (m->capacity - 1)].time_us;
+}
+
+// the earliest head on top, equal times in stream order (source, type)
+static void merge_sift_down(struct cc_merge *m, int size, int i)
+{
+	while(1)
+	{
+		int min=i;
+		const int left=2*i+1, right=2*i+2;
+
+		#define CC_MERGE_LESS(a, b) \
+			(merge_head_time(m, m->heap[a]) < merge_head_time(m, m->heap[b]) || \
+			(merge_head_time(m, m->heap[a]) == merge_head_time(m, m->heap[b]) && m->heap[a] < m->heap[b]))
+
+		if(left < size && CC_MERGE_LESS(left, min))
+			min=left;
+		if(right < size && CC_MERGE_LESS(right, min))
+			min=right;
+
+		#undef CC_MERGE_LESS
+
+		if(min == i)
+			return;
+
+		const int temp=m->heap[i];
+		m->heap[i]=m->heap[min];
+		m->heap[min]=temp;
+		i=min;
+	}
+}
+
+/* Shared memory */
+
+// Publisher never waits for readers and readers never write to rings.
+// Reader positions are process local, so any number of readers may attach.
+
+struct cc_shm *cc_shm_create(const char *name, const struct cc_size *capacity)
+{
+	int capacities[CC_QUEUES];
+	struct cc_shm_ring rings[CC_QUEUES];
+	uint64_t size=sizeof(struct cc_shm_header);
+	struct cc_shm *shm;
+	char *shm_name;
+	int fd, error, i;
+
+	#define CC_SHM_CAPACITY(NAME, name, type, bytes) \
+		capacities[CC_##NAME##_QUEUE] = capacity ? capacity->name : CC_SHM_DEFAULT_CAPACITY;
+	CC_PROTOCOL_MESSAGES(CC_SHM_CAPACITY)
+	#undef CC_SHM_CAPACITY
+
+	for(i=0;i<CC_QUEUES;++i)
+	{
+		uint32_t slots=1;
+
+		if(capacities[i] < 0 || capacities[i] > (1 << 24))
+		{
+			errno=EINVAL;
+			return NULL;
+		}
+
+		while(slots < (uint32_t)capacities[i])
+			slots <<= 1;
+
+		rings[i].element_size=CC_QUEUE_ELEMENT_SIZES[i];
+		rings[i].capacity= capacities[i] ? slots : 0;
+		rings[i].stride=(sizeof(struct cc_shm_slot) + CC_QUEUE_ELEMENT_SIZES[i] + CC_SHM_ALIGNMENT - 1) & ~(uint64_t)(CC_SHM_ALIGNMENT - 1);
+		rings[i].offset=(size + CC_CACHE_LINE - 1) & ~(uint64_t)(CC_CACHE_LINE - 1);
+		size=rings[i].offset + rings[i].capacity * rings[i].stride;
+	}
+
+	if( (shm_name=strdup(name)) == NULL )
+		return NULL;
+
+	//replace stale segment (e.g. after crash), readers of the old one keep their mapping
+	if( (shm_unlink(name) == -1 && errno != ENOENT) ||
+		(fd=shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0666)) == -1 )
+	{
+		free(shm_name);
+		return NULL;
+	}
+
+	if(ftruncate(fd, size) == -1 || (shm=shm_map(fd, size, 1)) == NULL)
+	{
+		error=errno;
+		close(fd);
+		shm_unlink(name);
+		free(shm_name);
+		errno=error;
+		return NULL;
+	}
+
+	close(fd);
+	shm->name=shm_name;
+
+	//segment is zeroed by ftruncate (heads, sequences, flags)
+	shm->header->size=size;
+
+	for(i=0;i<CC_QUEUES;++i)
+	{
+		shm->header->rings[i].element_size=rings[i].element_size;
+		shm->header->rings[i].capacity=rings[i].capacity;
+		shm->header->rings[i].offset=rings[i].offset;
+		shm->header->rings[i].stride=rings[i].stride;
+	}
+
+	//readers validate magic first
+	atomic_thread_fence(memory_order_release);
+	memcpy(shm->header->magic, CC_SHM_MAGIC, sizeof(CC_SHM_MAGIC));
+
+	return shm;
+}
+
+int cc_shm_publish(struct cc_shm *shm, const struct cc_data *data)
+{
+	struct cc_shm_header *h=shm->header;
+
+	if(!shm->publisher)
+	{
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	#define CC_SHM_PUBLISHED(NAME, name, type, bytes) data->size.name > 0 ||
+	if( !(CC_PROTOCOL_MESSAGES(CC_SHM_PUBLISHED) 0) )
+		return CC_OK;
+	#undef CC_SHM_PUBLISHED
+
+	#define CC_SHM_PUBLISH(NAME, name, type, bytes) \
+		shm_ring_publish(h, CC_##NAME##_QUEUE, data->name, data->size.name);
+	CC_PROTOCOL_MESSAGES(CC_SHM_PUBLISH)
+	#undef CC_SHM_PUBLISH
+
+	//sequentially consistent, either we see waiter or waiter sees new generation
+	atomic_fetch_add(&h->generation, 1);
+
+	if(atomic_load(&h->waiters))
+		syscall(SYS_futex, &h->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+	return CC_OK;
+}
+
+struct cc_shm *cc_shm_attach(const char *name)
+{
+	struct cc_shm *shm;
+	struct stat st;
+	int fd, i;
+
+	if( (fd=shm_open(name, O_RDWR | O_CLOEXEC, 0)) == -1 )
+		return NULL;
+
+	if(fstat(fd, &st) == -1)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	if((size_t)st.st_size < sizeof(struct cc_shm_header))
+	{
+		close(fd);
+		errno=EPROTO;
+		return NULL;
+	}
+
+	shm=shm_map(fd, st.st_size, 0);
+	close(fd);
+
+	if(shm == NULL)
+		return NULL;
+
+	if(!shm_valid(shm->header, shm->size))
+	{
+		cc_shm_close(shm);
+		errno=EPROTO;
+		return NULL;
+	}
+
+	for(i=0;i<CC_QUEUES;++i)
+		shm->cursor[i]=atomic_load_explicit(&shm->header->rings[i].head, memory_order_acquire);
+
+	return shm;
+}
+
+int cc_shm_read_all(struct cc_shm *shm, struct cc_data *data, int timeout_ms)
+{
+	struct cc_shm_header *h=shm->header;
+	const struct cc_size size=data->size;
+	int received=0, pending=0;
+	const uint64_t deadline_us= timeout_ms > 0 ? host_clock_us() + (uint64_t)timeout_ms * 1000 : 0;
+
+	if(shm->publisher)
+	{
+		data->size=(struct cc_size){0};
+		errno=EINVAL;
+		return CC_ERROR;
+	}
+
+	for(;;)
+	{	//read before rings, generation to detect publishing, closed to know we drained everything
+		const uint32_t generation=atomic_load(&h->generation);
+		const uint32_t closed=atomic_load(&h->closed);
+
+		#define CC_SHM_READ(NAME, name, type, bytes) \
+			data->size.name=shm_ring_read(shm, CC_##NAME##_QUEUE, data->name, size.name); \
+			received |= data->size.name > 0;
+		CC_PROTOCOL_MESSAGES(CC_SHM_READ)
+		#undef CC_SHM_READ
+
+		if(received)
+			break;
+
+		if(closed)
+		{
+			errno=ENODEV;
+			return CC_ERROR;
+		}
+
+		if(timeout_ms == 0)
+		{
+			errno=EAGAIN;
+			return CC_ERROR;
+		}
+
+		if(shm_wait(h, generation, deadline_us) == CC_ERROR)
+			return CC_ERROR;
+	}
+
+	#define CC_SHM_PENDING(NAME, name, type, bytes) \
+		pending |= size.name > 0 && shm_ring_pending(shm, CC_##NAME##_QUEUE);
+	CC_PROTOCOL_MESSAGES(CC_SHM_PENDING)
+	#undef CC_SHM_PENDING
+
+	if(pending)
+		return CC_DATA_PENDING;
+
+	return CC_OK;
+}
+
+void cc_shm_get_lag(struct cc_shm *shm, struct cc_shm_lag *lag)
+{
+	memset(lag, 0, sizeof(struct cc_shm_lag));
+
+	if(shm->publisher)
+		return;
+
+	#define CC_SHM_LAG(NAME, name, type, bytes) \
+		lag->dropped_##name=shm->dropped[CC_##NAME##_QUEUE]; \
+		lag->pending.name=shm_ring_pending(shm, CC_##NAME##_QUEUE);
+	CC_PROTOCOL_MESSAGES(CC_SHM_LAG)
+	#undef CC_SHM_LAG
+}
+
+int cc_shm_close(struct cc_shm *shm)
+{
+	int error=0;
+
+	if(shm == NULL)
+		return CC_OK;
+
+	if(shm->publisher)
 	{
-		if(valid == CC_INVALID_MESSAGE)
-		{	//try luck starting from the next byte
-			++offset;
-			continue;
-		}
-		//otherwise CC_VALID_MESSAGE
-		if( (msg_process_status=process_message(c->buffer+offset, data, &counters)) == CC_NO_SPACE_IN_USER_ARRAY)
-			break;
-		//otherwise CC_MESSAGE_PROCESSED
-		offset+=c->buffer[offset+CC_MESSAGE_SIZE_OFFSET]; //TO DO - check if it is the right size
+		atomic_store(&shm->header->closed, 1);
+		atomic_fetch_add(&shm->header->generation, 1);
+		syscall(SYS_futex, &shm->header->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+		error |= shm_unlink(shm->name) == -1;
 	}
 
-	memmove(c->buffer, c->buffer+offset, c->buffer_bytes-offset);
-	c->buffer_bytes -= offset;
+	error |= munmap(shm->header, shm->size) == -1;
 
-	data->size = counters;
+	free(shm->name);
+	free(shm);
 
-	if(msg_process_status == CC_NO_SPACE_IN_USER_ARRAY)
+	return error ? CC_ERROR : CC_OK;
+}
+
+static struct cc_shm *shm_map(int fd, size_t size, int publisher)
+{
+	struct cc_shm *shm;
+
+	if( (shm=(struct cc_shm*)calloc(1, sizeof(struct cc_shm))) == NULL )
+		return NULL;
+
+	//readers map read-write for futex waiter count, rings are written only by publisher
+	if( (shm->header=(struct cc_shm_header*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED )
 	{
-		c->data_pending=1;
-		return CC_DATA_PENDING;
+		free(shm);
+		return NULL;
 	}
-	//otherwise valid == CC_NEED_MORE_DATA
-	c->data_pending=0;
-	return CC_OK;
-}
 
-/* Message validation */
+	shm->size=size;
+	shm->publisher=publisher;
 
-// returns CC_INVALID_MESSAGE or CC_NEED_MORE_DATA or CC_VALID_MESSAGE
-static int validate_message(struct cc *c, int from)
+	return shm;
+}
+
+// checks segment was created by the same library version and fits mapping
+static int shm_valid(const struct cc_shm_header *h, size_t size)
 {
-	int pending_bytes=c->buffer_bytes-from;
-	uint8_t msg_start, msg_size=UINT8_MAX, msg_end, msg_type;
+	int i;
 
-	if(pending_bytes == 0)
-		return CC_NEED_MORE_DATA;
+	if(memcmp(h->magic, CC_SHM_MAGIC, sizeof(CC_SHM_MAGIC)) != 0)
+		return 0;
 
-	if(pending_bytes >= 1)
+	atomic_thread_fence(memory_order_acquire);
+
+	if(h->size != size)
+		return 0;
+
+	for(i=0;i<CC_QUEUES;++i)
 	{
-		msg_start=c->buffer[from];
-		if(!is_valid_message_start(msg_start))
-			return CC_INVALID_MESSAGE;
+		const struct cc_shm_ring *r=&h->rings[i];
+
+		if(r->element_size != CC_QUEUE_ELEMENT_SIZES[i] || (r->capacity & (r->capacity - 1)) != 0 ||
+			r->stride < sizeof(struct cc_shm_slot) + r->element_size || r->offset % CC_SHM_ALIGNMENT != 0 ||
+			r->offset + r->capacity * r->stride > size)
+			return 0;
 	}
 
-	if(pending_bytes >= 3)
+	return 1;
+}
+
+static struct cc_shm_slot *shm_slot(struct cc_shm_header *h, int ring, uint64_t position)
+{
+	const struct cc_shm_ring *r=&h->rings[ring];
+
+	return (struct cc_shm_slot*)((uint8_t*)h + r->offset + (position & (r->capacity - 1)) * r->stride);
+}
+
+// seqlock write of each slot, head is published once for the whole batch
+static void shm_ring_publish(struct cc_shm_header *h, int ring, const void *elements, int size)
+{
+	struct cc_shm_ring *r=&h->rings[ring];
+	const uint8_t *src=(const uint8_t*)elements;
+	uint64_t head=atomic_load_explicit(&r->head, memory_order_relaxed);
+	int i;
+
+	if(r->capacity == 0 || size <= 0)
+		return;
+
+	for(i=0;i<size;++i, ++head)
 	{
-		msg_size=c->buffer[from+1];
-		msg_type=c->buffer[from+2];
+		struct cc_shm_slot *slot=shm_slot(h, ring, head);
 
-		if(!is_valid_length_for_message_type(msg_start, msg_type, msg_size))
-			return CC_INVALID_MESSAGE;
+		atomic_store_explicit(&slot->sequence, 2*head + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		memcpy(slot->data, src + (size_t)i * r->element_size, r->element_size);
+		atomic_store_explicit(&slot->sequence, 2*head + 2, memory_order_release);
 	}
 
-	if(pending_bytes >= msg_size ) //start, length, type/reserved, end so we have end of message
+	atomic_store_explicit(&r->head, head, memory_order_release);
+}
+
+// returns number of read elements, lost elements are added to reader dropped
+static int shm_ring_read(struct cc_shm *shm, int ring, void *elements, int size)
+{
+	const struct cc_shm_ring *r=&shm->header->rings[ring];
+	uint8_t *dst=(uint8_t*)elements;
+	uint64_t cursor=shm->cursor[ring], head;
+	int count=0;
+
+	if(r->capacity == 0 || size <= 0)
+		return 0;
+
+	head=atomic_load_explicit(&r->head, memory_order_acquire);
+
+	while(count < size && cursor < head)
 	{
-		msg_end=c->buffer[from + msg_size -1];
+		struct cc_shm_slot *slot;
+		uint64_t sequence, position;
 
-		if(!is_valid_message_start_end(msg_start, msg_end))
-			return CC_INVALID_MESSAGE;
+		if(head > cursor + r->capacity)
+		{	//lapped, continue from the oldest available
+			shm->dropped[ring] += head - r->capacity - cursor;
+			cursor = head - r->capacity;
+		}
 
-		// if we got that far:
-		// - message has correct start
-		// - message has valid length for start/type
-		// - message end delimter matches start delimeter
-		// we conclude that it is a valid message
-		return CC_VAlID_MESSAGE;
+		slot=shm_slot(shm->header, ring, cursor);
+		sequence=atomic_load_explicit(&slot->sequence, memory_order_acquire);
+
+		if(sequence == 2*cursor + 2)
+		{
+			memcpy(dst + (size_t)count * r->element_size, slot->data, r->element_size);
+			atomic_thread_fence(memory_order_acquire);
+
+			if( (sequence=atomic_load_explicit(&slot->sequence, memory_order_relaxed)) == 2*cursor + 2 )
+			{
+				++count;
+				++cursor;
+				continue;
+			}
+		}
+
+		//slot overwritten (or being overwritten) by position >= cursor + capacity
+		//publisher may be ahead of head (not yet published batch) so cursor may pass head
+		position=(sequence - 1) / 2;
+		shm->dropped[ring] += position - r->capacity + 1 - cursor;
+		cursor = position - r->capacity + 1;
+		head=atomic_load_explicit(&r->head, memory_order_acquire);
 	}
 
-	return CC_NEED_MORE_DATA;
+	shm->cursor[ring]=cursor;
+	return count;
 }
 
-static int is_valid_message_start(uint8_t c)
+static int shm_ring_pending(const struct cc_shm *shm, int ring)
 {
-	return c == CC_START_OF_MESSAGE;
-}
+	const struct cc_shm_ring *r=&shm->header->rings[ring];
+	const uint64_t head=atomic_load_explicit(&r->head, memory_order_acquire);
+	const uint64_t cursor=shm->cursor[ring];
 
-static int is_valid_message_start_end(uint8_t msg_start, uint8_t msg_end)
-{
-	return  (msg_start == CC_START_OF_MESSAGE && msg_end == CC_END_OF_MESSAGE);
+	if(head <= cursor)
+		return 0;
+
+	return head - cursor > r->capacity ? (int)r->capacity : (int)(head - cursor);
 }
 
-static int is_valid_length_for_message_type(uint8_t msg_start,uint8_t msg_type, uint8_t msg_length)
+// waits until generation changes, returns CC_ERROR with EAGAIN on timeout
+static int shm_wait(struct cc_shm_header *h, uint32_t generation, uint64_t deadline_us)
 {
-	return msg_start == CC_START_OF_MESSAGE &&
-	(  (msg_type == CC_ODOMETRY_TYPE && msg_length == CC_ODOMETRY_SIZE ) ||
-		(msg_type == CC_RPLIDAR_TYPE && msg_length == CC_RPLIDAR_SIZE) ||
-		(msg_type == CC_XV11LIDAR_TYPE && msg_length == CC_XV11LIDAR_SIZE) );
+	struct timespec timeout, *wait_timeout=NULL;
+	long ret;
+
+	if(deadline_us)
+	{
+		const uint64_t now_us=host_clock_us();
+
+		if(now_us >= deadline_us)
+		{
+			errno=EAGAIN;
+			return CC_ERROR;
+		}
+
+		timeout.tv_sec=(deadline_us - now_us) / 1000000;
+		timeout.tv_nsec=(deadline_us - now_us) % 1000000 * 1000;
+		wait_timeout=&timeout;
+	}
+
+	atomic_fetch_add(&h->waiters, 1);
+	//returns immediately if generation already changed
+	ret=syscall(SYS_futex, &h->generation, FUTEX_WAIT, generation, wait_timeout, NULL, 0);
+	atomic_fetch_sub(&h->waiters, 1);
+
+	if(ret == -1 && errno == ETIMEDOUT)
+	{
+		errno=EAGAIN;
+		return CC_ERROR;
+	}
+	//woken, generation changed, interrupted by signal or spurious wakeup
+	return CC_OK;
 }
 
-/* Message processing and decoding */
+/* Offline decoding */
 
-//returns CC_MESSAGE_PROCESSED or CC_NO_SPACE_IN_USER_ARRAY
-static int process_message(uint8_t *msg, struct cc_data *data, struct cc_size *counters)
+int cc_decode_buffer(const uint8_t *stream, size_t size, const struct cc_decode_config *config, struct cc_data *data)
 {
-	const uint8_t msg_type=msg[CC_MESSAGE_TYPE_OFFSET];
+	struct cc_decoder d={stream, size, CC_DECODE_CHUNK_BYTES, NULL, 0, data, CC_DECODE_SCAN, 0, 0};
+	struct cc_size total={0};
+	const struct cc_size empty={0};
+	long threads=0;
+	int error=0;
 
-	switch(msg_type)
+	if(config && (config->threads < 0 || config->threads > CC_DECODE_MAX_THREADS || config->chunk_bytes < 0 ||
+		(config->chunk_bytes && (config->chunk_bytes < CC_DECODE_MIN_CHUNK_BYTES || config->chunk_bytes > CC_DECODE_MAX_CHUNK_BYTES))))
 	{
-		case CC_ODOMETRY_TYPE:
-			if(data->size.odometry==0)
-				return CC_MESSAGE_PROCESSED;
-			if(counters->odometry >= data->size.odometry)
-				return CC_NO_SPACE_IN_USER_ARRAY;
+		errno=EINVAL;
+		return CC_ERROR;
+	}
 
-			decode_message_odometry(msg, data->odometry + counters->odometry);
+	if(config && config->chunk_bytes)
+		d.chunk_bytes=config->chunk_bytes;
 
-			++counters->odometry;
-			break;
-		case CC_RPLIDAR_TYPE:
-			if(data->size.rplidar==0)
-				return CC_MESSAGE_PROCESSED;
-			if(counters->rplidar >= data->size.rplidar)
-				return CC_NO_SPACE_IN_USER_ARRAY;
+	if(config && config->threads)
+		threads=config->threads;
+	else if( (threads=sysconf(_SC_NPROCESSORS_ONLN)) < 1 )
+		threads=1;
 
-			decode_message_rplidar(msg, data->rplidar + counters->rplidar);
+	if(threads > CC_DECODE_MAX_THREADS)
+		threads=CC_DECODE_MAX_THREADS;
 
-			++counters->rplidar;
-			break;
-		case CC_XV11LIDAR_TYPE:
-			if(data->size.xv11lidar==0)
-				return CC_MESSAGE_PROCESSED;
-			if(counters->xv11lidar >= data->size.xv11lidar)
-				return CC_NO_SPACE_IN_USER_ARRAY;
+	d.count = size ? (size - 1) / d.chunk_bytes + 1 : 0;
 
-			decode_message_xv11lidar(msg, data->xv11lidar + counters->xv11lidar);
+	if( (d.chunks=(struct cc_decode_chunk*)calloc(d.count ? d.count : 1, sizeof(struct cc_decode_chunk))) == NULL )
+		return CC_ERROR;
 
-			++counters->xv11lidar;
-			break;
-		default:
-			;//fprintf(stderr, "unsupported message type: %c\n", msg_type);
+	if(threads > d.count)
+		threads=d.count ? d.count : 1;
+
+	if(decode_run(&d, threads, CC_DECODE_SCAN) != CC_OK || decode_merge(&d, &total) != CC_OK)
+		error=errno;
+	#define CC_DECODE_NO_SPACE(NAME, name, type, bytes) (data->size.name && total.name > data->size.name) ||
+	else if(CC_PROTOCOL_MESSAGES(CC_DECODE_NO_SPACE) 0)
+		error=ENOBUFS;
+	#undef CC_DECODE_NO_SPACE
+	else
+		decode_run(&d, threads, CC_DECODE_MESSAGES);
+
+	for(uint32_t i=0;i<d.count;++i)
+		free(d.chunks[i].offsets);
+	free(d.chunks);
+
+	if(error && error != ENOBUFS)
+	{
+		data->size=empty;
+		errno=error;
+		return CC_ERROR;
 	}
 
-	//if we got that far the message was processed or is of unsupported type
-	return CC_MESSAGE_PROCESSED;
+	//skipped types are not counted
+	#define CC_DECODE_TOTAL(NAME, name, type, bytes) data->size.name = data->size.name ? total.name : 0;
+	CC_PROTOCOL_MESSAGES(CC_DECODE_TOTAL)
+	#undef CC_DECODE_TOTAL
+
+	if(error)
+	{
+		errno=error;
+		return CC_ERROR;
+	}
+
+	return CC_OK;
 }
 
-/* Message level decoding */
+// calling thread also works, so decoding completes even if threads can't be created
+static int decode_run(struct cc_decoder *d, int threads, int pass)
+{
+	pthread_t workers[CC_DECODE_MAX_THREADS];
+	int created=0;
 
+	d->pass=pass;
+	atomic_store(&d->next, 0);
 
-/*
-### ODOMETRY
+	for(; created < threads - 1; ++created)
+		if(pthread_create(&workers[created], NULL, decode_worker, d) != 0)
+			break;
 
-|           | Timestamp | Left encoder | Right encoder |    QW      |     QX     |    QY      |     QZ     |
-| ----------|-----------|--------------|---------------|------------|------------|------------|------------|
-|   bytes   |    4      |      4       |      4        |     4      |      4     |     4      |     4      |
-|   type    | uint32    |   int32      |    int32      |   float    |   float    |   float    |   float    |
-|   unit    |   us      |   counts     |    counts     | quaternion | quaternion | quaternion | quaternion |
-*/
+	decode_worker(d);
+
+	for(int i=0;i<created;++i)
+		pthread_join(workers[i], NULL);
+
+	if(atomic_load(&d->error))
+	{
+		errno=atomic_load(&d->error);
+		return CC_ERROR;
+	}
+
+	return CC_OK;
+}
 
-static void decode_message_odometry(uint8_t *msg, struct cc_odometry_data *data)
+static void *decode_worker(void *arg)
 {
-	uint8_t *payload=msg+CC_MSG_PAYLOAD_OFFSET;
+	struct cc_decoder *d=(struct cc_decoder*)arg;
+	uint32_t i;
 
-	data->timestamp_us = decode_uint32(payload);
+	while( (i=atomic_fetch_add(&d->next, 1)) < d->count && !atomic_load(&d->error) )
+	{
+		struct cc_decode_chunk *chunk=d->chunks + i;
 
-	data->left_encoder_counts = decode_int32(payload+4);
-	data->right_encoder_counts = decode_int32(payload+8);
+		if(d->pass == CC_DECODE_MESSAGES)
+		{
+			decode_chunk(d, chunk);
+			continue;
+		}
 
-	data->qw = decode_float(payload+12);
-	data->qx = decode_float(payload+16);
-	data->qy = decode_float(payload+20);
-	data->qz = decode_float(payload+24);
-}
+		//sequential parsing starts at 0 and resynchronizes by itself
+		chunk->boundary = i + 1 < d->count ? decode_split(d, (i + 1) * d->chunk_bytes) : d->size;
 
-/*
-### RPLIDARA3
-
-|          | Timestamp | Device ID | Sequence | Data               |
-| ---------|-------- --|-----------|----------|--------------------|
-|   bytes  |     4     |     1     |    1     |  132               |
-|   type   |  uint32   |  uint8    |  uint8   | ultra_capsules     |
-|   unit   |    us     |    ID     | counts   | RPLidarA3 internal |
-
-- device ID identifies lidar when using multiple lidars
-- data is not decoded on MCU due to complexity
-- sequence if for checking if data angles follow one another
-- data corresponds to [rplidar_response_ultra_capsule_measurement_nodes_t](https://github.com/Slamtec/rplidar_sdk/blob/8291e232af614842447a634b6dbd725b81f24713/sdk/sdk/include/rplidar_cmd.h#L197) in [rplidar_sdk](https://github.com/Slamtec/rplidar_sdk)
-- decoding should do the same as [_ultraCapsuleToNormal](https://github.com/Slamtec/rplidar_sdk/blob/master/sdk/sdk/src/rplidar_driver.cpp#L1071) in [rplidar_sdk](https://github.com/Slamtec/rplidar_sdk)
-*/
+		if(decode_scan(d, chunk, i ? decode_split(d, i * d->chunk_bytes) : 0) != CC_OK)
+		{
+			int expected=0;
+			atomic_compare_exchange_strong(&d->error, &expected, errno);
+		}
+	}
 
-static void decode_message_rplidar(uint8_t *msg, struct cc_rplidar_data *data)
-{  //add some constants
-	uint8_t *payload=msg+CC_MSG_PAYLOAD_OFFSET;
+	return NULL;
+}
 
-	data->timestamp_us = decode_uint32(payload);
-	data->device_id = payload[4];
-	data->sequence = payload[5];
+// the first candidate message start at or after nominal position
+static size_t decode_split(const struct cc_decoder *d, size_t nominal)
+{
+	const size_t remaining=d->size - nominal;
+	const int bytes = remaining > INT_MAX ? INT_MAX : (int)remaining;
 
-	memcpy( &data->capsule, payload+6, sizeof(rplidar_response_ultra_capsule_measurement_nodes_t) );
+	return nominal + find_message_start(d->stream + nominal, bytes, 0);
 }
 
-/*
-### XV11LIDAR
+// the same as next_message loop in cc_read_all but until boundary
+static int decode_scan(const struct cc_decoder *d, struct cc_decode_chunk *chunk, size_t from)
+{
+	const uint8_t *data=d->stream + from;
+	const size_t remaining=d->size - from;
+	const int bytes = remaining > INT_MAX ? INT_MAX : (int)remaining;
+	const size_t limit = chunk->boundary > from ? chunk->boundary - from : 0;
+	int offset=0, valid;
 
-|          | Timestamp | Angle quad            |  Speed64       | Distances x 4 [mm]            |
-| ---------|-----------|-----------------------|----------------|-------------------------------|
-|   bytes  |    4      |      1                |    2           |        8                      |
-|   type   | uint32    |   uint8_t             |  uint16_t      | uint16_t  x 4 (array)         |
-|   unit   |   us      | 0,89 for 0-3,356-359  | rpm = Speed/64 | flag, distances or error_code |
+	chunk->start=from;
+	chunk->messages=0;
+	memset(&chunk->counts, 0, sizeof(chunk->counts));
+	chunk->local_mcu_us=0;
+	chunk->reset=0;
 
-- the packet is raw XV11Lidar packet with timestamp, without signal strength, CRC
-- Distances are 14 bits mm distances or error code, 1 bit strength warning, 1 bit invalid_data
-    - if invalid_data bit is set, the field carries error code
-    - otherwise it is distance in mm
-    - strength warning when power received is lower than expected for the distance
+	while( (size_t)offset < limit )
+	{
+		uint32_t timestamp_us;
 
- */
- /*
- struct cc_xv11lidar_data
-{
-	uint32_t timestamp_us;
-	uint8_t angle_quad; //0-89 for readings 0-3 356-359
-	uint16_t speed64;	//divide by 64 for speed in rpm
-	uint16_t distances[4]; //flags and distance or error code
-};
- */
+		if( (valid=validate_message(data, bytes, offset)) == CC_INVALID_MESSAGE )
+		{
+			offset=find_message_start(data, bytes, offset + 1);
+			continue;
+		}
+
+		if(valid == CC_NEED_MORE_DATA) //truncated message at the end of stream
+			break;
+
+		if(chunk->messages == chunk->capacity)
+		{
+			const uint32_t capacity = chunk->capacity ? 2 * chunk->capacity : 1024;
+			uint32_t *offsets=(uint32_t*)realloc(chunk->offsets, capacity * sizeof(uint32_t));
+
+			if(offsets == NULL)
+				return CC_ERROR;
+
+			chunk->offsets=offsets;
+			chunk->capacity=capacity;
+		}
+
+		chunk->offsets[chunk->messages]=offset;
+
+		switch(data[offset + CC_MESSAGE_TYPE_OFFSET])
+		{
+			#define CC_DECODE_COUNT_MESSAGE(NAME, name, type, bytes) \
+			case CC_##NAME##_TYPE: ++chunk->counts.name; break;
+			CC_PROTOCOL_MESSAGES(CC_DECODE_COUNT_MESSAGE)
+			#undef CC_DECODE_COUNT_MESSAGE
+		}
+
+		//the same unwrapping as clock_update, relative to the first message
+		timestamp_us=decode_uint32(data + offset + CC_MSG_PAYLOAD_OFFSET);
+
+		if(chunk->messages == 0)
+			chunk->first_timestamp_us=timestamp_us;
+		else if((int32_t)(timestamp_us - chunk->last_timestamp_us) < -CC_CLOCK_RESET_US)
+		{
+			chunk->reset=1;
+			chunk->local_mcu_us=timestamp_us;
+		}
+		else
+			chunk->local_mcu_us += (int32_t)(timestamp_us - chunk->last_timestamp_us);
 
-static void decode_message_xv11lidar(uint8_t *msg, struct cc_xv11lidar_data *data)
+		chunk->last_timestamp_us=timestamp_us;
+		++chunk->messages;
+
+		offset += data[offset + CC_MESSAGE_SIZE_OFFSET];
+	}
+
+	chunk->end = from + offset;
+
+	return CC_OK;
+}
+
+// in order, sets clock state and output positions of chunks, returns total counts
+static int decode_merge(struct cc_decoder *d, struct cc_size *total)
 {
-	uint8_t *payload=msg+CC_MSG_PAYLOAD_OFFSET;
+	uint32_t previous_timestamp_us=0;
+	uint64_t previous_mcu_us=0;
+	int initialized=0;
+
+	for(uint32_t i=0;i<d->count;++i)
+	{
+		struct cc_decode_chunk *chunk=d->chunks + i;
+
+		//rare, previous chunk ended inside message or garbage where we started
+		if(i > 0 && chunk->start != d->chunks[i-1].end)
+			if(decode_scan(d, chunk, d->chunks[i-1].end) != CC_OK)
+				return CC_ERROR;
+
+		chunk->initialized=initialized;
+		chunk->previous_timestamp_us=previous_timestamp_us;
+		chunk->previous_mcu_us=previous_mcu_us;
+		chunk->first=*total;
+
+		#define CC_DECODE_MERGE_COUNTS(NAME, name, type, bytes) total->name += chunk->counts.name;
+		CC_PROTOCOL_MESSAGES(CC_DECODE_MERGE_COUNTS)
+		#undef CC_DECODE_MERGE_COUNTS
 
-	data->timestamp_us = decode_uint32(payload);
+		if(chunk->messages == 0)
+			continue;
+
+		if(chunk->reset)
+			previous_mcu_us=chunk->local_mcu_us;
+		else if(!initialized || (int32_t)(chunk->first_timestamp_us - previous_timestamp_us) < -CC_CLOCK_RESET_US)
+			previous_mcu_us=chunk->first_timestamp_us + chunk->local_mcu_us;
+		else
+			previous_mcu_us += (int32_t)(chunk->first_timestamp_us - previous_timestamp_us) + chunk->local_mcu_us;
+
+		previous_timestamp_us=chunk->last_timestamp_us;
+		initialized=1;
+	}
 
-	data->angle_quad = payload[4];
-	data->speed64 = decode_uint16(payload+5);
-	//TO DO
-	//decode distances
+	return CC_OK;
 }
 
-/* Data type level decoding */
+static void decode_chunk(const struct cc_decoder *d, const struct cc_decode_chunk *chunk)
+{
+	struct cc_data *data=d->data;
+	struct cc_size next=chunk->first;
+	uint32_t previous_timestamp_us=chunk->previous_timestamp_us;
+	struct cc_time time={chunk->previous_mcu_us, 0, 0};
+	int initialized=chunk->initialized;
 
-// note - the communication is currently simple little endian
-// so the functions just copy memory
-// TO DO - consider using network order/consider host byte order
+	for(uint32_t m=0;m<chunk->messages;++m)
+	{
+		const uint8_t *msg=d->stream + chunk->start + chunk->offsets[m];
+		const uint32_t timestamp_us=decode_uint32(msg + CC_MSG_PAYLOAD_OFFSET);
+		const int32_t elapsed_us=(int32_t)(timestamp_us - previous_timestamp_us);
+
+		if(!initialized || elapsed_us < -CC_CLOCK_RESET_US)
+			time.mcu_us=timestamp_us;
+		else
+			time.mcu_us += elapsed_us;
 
-static uint16_t decode_uint16(uint8_t *encoded)
+		previous_timestamp_us=timestamp_us;
+		initialized=1;
+
+		switch(msg[CC_MESSAGE_TYPE_OFFSET])
+		{
+			#define CC_DECODE_CHUNK_MESSAGE(NAME, name, type, bytes) \
+			case CC_##NAME##_TYPE: \
+				if(data->size.name) \
+					decode_message_##name(msg, &time, data->name + next.name++); \
+				break;
+			CC_PROTOCOL_MESSAGES(CC_DECODE_CHUNK_MESSAGE)
+			#undef CC_DECODE_CHUNK_MESSAGE
+		}
+	}
+}
+
+/* Statistics */
+
+void cc_get_stats(struct cc *c, struct cc_stats *stats)
 {
-	uint16_t temp;
-	memcpy(&temp, encoded, sizeof(temp));
-	return temp;
+	struct cc_async_stats async;
+
+	*stats=c->stats;
+
+	//zero if asynchronous reading was never started
+	cc_get_async_stats(c, &async);
+	#define CC_STATS_DROPPED(NAME, name, type, bytes) stats->dropped_##name=async.dropped_##name;
+	CC_PROTOCOL_MESSAGES(CC_STATS_DROPPED)
+	#undef CC_STATS_DROPPED
+
+	for(int id=0;id<=UINT8_MAX;++id)
+		stats->rplidar_route_dropped[id] = c->rplidar_routes[id] ? atomic_load(&c->rplidar_routes[id]->dropped) : 0;
 }
-static uint32_t decode_uint32(uint8_t *encoded)
+
+static void stats_recv(struct cc_stats *s, int bytes, uint64_t elapsed_us)
 {
-	uint32_t temp;
-	memcpy(&temp, encoded, sizeof(temp));
-	return temp;
+	++s->recv_time_histogram[log2_bucket(elapsed_us, CC_STATS_BUCKETS)];
+
+	if(bytes == 0) //timeout or error
+		return;
+
+	++s->reads;
+	s->bytes_read += bytes;
+	++s->read_size_histogram[log2_bucket(bytes, CC_STATS_BUCKETS)];
 }
-static int32_t decode_int32(uint8_t *encoded)
+
+// counts validated message, msg is known to be valid
+static void stats_message(struct cc *c, const uint8_t *msg)
 {
-	int32_t temp;
-	memcpy(&temp, encoded, sizeof(temp));
-	return temp;
+	const uint8_t *payload=msg+CC_MSG_PAYLOAD_OFFSET;
+	uint8_t device_id, sequence;
+
+	switch(msg[CC_MESSAGE_TYPE_OFFSET])
+	{
+		#define CC_STATS_FRAMES(NAME, name, type, bytes) \
+		case CC_##NAME##_TYPE: ++c->stats.name##_frames; break;
+		CC_PROTOCOL_MESSAGES(CC_STATS_FRAMES)
+		#undef CC_STATS_FRAMES
+	}
+
+	if(msg[CC_MESSAGE_TYPE_OFFSET] != CC_RPLIDAR_TYPE)
+		return;
+
+	device_id=payload[4];
+	sequence=payload[5];
+
+	//uint8_t arithmetic handles sequence wrap around
+	if(c->rplidar_sequence_ready[device_id])
+		c->stats.rplidar_sequence_gaps[device_id] += (uint8_t)(sequence - c->rplidar_sequence[device_id] - 1);
+
+	c->rplidar_sequence[device_id]=sequence;
+	c->rplidar_sequence_ready[device_id]=1;
 }
-static float decode_float(uint8_t *encoded)
+
+// 0 for 0, otherwise floor(log2(value)) + 1, the last bucket collects the rest
+static int log2_bucket(uint64_t value, int buckets)
 {
-	float tempf;
-	memcpy(&tempf, encoded, sizeof(tempf));
-	return tempf;
+	const int bucket = value ? 64 - __builtin_clzll(value) : 0;
+	return bucket < buckets ? bucket : buckets - 1;
 }
 
 /* Low level IO */
 
 static int recv(struct cc *c)
 {
+	const int bytes=c->buffer_bytes;
+	uint64_t start_us;
 	int ret;
-	struct timeval tv={0};
-	fd_set rfds;
 
 	if(c->data_pending)
 		return CC_OK;
 
-	FD_ZERO(&rfds);
-	FD_SET(c->fd, &rfds);
+	start_us=host_clock_us();
+	ret = c->replay ? replay_recv(c) : recv_device(c);
 
-	tv.tv_usec = CC_READ_TIMEOUT_MS*1000;
+	//includes waiting for data and replay pacing
+	stats_recv(&c->stats, c->buffer_bytes - bytes, host_clock_us() - start_us);
 
-	if( (ret = select(c->fd+1, &rfds, NULL, NULL, &tv)) < 0 )
-		return CC_ERROR;
+	return ret;
+}
 
-	if (ret == 0) //timeout
-	{
-		errno = EAGAIN;
+static int recv_device(struct cc *c)
+{
+	int ret;
+
+	//cc_group already waited for all devices at once
+	if(c->input_ready)
+		c->input_ready=0;
+	else if(wait_readable(c->fd, c->read_timeout_ms) != CC_OK)
 		return CC_ERROR;
-	}
 
-	if( (ret = read(c->fd, c->buffer+c->buffer_bytes, CC_BUFFER_SIZE-c->buffer_bytes )) < 0 )
+	//the free space is contiguous in the mirrored mapping
+	if( (ret = read(c->fd, ring_data(c)+c->buffer_bytes, c->buffer_size-c->buffer_bytes )) < 0 )
 		return CC_ERROR;
 	if( ret == 0 )
 	{ //EOF - device unplugged
@@ -547,12 +6190,40 @@ static int recv(struct cc *c)
 		return CC_ERROR;
 	}
 
+	c->clock.receive_time_us = host_clock_us();
+
+	if(c->recorder)
+		record_append(c->recorder, ring_data(c)+c->buffer_bytes, ret, c->clock.receive_time_us);
+
 	c->buffer_bytes += ret;
 
 	return CC_OK;
 }
 
+// poll instead of select, the latter fails for fd >= FD_SETSIZE
+static int wait_readable(int fd, int timeout_ms)
+{
+	struct pollfd pfd={fd, POLLIN, 0};
+	int ret;
+
+	if( (ret = poll(&pfd, 1, timeout_ms)) < 0 )
+		return CC_ERROR;
+
+	if (ret == 0) //timeout
+	{
+		errno = EAGAIN;
+		return CC_ERROR;
+	}
+
+	return CC_OK;
+}
+
 int cc_fd(struct cc *c)
 {
 	return c->fd;
 }
+
+uint64_t cc_skipped_bytes(struct cc *c)
+{
+	return c->stats.skipped_bytes;
+}
@@ -30,6 +30,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stddef.h>
 
 /** \addtogroup interface Public interface
  *	@{
@@ -42,22 +43,6 @@ extern "C" {
  */
 struct cc;
 
-/**
- * @struct cc_odometry_data
- * @brief Data streamed for odometry and IMU.
- * @see cc_read_all
- */
-struct cc_odometry_data
-{
-	uint32_t timestamp_us; //!< microseconds elapsed since MCU was plugged in
-	int32_t left_encoder_counts; //!< left wheel encoder counts
-	int32_t right_encoder_counts; //!< right wheel encoder counts
-	float qw; //!< orientation quaternion w
-	float qx; //!< orientation quaternion x
-	float qy; //!< orientation quaternion y
-	float qz; //!< orientation quaternion z
-};
-
 // type definition from RPLidarSDK
 typedef struct rplidar_response_ultra_cabin_nodes_t {
     // 31                                              0
@@ -73,43 +58,206 @@ typedef struct _rplidar_response_ultra_capsule_measurement_nodes_t {
     rplidar_response_ultra_cabin_nodes_t  ultra_cabins[32];
 } __attribute__((packed)) rplidar_response_ultra_capsule_measurement_nodes_t;
 
+// message types, data structs and message decoding generated from protocol/cc_protocol.json
+#include "cc_protocol.h"
+
 /**
- * @struct cc_rplidar_data
- * @brief Data streamed for RPLidar A3
- * @see cc_read_all
+ * @brief Number of measurements in single XV11 reading
+ */
+enum {CC_XV11LIDAR_READING_POINTS=4};
+
+/**
+ * @struct cc_xv11lidar_points
+ * @brief Decoded XV11 measurements (structure of arrays)
+ *
+ * Supply arrays of equal size, set the size in \p size member.
+ *
+ * @see cc_xv11lidar_decode
+ */
+struct cc_xv11lidar_points
+{
+	float *angle_deg; //!< angle in degrees (0-359)
+	float *range_m; //!< range in meters, 0 for invalid measurement
+	uint8_t *valid; //!< 1 for valid measurement, 0 otherwise
+	uint16_t *error_code; //!< error code for invalid measurement, 0 otherwise
+
+	int size; //!< array sizes on input, decoded measurements on output
+};
+
+/**
+ * @brief Number of rays in XV11 revolution (one per degree)
+ */
+enum {CC_XV11LIDAR_SCAN_RAYS=360};
+
+/**
+ * @struct cc_xv11lidar_scan
+ * @brief Complete XV11 revolution indexed by angle in degrees
+ *
+ * Rays of quads which were not received are marked in \p missing
+ * and have zero range. Ray times are interpolated from reading
+ * timestamp and reported speed (the reading timestamp is assumed to be
+ * time of its last ray), missing rays are timed from the nearest
+ * received ray with the last reported speed.
+ *
+ * @see cc_xv11lidar_scan, cc_xv11lidar_scan_enable
+ */
+struct cc_xv11lidar_scan
+{
+	uint32_t number; //!< revolution number, consecutive unless scans were overwritten
+	uint64_t start_mcu_time_us; //!< MCU time of the first reading in revolution
+	uint64_t end_mcu_time_us; //!< MCU time of the last reading in revolution
+	uint64_t start_host_time_us; //!< host CLOCK_MONOTONIC time of the first reading in revolution
+	uint64_t end_host_time_us; //!< host CLOCK_MONOTONIC time of the last reading in revolution
+	float rpm; //!< average reported speed in revolution
+	int missing_quads; //!< number of quads (4 rays) not received, 0 for complete revolution
+
+	float range_m[CC_XV11LIDAR_SCAN_RAYS]; //!< range in meters, 0 for invalid or missing ray
+	uint8_t valid[CC_XV11LIDAR_SCAN_RAYS]; //!< 1 for valid measurement, 0 otherwise
+	uint16_t error_code[CC_XV11LIDAR_SCAN_RAYS]; //!< error code for invalid measurement, 0 otherwise
+	uint8_t missing[CC_XV11LIDAR_SCAN_RAYS]; //!< 1 if ray quad was not received
+	uint64_t mcu_time_us[CC_XV11LIDAR_SCAN_RAYS]; //!< MCU time of ray measurement
+};
+
+/**
+ * @brief Number of measurements decoded from single RPLidar capsule
+ */
+enum {CC_RPLIDAR_CAPSULE_POINTS=96};
+
+/**
+ * @struct cc_rplidar_points
+ * @brief Decoded RPLidar A3 measurements (structure of arrays)
+ *
+ * Supply arrays of equal size, set the size in \p size member.
+ *
+ * @see cc_rplidar_decode
+ */
+struct cc_rplidar_points
+{
+	uint16_t *angle_q14; //!< angle in degrees is angle_q14 * 90 / 16384
+	uint32_t *dist_mm_q2; //!< distance in mm is dist_mm_q2 / 4, 0 for invalid measurement
+	uint8_t *sync; //!< 1 for the first measurement of new scan, may be NULL
+
+	int size; //!< array sizes on input, decoded measurements on output
+};
+
+/**
+ * @struct cc_rplidar_scan
+ * @brief Complete RPLidar A3 revolution (360 degrees)
+ *
+ * Arrays point to library buffers valid until the next cc_rplidar_scan
+ * call for the same device.
+ *
+ * @see cc_rplidar_scan, cc_rplidar_scan_enable
  */
-struct cc_rplidar_data
+struct cc_rplidar_scan
 {
-	uint32_t timestamp_us; //!< microseconds elapsed since MCU was plugged in
 	uint8_t device_id; //!< identifies device when using multiple lidars
-	uint8_t sequence; //!< 0-255, wrap-around for checking if packets are consecutive
-	rplidar_response_ultra_capsule_measurement_nodes_t capsule; //!< type from RPLidarSDK
+	uint32_t number; //!< scan number for the device, consecutive unless scans were overwritten
+	uint64_t start_mcu_time_us; //!< MCU time of the first capsule in scan
+	uint64_t end_mcu_time_us; //!< MCU time of the last capsule in scan
+	uint64_t start_host_time_us; //!< host CLOCK_MONOTONIC time of the first capsule in scan
+	uint64_t end_host_time_us; //!< host CLOCK_MONOTONIC time of the last capsule in scan
+	uint32_t missed_capsules; //!< capsules lost in the scan (sequence gaps), 0 for complete scan
+	uint32_t dropped_points; //!< measurements which didn't fit in scan buffer
+
+	const uint16_t *angle_q14; //!< angle in degrees is angle_q14 * 90 / 16384
+	const uint32_t *dist_mm_q2; //!< distance in mm is dist_mm_q2 / 4, 0 for invalid measurement
+	int size; //!< number of measurements
 };
 
 /**
- * @struct cc_xv11lidar_data
- * @brief Data streamed for XV11 Lidar
- * @see cc_read_all
+ * @struct cc_odometry_history_config
+ * @brief Odometry history configuration
+ *
+ * @see cc_odometry_history_enable
+ */
+struct cc_odometry_history_config
+{
+	int capacity; //!< number of poses kept (rounded up to power of 2), 0 for default (4096)
+	double meters_per_count; //!< distance travelled by wheel per encoder count
+};
+
+/**
+ * @struct cc_pose
+ * @brief Pose integrated from odometry and IMU
+ *
+ * Position starts at origin with the first odometry sample.
+ * For 2D use x, y and yaw_rad.
+ *
+ * @see cc_pose_at
+ */
+struct cc_pose
+{
+	uint64_t mcu_time_us; //!< MCU time unwrapped to 64 bits
+	double x; //!< position in meters
+	double y; //!< position in meters
+	double z; //!< position in meters
+	float qw; //!< orientation quaternion w
+	float qx; //!< orientation quaternion x
+	float qy; //!< orientation quaternion y
+	float qz; //!< orientation quaternion z
+	float yaw_rad; //!< heading (rotation around z axis) in radians
+};
+
+/**
+ * @brief Point cloud output frame
+ *
+ * @see cc_cloud_config
+ */
+enum cc_cloud_frame_enum
+{
+	CC_CLOUD_FRAME_SCAN_END=0, //!< body frame at the time of the last measurement in scan
+	CC_CLOUD_FRAME_SCAN_START=1, //!< body frame at the time of the first measurement in scan
+	CC_CLOUD_FRAME_ODOMETRY=2 //!< odometry (world) frame, origin at the first odometry sample
+};
+
+/**
+ * @struct cc_cloud_config
+ * @brief Point cloud configuration
+ *
+ * Zero initialized config is valid (scan end frame, lidar at body origin).
+ *
+ * @see cc_rplidar_cloud, cc_xv11lidar_cloud
+ */
+struct cc_cloud_config
+{
+	int frame; //!< output frame, one of cc_cloud_frame_enum
+	int knots; //!< poses queried per scan (2-64), points in between are interpolated, 0 for default (8)
+	float mount_x; //!< lidar position in body frame in meters
+	float mount_y; //!< lidar position in body frame in meters
+	float mount_z; //!< lidar position in body frame in meters
+	float mount_yaw_rad; //!< lidar rotation around body z axis in radians
+};
+
+/**
+ * @struct cc_cloud
+ * @brief Motion compensated Cartesian point cloud
+ *
+ * Arrays are provided by the user, \p size is capacity on input and number of points on output.
+ *
+ * @see cc_rplidar_cloud, cc_xv11lidar_cloud
  */
-struct cc_xv11lidar_data
+struct cc_cloud
 {
-	uint32_t timestamp_us; //!< microseconds elapsed since MCU was plugged in
-	uint8_t angle_quad; //!< 0-89 for readings 0-3 356-359
-	uint16_t speed64;	//!< divide by 64 for speed in rpm
-	uint16_t distances[4]; //!< flags and distance or error code
+	float *x; //!< x coordinates in meters
+	float *y; //!< y coordinates in meters
+	float *z; //!< z coordinates in meters, may be NULL for 2D
+	int size; //!< array capacity on input, number of points on output
 };
 
 /**
  * @struct cc_size
  * @brief Array sizes for \p cc_data arrays
  *
+ * Member per message type (CC_PROTOCOL_MESSAGES), e.g. odometry, rplidar, xv11lidar.
+ *
  * @see cc_data
  */
 struct cc_size
 {
-	int odometry;
-	int rplidar;
-	int xv11lidar;
+#define CC_SIZE_MEMBER(NAME, name, type, size) int name;
+	CC_PROTOCOL_MESSAGES(CC_SIZE_MEMBER)
+#undef CC_SIZE_MEMBER
 };
 
 /**
@@ -117,18 +265,283 @@ struct cc_size
  * @brief Structure with multiple types of data returned from the device.
  *
  * Supply only arrays of data your are interested in. Set arrays sizes in \p size member.
+ * Array per message type (CC_PROTOCOL_MESSAGES), e.g. struct cc_odometry_data *odometry.
  *
  * @see cc_read_all
  */
 struct cc_data
 {
-	struct cc_odometry_data *odometry;
-	struct cc_rplidar_data *rplidar;
-	struct cc_xv11lidar_data *xv11lidar;
+#define CC_DATA_MEMBER(NAME, name, type, size) struct cc_##name##_data *name;
+	CC_PROTOCOL_MESSAGES(CC_DATA_MEMBER)
+#undef CC_DATA_MEMBER
 
 	struct cc_size size; //array sizes
 };
 
+/**
+ * @struct cc_columns
+ * @brief Column (structure of arrays) alternative of \p cc_data.
+ *
+ * Each field is decoded straight to its own array, e.g. odometry timestamps,
+ * left encoder counts, quaternion components. Supply only columns you are
+ * interested in, NULL columns are not written. Set arrays sizes (capacity
+ * of all columns of data type) in \p size member.
+ * Columns per message type (CC_PROTOCOL_MESSAGES), e.g. struct cc_odometry_columns odometry.
+ *
+ * @see cc_read_columns
+ */
+struct cc_columns
+{
+#define CC_COLUMNS_MEMBER(NAME, name, type, size) struct cc_##name##_columns name;
+	CC_PROTOCOL_MESSAGES(CC_COLUMNS_MEMBER)
+#undef CC_COLUMNS_MEMBER
+
+	struct cc_size size; //column sizes
+};
+
+/**
+ * @struct cc_message
+ * @brief Read-only view of message in internal library buffer.
+ *
+ * Valid only during cc_message_handler call.
+ * Access fields with cc_message_* functions, decoding is done only on request.
+ *
+ * @see cc_read_each
+ */
+struct cc_message;
+
+/**
+ * @brief User supplied function called for each message in cc_read_each.
+ *
+ * @param msg read-only message view, valid only during the call
+ * @param userdata pointer passed to cc_read_each
+ * @return 0 to continue, non-zero to stop processing (the message is consumed anyway)
+ */
+typedef int (*cc_message_handler)(const struct cc_message *msg, void *userdata);
+
+/**
+ * @struct cc_group
+ * @brief Multiple devices read from single thread with single epoll.
+ *
+ * @see cc_group_init, cc_group_close
+ */
+struct cc_group;
+
+/**
+ * @brief User supplied function called for each message in cc_group_read_each.
+ *
+ * @param source device source id returned from cc_group_add
+ * @param msg read-only message view, valid only during the call
+ * @param userdata pointer passed to cc_group_read_each
+ * @return 0 to continue, non-zero to stop processing (the message is consumed anyway)
+ */
+typedef int (*cc_group_handler)(int source, const struct cc_message *msg, void *userdata);
+
+/**
+ * @brief Policy when asynchronous queue is full
+ * @see cc_async_config
+ */
+enum cc_queue_policy_enum {
+	CC_DROP_NEWEST=0, //!< discard new data until consumer makes space
+	CC_DROP_OLDEST=1 //!< overwrite the oldest data in queue
+	};
+
+/**
+ * @struct cc_async_config
+ * @brief Asynchronous reading configuration
+ *
+ * @see cc_start_async
+ */
+struct cc_async_config
+{
+	struct cc_size capacity; //!< queue capacities (rounded up to power of 2), 0 to discard data type
+	int policy; //!< CC_DROP_NEWEST or CC_DROP_OLDEST
+	int cpu; //!< pin reader thread to cpu, -1 for no pinning
+	int priority; //!< SCHED_FIFO priority for reader thread, 0 for default scheduling
+};
+
+/**
+ * @struct cc_decode_config
+ * @brief Offline decoding configuration
+ *
+ * Zero initialized fields mean library defaults.
+ *
+ * @see cc_decode_buffer
+ */
+struct cc_decode_config
+{
+	int threads; //!< worker threads including calling thread, 0 for online CPU count
+	int chunk_bytes; //!< nominal chunk size, 0 for default (1 MiB)
+};
+
+/**
+ * @struct cc_async_stats
+ * @brief Asynchronous reading statistics
+ *
+ * Member per message type (CC_PROTOCOL_MESSAGES), e.g. dropped_odometry
+ * counts odometry data dropped due to full queue.
+ *
+ * @see cc_get_async_stats
+ */
+struct cc_async_stats
+{
+#define CC_ASYNC_STATS_MEMBER(NAME, name, type, size) uint64_t dropped_##name;
+	CC_PROTOCOL_MESSAGES(CC_ASYNC_STATS_MEMBER)
+#undef CC_ASYNC_STATS_MEMBER
+};
+
+/**
+ * @struct cc_merge
+ * @brief Time-ordered merge of messages of all types from multiple sources.
+ *
+ * @see cc_merge_init, cc_merge_close
+ */
+struct cc_merge;
+
+/**
+ * @struct cc_merge_config
+ * @brief Merged event stream configuration
+ *
+ * Zero initialized fields mean library defaults.
+ *
+ * @see cc_merge_init
+ */
+struct cc_merge_config
+{
+	int sources; //!< number of sources, source ids are in [0, sources), 0 for 1
+	int capacity; //!< messages buffered per source and message type (rounded up to power of 2), 0 for default (1024)
+	uint32_t window_us; //!< reorder window, 0 for default (20000 us)
+};
+
+/**
+ * @struct cc_event
+ * @brief Tagged record of merged event stream
+ *
+ * @see cc_merge_read
+ */
+struct cc_event
+{
+	uint64_t time_us; //!< ordering key, host_time_us of the message
+	int type; //!< message type, e.g. CC_MESSAGE_ODOMETRY
+	int source; //!< source id, e.g. from cc_group_add
+	union
+	{
+#define CC_EVENT_MEMBER(NAME, name, type, size) struct cc_##name##_data name;
+		CC_PROTOCOL_MESSAGES(CC_EVENT_MEMBER)
+#undef CC_EVENT_MEMBER
+	} data; //!< message data of \p type, e.g. odometry for CC_MESSAGE_ODOMETRY
+};
+
+/**
+ * @struct cc_events
+ * @brief User supplied array of events
+ *
+ * @see cc_merge_read
+ */
+struct cc_events
+{
+	struct cc_event *events; //!< user array
+	int size; //!< array capacity on input, number of events on output
+};
+
+/**
+ * @struct cc_merge_stats
+ * @brief Merged event stream statistics
+ *
+ * @see cc_merge_get_stats
+ */
+struct cc_merge_stats
+{
+	uint64_t events; //!< events returned in time order
+	uint64_t late; //!< messages dropped because they arrived after later events were returned
+	uint64_t dropped; //!< the oldest messages dropped due to full buffer (events not read in time)
+};
+
+/**
+ * @struct cc_shm
+ * @brief Shared memory broadcast of decoded data to multiple local processes.
+ *
+ * Publisher (e.g. cc-shmd) owns the device and the segment, readers attach to it.
+ *
+ * @see cc_shm_create, cc_shm_attach, cc_shm_close
+ */
+struct cc_shm;
+
+/**
+ * @struct cc_shm_lag
+ * @brief Shared memory reader lag
+ *
+ * Member per message type (CC_PROTOCOL_MESSAGES), e.g. dropped_odometry
+ * counts odometry data overwritten by publisher before it was read.
+ *
+ * @see cc_shm_get_lag
+ */
+struct cc_shm_lag
+{
+#define CC_SHM_LAG_MEMBER(NAME, name, type, size) uint64_t dropped_##name;
+	CC_PROTOCOL_MESSAGES(CC_SHM_LAG_MEMBER)
+#undef CC_SHM_LAG_MEMBER
+	struct cc_size pending; //!< data published but not read yet
+};
+
+/**
+ * @brief Number of log2 histogram buckets in \p cc_stats
+ */
+enum {CC_STATS_BUCKETS=24};
+
+/**
+ * @struct cc_stats
+ * @brief Runtime statistics and health counters
+ *
+ * Counters are cumulative since cc_init. Histogram bucket 0 counts zeros,
+ * bucket i counts values in [2^(i-1), 2^i), the last bucket also counts larger values.
+ *
+ * @see cc_get_stats
+ */
+struct cc_stats
+{
+	uint64_t bytes_read; //!< bytes read from device (or replay)
+	uint64_t reads; //!< read() calls returning data, bytes_read / reads is mean read size
+#define CC_STATS_FRAMES_MEMBER(NAME, name, type, size) uint64_t name##_frames;
+	CC_PROTOCOL_MESSAGES(CC_STATS_FRAMES_MEMBER) //validated frames per type, e.g. odometry_frames
+#undef CC_STATS_FRAMES_MEMBER
+	uint64_t skipped_bytes; //!< bytes discarded while resynchronizing (see cc_skipped_bytes)
+	uint64_t user_array_full; //!< reads stopped because user array was full (data kept pending, not lost)
+	uint64_t data_pending; //!< CC_DATA_PENDING returned by cc_read_all, cc_read_each
+#define CC_STATS_DROPPED_MEMBER(NAME, name, type, size) uint64_t dropped_##name;
+	CC_PROTOCOL_MESSAGES(CC_STATS_DROPPED_MEMBER) //dropped due to full asynchronous queue per type, e.g. dropped_odometry
+#undef CC_STATS_DROPPED_MEMBER
+	uint64_t rplidar_sequence_gaps[256]; //!< rplidar capsules missed (sequence gaps) per device_id
+	uint64_t rplidar_route_dropped[256]; //!< rplidar capsules dropped due to full per device queue (cc_rplidar_route)
+	uint64_t recv_time_histogram[CC_STATS_BUCKETS]; //!< time spent waiting for and reading data in microseconds
+	uint64_t read_size_histogram[CC_STATS_BUCKETS]; //!< bytes per read() call
+	uint64_t log_messages; //!< messages written to compressed log (cc_log_start)
+	uint64_t log_raw_bytes; //!< bytes of logged messages before compression (in written blocks)
+	uint64_t log_written_bytes; //!< bytes of compressed log blocks written to file
+	int low_latency; //!< 1 if serial driver applied ASYNC_LOW_LATENCY requested in cc_config, 0 otherwise
+};
+
+/**
+ * @struct cc_config
+ * @brief Device and reading configuration
+ *
+ * Zero initialized fields mean library defaults.
+ *
+ * For logging nodes larger buffer and VMIN/VTIME batching reduce number of
+ * wakeups. For control nodes defaults with low_latency minimize delay.
+ *
+ * @see cc_init_ex
+ */
+struct cc_config
+{
+	int buffer_size; //!< minimal ring buffer size in bytes (rounded up to page size), default 2048
+	int init_timeout_ms; //!< wait for first data in cc_init_ex, default 5000
+	int read_timeout_ms; //!< wait for data in reading functions, default 100
+	int vmin; //!< termios VMIN, minimum bytes returned by single read (1-255), default 1
+	int vtime; //!< termios VTIME, inter-byte timeout in tenths of second (0-255), default 0
+	int low_latency; //!< non-zero to request ASYNC_LOW_LATENCY from serial driver (best effort, see cc_stats)
+};
+
 /***
 	* @brief Constants returned by most of library functions
 	*/
@@ -162,6 +575,41 @@ enum cc_retval_enum {
  */
 struct cc *cc_init(const char *tty);
 
+/**
+ * @brief initialize internal library data with custom configuration.
+ *
+ * Like cc_init but buffer size, timeouts and serial settings are taken
+ * from \p config. After configuring the device settings are read back and
+ * initialization fails if any was not applied (raw mode, speed, VMIN, VTIME).
+ *
+ * With VMIN greater than 1 single read blocks until VMIN bytes arrive or
+ * VTIME expires after the last byte. This batches data at the cost of latency.
+ *
+ * Low latency is requested on best effort basis. Not all drivers support it
+ * (e.g. cdc_acm ttyACM devices accept but ignore the flag, which is fine as
+ * USB CDC has no latency timer). Check low_latency in cc_get_stats
+ * whether it was applied.
+ *
+ * @param tty device like "/dev/ttyACM0"
+ * @param config configuration, NULL or zero initialized fields for defaults
+ * @return
+ * - pointer to internal library data
+ * - NULL on error with errno set (EINVAL for invalid config, EIO if settings were not applied)
+ *
+ * @see cc_init, cc_close
+ *
+ * Example:
+ * @code
+ * //logging node, batch reads
+ * struct cc_config config={0};
+ * config.buffer_size=65536;
+ * config.vmin=255;
+ * config.vtime=1;
+ * struct cc *c=cc_init_ex("/dev/ttyACM0", &config);
+ * @endcode
+ */
+struct cc *cc_init_ex(const char *tty, const struct cc_config *config);
+
 /**
  * @brief free library resources
  *
@@ -206,15 +654,1077 @@ int cc_close(struct cc *c);
 int cc_read_all(struct cc *c, struct cc_data *data);
 
 /**
- * @brief Get file descriptor used for serial communication with the device
+ * @brief Read multiple types of data simultanously in columns.
  *
- * Library user should not directly read or write from or to descriptor.
- * This function is intended to be used in synchronous I/O multiplexing (select, poll).
+ * The same as cc_read_all but data is decoded to column arrays
+ * (structure of arrays) which suits vectorized processing.
+ *
+ * Data types with 0 size in \p columns parameter are discarded silently without parsing.
+ * Scan assembly, odometry history and RPLidar routing work the same as with cc_read_all.
  *
  * @param c pointer to internal library data
- * @return file descriptor
+ * @param columns user supplied column arrays with sizes
+ * @return
+ * - CC_OK indicates user columns in \p columns parameter were filled
+ * - CC_DATA_PENDING indicates columns of at least one data type were filled completely and more data is pending (without blocking)
+ * - CC_ERROR indicates error, query errno for the details
+ *
+ * Example:
+ * @code
+ * uint32_t timestamps[64];
+ * int32_t left[64], right[64];
+ * struct cc_columns columns={0};
+ *
+ * columns.odometry.timestamp_us=timestamps;
+ * columns.odometry.left_encoder_counts=left;
+ * columns.odometry.right_encoder_counts=right;
+ * columns.size.odometry=64;
+ *
+ * if(cc_read_columns(c, &columns) != CC_ERROR)
+ * 	for(int i=0;i<columns.size.odometry;++i)
+ * 		printf("%u %d %d\n", timestamps[i], left[i], right[i]);
+ * @endcode
  */
-int cc_fd(struct cc *c);
+int cc_read_columns(struct cc *c, struct cc_columns *columns);
+
+/**
+ * @brief Map unwrapped MCU time to host clock.
+ *
+ * Library keeps online model of MCU to host clock mapping (offset and drift).
+ * The model is fitted to the lower envelope of host receive time - MCU time,
+ * so it is robust to transport delays and USB batching. Model is updated
+ * with each message and adapts in first few seconds of communication.
+ *
+ * Host clock is CLOCK_MONOTONIC.
+ *
+ * @param c pointer to internal library data
+ * @param mcu_time_us MCU time unwrapped to 64 bits (e.g. \p mcu_time_us of data)
+ * @return host CLOCK_MONOTONIC microseconds
+ */
+uint64_t cc_host_time_us(struct cc *c, uint64_t mcu_time_us);
+
+/**
+ * @brief Decode RPLidar capsules to angle/distance measurements.
+ *
+ * Capsule can be decoded only after the next capsule from the same device arrives.
+ * Library keeps the previous capsule for each \p device_id internally.
+ * Each call decodes ::CC_RPLIDAR_CAPSULE_POINTS measurements for every
+ * capsule with previous capsule available.
+ *
+ * Supply consecutive capsules from cc_read_all in order of arrival.
+ *
+ * The decoding is the same as _ultraCapsuleToNormal in RPLidar SDK.
+ * The distances are unpacked with SSE2 vectorized kernel when compiled for it.
+ *
+ * @param c pointer to internal library data
+ * @param capsules capsules returned from cc_read_all
+ * @param size number of capsules
+ * @param points user supplied arrays, at least size * ::CC_RPLIDAR_CAPSULE_POINTS
+ * @return
+ * - CC_OK on success, number of decoded measurements in \p points size member
+ * - CC_ERROR on error with errno set (ENOBUFS if \p points arrays are too small)
+ */
+int cc_rplidar_decode(struct cc *c, const struct cc_rplidar_data *capsules, int size, struct cc_rplidar_points *points);
+
+/**
+ * @brief Enable assembling full revolution scans for RPLidar device.
+ *
+ * Once enabled capsules of \p device_id are assembled to scans while reading
+ * (cc_read_all, cc_read_each, asynchronous reading) even if user doesn't
+ * request rplidar data. Revolution boundary is detected from capsule start
+ * angles. The first partial revolution is discarded.
+ *
+ * Scan buffers are allocated here, assembly itself never allocates.
+ * Enable before reading, in particular before cc_start_async.
+ * Buffers are freed in cc_close.
+ *
+ * @param c pointer to internal library data
+ * @param device_id RPLidar device id
+ * @param max_points capacity of single scan, 0 for default (8192)
+ * @return
+ * - CC_OK on success (also if already enabled)
+ * - CC_ERROR on error with errno set
+ *
+ * @see cc_rplidar_scan
+ */
+int cc_rplidar_scan_enable(struct cc *c, uint8_t device_id, int max_points);
+
+/**
+ * @brief Get the newest complete RPLidar scan.
+ *
+ * Scans are published through triple buffer. Reading thread never waits for
+ * consumer, unconsumed scans are overwritten by newer ones (see \p number).
+ * May be called from different thread than reading (e.g. with cc_start_async),
+ * but only from one thread.
+ *
+ * @param c pointer to internal library data
+ * @param device_id RPLidar device id
+ * @param scan the newest scan returned here, arrays valid until next call for the device
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error with errno set (EAGAIN if no new scan, EINVAL if not enabled for device)
+ *
+ * Example:
+ * @code
+ * cc_rplidar_scan_enable(c, 0, 0);
+ * //... read with cc_read_all
+ * struct cc_rplidar_scan scan;
+ * if(cc_rplidar_scan(c, 0, &scan) == CC_OK)
+ * 	printf("scan %u with %d points\n", scan.number, scan.size);
+ * @endcode
+ */
+int cc_rplidar_scan(struct cc *c, uint8_t device_id, struct cc_rplidar_scan *scan);
+
+/** @name RPLidar routing
+ */
+///@{
+
+/**
+ * @brief Route RPLidar device capsules to its own queue.
+ *
+ * Once routed capsules of \p device_id are no longer returned in cc_data rplidar array
+ * by cc_read_all (and asynchronous reading). They are queued for the device instead
+ * and read with cc_rplidar_read. The queue never stops reading, when full the \p policy
+ * decides which capsules are dropped (counted in cc_stats rplidar_route_dropped).
+ * Busy lidar can't fill the shared array and push other data into CC_DATA_PENDING cycles.
+ *
+ * Capsules are routed only through cc_data interface, cc_read_each still visits all messages.
+ * Queue is allocated here and freed in cc_close. Route before reading,
+ * in particular before cc_start_async.
+ *
+ * @param c pointer to internal library data
+ * @param device_id RPLidar device id
+ * @param capacity queue capacity in capsules (rounded up to power of 2)
+ * @param policy CC_DROP_NEWEST or CC_DROP_OLDEST
+ * @return
+ * - CC_OK on success (also if already routed)
+ * - CC_ERROR on error with errno set (EINVAL for invalid capacity or policy)
+ *
+ * @see cc_rplidar_read
+ *
+ * Example:
+ * @code
+ * cc_rplidar_route(c, 0, 256, CC_DROP_OLDEST);
+ * cc_rplidar_route(c, 1, 256, CC_DROP_OLDEST);
+ * @endcode
+ */
+int cc_rplidar_route(struct cc *c, uint8_t device_id, int capacity, int policy);
+
+/**
+ * @brief Read capsules routed to RPLidar device queue.
+ *
+ * Never blocks. Call after cc_read_all (or at any time with asynchronous reading).
+ * Queue is single producer single consumer, with asynchronous reading
+ * call for the device from one thread only.
+ *
+ * @param c pointer to internal library data
+ * @param device_id RPLidar device id
+ * @param data user supplied array
+ * @param size array size
+ * @return
+ * - number of capsules read (0 if queue is empty)
+ * - CC_ERROR on error with errno set (EINVAL if device is not routed)
+ *
+ * Example:
+ * @code
+ * struct cc_rplidar_data capsules[64];
+ * while(cc_read_all(c, &data) != CC_ERROR)
+ * 	for(int id=0;id<2;++id)
+ * 	{
+ * 		int n=cc_rplidar_read(c, id, capsules, 64);
+ * 		//process n capsules of lidar id
+ * 	}
+ * @endcode
+ */
+int cc_rplidar_read(struct cc *c, uint8_t device_id, struct cc_rplidar_data *data, int size);
+
+///@}
+
+/**
+ * @brief Decode XV11 readings to angle/range measurements.
+ *
+ * Each reading is decoded to ::CC_XV11LIDAR_READING_POINTS measurements.
+ * Measurements are decoded without branching, with SSE2 when compiled for it.
+ *
+ * @param readings readings returned from cc_read_all
+ * @param size number of readings
+ * @param points user supplied arrays, at least size * ::CC_XV11LIDAR_READING_POINTS
+ * @return
+ * - CC_OK on success, number of decoded measurements in \p points size member
+ * - CC_ERROR on error with errno set (ENOBUFS if \p points arrays are too small)
+ */
+int cc_xv11lidar_decode(const struct cc_xv11lidar_data *readings, int size, struct cc_xv11lidar_points *points);
+
+/**
+ * @brief Enable assembling XV11 revolutions.
+ *
+ * Once enabled readings are assembled to revolutions while reading
+ * (cc_read_all, cc_read_each, asynchronous reading) even if user doesn't
+ * request xv11lidar data. Revolution boundary is where angle_quad decreases.
+ * The first partial revolution is discarded.
+ *
+ * Scan objects are allocated here, assembly itself never allocates.
+ * Enable before reading, in particular before cc_start_async.
+ *
+ * @param c pointer to internal library data
+ * @return
+ * - CC_OK on success (also if already enabled)
+ * - CC_ERROR on error with errno set
+ *
+ * @see cc_xv11lidar_scan
+ */
+int cc_xv11lidar_scan_enable(struct cc *c);
+
+/**
+ * @brief Get the newest complete XV11 revolution.
+ *
+ * Revolutions are published through triple buffer like in cc_rplidar_scan.
+ * Use cc_host_time_us from reading thread to map ray times to host clock.
+ *
+ * @param c pointer to internal library data
+ * @param scan pointer to library owned scan returned here, valid until next call
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error with errno set (EAGAIN if no new revolution, EINVAL if not enabled)
+ *
+ * Example:
+ * @code
+ * const struct cc_xv11lidar_scan *scan;
+ * if(cc_xv11lidar_scan(c, &scan) == CC_OK)
+ * 	printf("range at 90 deg %f\n", scan->range_m[90]);
+ * @endcode
+ */
+int cc_xv11lidar_scan(struct cc *c, const struct cc_xv11lidar_scan **scan);
+
+/** @name Odometry history
+ */
+///@{
+
+/**
+ * @brief Enable odometry history.
+ *
+ * Once enabled odometry is integrated to poses while reading
+ * (cc_read_all, cc_read_each, asynchronous reading) even if user doesn't
+ * request odometry data. Distance is the mean of wheel distances and is
+ * applied along the body forward (x) axis rotated by IMU quaternion.
+ *
+ * Poses are kept in preallocated ring indexed by MCU time,
+ * the oldest are overwritten. History starts over if MCU time goes back.
+ * Enable before reading, in particular before cc_start_async.
+ *
+ * @param c pointer to internal library data
+ * @param config history configuration
+ * @return
+ * - CC_OK on success (also if already enabled)
+ * - CC_ERROR on error with errno set (EINVAL for invalid config)
+ *
+ * @see cc_pose_at
+ *
+ * Example:
+ * @code
+ * struct cc_odometry_history_config config={ 8192, 0.0005 };
+ * cc_odometry_history_enable(c, &config);
+ * @endcode
+ */
+int cc_odometry_history_enable(struct cc *c, const struct cc_odometry_history_config *config);
+
+/**
+ * @brief Get pose at MCU time.
+ *
+ * Binary search in history, O(log n). Position is interpolated linearly,
+ * orientation with spherical linear interpolation (slerp).
+ *
+ * May be called from different threads than reading (e.g. with cc_start_async).
+ * Function never blocks nor makes system calls.
+ *
+ * History is written without locking. If reading overwrites any sample
+ * the search used (it reached the oldest samples while history is full)
+ * or resets history meanwhile, the search is retried. After a few failed
+ * attempts function fails with EAGAIN, the caller may retry (e.g. with
+ * newer time) or enable larger history.
+ *
+ * @param c pointer to internal library data
+ * @param mcu_time_us MCU time unwrapped to 64 bits (e.g. scan or ray time)
+ * @param pose interpolated pose returned here
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error with errno set (ERANGE if time is outside of history,
+ *   EINVAL if not enabled, EAGAIN if history was overwritten during the call)
+ */
+int cc_pose_at(struct cc *c, uint64_t mcu_time_us, struct cc_pose *pose);
+
+///@}
+
+/** @name Point clouds
+ */
+///@{
+
+/**
+ * @brief Motion compensated (de-skewed) point cloud from RPLidar scan.
+ *
+ * Measurements are taken while the robot moves. Each point is transformed
+ * with pose at its measurement time. Poses are queried from odometry history
+ * at knots evenly spaced over the scan and interpolated in between.
+ * Measurement times are spread evenly between the first and the last capsule.
+ *
+ * Invalid measurements (distance 0) are skipped. Uses lookup table and SIMD,
+ * full scan takes small fraction of scan period.
+ *
+ * Requires odometry history (cc_odometry_history_enable).
+ *
+ * @param c pointer to internal library data
+ * @param scan scan from cc_rplidar_scan
+ * @param config cloud configuration, NULL for defaults
+ * @param cloud user supplied arrays, size is capacity on input and number of points on output
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error with errno set (ENOBUFS if capacity is smaller than scan size,
+ *   ERANGE if odometry history doesn't cover the scan yet - retry later,
+ *   EINVAL if history is not enabled or config is invalid)
+ *
+ * @see cc_rplidar_scan, cc_odometry_history_enable
+ *
+ * Example:
+ * @code
+ * float x[8192], y[8192];
+ * struct cc_cloud cloud={x, y, NULL, 8192};
+ * struct cc_cloud_config config={CC_CLOUD_FRAME_SCAN_END, 0, 0.1f, 0.0f, 0.2f, 0.0f};
+ * if(cc_rplidar_scan(c, 0, &scan) == CC_OK && cc_rplidar_cloud(c, &scan, &config, &cloud) == CC_OK)
+ * 	printf("%d points\n", cloud.size);
+ * @endcode
+ */
+int cc_rplidar_cloud(struct cc *c, const struct cc_rplidar_scan *scan, const struct cc_cloud_config *config, struct cc_cloud *cloud);
+
+/**
+ * @brief Motion compensated (de-skewed) point cloud from XV11 lidar revolution.
+ *
+ * Like cc_rplidar_cloud but uses per ray times. Invalid and missing rays are skipped.
+ * Cloud capacity has to be at least CC_XV11LIDAR_SCAN_RAYS.
+ *
+ * @param c pointer to internal library data
+ * @param scan revolution from cc_xv11lidar_scan
+ * @param config cloud configuration, NULL for defaults
+ * @param cloud user supplied arrays, size is capacity on input and number of points on output
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error with errno set (like cc_rplidar_cloud)
+ *
+ * @see cc_xv11lidar_scan, cc_odometry_history_enable
+ */
+int cc_xv11lidar_cloud(struct cc *c, const struct cc_xv11lidar_scan *scan, const struct cc_cloud_config *config, struct cc_cloud *cloud);
+
+///@}
+
+/** @name Zero-copy message visiting
+ */
+///@{
+
+/**
+ * @brief Visit each message without copying.
+ *
+ * Alternative to cc_read_all. Calls \p handler for each validated message
+ * with read-only view into internal library buffer. Nothing is decoded
+ * unless requested from \p handler with cc_message_* functions.
+ *
+ * Function will block waiting for data unless last call returned CC_DATA_PENDING.
+ *
+ * @param c pointer to internal library data
+ * @param handler user function called for each message
+ * @param userdata passed to \p handler
+ * @return
+ * - CC_OK indicates all available messages were visited
+ * - CC_DATA_PENDING indicates \p handler requested stop and more messages are pending (without blocking)
+ * - CC_ERROR indicates error, query errno for the details
+ *
+ * Example:
+ * @code
+ * int forward(const struct cc_message *msg, void *userdata)
+ * {
+ * 	if(cc_message_type(msg) == CC_MESSAGE_RPLIDAR)
+ * 		write(*(int*)userdata, cc_message_bytes(msg), cc_message_size(msg));
+ * 	return 0;
+ * }
+ *
+ * cc_read_each(c, forward, &fd);
+ * @endcode
+ */
+int cc_read_each(struct cc *c, cc_message_handler handler, void *userdata);
+
+/**
+ * @brief Get message type.
+ * @param msg message view
+ * @return one of ::cc_message_type_enum
+ */
+int cc_message_type(const struct cc_message *msg);
+
+/**
+ * @brief Get message size in bytes (including start, size, type and end bytes).
+ * @param msg message view
+ * @return message size
+ */
+int cc_message_size(const struct cc_message *msg);
+
+/**
+ * @brief Get raw message bytes (starting with start byte).
+ * @param msg message view
+ * @return cc_message_size bytes valid during handler call
+ */
+const uint8_t *cc_message_bytes(const struct cc_message *msg);
+
+/**
+ * @brief Get raw message payload (starting with timestamp).
+ * @param msg message view
+ * @return payload bytes valid during handler call
+ */
+const uint8_t *cc_message_payload(const struct cc_message *msg);
+
+/**
+ * @brief Get message timestamp.
+ * @param msg message view
+ * @return microseconds elapsed since MCU was plugged in
+ */
+uint32_t cc_message_timestamp_us(const struct cc_message *msg);
+
+/**
+ * @brief Get message timestamp unwrapped to 64 bits.
+ * @param msg message view
+ * @return microseconds elapsed since MCU was plugged in
+ */
+uint64_t cc_message_mcu_time_us(const struct cc_message *msg);
+
+/**
+ * @brief Get message timestamp in host clock domain.
+ * @param msg message view
+ * @return host CLOCK_MONOTONIC microseconds
+ * @see cc_host_time_us
+ */
+uint64_t cc_message_host_time_us(const struct cc_message *msg);
+
+/**
+ * @brief Get message estimated transport latency.
+ * @param msg message view
+ * @return microseconds between host_time_us and host receive time
+ */
+uint32_t cc_message_latency_us(const struct cc_message *msg);
+
+/**
+ * @brief Get RPLidar device id, valid only for ::CC_MESSAGE_RPLIDAR
+ * @param msg message view
+ * @return device id
+ */
+uint8_t cc_message_rplidar_device_id(const struct cc_message *msg);
+
+/**
+ * @brief Get RPLidar sequence, valid only for ::CC_MESSAGE_RPLIDAR
+ * @param msg message view
+ * @return sequence
+ */
+uint8_t cc_message_rplidar_sequence(const struct cc_message *msg);
+
+/**
+ * @brief Get RPLidar capsule in place, valid only for ::CC_MESSAGE_RPLIDAR
+ * @param msg message view
+ * @return capsule valid during handler call
+ */
+const rplidar_response_ultra_capsule_measurement_nodes_t *cc_message_rplidar_capsule(const struct cc_message *msg);
+
+// cc_message_odometry, cc_message_rplidar, cc_message_xv11lidar decoding functions are in cc_protocol.h
+
+///@}
+
+/** @name Asynchronous reading
+ */
+///@{
+
+/**
+ * @brief Start reading in background thread.
+ *
+ * Reader thread drains the device and pushes data to lock-free
+ * single producer single consumer queues (one for each data type).
+ * Consume data with cc_read_async.
+ *
+ * Don't call cc_read_all while asynchronous reading is running.
+ *
+ * Setting SCHED_FIFO priority typically requires privileges (CAP_SYS_NICE).
+ *
+ * @param c pointer to internal library data
+ * @param config queues and reader thread configuration, NULL for defaults
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error, query errno for the details
+ *
+ * @see cc_read_async, cc_stop_async
+ *
+ * Example:
+ * @code
+ * struct cc_async_config config={ {1024, 1024, 0}, CC_DROP_OLDEST, 2, 50 };
+ * cc_start_async(c, &config);
+ * @endcode
+ */
+int cc_start_async(struct cc *c, const struct cc_async_config *config);
+
+/**
+ * @brief Pop data queued by reader thread.
+ *
+ * Function never blocks nor makes system calls.
+ * Semantics of \p data is the same as in cc_read_all.
+ *
+ * @param c pointer to internal library data
+ * @param data user supplied arrays with sizes
+ * @return
+ * - CC_OK indicates user arrays in \p data parameter were filled with all queued data (possibly none)
+ * - CC_DATA_PENDING indicates more data is queued (of types with non zero size in \p data)
+ * - CC_ERROR indicates reader thread failed and queues of types with non zero size are drained, query errno for the details
+ */
+int cc_read_async(struct cc *c, struct cc_data *data);
+
+/**
+ * @brief Stop reading in background thread.
+ *
+ * Queued data is discarded. May be safely called if reading is not running.
+ * Called automatically from cc_close.
+ *
+ * @param c pointer to internal library data
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error, query errno for the details
+ */
+int cc_stop_async(struct cc *c);
+
+/**
+ * @brief Get asynchronous reading statistics.
+ *
+ * @param c pointer to internal library data
+ * @param stats statistics returned here
+ */
+void cc_get_async_stats(struct cc *c, struct cc_async_stats *stats);
+
+///@}
+
+/** @name Multiple devices
+ */
+///@{
+
+/**
+ * @brief Create empty device group.
+ *
+ * Group waits for all devices at once and reads only those which have data,
+ * device timeouts don't serialize reading. Group doesn't own devices.
+ *
+ * @return
+ * - pointer to group
+ * - NULL on error with errno set
+ *
+ * @see cc_group_add, cc_group_read_all, cc_group_read_each, cc_group_close
+ *
+ * Example:
+ * @code
+ * struct cc_group *g=cc_group_init();
+ * int front=cc_group_add(g, cc_init("/dev/ttyACM0"));
+ * int rear=cc_group_add(g, cc_init("/dev/ttyACM1"));
+ * @endcode
+ */
+struct cc_group *cc_group_init(void);
+
+/**
+ * @brief Free group resources.
+ *
+ * Devices are not closed. May be safely called with NULL argument.
+ *
+ * @param g group
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error, query errno for the details
+ */
+int cc_group_close(struct cc_group *g);
+
+/**
+ * @brief Add device to group.
+ *
+ * Don't read the device directly while it is in group.
+ * Remove the device from group before closing it.
+ *
+ * @param g group
+ * @param c pointer to internal library data from cc_init
+ * @return
+ * - source id (non-negative, the lowest free) tagging data of the device
+ * - CC_ERROR on error with errno set (EINVAL for replay, EBUSY with asynchronous reading)
+ */
+int cc_group_add(struct cc_group *g, struct cc *c);
+
+/**
+ * @brief Remove device from group.
+ *
+ * Source id may be reused by next cc_group_add.
+ *
+ * @param g group
+ * @param source source id returned from cc_group_add
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error, query errno for the details
+ */
+int cc_group_remove(struct cc_group *g, int source);
+
+/**
+ * @brief Read multiple types of data from all devices which are ready.
+ *
+ * Blocks up to \p timeout_ms until any device has data. Each device is read
+ * at most once per call. Semantics of every \p data element is the same as in
+ * cc_read_all, devices which were not ready get zero sizes.
+ *
+ * Device which fails (e.g. unplugged) is removed from waiting and
+ * its errno is available with cc_group_error.
+ *
+ * @param g group
+ * @param data user supplied arrays with sizes, array indexed by source id
+ * @param timeout_ms maximum wait time, -1 for infinite
+ * @return
+ * - CC_OK indicates data was read from ready devices
+ * - CC_DATA_PENDING indicates more data is pending for some device without blocking
+ * - CC_ERROR indicates error, query errno for the details (EAGAIN on timeout, ENODEV with no working devices)
+ */
+int cc_group_read_all(struct cc_group *g, struct cc_data *data, int timeout_ms);
+
+/**
+ * @brief Visit messages from all devices which are ready.
+ *
+ * Like cc_group_read_all but messages are visited in place as in cc_read_each.
+ *
+ * @param g group
+ * @param handler function called for each message with source id
+ * @param userdata passed to \p handler
+ * @param timeout_ms maximum wait time, -1 for infinite
+ * @return
+ * - CC_OK indicates messages from ready devices were visited
+ * - CC_DATA_PENDING indicates handler requested stop and more data is pending without blocking
+ * - CC_ERROR indicates error, query errno for the details (EAGAIN on timeout, ENODEV with no working devices)
+ */
+int cc_group_read_each(struct cc_group *g, cc_group_handler handler, void *userdata, int timeout_ms);
+
+/**
+ * @brief Get error of device removed from waiting.
+ *
+ * @param g group
+ * @param source source id returned from cc_group_add
+ * @return errno value of device failure, 0 if device is working
+ */
+int cc_group_error(struct cc_group *g, int source);
+
+///@}
+
+/** @name Merged event stream
+ */
+///@{
+
+/**
+ * @brief Create time-ordered merge of messages.
+ *
+ * Messages of all types from all sources are returned as single sequence
+ * of tagged events ordered by host time (common for all devices).
+ * Message is held until the newest host time seen is at least reorder window
+ * later, so messages arriving out of order within window are still returned in order.
+ *
+ * All the memory is allocated here, pushing and reading doesn't allocate.
+ *
+ * @param config merge configuration, NULL for defaults
+ * @return
+ * - pointer to merge
+ * - NULL on error with errno set (EINVAL for invalid configuration)
+ *
+ * @see cc_merge_push, cc_group_read_merged, cc_merge_read, cc_merge_close
+ *
+ * Example:
+ * @code
+ * struct cc_merge_config config={2, 0, 0}; //two devices, default capacity and window
+ * struct cc_merge *m=cc_merge_init(&config);
+ * @endcode
+ */
+struct cc_merge *cc_merge_init(const struct cc_merge_config *config);
+
+/**
+ * @brief Free merge resources.
+ *
+ * May be safely called with NULL argument.
+ *
+ * @param m merge
+ */
+void cc_merge_close(struct cc_merge *m);
+
+/**
+ * @brief Add data read with cc_read_all (or cc_read_async, cc_shm_read_all) to merge.
+ *
+ * Data is copied. Message older than event already returned is dropped (late).
+ * If buffer of source and message type is full the oldest message is dropped.
+ *
+ * @param m merge
+ * @param source source id in [0, sources)
+ * @param data data with sizes
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error with errno set (EINVAL for invalid source)
+ */
+int cc_merge_push(struct cc_merge *m, int source, const struct cc_data *data);
+
+/**
+ * @brief Read from all devices of group which are ready and add messages to merge.
+ *
+ * Like cc_group_read_each with source ids of group, messages are decoded
+ * directly to merge buffers. Then returns events ready in time order as cc_merge_read.
+ *
+ * @param g group
+ * @param m merge with sources covering group source ids
+ * @param events user supplied array, size is capacity on input and number of events on output
+ * @param timeout_ms maximum wait time, -1 for infinite
+ * @return
+ * - CC_OK on success
+ * - CC_DATA_PENDING indicates more events are ready, call cc_merge_read
+ * - CC_ERROR indicates error, query errno for the details (EAGAIN on timeout, ENODEV with no working devices)
+ */
+int cc_group_read_merged(struct cc_group *g, struct cc_merge *m, struct cc_events *events, int timeout_ms);
+
+/**
+ * @brief Get events ready in time order.
+ *
+ * Event is ready when it is older than the newest host time seen minus reorder window
+ * (or was added before cc_merge_flush). Sources and message types are merged with k-way merge.
+ *
+ * @param m merge
+ * @param events user supplied array, size is capacity on input and number of events on output
+ * @return
+ * - CC_OK if all ready events were returned
+ * - CC_DATA_PENDING if array is full and more events are ready
+ */
+int cc_merge_read(struct cc_merge *m, struct cc_events *events);
+
+/**
+ * @brief Make all messages added so far ready regardless of reorder window.
+ *
+ * Use at the end of data (e.g. replay or device disconnected), then read with cc_merge_read.
+ *
+ * @param m merge
+ */
+void cc_merge_flush(struct cc_merge *m);
+
+/**
+ * @brief Get merged event stream statistics.
+ *
+ * @param m merge
+ * @param stats statistics returned here
+ */
+void cc_merge_get_stats(struct cc_merge *m, struct cc_merge_stats *stats);
+
+///@}
+
+/** @name Shared memory
+ */
+///@{
+
+/**
+ * @brief Create shared memory segment for publishing data.
+ *
+ * Each data type is published to broadcast ring of \p capacity latest data.
+ * Publisher never waits for readers, slow readers lose the oldest data
+ * (reported by cc_shm_get_lag). Existing segment with the same name is replaced.
+ *
+ * Readers have to be built with the same library version (data layout is checked on attach).
+ *
+ * @param name POSIX shared memory name, e.g. "/cave-crawler"
+ * @param capacity ring capacities (rounded up to power of 2), 0 to not publish data type, NULL for defaults
+ * @return
+ * - pointer to publisher
+ * - NULL on error with errno set
+ *
+ * @see cc_shm_publish, cc_shm_close
+ *
+ * Example:
+ * @code
+ * struct cc_shm *shm=cc_shm_create("/cave-crawler", NULL);
+ *
+ * while(cc_read_all(c, &data) != CC_ERROR)
+ * {
+ * 	cc_shm_publish(shm, &data);
+ * 	data.size=size;
+ * }
+ * @endcode
+ */
+struct cc_shm *cc_shm_create(const char *name, const struct cc_size *capacity);
+
+/**
+ * @brief Publish data to shared memory.
+ *
+ * Function never blocks. System call is made only if some reader is waiting for data.
+ *
+ * @param shm publisher from cc_shm_create
+ * @param data arrays with sizes (e.g. filled by cc_read_all)
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error with errno set (EINVAL if \p shm is reader)
+ */
+int cc_shm_publish(struct cc_shm *shm, const struct cc_data *data);
+
+/**
+ * @brief Attach to shared memory segment as reader.
+ *
+ * Reader gets data published after attaching.
+ *
+ * @param name POSIX shared memory name used in cc_shm_create
+ * @return
+ * - pointer to reader
+ * - NULL on error with errno set (EPROTO if segment was created by different library version)
+ *
+ * @see cc_shm_read_all, cc_shm_get_lag, cc_shm_close
+ */
+struct cc_shm *cc_shm_attach(const char *name);
+
+/**
+ * @brief Read multiple types of data from shared memory.
+ *
+ * Semantics of \p data is the same as in cc_read_all.
+ *
+ * Reading data that is already published makes no system calls.
+ * Function waits only if there is no new data of requested types.
+ *
+ * If reader falls behind by more than ring capacity the oldest data is lost,
+ * reading continues from the oldest data available (see cc_shm_get_lag).
+ *
+ * @param shm reader from cc_shm_attach
+ * @param data user supplied arrays with sizes
+ * @param timeout_ms maximum wait time, -1 for infinite, 0 for no waiting
+ * @return
+ * - CC_OK indicates user arrays in \p data parameter were filled with all published data
+ * - CC_DATA_PENDING indicates at least one array in \p data parameter was filled completely and more data is pending
+ * - CC_ERROR indicates error, query errno for the details (EAGAIN on timeout, ENODEV if publisher closed segment)
+ */
+int cc_shm_read_all(struct cc_shm *shm, struct cc_data *data, int timeout_ms);
+
+/**
+ * @brief Get reader lag.
+ *
+ * @param shm reader from cc_shm_attach
+ * @param lag lag returned here (zeroed for publisher)
+ */
+void cc_shm_get_lag(struct cc_shm *shm, struct cc_shm_lag *lag);
+
+/**
+ * @brief Close publisher or detach reader.
+ *
+ * Publisher marks segment closed (waking waiting readers) and removes its name.
+ * Attached readers keep their mapping until they close. May be safely called with NULL argument.
+ *
+ * @param shm publisher or reader
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error, query errno for the details
+ */
+int cc_shm_close(struct cc_shm *shm);
+
+///@}
+
+/** @name Recording and replay
+ */
+///@{
+
+/**
+ * @brief Start recording raw data stream to file.
+ *
+ * Everything read from the device is written in chunks with host receive times
+ * and timestamp index. Recording failure (e.g. disk full) stops recording
+ * without affecting reading and is reported by cc_record_stop.
+ *
+ * @param c pointer to internal library data
+ * @param path file to create or truncate
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error, query errno for the details
+ *
+ * @see cc_record_stop, cc_open_replay
+ */
+int cc_record_start(struct cc *c, const char *path);
+
+/**
+ * @brief Stop recording and write timestamp index.
+ *
+ * May be safely called if not recording. Called automatically from cc_close.
+ *
+ * @param c pointer to internal library data
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR if recording failed at any point, query errno for the details
+ */
+int cc_record_stop(struct cc *c);
+
+/**
+ * @brief Start writing compressed log of messages to file.
+ *
+ * Compact alternative of cc_record_start for long missions. Every message
+ * consumed by reading functions is logged with host receive time. Timestamps,
+ * encoder counts, orientation and lidar fields are delta encoded, RPLidar
+ * capsules with specialized codec, blocks are compressed with LZ4
+ * (liblz4 if available at build time, built-in compatible codec otherwise).
+ * Block index allows seeking.
+ *
+ * Unlike raw recording only valid messages are logged (corrupted bytes are not).
+ * Logging failure (e.g. disk full) stops logging without affecting reading
+ * and is reported by cc_log_stop. Compression ratio is in cc_stats.
+ *
+ * @param c pointer to internal library data (also from cc_open_replay, e.g. to compress recording)
+ * @param path file to create or truncate
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error, query errno for the details (EBUSY if already logging or with asynchronous reading)
+ *
+ * @see cc_log_stop, cc_open_replay
+ */
+int cc_log_start(struct cc *c, const char *path);
+
+/**
+ * @brief Stop compressed logging and write block index.
+ *
+ * May be safely called if not logging. Called automatically from cc_close.
+ *
+ * @param c pointer to internal library data
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR if logging failed at any point, query errno for the details
+ */
+int cc_log_stop(struct cc *c);
+
+/**
+ * @brief Open recording for replay.
+ *
+ * Returned handle works like the one from cc_init with all the reading functions.
+ * The recording is memory mapped, it is not read into memory.
+ * Host receive times are replayed from recording.
+ * The end of recording is reported as CC_ERROR with errno ENODEV (like unplugged device).
+ *
+ * Recordings without index (e.g. interrupted) are also supported.
+ * Compressed logs are decompressed block by block while reading,
+ * corrupted block is reported as CC_ERROR with errno EBADMSG.
+ *
+ * @param path recording created with cc_record_start or compressed log created with cc_log_start
+ * @param speed replay speed (1.0 for real-time pace), 0 for as fast as possible
+ * @return
+ * - pointer to internal library data, free with cc_close
+ * - NULL on error with errno set
+ *
+ * Example:
+ * @code
+ * struct cc *c=cc_open_replay("mission.ccrec", 1.0);
+ * @endcode
+ */
+struct cc *cc_open_replay(const char *path, double speed);
+
+/**
+ * @brief Open in-memory raw byte stream as if read from device.
+ *
+ * Returned handle works like the one from cc_init with all the reading functions.
+ * Each read takes as much data as fits in internal buffer.
+ * The end of data is reported as CC_ERROR with errno ENODEV (like unplugged device).
+ *
+ * This is intended for benchmarking and processing raw streams captured by other means.
+ *
+ * @param data raw stream, must be valid until cc_close
+ * @param size raw stream size
+ * @return
+ * - pointer to internal library data, free with cc_close
+ * - NULL on error with errno set
+ */
+struct cc *cc_open_buffer(const uint8_t *data, size_t size);
+
+/**
+ * @brief Seek replay to host receive time.
+ *
+ * Replay continues from the first read received not earlier than \p receive_time_us.
+ * Seek is O(log n) in the number of recording chunks (compressed log blocks).
+ *
+ * @param c pointer to internal library data from cc_open_replay
+ * @param receive_time_us host CLOCK_MONOTONIC microseconds
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error with errno set (EINVAL if \p c is not opened with cc_open_replay)
+ */
+int cc_replay_seek(struct cc *c, uint64_t receive_time_us);
+
+///@}
+
+/** @name Offline decoding
+ */
+///@{
+
+/**
+ * @brief Decode whole in-memory raw byte stream in parallel.
+ *
+ * Stream is split in chunks at resynchronization points (validated message starts),
+ * chunks are decoded by worker threads and merged in order. Messages crossing chunk
+ * boundaries are decoded once. The result is the same as reading the stream
+ * with cc_open_buffer and cc_read_all until the end, including resynchronization
+ * on corrupted data and unwrapped mcu_time_us.
+ *
+ * Raw stream has no host receive times, host_time_us and latency_us are 0.
+ * Data types with size 0 are skipped (not decoded).
+ *
+ * @param stream raw stream
+ * @param size raw stream size
+ * @param config decoding configuration, NULL for defaults
+ * @param data user supplied arrays, size is capacity on input and number of messages on output
+ * @return
+ * - CC_OK on success
+ * - CC_ERROR on error with errno set (ENOBUFS if arrays are too small,
+ *   required sizes are returned in \p data size member)
+ *
+ * Example:
+ * @code
+ * struct cc_size size={1, 1, 1};
+ * struct cc_data data={odometry, rplidar, xv11lidar, size};
+ *
+ * if(cc_decode_buffer(stream, bytes, NULL, &data) == CC_ERROR && errno == ENOBUFS)
+ * 	; //allocate arrays of data.size and decode again
+ * @endcode
+ */
+int cc_decode_buffer(const uint8_t *stream, size_t size, const struct cc_decode_config *config, struct cc_data *data);
+
+///@}
+
+/**
+ * @brief Get file descriptor used for serial communication with the device
+ *
+ * Library user should not directly read or write from or to descriptor.
+ * This function is intended to be used in synchronous I/O multiplexing (select, poll).
+ *
+ * @param c pointer to internal library data
+ * @return file descriptor, -1 for replay
+ */
+int cc_fd(struct cc *c);
+
+/**
+ * @brief Get number of bytes discarded while resynchronizing with the stream
+ *
+ * Bytes are discarded when stream is corrupted or communication started in the middle of the message.
+ *
+ * Resynchronization is vectorized with AVX2 or SSE2 when compiled for those instruction sets.
+ *
+ * @param c pointer to internal library data
+ * @return number of bytes discarded since cc_init
+ */
+uint64_t cc_skipped_bytes(struct cc *c);
+
+/**
+ * @brief Get runtime statistics and health counters
+ *
+ * Counters are plain integers updated by the reading thread, cheap enough to be always on.
+ * With asynchronous reading values are a snapshot which may be slightly out of date.
+ *
+ * @param c pointer to internal library data
+ * @param stats statistics returned here
+ *
+ * Example:
+ * @code
+ * struct cc_stats stats;
+ * cc_get_stats(c, &stats);
+ * printf("%llu bytes in %llu reads\n", (unsigned long long)stats.bytes_read, (unsigned long long)stats.reads);
+ * @endcode
+ */
+void cc_get_stats(struct cc *c, struct cc_stats *stats);
 
 /** @}*/
 
@@ -0,0 +1,379 @@
+/*
+ * Cave Crawler Library C++ header
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+/**
+ ******************************************************************************
+ *
+ *	\copyright	Copyright (C) 2019 Bartosz Meglicki
+ *	\file		 cave_crawler.hpp
+ *	\brief	 Header-only C++17 interface
+ *
+ * Thin layer over C interface:
+ * - RAII device handle (move-only)
+ * - move-only batches returned as spans, never copied
+ * - reader and visitor specialized at compile time for requested message types
+ *
+ ******************************************************************************
+ */
+
+#ifndef CAVE_CRAWLER_LIB_HPP_
+#define CAVE_CRAWLER_LIB_HPP_
+
+#include "cave_crawler.h"
+
+#include <cerrno> //errno, EAGAIN, ENODEV
+#include <cstddef> //std::size_t
+#include <memory> //std::unique_ptr
+#include <system_error> //std::system_error
+#include <tuple> //std::tuple
+#include <type_traits> //std::is_invocable_r_v, std::remove_reference_t
+#include <utility> //std::exchange
+
+#if __has_include(<version>)
+#include <version> //__cpp_lib_span
+#endif
+
+#if defined(__cpp_lib_span)
+#include <span> //std::span
+#endif
+
+/** \addtogroup cpp C++ interface
+ *	@{
+ */
+
+namespace cave_crawler
+{
+
+#if defined(__cpp_lib_span)
+
+template<class T>
+using span=std::span<T>;
+
+#else
+
+/**
+ * @brief Minimal std::span replacement for C++17
+ */
+template<class T>
+class span
+{
+public:
+	constexpr span() noexcept : data_(nullptr), size_(0) {}
+	constexpr span(T *data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+	constexpr T *data() const noexcept { return data_; }
+	constexpr std::size_t size() const noexcept { return size_; }
+	constexpr bool empty() const noexcept { return size_ == 0; }
+	constexpr T *begin() const noexcept { return data_; }
+	constexpr T *end() const noexcept { return data_ + size_; }
+	constexpr T &operator[](std::size_t i) const noexcept { return data_[i]; }
+private:
+	T *data_;
+	std::size_t size_;
+};
+
+#endif
+
+/**
+ * @brief Result of reading
+ */
+enum class status
+{
+	ok, //!< all available data was read (CC_OK)
+	pending, //!< more data pending without blocking, read again (CC_DATA_PENDING)
+	timeout, //!< no data within read timeout (CC_ERROR with EAGAIN)
+	disconnected //!< device unplugged or end of replay (CC_ERROR with ENODEV)
+};
+
+/**
+ * @brief Compile-time description of message data type
+ *
+ * Specialized for each message type (CC_PROTOCOL_MESSAGES), e.g. cc_odometry_data.
+ */
+template<class T>
+struct message_traits;
+
+#define CC_MESSAGE_TRAITS(NAME, name, value, bytes) \
+template<> \
+struct message_traits<cc_##name##_data> \
+{ \
+	static constexpr int type=CC_MESSAGE_##NAME; \
+	static void decode(const cc_message *msg, cc_##name##_data *data) { cc_message_##name(msg, data); } \
+	static cc_##name##_data *&array(cc_data &data) { return data.name; } \
+	static int &size(cc_size &size) { return size.name; } \
+};
+CC_PROTOCOL_MESSAGES(CC_MESSAGE_TRAITS)
+#undef CC_MESSAGE_TRAITS
+
+/**
+ * @brief Move-only batch of decoded messages
+ *
+ * Memory is allocated once in constructor and reused by every read.
+ */
+template<class T>
+class batch
+{
+public:
+	explicit batch(std::size_t capacity) : data_(new T[capacity]), capacity_(capacity), size_(0) {}
+
+	batch(batch &&) noexcept = default;
+	batch &operator=(batch &&) noexcept = default;
+	batch(const batch &) = delete;
+	batch &operator=(const batch &) = delete;
+
+	span<const T> view() const noexcept { return span<const T>(data_.get(), size_); }
+
+	const T *begin() const noexcept { return data_.get(); }
+	const T *end() const noexcept { return data_.get() + size_; }
+	const T &operator[](std::size_t i) const noexcept { return data_[i]; }
+	std::size_t size() const noexcept { return size_; }
+	std::size_t capacity() const noexcept { return capacity_; }
+	bool empty() const noexcept { return size_ == 0; }
+
+private:
+	template<class... Types> friend class reader;
+
+	std::unique_ptr<T[]> data_;
+	std::size_t capacity_;
+	std::size_t size_;
+};
+
+/**
+ * @brief Batches for requested message types, filled by device::read
+ *
+ * Types not requested are not decoded at all, their cc_data arrays are
+ * null with size 0 fixed at compile time.
+ *
+ * Example:
+ * @code
+ * cave_crawler::reader<cc_odometry_data, cc_rplidar_data> r(64);
+ * while(dev.read(r) != cave_crawler::status::disconnected)
+ * 	for(const cc_odometry_data &o : r.get<cc_odometry_data>())
+ * 		printf("%u\n", o.timestamp_us);
+ * @endcode
+ */
+template<class... Types>
+class reader
+{
+	static_assert(sizeof...(Types) > 0, "request at least one message type");
+
+public:
+	explicit reader(std::size_t capacity=64) : batches_(batch<Types>(capacity)...) {}
+
+	reader(reader &&) noexcept = default;
+	reader &operator=(reader &&) noexcept = default;
+	reader(const reader &) = delete;
+	reader &operator=(const reader &) = delete;
+
+	/// batch of the last read for message type T
+	template<class T>
+	const batch<T> &get() const noexcept { return std::get<batch<T>>(batches_); }
+
+	/// messages of type T from the last read
+	template<class T>
+	span<const T> view() const noexcept { return get<T>().view(); }
+
+	/// cc_data with arrays of requested types and sizes set to capacity
+	cc_data data() noexcept
+	{
+		cc_data data{};
+		(bind<Types>(data), ...);
+		return data;
+	}
+
+	/// take sizes returned by C interface
+	void commit(const cc_data &data) noexcept
+	{
+		cc_size size=data.size;
+		((std::get<batch<Types>>(batches_).size_ = message_traits<Types>::size(size)), ...);
+	}
+
+private:
+	template<class T>
+	void bind(cc_data &data) noexcept
+	{
+		batch<T> &b=std::get<batch<T>>(batches_);
+		message_traits<T>::array(data)=b.data_.get();
+		message_traits<T>::size(data.size)=static_cast<int>(b.capacity_);
+	}
+
+	std::tuple<batch<Types>...> batches_;
+};
+
+/**
+ * @brief RAII handle for device (or replay)
+ *
+ * Move-only, closes device in destructor. Construction and fatal reading
+ * errors throw std::system_error with errno.
+ */
+class device
+{
+public:
+	/// cc_init
+	explicit device(const char *tty) : device(cc_init(tty), "cc_init") {}
+
+	/// cc_init_ex
+	device(const char *tty, const cc_config &config) : device(cc_init_ex(tty, &config), "cc_init_ex") {}
+
+	/// cc_open_replay
+	static device replay(const char *path, double speed=0.0) { return device(cc_open_replay(path, speed), "cc_open_replay"); }
+
+	/// cc_open_buffer, data has to outlive device
+	static device buffer(const uint8_t *data, std::size_t size) { return device(cc_open_buffer(data, size), "cc_open_buffer"); }
+
+	device(device &&other) noexcept : c_(std::exchange(other.c_, nullptr)) {}
+
+	device &operator=(device &&other) noexcept
+	{
+		if(this != &other)
+		{
+			close();
+			c_=std::exchange(other.c_, nullptr);
+		}
+		return *this;
+	}
+
+	device(const device &) = delete;
+	device &operator=(const device &) = delete;
+
+	~device() { close(); }
+
+	/// C handle for functions without C++ wrapper
+	cc *get() const noexcept { return c_; }
+
+	/**
+	 * @brief Read batches of requested types (cc_read_all).
+	 *
+	 * Batch sizes are set from capacity before every read, no manual reset.
+	 */
+	template<class... Types>
+	status read(reader<Types...> &r)
+	{
+		cc_data data=r.data();
+		const int ret=cc_read_all(c_, &data);
+
+		r.commit(data);
+		return result(ret, "cc_read_all");
+	}
+
+	/**
+	 * @brief Read batches of requested types from asynchronous queues (cc_read_async).
+	 */
+	template<class... Types>
+	status read_async(reader<Types...> &r)
+	{
+		cc_data data=r.data();
+		const int ret=cc_read_async(c_, &data);
+
+		r.commit(data);
+		return result(ret, "cc_read_async");
+	}
+
+	/**
+	 * @brief Visit messages of requested types in place (cc_read_each).
+	 *
+	 * Dispatch compares message type only with requested \p Types,
+	 * other messages are skipped without decoding. Visitor is called with
+	 * decoded const T&, if it returns bool true stops reading (status::pending).
+	 *
+	 * Example:
+	 * @code
+	 * dev.visit<cc_odometry_data, cc_xv11lidar_data>([](const auto &m) { printf("%u\n", m.timestamp_us); });
+	 * @endcode
+	 */
+	template<class... Types, class Visitor>
+	status visit(Visitor &&visitor)
+	{
+		static_assert(sizeof...(Types) > 0, "request at least one message type");
+		using visitor_type=std::remove_reference_t<Visitor>;
+
+		return result(cc_read_each(c_, visit_handler<visitor_type, Types...>, &visitor), "cc_read_each");
+	}
+
+	/// cc_start_async
+	void start_async(const cc_async_config &config)
+	{
+		if(cc_start_async(c_, &config) != CC_OK)
+			throw std::system_error(errno, std::generic_category(), "cc_start_async");
+	}
+
+	/// cc_stop_async
+	void stop_async()
+	{
+		if(cc_stop_async(c_) != CC_OK)
+			throw std::system_error(errno, std::generic_category(), "cc_stop_async");
+	}
+
+private:
+	device(cc *c, const char *what) : c_(c)
+	{
+		if(c_ == nullptr)
+			throw std::system_error(errno, std::generic_category(), what);
+	}
+
+	void close() noexcept
+	{
+		if(c_)
+			cc_close(c_);
+		c_=nullptr;
+	}
+
+	static status result(int ret, const char *what)
+	{
+		if(ret == CC_OK)
+			return status::ok;
+		if(ret == CC_DATA_PENDING)
+			return status::pending;
+		if(errno == EAGAIN)
+			return status::timeout;
+		if(errno == ENODEV)
+			return status::disconnected;
+
+		throw std::system_error(errno, std::generic_category(), what);
+	}
+
+	template<class T, class Visitor>
+	static int dispatch(const cc_message *msg, Visitor &visitor)
+	{
+		T data;
+		message_traits<T>::decode(msg, &data);
+
+		//void is not convertible to bool, such visitors never stop reading
+		if constexpr(std::is_invocable_r_v<bool, Visitor&, const T&>)
+			return visitor(static_cast<const T&>(data)) ? 1 : 0;
+		else
+		{
+			visitor(static_cast<const T&>(data));
+			return 0;
+		}
+	}
+
+	// expands to comparisons with requested types only
+	template<class Visitor, class... Types>
+	static int visit_handler(const cc_message *msg, void *userdata)
+	{
+		Visitor &visitor=*static_cast<Visitor*>(userdata);
+		const int type=cc_message_type(msg);
+		int stop=0;
+
+		(void)((type == message_traits<Types>::type && ((stop=dispatch<Types>(msg, visitor)), true)) || ...);
+
+		return stop;
+	}
+
+	cc *c_;
+};
+
+} //namespace cave_crawler
+
+/** @}*/
+
+#endif //CAVE_CRAWLER_LIB_HPP_
@@ -0,0 +1,460 @@
+/*
+ * cc-bench parser benchmark for cave-crawler-lib library
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+ /*
+  * This program:
+  * - generates synthetic in-memory streams (per type and mixed)
+  * - clean and with 1%, 10% frames corrupted
+  * - optionally adds recorded stream (cc_record_start)
+  * - runs them through cc_read_all (validation, processing, decoding)
+  * - runs mixed streams through cc_decode_buffer with 1, 2, 4, ... threads
+  * - reports MB/s, messages/s, ns/message
+  * - saves results as JSON baseline and compares with previous baseline
+  *
+  * ./cc-bench -j new.json -b old.json
+  *
+  */
+
+#include "../cave_crawler.h"
+#include "cc_frames.h"
+
+#include <stdio.h> //printf, fprintf, fopen
+#include <stdlib.h> //malloc, free, atoi
+#include <string.h> //strcmp, strstr
+#include <unistd.h> //getopt, sysconf
+#include <errno.h> //errno, ENODEV
+#include <time.h> //clock_gettime
+#include <sys/stat.h> //stat
+
+enum {BENCH_MAX_RESULTS=64, BENCH_ARRAY_SIZE=64, BENCH_NAME_SIZE=64};
+
+enum {BENCH_ODOMETRY=1, BENCH_XV11LIDAR=2, BENCH_RPLIDAR=4, BENCH_MIXED=7};
+
+struct bench_result
+{
+	char name[BENCH_NAME_SIZE];
+	uint64_t bytes;
+	uint64_t messages;
+	double seconds;
+};
+
+struct bench_config
+{
+	int stream_mb;
+	int repeats;
+	int threads;
+	const char *recording;
+	const char *json;
+	const char *baseline;
+};
+
+struct buffer_arg
+{
+	const uint8_t *data;
+	size_t size;
+};
+
+static uint8_t *synthetic_stream(int types, double corruption, size_t size);
+static int bench_stream(const char *name, struct cc *(*open)(const void *), const void *arg, uint64_t bytes, int repeats, struct bench_result *result);
+static int run(struct cc *c, uint64_t *messages);
+static int bench_parallel(const char *name, const struct buffer_arg *stream, int threads, int repeats, struct bench_result *result);
+static struct cc *open_buffer(const void *arg);
+static struct cc *open_recording(const void *arg);
+static double ns_per_message(const struct bench_result *r);
+static void print_result(const struct bench_result *r, const struct bench_result *baseline);
+static int save_json(const char *path, const struct bench_result *results, int count);
+static int load_json(const char *path, struct bench_result *results, int max);
+static const struct bench_result *find_result(const char *name, const struct bench_result *results, int count);
+static double seconds(void);
+static void usage(char **argv);
+
+int main(int argc, char **argv)
+{
+	const struct {const char *name; int types;} streams[]={
+		{"odometry", BENCH_ODOMETRY}, {"xv11lidar", BENCH_XV11LIDAR},
+		{"rplidar", BENCH_RPLIDAR}, {"mixed", BENCH_MIXED} };
+	const struct {const char *name; double corruption;} corruptions[]={
+		{"clean", 0.0}, {"corrupt1", 0.01}, {"corrupt10", 0.10} };
+
+	struct bench_config config={16, 5, 0, NULL, NULL, NULL};
+	struct bench_result results[BENCH_MAX_RESULTS], baseline[BENCH_MAX_RESULTS];
+	int opt, count=0, baseline_count=0;
+
+	while( (opt=getopt(argc, argv, "s:n:t:r:j:b:h")) != -1 )
+	{
+		switch(opt)
+		{
+			case 's': config.stream_mb=atoi(optarg); break;
+			case 'n': config.repeats=atoi(optarg); break;
+			case 't': config.threads=atoi(optarg); break;
+			case 'r': config.recording=optarg; break;
+			case 'j': config.json=optarg; break;
+			case 'b': config.baseline=optarg; break;
+			default: usage(argv); return 1;
+		}
+	}
+
+	if(config.threads == 0)
+		config.threads=sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(config.stream_mb <= 0 || config.repeats <= 0 || config.threads <= 0)
+	{
+		usage(argv);
+		return 1;
+	}
+
+	if(config.baseline && (baseline_count=load_json(config.baseline, baseline, BENCH_MAX_RESULTS)) < 0)
+	{
+		perror("unable to load baseline");
+		return 1;
+	}
+
+	printf("%-24s %10s %14s %12s %10s\n", "stream", "MB/s", "messages/s", "ns/message", "vs base");
+
+	for(unsigned s=0;s<sizeof(streams)/sizeof(streams[0]);++s)
+		for(unsigned k=0;k<sizeof(corruptions)/sizeof(corruptions[0]);++k)
+		{
+			const size_t size=(size_t)config.stream_mb << 20;
+			struct buffer_arg arg={synthetic_stream(streams[s].types, corruptions[k].corruption, size), size};
+			char name[BENCH_NAME_SIZE];
+
+			if(arg.data == NULL)
+			{
+				perror("unable to generate stream");
+				return 1;
+			}
+
+			snprintf(name, sizeof(name), "%s/%s", streams[s].name, corruptions[k].name);
+
+			if(bench_stream(name, open_buffer, &arg, size, config.repeats, &results[count]) != 0)
+				return 1;
+
+			print_result(&results[count], find_result(name, baseline, baseline_count));
+			++count;
+
+			//parallel offline decoding speedup with thread count
+			for(int threads=1; streams[s].types == BENCH_MIXED && count < BENCH_MAX_RESULTS; threads *= 2)
+			{
+				if(threads > config.threads)
+					threads=config.threads;
+
+				snprintf(name, sizeof(name), "%s/%s/t%d", streams[s].name, corruptions[k].name, threads);
+
+				if(bench_parallel(name, &arg, threads, config.repeats, &results[count]) != 0)
+					return 1;
+
+				print_result(&results[count], find_result(name, baseline, baseline_count));
+				++count;
+
+				if(threads == config.threads)
+					break;
+			}
+
+			free((void*)arg.data);
+		}
+
+	if(config.recording)
+	{
+		struct stat st;
+
+		if(stat(config.recording, &st) != 0)
+		{
+			perror("unable to access recording");
+			return 1;
+		}
+		//includes recording format overhead
+		if(bench_stream("recording", open_recording, config.recording, st.st_size, config.repeats, &results[count]) != 0)
+			return 1;
+
+		print_result(&results[count], find_result("recording", baseline, baseline_count));
+		++count;
+	}
+
+	if(config.json && save_json(config.json, results, count) != 0)
+	{
+		perror("unable to save results");
+		return 1;
+	}
+
+	return 0;
+}
+
+static uint8_t *synthetic_stream(int types, double corruption, size_t size)
+{
+	const struct cc_frames_corruption c={corruption, 0.0, corruption};
+	uint8_t *stream=(uint8_t*)malloc(size);
+	uint8_t frame[CC_FRAME_MAX_SIZE], out[2*CC_FRAME_MAX_SIZE];
+	struct cc_frames frames;
+	uint32_t timestamp_us=0;
+	size_t offset=0;
+	unsigned i=0;
+
+	if(stream == NULL)
+		return NULL;
+
+	cc_frames_init(&frames, 2019);
+
+	//roughly real device proportions in mixed stream: odometry, xv11lidar, 2 x rplidar
+	while(1)
+	{
+		const int type = (i++) % 4;
+		int frame_size, out_size;
+
+		if(type == 0 && (types & BENCH_ODOMETRY))
+			frame_size=cc_frames_odometry(&frames, timestamp_us, frame);
+		else if(type == 1 && (types & BENCH_XV11LIDAR))
+			frame_size=cc_frames_xv11lidar(&frames, timestamp_us, frame);
+		else if(type >= 2 && (types & BENCH_RPLIDAR))
+			frame_size=cc_frames_rplidar(&frames, timestamp_us, type-2, frame);
+		else
+			continue;
+
+		timestamp_us += 250;
+		out_size=cc_frames_corrupt(&frames, &c, frame, frame_size, out);
+
+		if(offset + out_size > size)
+			break;
+
+		memcpy(stream+offset, out, out_size);
+		offset += out_size;
+	}
+
+	memset(stream+offset, 0, size-offset);
+
+	return stream;
+}
+
+// best of repeats
+static int bench_stream(const char *name, struct cc *(*open)(const void *), const void *arg, uint64_t bytes, int repeats, struct bench_result *result)
+{
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->bytes=bytes;
+	result->seconds=0;
+
+	for(int i=0;i<repeats;++i)
+	{
+		struct cc *c=open(arg);
+		double start, elapsed;
+
+		if(c == NULL)
+		{
+			perror("unable to open stream");
+			return -1;
+		}
+
+		start=seconds();
+
+		if(run(c, &result->messages) != 0)
+		{
+			perror("failed to process stream");
+			cc_close(c);
+			return -1;
+		}
+
+		elapsed=seconds()-start;
+
+		if(i == 0 || elapsed < result->seconds)
+			result->seconds=elapsed;
+
+		cc_close(c);
+	}
+
+	return 0;
+}
+
+static int run(struct cc *c, uint64_t *messages)
+{
+	struct cc_odometry_data odometry[BENCH_ARRAY_SIZE];
+	struct cc_rplidar_data rplidar[BENCH_ARRAY_SIZE];
+	struct cc_xv11lidar_data xv11lidar[BENCH_ARRAY_SIZE];
+	struct cc_data data={odometry, rplidar, xv11lidar, {0}};
+	const struct cc_size size={BENCH_ARRAY_SIZE, BENCH_ARRAY_SIZE, BENCH_ARRAY_SIZE};
+
+	*messages=0;
+	data.size=size;
+
+	while(cc_read_all(c, &data) != CC_ERROR)
+	{
+		*messages += data.size.odometry + data.size.rplidar + data.size.xv11lidar;
+		data.size=size;
+	}
+
+	//end of stream is reported like unplugged device
+	return errno == ENODEV ? 0 : -1;
+}
+
+// best of repeats, arrays for the whole stream are allocated once
+static int bench_parallel(const char *name, const struct buffer_arg *stream, int threads, int repeats, struct bench_result *result)
+{
+	const struct cc_decode_config config={threads, 0};
+	struct cc_odometry_data odometry;
+	struct cc_rplidar_data rplidar;
+	struct cc_xv11lidar_data xv11lidar;
+	struct cc_data data={&odometry, &rplidar, &xv11lidar, {1, 1, 1}};
+	struct cc_size size;
+	int ret=CC_OK;
+
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->bytes=stream->size;
+	result->messages=0;
+	result->seconds=0;
+
+	//the first call with small arrays returns required sizes
+	if(cc_decode_buffer(stream->data, stream->size, &config, &data) == CC_ERROR && errno != ENOBUFS)
+	{
+		perror("unable to decode stream");
+		return -1;
+	}
+
+	size=data.size;
+	data.odometry=(struct cc_odometry_data*)malloc((size.odometry + 1) * sizeof(struct cc_odometry_data));
+	data.rplidar=(struct cc_rplidar_data*)malloc((size.rplidar + 1) * sizeof(struct cc_rplidar_data));
+	data.xv11lidar=(struct cc_xv11lidar_data*)malloc((size.xv11lidar + 1) * sizeof(struct cc_xv11lidar_data));
+
+	if(data.odometry == NULL || data.rplidar == NULL || data.xv11lidar == NULL)
+		ret=CC_ERROR;
+
+	for(int i=0; i<repeats && ret != CC_ERROR; ++i)
+	{
+		double start, elapsed;
+
+		data.size=size;
+		start=seconds();
+
+		if( (ret=cc_decode_buffer(stream->data, stream->size, &config, &data)) == CC_ERROR )
+			break;
+
+		elapsed=seconds()-start;
+
+		if(i == 0 || elapsed < result->seconds)
+			result->seconds=elapsed;
+
+		result->messages = data.size.odometry + data.size.rplidar + data.size.xv11lidar;
+	}
+
+	if(ret == CC_ERROR)
+		perror("failed to decode stream");
+
+	free(data.odometry);
+	free(data.rplidar);
+	free(data.xv11lidar);
+
+	return ret == CC_ERROR ? -1 : 0;
+}
+
+static struct cc *open_buffer(const void *arg)
+{
+	const struct buffer_arg *buffer=(const struct buffer_arg*)arg;
+	return cc_open_buffer(buffer->data, buffer->size);
+}
+
+static struct cc *open_recording(const void *arg)
+{
+	return cc_open_replay((const char*)arg, 0.0);
+}
+
+static double ns_per_message(const struct bench_result *r)
+{
+	return r->messages ? r->seconds * 1e9 / r->messages : 0.0;
+}
+
+static void print_result(const struct bench_result *r, const struct bench_result *baseline)
+{
+	char versus[32]="-";
+
+	if(baseline && ns_per_message(baseline) > 0)
+		snprintf(versus, sizeof(versus), "%+.1f%%", 100.0 * (ns_per_message(r) / ns_per_message(baseline) - 1.0));
+
+	printf("%-24s %10.1f %14.0f %12.1f %10s\n", r->name, r->bytes / r->seconds / 1e6,
+		r->messages / r->seconds, ns_per_message(r), versus);
+}
+
+// one result per line, so that load_json can stay simple
+static int save_json(const char *path, const struct bench_result *results, int count)
+{
+	FILE *f=fopen(path, "w");
+
+	if(f == NULL)
+		return -1;
+
+	fprintf(f, "{\n  \"version\": 1,\n  \"results\": [\n");
+
+	for(int i=0;i<count;++i)
+		fprintf(f, "    {\"name\": \"%s\", \"bytes\": %llu, \"messages\": %llu, \"seconds\": %.9f, "
+			"\"mb_per_s\": %.3f, \"messages_per_s\": %.1f, \"ns_per_message\": %.3f}%s\n",
+			results[i].name, (unsigned long long)results[i].bytes, (unsigned long long)results[i].messages,
+			results[i].seconds, results[i].bytes / results[i].seconds / 1e6, results[i].messages / results[i].seconds,
+			ns_per_message(&results[i]), i+1 < count ? "," : "");
+
+	fprintf(f, "  ]\n}\n");
+
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+static int load_json(const char *path, struct bench_result *results, int max)
+{
+	FILE *f=fopen(path, "r");
+	char line[512];
+	int count=0;
+
+	if(f == NULL)
+		return -1;
+
+	while(count < max && fgets(line, sizeof(line), f))
+	{
+		struct bench_result *r=&results[count];
+		unsigned long long bytes, messages;
+
+		if(sscanf(line, " {\"name\": \"%63[^\"]\", \"bytes\": %llu, \"messages\": %llu, \"seconds\": %lf",
+			r->name, &bytes, &messages, &r->seconds) != 4)
+			continue;
+
+		r->bytes=bytes;
+		r->messages=messages;
+		++count;
+	}
+
+	fclose(f);
+
+	return count;
+}
+
+static const struct bench_result *find_result(const char *name, const struct bench_result *results, int count)
+{
+	for(int i=0;i<count;++i)
+		if(strcmp(name, results[i].name) == 0)
+			return &results[i];
+
+	return NULL;
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(char **argv)
+{
+	printf("Usage:\n");
+	printf("%s [options]\n\n", argv[0]);
+	printf("options:\n");
+	printf("-s MB      synthetic stream size (default 16)\n");
+	printf("-n N       repeats, the best is reported (default 5)\n");
+	printf("-t N       maximum threads for parallel decoding (default online CPUs)\n");
+	printf("-r FILE    also benchmark recording (made with cc_record_start)\n");
+	printf("-j FILE    save results as JSON baseline\n");
+	printf("-b FILE    compare with JSON baseline\n\n");
+	printf("examples:\n");
+	printf("%s -j baseline.json\n", argv[0]);
+	printf("%s -b baseline.json -r mission.ccrec\n", argv[0]);
+}
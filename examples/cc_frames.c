@@ -0,0 +1,139 @@
+/*
+ * Synthetic cave-crawler-mcu frames for cave-crawler-lib tools
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "cc_frames.h"
+
+#include <stdlib.h> //rand_r
+#include <string.h> //memcpy, memset
+#include <math.h> //sinf, cosf
+
+enum {START_OF_MESSAGE=0xFB, END_OF_MESSAGE=0xFC};
+enum {ODOMETRY_SIZE=28+4, XV11LIDAR_SIZE=15+4, RPLIDAR_SIZE=138+4};
+
+static int frame_begin(uint8_t *frame, uint8_t type, uint8_t size, uint32_t timestamp_us);
+static double random_unit(struct cc_frames *f);
+
+void cc_frames_init(struct cc_frames *f, unsigned int seed)
+{
+	memset(f, 0, sizeof(*f));
+	f->seed=seed;
+}
+
+int cc_frames_odometry(struct cc_frames *f, uint32_t timestamp_us, uint8_t *frame)
+{
+	int i=frame_begin(frame, CC_MESSAGE_ODOMETRY, ODOMETRY_SIZE, timestamp_us);
+	//slow turn in place while driving forward
+	const float q[4]={cosf(f->yaw/2), 0.0f, 0.0f, sinf(f->yaw/2)};
+
+	f->left_encoder_counts += 3;
+	f->right_encoder_counts += 4;
+	f->yaw += 0.0001f;
+
+	memcpy(frame+i, &f->left_encoder_counts, 4); i+=4;
+	memcpy(frame+i, &f->right_encoder_counts, 4); i+=4;
+	memcpy(frame+i, q, sizeof(q)); i+=sizeof(q);
+
+	frame[i]=END_OF_MESSAGE;
+	return ODOMETRY_SIZE;
+}
+
+int cc_frames_xv11lidar(struct cc_frames *f, uint32_t timestamp_us, uint8_t *frame)
+{
+	int i=frame_begin(frame, CC_MESSAGE_XV11LIDAR, XV11LIDAR_SIZE, timestamp_us);
+	const uint16_t speed64=300*64;
+
+	frame[i++]=f->angle_quad;
+	memcpy(frame+i, &speed64, 2); i+=2;
+
+	for(int k=0;k<4;++k, i+=2)
+	{	//invalid data with error code now and then, otherwise 1-3 m
+		const uint16_t distance = (rand_r(&f->seed) % 20 == 0) ? (0x8000 | 0x21) : (uint16_t)(1000 + (f->angle_quad*4+k)*5);
+		memcpy(frame+i, &distance, 2);
+	}
+
+	f->angle_quad = (f->angle_quad + 1) % 90;
+
+	frame[i]=END_OF_MESSAGE;
+	return XV11LIDAR_SIZE;
+}
+
+int cc_frames_rplidar(struct cc_frames *f, uint32_t timestamp_us, uint8_t device_id, uint8_t *frame)
+{
+	int i=frame_begin(frame, CC_MESSAGE_RPLIDAR, RPLIDAR_SIZE, timestamp_us);
+	rplidar_response_ultra_capsule_measurement_nodes_t capsule;
+	//~ 10 Hz scan with ~ 170 capsules per second
+	const uint16_t angle_increment_q6 = (360 << 6) / 17;
+	uint16_t start_angle_q6 = f->start_angle_q6[device_id];
+
+	capsule.s_checksum_1=0xA0;
+	capsule.s_checksum_2=0x50;
+	capsule.start_angle_sync_q6=start_angle_q6;
+
+	for(int k=0;k<32;++k)
+	{	//major distance with small predictions
+		const uint32_t major = 1000 + 10*k + rand_r(&f->seed) % 16;
+		const uint32_t predict1 = (uint32_t)(rand_r(&f->seed) % 32 - 16) & 0x3FF;
+		const uint32_t predict2 = (uint32_t)(rand_r(&f->seed) % 32 - 16) & 0x3FF;
+
+		capsule.ultra_cabins[k].combined_x3 = major | (predict1 << 12) | (predict2 << 22);
+	}
+
+	start_angle_q6 += angle_increment_q6;
+
+	if(start_angle_q6 >= (360 << 6))
+		start_angle_q6 -= 360 << 6;
+
+	f->start_angle_q6[device_id]=start_angle_q6;
+
+	frame[i++]=device_id;
+	frame[i++]=f->sequence[device_id]++;
+	memcpy(frame+i, &capsule, sizeof(capsule)); i+=sizeof(capsule);
+
+	frame[i]=END_OF_MESSAGE;
+	return RPLIDAR_SIZE;
+}
+
+int cc_frames_corrupt(struct cc_frames *f, const struct cc_frames_corruption *c, const uint8_t *frame, int size, uint8_t *out)
+{
+	int bytes=0;
+
+	if(random_unit(f) < c->garbage)
+	{	//with fake message starts
+		const int garbage=1 + rand_r(&f->seed) % CC_FRAME_MAX_SIZE;
+
+		for(int i=0;i<garbage;++i)
+			out[bytes++] = (rand_r(&f->seed) % 8 == 0) ? START_OF_MESSAGE : (uint8_t)rand_r(&f->seed);
+	}
+
+	memcpy(out+bytes, frame, size);
+
+	if(random_unit(f) < c->corrupt)
+		out[bytes + rand_r(&f->seed) % size] ^= (uint8_t)(1 + rand_r(&f->seed) % 255);
+
+	if(random_unit(f) < c->truncate)
+		size = rand_r(&f->seed) % size;
+
+	return bytes + size;
+}
+
+static int frame_begin(uint8_t *frame, uint8_t type, uint8_t size, uint32_t timestamp_us)
+{
+	frame[0]=START_OF_MESSAGE;
+	frame[1]=size;
+	frame[2]=type;
+	memcpy(frame+3, &timestamp_us, 4);
+	return 7;
+}
+
+static double random_unit(struct cc_frames *f)
+{
+	return rand_r(&f->seed) / (RAND_MAX + 1.0);
+}
@@ -0,0 +1,56 @@
+/*
+ * Synthetic cave-crawler-mcu frames for cave-crawler-lib tools
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+ /*
+  * Encodes protocol correct ODOMETRY, XV11LIDAR and RPLIDARA3 frames
+  * (as described in cave_crawler.c packet tables) with plausible content
+  * and optionally corrupts them. Used by simulator and benchmark.
+  */
+
+#ifndef CC_FRAMES_H_
+#define CC_FRAMES_H_
+
+#include "../cave_crawler.h"
+
+#include <stdint.h>
+
+enum {CC_FRAME_MAX_SIZE=255};
+
+struct cc_frames
+{
+	unsigned int seed; //for rand_r
+	int32_t left_encoder_counts;
+	int32_t right_encoder_counts;
+	float yaw;
+	uint8_t angle_quad;
+	uint16_t start_angle_q6[UINT8_MAX+1];
+	uint8_t sequence[UINT8_MAX+1];
+};
+
+struct cc_frames_corruption
+{
+	double corrupt; //probability of flipping random byte in frame
+	double truncate; //probability of truncating frame
+	double garbage; //probability of garbage bytes before frame
+};
+
+void cc_frames_init(struct cc_frames *f, unsigned int seed);
+
+// return frame size
+int cc_frames_odometry(struct cc_frames *f, uint32_t timestamp_us, uint8_t *frame);
+int cc_frames_xv11lidar(struct cc_frames *f, uint32_t timestamp_us, uint8_t *frame);
+int cc_frames_rplidar(struct cc_frames *f, uint32_t timestamp_us, uint8_t device_id, uint8_t *frame);
+
+// corrupts frame of size in place, may write garbage to out first
+// returns number of bytes in out (at most 2 * CC_FRAME_MAX_SIZE)
+int cc_frames_corrupt(struct cc_frames *f, const struct cc_frames_corruption *c, const uint8_t *frame, int size, uint8_t *out);
+
+#endif //CC_FRAMES_H_
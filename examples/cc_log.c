@@ -0,0 +1,162 @@
+/*
+ * cc-log example for cave-crawler-lib library
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+ /*
+  * This example:
+  * - replays recording (cc_record_start) as fast as possible
+  * - writes its messages to compressed log (cc_log_start)
+  * - prints compression ratio
+  * - replays compressed log and prints decoding speed relative to real time
+  *
+  * Program expects input recording and output log, e.g.
+  *
+  * ./cc-log mission.ccrec mission.cclog
+  *
+  */
+
+#include "../cave_crawler.h"
+
+#include <stdio.h> //printf
+#include <errno.h> //errno
+#include <string.h> //strerror
+#include <time.h> //clock_gettime
+
+struct log_summary
+{
+	uint64_t messages;
+	uint64_t first_host_time_us;
+	uint64_t last_host_time_us;
+};
+
+void usage(char **argv);
+int log_recording(const char *input, const char *output);
+int decode_log(const char *log, struct log_summary *summary, double *decode_s);
+int count_message(const struct cc_message *msg, void *userdata);
+
+int main(int argc, char **argv)
+{
+	struct log_summary summary={0};
+	double decode_s, mission_s;
+
+	if(argc != 3)
+	{
+		usage(argv);
+		return 0;
+	}
+
+	if(log_recording(argv[1], argv[2]) != 0)
+		return 1;
+
+	if(decode_log(argv[2], &summary, &decode_s) != 0)
+		return 1;
+
+	mission_s=(summary.last_host_time_us - summary.first_host_time_us) / 1000000.0;
+
+	printf("decoded %llu messages in %.3f s, %.0f x real time (%.1f s of data)\n",
+	(unsigned long long)summary.messages, decode_s, decode_s > 0 ? mission_s / decode_s : 0.0, mission_s);
+
+	return 0;
+}
+
+int log_recording(const char *input, const char *output)
+{
+	struct cc *c;
+	struct cc_stats stats;
+	struct log_summary summary={0};
+
+	if( (c=cc_open_replay(input, 0)) == NULL )
+	{
+		fprintf(stderr, "unable to open %s: %s\n", input, strerror(errno));
+		return 1;
+	}
+
+	if(cc_log_start(c, output) != CC_OK)
+	{
+		fprintf(stderr, "unable to start logging to %s: %s\n", output, strerror(errno));
+		cc_close(c);
+		return 1;
+	}
+
+	//logging happens while reading, any reading function will do
+	while(cc_read_each(c, count_message, &summary) != CC_ERROR)
+		;
+
+	if(errno != ENODEV)
+		fprintf(stderr, "reading %s failed: %s\n", input, strerror(errno));
+
+	if(cc_log_stop(c) != CC_OK)
+	{
+		fprintf(stderr, "logging to %s failed: %s\n", output, strerror(errno));
+		cc_close(c);
+		return 1;
+	}
+
+	cc_get_stats(c, &stats);
+	cc_close(c);
+
+	printf("logged %llu messages, %llu bytes -> %llu bytes (%.2f x)\n",
+	(unsigned long long)stats.log_messages, (unsigned long long)stats.log_raw_bytes,
+	(unsigned long long)stats.log_written_bytes,
+	stats.log_written_bytes ? (double)stats.log_raw_bytes / stats.log_written_bytes : 0.0);
+
+	return 0;
+}
+
+int decode_log(const char *log, struct log_summary *summary, double *decode_s)
+{
+	struct timespec start, stop;
+	struct cc *c;
+
+	if( (c=cc_open_replay(log, 0)) == NULL )
+	{
+		fprintf(stderr, "unable to open %s: %s\n", log, strerror(errno));
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while(cc_read_each(c, count_message, summary) != CC_ERROR)
+		;
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	cc_close(c);
+
+	if(errno != ENODEV)
+	{
+		fprintf(stderr, "decoding %s failed: %s\n", log, strerror(errno));
+		return 1;
+	}
+
+	*decode_s=(stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	return 0;
+}
+
+int count_message(const struct cc_message *msg, void *userdata)
+{
+	struct log_summary *summary=(struct log_summary*)userdata;
+
+	if(summary->messages++ == 0)
+		summary->first_host_time_us=cc_message_host_time_us(msg);
+
+	summary->last_host_time_us=cc_message_host_time_us(msg);
+
+	return 0;
+}
+
+void usage(char **argv)
+{
+	printf("Usage:\n");
+	printf("%s input-recording output-log\n\n", argv[0]);
+	printf("examples:\n");
+	printf("%s mission.ccrec mission.cclog\n", argv[0]);
+}
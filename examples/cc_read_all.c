@@ -82,8 +82,10 @@ int main(int argc, char **argv)
 			data.rplidar[i].timestamp_us, data.rplidar[i].device_id, data.rplidar[i].sequence);
 
 		for(int i=0;i<data.size.xv11lidar;++i)
-			printf("[xv11] t=%u aq=%d s=%d d=?\n", data.xv11lidar[i].timestamp_us,
-			data.xv11lidar[i].angle_quad, data.xv11lidar[i].speed64/64);
+			printf("[xv11] t=%u aq=%d s=%d d=%d %d %d %d\n", data.xv11lidar[i].timestamp_us,
+			data.xv11lidar[i].angle_quad, data.xv11lidar[i].speed64/64,
+			data.xv11lidar[i].distances[0], data.xv11lidar[i].distances[1],
+			data.xv11lidar[i].distances[2], data.xv11lidar[i].distances[3]);
 		
 		//terminate after reading MAX_READS times
 		//remove those lines if you want to read infinitely
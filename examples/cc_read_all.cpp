@@ -0,0 +1,87 @@
+/*
+ * cc-read-all-cpp example for cave-crawler-lib library
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+ /*
+  * This example (C++17 interface):
+  * - initilies communication with cave-crawler microcontroller
+  * - reads & prints odometry and rplidar data 1000 times
+  * - visits xv11lidar messages in place 1000 times
+  * - cleans after itself (RAII)
+  *
+  * Program expects terminal device, e.g.
+  *
+  * ./cc-read-all-cpp /dev/ttyACM0
+  *
+  */
+
+#include "../cave_crawler.hpp"
+
+#include <cstdio> //printf
+#include <system_error> //std::system_error
+
+using namespace cave_crawler;
+
+const int DATA_SIZE=10;
+const int MAX_READS=1000;
+
+void usage(char **argv);
+
+int main(int argc, char **argv)
+{
+	if(argc != 2)
+	{
+		usage(argv);
+		return 0;
+	}
+
+	try
+	{
+		device dev(argv[1]);
+		//only odometry and rplidar are decoded, xv11lidar is skipped
+		reader<cc_odometry_data, cc_rplidar_data> r(DATA_SIZE);
+		status ret=status::ok;
+
+		for(int reads=0; reads < MAX_READS && ret != status::disconnected; ++reads)
+		{
+			ret=dev.read(r);
+
+			for(const cc_odometry_data &o : r.view<cc_odometry_data>())
+				printf("[odo] t=%u left=%d right=%d qw=%f qx=%f qy=%f qz=%f\n",
+				o.timestamp_us, o.left_encoder_counts, o.right_encoder_counts, o.qw, o.qx, o.qy, o.qz);
+
+			for(const cc_rplidar_data &rp : r.view<cc_rplidar_data>())
+				printf("[rp ] t=%u id=%d seq=%d\n", rp.timestamp_us, rp.device_id, rp.sequence);
+		}
+
+		for(int reads=0; reads < MAX_READS && ret != status::disconnected; ++reads)
+			ret=dev.visit<cc_xv11lidar_data>([](const cc_xv11lidar_data &x) {
+				printf("[xv11] t=%u aq=%d s=%d d=%d %d %d %d\n", x.timestamp_us, x.angle_quad, x.speed64/64,
+				x.distances[0], x.distances[1], x.distances[2], x.distances[3]);
+			});
+
+		printf("success reading from cave-crawler mcu, bye...\n");
+	}
+	catch(const std::system_error &e)
+	{
+		fprintf(stderr, "%s: %s\n", e.what(), e.code().message().c_str());
+		return 1;
+	}
+
+	return 0;
+}
+
+void usage(char **argv)
+{
+	printf("Usage:\n");
+	printf("%s tty_device\n\n", argv[0]);
+	printf("examples:\n");
+	printf("%s /dev/ttyACM0\n", argv[0]);
+}
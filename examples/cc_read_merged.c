@@ -0,0 +1,160 @@
+/*
+ * cc-read-merged example for cave-crawler-lib library
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+ /*
+  * This example:
+  * - initializes communication with one or more cave-crawler microcontrollers
+  * - reads all devices from single thread (device group)
+  * - prints single time-ordered stream of messages of all types and devices 1000 times
+  * - prints late and dropped messages
+  * - cleans after itself
+  *
+  * Program expects terminal devices, e.g.
+  *
+  * ./cc-read-merged /dev/ttyACM0 /dev/ttyACM1
+  *
+  */
+
+#include "../cave_crawler.h"
+
+#include <stdio.h> //printf
+#include <errno.h> //errno
+#include <string.h> //strerror
+
+enum {MAX_DEVICES=8, EVENTS_SIZE=64};
+
+const int MAX_READS=1000;
+const int TIMEOUT_MS=1000;
+
+void usage(char **argv);
+int main_loop(struct cc_group *g, struct cc_merge *m);
+void print_events(const struct cc_events *events);
+
+int main(int argc, char **argv)
+{
+	struct cc *devices[MAX_DEVICES]={0};
+	struct cc_merge_config config={0};
+	struct cc_merge_stats stats;
+	struct cc_group *g;
+	struct cc_merge *m;
+	int ret=1;
+
+	if(argc < 2 || argc - 1 > MAX_DEVICES)
+	{
+		usage(argv);
+		return 0;
+	}
+
+	config.sources=argc - 1;
+
+	if( (g=cc_group_init()) == NULL || (m=cc_merge_init(&config)) == NULL )
+	{
+		fprintf(stderr, "unable to initialize: %s\n", strerror(errno));
+		cc_group_close(g);
+		return 1;
+	}
+
+	for(int i=0;i<argc-1;++i)
+		if( (devices[i]=cc_init(argv[i+1])) == NULL || cc_group_add(g, devices[i]) == CC_ERROR )
+		{
+			fprintf(stderr, "unable to add %s: %s\n", argv[i+1], strerror(errno));
+			goto cleanup;
+		}
+
+	ret=main_loop(g, m);
+
+	cc_merge_get_stats(m, &stats);
+	printf("events %llu, late %llu, dropped %llu\n", (unsigned long long)stats.events,
+	(unsigned long long)stats.late, (unsigned long long)stats.dropped);
+
+cleanup:
+	for(int i=0;i<argc-1;++i)
+		if(devices[i])
+		{
+			cc_group_remove(g, i);
+			cc_close(devices[i]);
+		}
+
+	cc_merge_close(m);
+	cc_group_close(g);
+
+	return ret;
+}
+
+int main_loop(struct cc_group *g, struct cc_merge *m)
+{
+	struct cc_event array[EVENTS_SIZE];
+	struct cc_events events={array, EVENTS_SIZE};
+	int ret;
+
+	for(int reads=0;reads<MAX_READS;++reads)
+	{
+		events.size=EVENTS_SIZE;
+
+		if( (ret=cc_group_read_merged(g, m, &events, TIMEOUT_MS)) == CC_ERROR )
+		{
+			if(errno == ENODEV)
+				break;
+
+			fprintf(stderr, "reading failed: %s\n", strerror(errno));
+			return 1;
+		}
+
+		print_events(&events);
+
+		//more events ready than array holds
+		while(ret == CC_DATA_PENDING)
+		{
+			events.size=EVENTS_SIZE;
+			ret=cc_merge_read(m, &events);
+			print_events(&events);
+		}
+	}
+
+	//the rest of buffered messages regardless of reorder window
+	cc_merge_flush(m);
+
+	do
+	{
+		events.size=EVENTS_SIZE;
+		ret=cc_merge_read(m, &events);
+		print_events(&events);
+	} while(ret == CC_DATA_PENDING);
+
+	return 0;
+}
+
+void print_events(const struct cc_events *events)
+{
+	for(int i=0;i<events->size;++i)
+	{
+		const struct cc_event *e=events->events + i;
+
+		if(e->type == CC_MESSAGE_ODOMETRY)
+			printf("[%d odo ] t=%llu left=%d right=%d\n", e->source, (unsigned long long)e->time_us,
+			e->data.odometry.left_encoder_counts, e->data.odometry.right_encoder_counts);
+		else if(e->type == CC_MESSAGE_RPLIDAR)
+			printf("[%d rp  ] t=%llu id=%d seq=%d\n", e->source, (unsigned long long)e->time_us,
+			e->data.rplidar.device_id, e->data.rplidar.sequence);
+		else if(e->type == CC_MESSAGE_XV11LIDAR)
+			printf("[%d xv11] t=%llu aq=%d\n", e->source, (unsigned long long)e->time_us,
+			e->data.xv11lidar.angle_quad);
+	}
+}
+
+void usage(char **argv)
+{
+	printf("Usage:\n");
+	printf("%s tty_device [tty_device ...]\n\n", argv[0]);
+	printf("examples:\n");
+	printf("%s /dev/ttyACM0\n", argv[0]);
+	printf("%s /dev/ttyACM0 /dev/ttyACM1\n", argv[0]);
+}
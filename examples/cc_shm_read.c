@@ -0,0 +1,105 @@
+/*
+ * cc-shm-read example for cave-crawler-lib library
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+ /*
+  * This example:
+  * - attaches to shared memory published by cc-shmd
+  * - reads & prints data 1000 times
+  * - prints data lost due to reader lag
+  * - detaches
+  *
+  * Program expects shared memory name, e.g.
+  *
+  * ./cc-shm-read /cave-crawler
+  *
+  */
+
+#include "../cave_crawler.h"
+
+#include <stdio.h> //printf
+#include <errno.h> //errno
+#include <string.h> //strerror
+
+const int DATA_SIZE=10;
+const int MAX_READS=1000;
+const int TIMEOUT_MS=1000;
+
+void usage(char **argv);
+int main_loop(struct cc_shm *shm);
+
+int main(int argc, char **argv)
+{
+	struct cc_shm *shm;
+	struct cc_shm_lag lag;
+	int ret;
+
+	if(argc != 2)
+	{
+		usage(argv);
+		return 0;
+	}
+
+	if( (shm=cc_shm_attach(argv[1])) == NULL )
+	{
+		fprintf(stderr, "unable to attach to %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+
+	ret=main_loop(shm);
+
+	cc_shm_get_lag(shm, &lag);
+	printf("lost odometry %llu, rplidar %llu, xv11lidar %llu\n",
+	(unsigned long long)lag.dropped_odometry, (unsigned long long)lag.dropped_rplidar, (unsigned long long)lag.dropped_xv11lidar);
+
+	cc_shm_close(shm);
+
+	return ret;
+}
+
+int main_loop(struct cc_shm *shm)
+{
+	struct cc_odometry_data odometry[DATA_SIZE];
+	struct cc_rplidar_data rplidar[DATA_SIZE];
+	struct cc_xv11lidar_data xv11lidar[DATA_SIZE];
+	struct cc_size size={DATA_SIZE, DATA_SIZE, DATA_SIZE};
+	struct cc_data data={odometry, rplidar, xv11lidar, size};
+
+	for(int reads=0;reads<MAX_READS;++reads)
+	{
+		if(cc_shm_read_all(shm, &data, TIMEOUT_MS) == CC_ERROR)
+		{
+			fprintf(stderr, "reading failed: %s\n", strerror(errno));
+			return 1;
+		}
+
+		for(int i=0;i<data.size.odometry;++i)
+			printf("[odo] t=%u i=%d left=%d right=%d\n", odometry[i].timestamp_us, i,
+			odometry[i].left_encoder_counts, odometry[i].right_encoder_counts);
+
+		for(int i=0;i<data.size.rplidar;++i)
+			printf("[rp ] t=%u id=%d seq=%d\n", rplidar[i].timestamp_us, rplidar[i].device_id, rplidar[i].sequence);
+
+		for(int i=0;i<data.size.xv11lidar;++i)
+			printf("[xv11] t=%u aq=%d s=%d\n", xv11lidar[i].timestamp_us, xv11lidar[i].angle_quad, xv11lidar[i].speed64/64);
+
+		data.size=size;
+	}
+
+	return 0;
+}
+
+void usage(char **argv)
+{
+	printf("Usage:\n");
+	printf("%s shm_name\n\n", argv[0]);
+	printf("examples:\n");
+	printf("%s /cave-crawler\n", argv[0]);
+}
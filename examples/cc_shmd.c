@@ -0,0 +1,162 @@
+/*
+ * cc-shmd shared memory daemon for cave-crawler-lib library
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+ /*
+  * This program:
+  * - owns cave-crawler microcontroller device
+  * - decodes data once with cc_read_all
+  * - publishes it to shared memory for any number of local readers
+  * - removes shared memory on SIGINT, SIGTERM or device failure
+  *
+  * Readers attach with cc_shm_attach (e.g. cc-shm-read), e.g.
+  *
+  * ./cc-shmd /dev/ttyACM0
+  * ./cc-shm-read /cave-crawler
+  *
+  */
+
+#include "../cave_crawler.h"
+
+#include <stdio.h> //printf, fprintf
+#include <stdlib.h> //atoi
+#include <unistd.h> //getopt
+#include <errno.h> //errno
+#include <string.h> //strerror
+#include <signal.h> //signal, SIGINT, SIGTERM
+
+enum {SHMD_BATCH=256};
+
+struct shmd_config
+{
+	const char *tty;
+	const char *name;
+	struct cc_size capacity;
+};
+
+static volatile sig_atomic_t keep_running=1;
+
+static int parse_arguments(int argc, char **argv, struct shmd_config *config);
+static void usage(char **argv);
+static void on_signal(int signum);
+
+int main(int argc, char **argv)
+{
+	struct shmd_config config={NULL, "/cave-crawler", {4096, 4096, 4096}};
+	struct cc_odometry_data odometry[SHMD_BATCH];
+	struct cc_rplidar_data rplidar[SHMD_BATCH];
+	struct cc_xv11lidar_data xv11lidar[SHMD_BATCH];
+	struct cc_size size={SHMD_BATCH, SHMD_BATCH, SHMD_BATCH};
+	struct cc_data data={odometry, rplidar, xv11lidar, size};
+	struct cc_size published={0};
+	struct cc *c;
+	struct cc_shm *shm;
+	int ret=0;
+
+	if(parse_arguments(argc, argv, &config) != 0)
+	{
+		usage(argv);
+		return 1;
+	}
+
+	//types not published are not decoded
+	size.odometry = config.capacity.odometry ? SHMD_BATCH : 0;
+	size.rplidar = config.capacity.rplidar ? SHMD_BATCH : 0;
+	size.xv11lidar = config.capacity.xv11lidar ? SHMD_BATCH : 0;
+	data.size=size;
+
+	if( (c=cc_init(config.tty)) == NULL )
+	{
+		fprintf(stderr, "unable to initialize device %s: %s\n", config.tty, strerror(errno));
+		return 1;
+	}
+
+	if( (shm=cc_shm_create(config.name, &config.capacity)) == NULL )
+	{
+		fprintf(stderr, "unable to create shared memory %s: %s\n", config.name, strerror(errno));
+		cc_close(c);
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	printf("publishing %s to %s\n", config.tty, config.name);
+	fflush(stdout);
+
+	while(keep_running)
+	{
+		//timeout only means device is not sending data right now
+		if( (ret=cc_read_all(c, &data)) == CC_ERROR && errno != EAGAIN )
+		{
+			fprintf(stderr, "reading failed: %s\n", strerror(errno));
+			break;
+		}
+
+		cc_shm_publish(shm, &data);
+
+		published.odometry += data.size.odometry;
+		published.rplidar += data.size.rplidar;
+		published.xv11lidar += data.size.xv11lidar;
+
+		data.size=size;
+	}
+
+	printf("published odometry %d, rplidar %d, xv11lidar %d\n", published.odometry, published.rplidar, published.xv11lidar);
+
+	cc_shm_close(shm);
+	cc_close(c);
+
+	return keep_running ? 1 : 0;
+}
+
+static int parse_arguments(int argc, char **argv, struct shmd_config *config)
+{
+	int opt;
+
+	while( (opt=getopt(argc, argv, "s:o:r:x:h")) != -1 )
+	{
+		switch(opt)
+		{
+			case 's': config->name=optarg; break;
+			case 'o': config->capacity.odometry=atoi(optarg); break;
+			case 'r': config->capacity.rplidar=atoi(optarg); break;
+			case 'x': config->capacity.xv11lidar=atoi(optarg); break;
+			default: return -1;
+		}
+	}
+
+	if(optind != argc - 1)
+		return -1;
+
+	config->tty=argv[optind];
+
+	return 0;
+}
+
+static void usage(char **argv)
+{
+	printf("Usage:\n");
+	printf("%s [options] tty_device\n\n", argv[0]);
+	printf("options:\n");
+	printf("-s NAME  shared memory name (default /cave-crawler)\n");
+	printf("-o N     odometry ring capacity (default 4096, 0 to not publish)\n");
+	printf("-r N     rplidar ring capacity (default 4096, 0 to not publish)\n");
+	printf("-x N     xv11lidar ring capacity (default 4096, 0 to not publish)\n\n");
+	printf("examples:\n");
+	printf("%s /dev/ttyACM0\n", argv[0]);
+	printf("%s -s /robot -x 0 /dev/ttyACM0\n", argv[0]);
+}
+
+static void on_signal(int signum)
+{
+	(void)signum;
+	keep_running=0;
+}
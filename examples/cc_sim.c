@@ -0,0 +1,321 @@
+/*
+ * cc-sim cave-crawler-mcu simulator for cave-crawler-lib library
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+ /*
+  * This program:
+  * - opens pseudo-terminal and prints the slave device name
+  * - emits protocol correct ODOMETRY, XV11LIDAR, RPLIDARA3 frames at configured rates
+  * - optionally corrupts, truncates frames, inserts garbage and stalls output (bursts)
+  * - reports bytes that could not be written (reader not keeping up)
+  *
+  * Point cc_init (e.g. cc-read-all) at the printed slave device, e.g.
+  *
+  * ./cc-sim -o 1000 -r 170 -n 2 -x 450
+  * ./cc-read-all /dev/pts/3
+  *
+  */
+
+#define _GNU_SOURCE //clock_nanosleep, TIMER_ABSTIME
+
+#include "cc_frames.h"
+
+#include <stdio.h> //printf, fprintf
+#include <stdlib.h> //exit, atof, strtoul
+#include <string.h> //strchr
+#include <unistd.h> //write, getopt, symlink, unlink
+#include <fcntl.h> //fcntl, O_NONBLOCK
+#include <errno.h> //errno
+#include <signal.h> //signal, SIGINT, SIGTERM
+#include <time.h> //clock_gettime, clock_nanosleep
+#include <termios.h> //cfmakeraw
+#include <pty.h> //openpty
+
+enum {SIM_RPLIDAR_MAX_DEVICES=8, SIM_OUTPUT_SIZE=1 << 20};
+enum {SIM_ODOMETRY=0, SIM_XV11LIDAR=1, SIM_RPLIDAR=2, SIM_STREAMS=2+SIM_RPLIDAR_MAX_DEVICES};
+
+struct sim_config
+{
+	double rate[SIM_STREAMS]; //Hz, 0 to disable
+	int rplidar_devices;
+	struct cc_frames_corruption corruption;
+	int stall_ms; //hold output for stall_ms
+	int stall_every_ms; //every stall_every_ms
+	double duration_s; //0 for infinite
+	uint32_t initial_timestamp_us;
+	const char *link;
+};
+
+struct sim_stats
+{
+	uint64_t frames[SIM_STREAMS];
+	uint64_t bytes;
+	uint64_t dropped_bytes;
+};
+
+static volatile sig_atomic_t keep_running=1;
+
+static int parse_arguments(int argc, char **argv, struct sim_config *config);
+static int simulate(int master, const struct sim_config *config, struct sim_stats *stats);
+static void output(int master, const uint8_t *data, int size, struct sim_stats *stats);
+static uint64_t clock_us(void);
+static void sleep_until_us(uint64_t time_us);
+static void print_stats(const struct sim_config *config, const struct sim_stats *stats, double elapsed_s);
+static void usage(char **argv);
+static void on_signal(int signum);
+
+int main(int argc, char **argv)
+{
+	struct sim_config config={0};
+	struct sim_stats stats={0};
+	struct termios raw;
+	int master, slave;
+	char slave_name[256];
+	uint64_t start;
+
+	config.rate[SIM_ODOMETRY]=1000;
+	config.rplidar_devices=1;
+
+	if(parse_arguments(argc, argv, &config) != 0)
+	{
+		usage(argv);
+		return 1;
+	}
+
+	memset(&raw, 0, sizeof(raw));
+	cfmakeraw(&raw);
+
+	//we keep the slave open so that writes don't fail before reader opens it
+	if(openpty(&master, &slave, slave_name, &raw, NULL) == -1)
+	{
+		perror("unable to open pseudo-terminal");
+		return 1;
+	}
+
+	//don't block if reader is not keeping up, count dropped data instead
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+	if(config.link)
+	{
+		unlink(config.link);
+		if(symlink(slave_name, config.link) == -1)
+			perror("unable to create link to slave device");
+	}
+
+	printf("%s\n", slave_name);
+	fflush(stdout);
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	start=clock_us();
+	simulate(master, &config, &stats);
+	print_stats(&config, &stats, (clock_us() - start) / 1000000.0);
+
+	if(config.link)
+		unlink(config.link);
+
+	close(slave);
+	close(master);
+
+	return 0;
+}
+
+static int simulate(int master, const struct sim_config *config, struct sim_stats *stats)
+{
+	static uint8_t out[SIM_OUTPUT_SIZE];
+	struct cc_frames frames;
+	uint8_t frame[CC_FRAME_MAX_SIZE], corrupted[2*CC_FRAME_MAX_SIZE];
+	uint64_t next_us[SIM_STREAMS], period_us[SIM_STREAMS];
+	const uint64_t start_us=clock_us();
+	uint64_t next_stall_us = start_us + config->stall_every_ms*1000ULL;
+	int out_size=0;
+
+	cc_frames_init(&frames, 2019);
+
+	for(int s=0;s<SIM_STREAMS;++s)
+	{
+		period_us[s] = config->rate[s] > 0 ? (uint64_t)(1000000.0 / config->rate[s]) : 0;
+		next_us[s] = start_us + period_us[s];
+	}
+
+	while(keep_running)
+	{
+		uint64_t now_us=clock_us(), wake_us=UINT64_MAX;
+		int stalled=0;
+
+		if(config->duration_s > 0 && now_us - start_us >= config->duration_s * 1000000.0)
+			break;
+
+		if(config->stall_every_ms > 0 && now_us >= next_stall_us)
+		{
+			stalled = now_us < next_stall_us + config->stall_ms*1000ULL;
+			if(!stalled)
+				next_stall_us += config->stall_every_ms*1000ULL;
+		}
+
+		//emit all frames which are due
+		for(int s=0;s<SIM_STREAMS;++s)
+		{
+			if(period_us[s] == 0)
+				continue;
+
+			while(next_us[s] <= now_us)
+			{
+				const uint32_t timestamp_us = config->initial_timestamp_us + (uint32_t)(next_us[s] - start_us);
+				int size;
+
+				if(s == SIM_ODOMETRY)
+					size=cc_frames_odometry(&frames, timestamp_us, frame);
+				else if(s == SIM_XV11LIDAR)
+					size=cc_frames_xv11lidar(&frames, timestamp_us, frame);
+				else
+					size=cc_frames_rplidar(&frames, timestamp_us, s - SIM_RPLIDAR, frame);
+
+				size=cc_frames_corrupt(&frames, &config->corruption, frame, size, corrupted);
+
+				if(out_size + size > SIM_OUTPUT_SIZE)
+				{	//stalled longer than buffer
+					stats->dropped_bytes += size;
+					size=0;
+				}
+
+				memcpy(out+out_size, corrupted, size);
+				out_size += size;
+				++stats->frames[s];
+				next_us[s] += period_us[s];
+			}
+
+			if(next_us[s] < wake_us)
+				wake_us=next_us[s];
+		}
+
+		if(!stalled && out_size)
+		{
+			output(master, out, out_size, stats);
+			out_size=0;
+		}
+
+		sleep_until_us(wake_us);
+	}
+
+	return 0;
+}
+
+static void output(int master, const uint8_t *data, int size, struct sim_stats *stats)
+{
+	ssize_t written=write(master, data, size);
+
+	if(written < 0)
+		written = 0;
+
+	stats->bytes += written;
+	stats->dropped_bytes += size - written;
+}
+
+static uint64_t clock_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(uint64_t time_us)
+{
+	struct timespec ts;
+
+	if(time_us == UINT64_MAX) //nothing to emit
+		time_us = clock_us() + 100000;
+
+	ts.tv_sec = time_us / 1000000;
+	ts.tv_nsec = (time_us % 1000000) * 1000;
+
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void print_stats(const struct sim_config *config, const struct sim_stats *stats, double elapsed_s)
+{
+	uint64_t rplidar=0;
+
+	for(int i=0;i<config->rplidar_devices;++i)
+		rplidar += stats->frames[SIM_RPLIDAR+i];
+
+	fprintf(stderr, "elapsed %.1f s\n", elapsed_s);
+	fprintf(stderr, "frames odometry=%llu xv11lidar=%llu rplidar=%llu\n",
+		(unsigned long long)stats->frames[SIM_ODOMETRY], (unsigned long long)stats->frames[SIM_XV11LIDAR], (unsigned long long)rplidar);
+	fprintf(stderr, "written %llu bytes (%.1f KB/s), dropped %llu bytes\n",
+		(unsigned long long)stats->bytes, stats->bytes / elapsed_s / 1000.0, (unsigned long long)stats->dropped_bytes);
+}
+
+static int parse_arguments(int argc, char **argv, struct sim_config *config)
+{
+	int opt;
+	char *separator;
+
+	while( (opt=getopt(argc, argv, "o:x:r:n:c:t:g:b:d:w:l:h")) != -1 )
+	{
+		switch(opt)
+		{
+			case 'o': config->rate[SIM_ODOMETRY]=atof(optarg); break;
+			case 'x': config->rate[SIM_XV11LIDAR]=atof(optarg); break;
+			case 'r': config->rate[SIM_RPLIDAR]=atof(optarg); break;
+			case 'n': config->rplidar_devices=atoi(optarg); break;
+			case 'c': config->corruption.corrupt=atof(optarg); break;
+			case 't': config->corruption.truncate=atof(optarg); break;
+			case 'g': config->corruption.garbage=atof(optarg); break;
+			case 'b':
+				if( (separator=strchr(optarg, ':')) == NULL)
+					return -1;
+				config->stall_ms=atoi(optarg);
+				config->stall_every_ms=atoi(separator+1);
+				break;
+			case 'd': config->duration_s=atof(optarg); break;
+			case 'w': config->initial_timestamp_us=(uint32_t)strtoul(optarg, NULL, 0); break;
+			case 'l': config->link=optarg; break;
+			default: return -1;
+		}
+	}
+
+	if(config->rplidar_devices < 1 || config->rplidar_devices > SIM_RPLIDAR_MAX_DEVICES)
+		return -1;
+
+	//the same rate for all rplidar devices
+	for(int i=1;i<config->rplidar_devices;++i)
+		config->rate[SIM_RPLIDAR+i]=config->rate[SIM_RPLIDAR];
+
+	return optind == argc ? 0 : -1;
+}
+
+static void usage(char **argv)
+{
+	printf("Usage:\n");
+	printf("%s [options]\n\n", argv[0]);
+	printf("options:\n");
+	printf("-o HZ          odometry rate (default 1000)\n");
+	printf("-x HZ          xv11lidar rate (default 0, real device 450)\n");
+	printf("-r HZ          rplidar capsule rate per device (default 0, real device ~170)\n");
+	printf("-n N           number of rplidar devices (1-%d, default 1)\n", SIM_RPLIDAR_MAX_DEVICES);
+	printf("-c P           probability of corrupting byte in frame (0-1)\n");
+	printf("-t P           probability of truncating frame (0-1)\n");
+	printf("-g P           probability of garbage before frame (0-1)\n");
+	printf("-b MS:EVERY_MS stall output for MS every EVERY_MS (then burst)\n");
+	printf("-d S           duration in seconds (default until interrupted)\n");
+	printf("-w US          initial MCU timestamp (e.g. 0xFFF00000 to test wrap-around)\n");
+	printf("-l PATH        create symlink to slave device\n\n");
+	printf("examples:\n");
+	printf("%s -o 1000 -r 170 -n 2 -x 450\n", argv[0]);
+	printf("%s -o 1000 -r 170 -g 0.01 -c 0.01 -b 50:1000 -l /tmp/ttyCC\n", argv[0]);
+}
+
+static void on_signal(int signum)
+{
+	(void)signum;
+	keep_running=0;
+}
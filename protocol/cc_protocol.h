@@ -0,0 +1,175 @@
+/*
+ * Cave Crawler Library protocol messages
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Generated by protocol/cc_protocol_gen.py from protocol/cc_protocol.json
+ * Do not edit, edit the protocol description and regenerate (done by CMake build).
+ *
+ */
+
+#ifndef CAVE_CRAWLER_PROTOCOL_H_
+#define CAVE_CRAWLER_PROTOCOL_H_
+
+// included from cave_crawler.h
+
+/**
+ * @brief Message types
+ * @see cc_message_type
+ */
+enum cc_message_type_enum {
+	CC_MESSAGE_ODOMETRY=0x01, //!< odometry and IMU
+	CC_MESSAGE_XV11LIDAR=0x02, //!< XV11 lidar
+	CC_MESSAGE_RPLIDAR=0x03 //!< RPLidar A3
+	};
+
+/**
+ * @brief X(NAME, name, type, size) for each message type
+ *
+ * Expands per type code, e.g. struct cc_data members.
+ * Size is message size including framing.
+ */
+#define CC_PROTOCOL_MESSAGES(X) \
+	X(ODOMETRY, odometry, 0x01, 32) \
+	X(RPLIDAR, rplidar, 0x03, 142) \
+	X(XV11LIDAR, xv11lidar, 0x02, 19)
+
+/**
+ * @struct cc_odometry_data
+ * @brief Data streamed for odometry and IMU.
+ * @see cc_read_all
+ */
+struct cc_odometry_data
+{
+	uint32_t timestamp_us; //!< microseconds elapsed since MCU was plugged in
+	int32_t left_encoder_counts; //!< left wheel encoder counts
+	int32_t right_encoder_counts; //!< right wheel encoder counts
+	float qw; //!< orientation quaternion w
+	float qx; //!< orientation quaternion x
+	float qy; //!< orientation quaternion y
+	float qz; //!< orientation quaternion z
+	uint64_t mcu_time_us; //!< timestamp_us unwrapped to 64 bits
+	uint64_t host_time_us; //!< timestamp_us mapped to host CLOCK_MONOTONIC microseconds
+	uint32_t latency_us; //!< estimated transport latency (host receive time - host_time_us)
+};
+
+/**
+ * @struct cc_rplidar_data
+ * @brief Data streamed for RPLidar A3
+ * @see cc_read_all
+ */
+struct cc_rplidar_data
+{
+	uint32_t timestamp_us; //!< microseconds elapsed since MCU was plugged in
+	uint8_t device_id; //!< identifies device when using multiple lidars
+	uint8_t sequence; //!< 0-255, wrap-around for checking if packets are consecutive
+	rplidar_response_ultra_capsule_measurement_nodes_t capsule; //!< type from RPLidarSDK
+	uint64_t mcu_time_us; //!< timestamp_us unwrapped to 64 bits
+	uint64_t host_time_us; //!< timestamp_us mapped to host CLOCK_MONOTONIC microseconds
+	uint32_t latency_us; //!< estimated transport latency (host receive time - host_time_us)
+};
+
+/**
+ * @struct cc_xv11lidar_data
+ * @brief Data streamed for XV11 Lidar
+ * @see cc_read_all
+ */
+struct cc_xv11lidar_data
+{
+	uint32_t timestamp_us; //!< microseconds elapsed since MCU was plugged in
+	uint8_t angle_quad; //!< 0-89 for readings 0-3 356-359
+	uint16_t speed64; //!< divide by 64 for speed in rpm
+	uint16_t distances[4]; //!< invalid_data bit, strength_warning bit, 14 bit distance in mm or error code
+	uint64_t mcu_time_us; //!< timestamp_us unwrapped to 64 bits
+	uint64_t host_time_us; //!< timestamp_us mapped to host CLOCK_MONOTONIC microseconds
+	uint32_t latency_us; //!< estimated transport latency (host receive time - host_time_us)
+};
+
+/**
+ * @struct cc_odometry_columns
+ * @brief Odometry and IMU data in columns (structure of arrays).
+ *
+ * Each member is user array with capacity from cc_columns size, NULL columns are not written.
+ * @see cc_read_columns
+ */
+struct cc_odometry_columns
+{
+	uint32_t *timestamp_us; //!< microseconds elapsed since MCU was plugged in
+	int32_t *left_encoder_counts; //!< left wheel encoder counts
+	int32_t *right_encoder_counts; //!< right wheel encoder counts
+	float *qw; //!< orientation quaternion w
+	float *qx; //!< orientation quaternion x
+	float *qy; //!< orientation quaternion y
+	float *qz; //!< orientation quaternion z
+	uint64_t *mcu_time_us; //!< timestamp_us unwrapped to 64 bits
+	uint64_t *host_time_us; //!< timestamp_us mapped to host CLOCK_MONOTONIC microseconds
+	uint32_t *latency_us; //!< estimated transport latency (host receive time - host_time_us)
+};
+
+/**
+ * @struct cc_rplidar_columns
+ * @brief RPLidar A3 data in columns (structure of arrays).
+ *
+ * Each member is user array with capacity from cc_columns size, NULL columns are not written.
+ * @see cc_read_columns
+ */
+struct cc_rplidar_columns
+{
+	uint32_t *timestamp_us; //!< microseconds elapsed since MCU was plugged in
+	uint8_t *device_id; //!< identifies device when using multiple lidars
+	uint8_t *sequence; //!< 0-255, wrap-around for checking if packets are consecutive
+	rplidar_response_ultra_capsule_measurement_nodes_t *capsule; //!< type from RPLidarSDK
+	uint64_t *mcu_time_us; //!< timestamp_us unwrapped to 64 bits
+	uint64_t *host_time_us; //!< timestamp_us mapped to host CLOCK_MONOTONIC microseconds
+	uint32_t *latency_us; //!< estimated transport latency (host receive time - host_time_us)
+};
+
+/**
+ * @struct cc_xv11lidar_columns
+ * @brief XV11 lidar data in columns (structure of arrays).
+ *
+ * Each member is user array with capacity from cc_columns size, NULL columns are not written.
+ * @see cc_read_columns
+ */
+struct cc_xv11lidar_columns
+{
+	uint32_t *timestamp_us; //!< microseconds elapsed since MCU was plugged in
+	uint8_t *angle_quad; //!< 0-89 for readings 0-3 356-359
+	uint16_t *speed64; //!< divide by 64 for speed in rpm
+	uint16_t (*distances)[4]; //!< invalid_data bit, strength_warning bit, 14 bit distance in mm or error code
+	uint64_t *mcu_time_us; //!< timestamp_us unwrapped to 64 bits
+	uint64_t *host_time_us; //!< timestamp_us mapped to host CLOCK_MONOTONIC microseconds
+	uint32_t *latency_us; //!< estimated transport latency (host receive time - host_time_us)
+};
+
+struct cc_message;
+
+/**
+ * @brief Decode odometry and IMU message.
+ * @param msg message view
+ * @param data decoded data returned here
+ * @return CC_OK or CC_ERROR if message is not ::CC_MESSAGE_ODOMETRY
+ */
+int cc_message_odometry(const struct cc_message *msg, struct cc_odometry_data *data);
+
+/**
+ * @brief Decode RPLidar A3 message.
+ * @param msg message view
+ * @param data decoded data returned here
+ * @return CC_OK or CC_ERROR if message is not ::CC_MESSAGE_RPLIDAR
+ */
+int cc_message_rplidar(const struct cc_message *msg, struct cc_rplidar_data *data);
+
+/**
+ * @brief Decode XV11 lidar message.
+ * @param msg message view
+ * @param data decoded data returned here
+ * @return CC_OK or CC_ERROR if message is not ::CC_MESSAGE_XV11LIDAR
+ */
+int cc_message_xv11lidar(const struct cc_message *msg, struct cc_xv11lidar_data *data);
+
+#endif //CAVE_CRAWLER_PROTOCOL_H_
@@ -0,0 +1,202 @@
+/*
+ * Cave Crawler Library protocol decoding (internal)
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Generated by protocol/cc_protocol_gen.py from protocol/cc_protocol.json
+ * Do not edit, edit the protocol description and regenerate (done by CMake build).
+ *
+ */
+
+#ifndef CAVE_CRAWLER_PROTOCOL_DECODE_H_
+#define CAVE_CRAWLER_PROTOCOL_DECODE_H_
+
+#include "cc_protocol.h"
+
+#include <stdint.h> //uint8_t
+#include <string.h> //memcpy
+
+/*
+## The packet structure
+
+|          |  Start Byte   |  Size     | Type            |      Payload   | End Byte      |
+| ---------|---------------|-----------|-----------------|----------------|---------------|
+|   bytes  |    1          |      1    |    1            | type dependent |     1         |
+|   value  | fixed 0xFB    |  0-255    | defined set     | type dependent |   fixed 0xFC  |
+
+- Start Byte, Size, Type, End Byte can all be used for sync
+- Size includes all the bytes (payload bytes + 4)
+- Payload starts with 4 bytes timestamp in microseconds
+- CRC is already included in USB (not needed)
+- Multi byte fields are little endian
+*/
+
+// start end delimeters
+enum {CC_START_OF_MESSAGE=0xFB, CC_END_OF_MESSAGE=0xFC};
+enum {CC_NON_PAYLOAD_SIZE=4};
+
+// types (the same as public cc_message_type_enum)
+enum {CC_ODOMETRY_TYPE=CC_MESSAGE_ODOMETRY, CC_RPLIDAR_TYPE=CC_MESSAGE_RPLIDAR, CC_XV11LIDAR_TYPE=CC_MESSAGE_XV11LIDAR};
+// sizes including framing
+enum {CC_ODOMETRY_SIZE=32, CC_RPLIDAR_SIZE=142, CC_XV11LIDAR_SIZE=19};
+
+// message size by type, 0 for unknown type
+static const uint8_t CC_MESSAGE_SIZES[256]={
+	[0x01]=32, //odometry
+	[0x02]=19, //xv11lidar
+	[0x03]=142, //rplidar
+};
+
+/*
+## Types
+
+|  Type       | Value  | Payload bytes |  Info                                   |
+| ------------|--------|---------------|-----------------------------------------|
+|  ODOMETRY   | 0x01   |      28       |  odometry and IMU                       |
+|  XV11LIDAR  | 0x02   |      15       |  XV11 lidar                             |
+|  RPLIDAR    | 0x03   |     138       |  RPLidar A3                             |
+*/
+
+/*
+### ODOMETRY
+
+|       | timestamp_us | left_encoder_counts | right_encoder_counts | qw         | qx         | qy         | qz         |
+|-------|--------------|---------------------|----------------------|------------|------------|------------|------------|
+| bytes | 4            | 4                   | 4                    | 4          | 4          | 4          | 4          |
+| type  | uint32       | int32               | int32                | float      | float      | float      | float      |
+| unit  | us           | counts              | counts               | quaternion | quaternion | quaternion | quaternion |
+
+*/
+
+static inline void decode_payload_odometry(const uint8_t *payload, struct cc_odometry_data *data)
+{
+	memcpy(&data->timestamp_us, payload + 0, 4);
+	memcpy(&data->left_encoder_counts, payload + 4, 4);
+	memcpy(&data->right_encoder_counts, payload + 8, 4);
+	memcpy(&data->qw, payload + 12, 4);
+	memcpy(&data->qx, payload + 16, 4);
+	memcpy(&data->qy, payload + 20, 4);
+	memcpy(&data->qz, payload + 24, 4);
+}
+
+static inline void decode_payload_odometry_columns(const uint8_t *payload, const struct cc_odometry_columns *columns, int i)
+{
+	if(columns->timestamp_us)
+		memcpy(columns->timestamp_us + i, payload + 0, 4);
+	if(columns->left_encoder_counts)
+		memcpy(columns->left_encoder_counts + i, payload + 4, 4);
+	if(columns->right_encoder_counts)
+		memcpy(columns->right_encoder_counts + i, payload + 8, 4);
+	if(columns->qw)
+		memcpy(columns->qw + i, payload + 12, 4);
+	if(columns->qx)
+		memcpy(columns->qx + i, payload + 16, 4);
+	if(columns->qy)
+		memcpy(columns->qy + i, payload + 20, 4);
+	if(columns->qz)
+		memcpy(columns->qz + i, payload + 24, 4);
+}
+
+static inline void encode_payload_odometry(const struct cc_odometry_data *data, uint8_t *payload)
+{
+	memcpy(payload + 0, &data->timestamp_us, 4);
+	memcpy(payload + 4, &data->left_encoder_counts, 4);
+	memcpy(payload + 8, &data->right_encoder_counts, 4);
+	memcpy(payload + 12, &data->qw, 4);
+	memcpy(payload + 16, &data->qx, 4);
+	memcpy(payload + 20, &data->qy, 4);
+	memcpy(payload + 24, &data->qz, 4);
+}
+
+/*
+### RPLIDAR
+
+|       | timestamp_us | device_id | sequence | capsule                                            |
+|-------|--------------|-----------|----------|----------------------------------------------------|
+| bytes | 4            | 1         | 1        | 132                                                |
+| type  | uint32       | uint8     | uint8    | rplidar_response_ultra_capsule_measurement_nodes_t |
+| unit  | us           | ID        | counts   | RPLidarA3 internal                                 |
+
+- device ID identifies lidar when using multiple lidars
+- sequence is for checking if data angles follow one another
+- capsule is rplidar_response_ultra_capsule_measurement_nodes_t from RPLidar SDK, not decoded on MCU due to complexity
+- capsule is copied as is, decoding to measurements is done in cc_rplidar_decode (the same as _ultraCapsuleToNormal in RPLidar SDK)
+*/
+
+_Static_assert(sizeof(((struct cc_rplidar_data*)0)->capsule) == 132, "capsule size mismatch");
+static inline void decode_payload_rplidar(const uint8_t *payload, struct cc_rplidar_data *data)
+{
+	memcpy(&data->timestamp_us, payload + 0, 4);
+	memcpy(&data->device_id, payload + 4, 1);
+	memcpy(&data->sequence, payload + 5, 1);
+	memcpy(&data->capsule, payload + 6, 132);
+}
+
+static inline void decode_payload_rplidar_columns(const uint8_t *payload, const struct cc_rplidar_columns *columns, int i)
+{
+	if(columns->timestamp_us)
+		memcpy(columns->timestamp_us + i, payload + 0, 4);
+	if(columns->device_id)
+		memcpy(columns->device_id + i, payload + 4, 1);
+	if(columns->sequence)
+		memcpy(columns->sequence + i, payload + 5, 1);
+	if(columns->capsule)
+		memcpy(columns->capsule + i, payload + 6, 132);
+}
+
+static inline void encode_payload_rplidar(const struct cc_rplidar_data *data, uint8_t *payload)
+{
+	memcpy(payload + 0, &data->timestamp_us, 4);
+	memcpy(payload + 4, &data->device_id, 1);
+	memcpy(payload + 5, &data->sequence, 1);
+	memcpy(payload + 6, &data->capsule, 132);
+}
+
+/*
+### XV11LIDAR
+
+|       | timestamp_us | angle_quad | speed64  | distances  |
+|-------|--------------|------------|----------|------------|
+| bytes | 4            | 1          | 2        | 8          |
+| type  | uint32       | uint8      | uint16   | uint16 x 4 |
+| unit  | us           | 0-89       | rpm * 64 | flags, mm  |
+
+- the packet is raw XV11Lidar packet with timestamp, without signal strength, CRC
+- distances are 14 bits mm distances or error code, 1 bit strength warning, 1 bit invalid_data
+- if invalid_data bit is set, the field carries error code, otherwise it is distance in mm
+- strength warning when power received is lower than expected for the distance
+*/
+
+static inline void decode_payload_xv11lidar(const uint8_t *payload, struct cc_xv11lidar_data *data)
+{
+	memcpy(&data->timestamp_us, payload + 0, 4);
+	memcpy(&data->angle_quad, payload + 4, 1);
+	memcpy(&data->speed64, payload + 5, 2);
+	memcpy(&data->distances, payload + 7, 8);
+}
+
+static inline void decode_payload_xv11lidar_columns(const uint8_t *payload, const struct cc_xv11lidar_columns *columns, int i)
+{
+	if(columns->timestamp_us)
+		memcpy(columns->timestamp_us + i, payload + 0, 4);
+	if(columns->angle_quad)
+		memcpy(columns->angle_quad + i, payload + 4, 1);
+	if(columns->speed64)
+		memcpy(columns->speed64 + i, payload + 5, 2);
+	if(columns->distances)
+		memcpy(columns->distances + i, payload + 7, 8);
+}
+
+static inline void encode_payload_xv11lidar(const struct cc_xv11lidar_data *data, uint8_t *payload)
+{
+	memcpy(payload + 0, &data->timestamp_us, 4);
+	memcpy(payload + 4, &data->angle_quad, 1);
+	memcpy(payload + 5, &data->speed64, 2);
+	memcpy(payload + 7, &data->distances, 8);
+}
+
+#endif //CAVE_CRAWLER_PROTOCOL_DECODE_H_
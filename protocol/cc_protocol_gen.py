@@ -0,0 +1,268 @@
+#!/usr/bin/env python3
+#
+# cc-protocol-gen protocol code generator for cave-crawler-lib library
+#
+# Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+#
+
+"""
+Generates from protocol description (cc_protocol.json):
+- cc_protocol.h - public message type enum, per type X-macro, data structs
+  (row and column layout), message decoding declarations
+- cc_protocol_decode.h - internal type and size constants, type -> size lookup table,
+  straight-line payload decoders (to struct and to columns)
+  and encoders (from struct, e.g. for compressed logs)
+
+./cc_protocol_gen.py cc_protocol.json OUTPUT_DIRECTORY
+
+Adding message type means appending it to messages in cc_protocol.json.
+Per type members (struct cc_data, cc_size, cc_columns, statistics) and
+dispatch (reading, queues, shared memory, merge, logging, offline decoding,
+C++ message_traits) are expanded from the X-macro. Only optional processing
+(scan assembly, odometry history, rplidar routing) and specialized log
+codecs are written by hand (see README).
+"""
+
+import json
+import os
+import sys
+
+LICENSE = """ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Generated by protocol/cc_protocol_gen.py from protocol/cc_protocol.json
+ * Do not edit, edit the protocol description and regenerate (done by CMake build).
+ *"""
+
+C_TYPES = {
+    'uint8': ('uint8_t', 1), 'int8': ('int8_t', 1),
+    'uint16': ('uint16_t', 2), 'int16': ('int16_t', 2),
+    'uint32': ('uint32_t', 4), 'int32': ('int32_t', 4),
+    'uint64': ('uint64_t', 8), 'int64': ('int64_t', 8),
+    'float': ('float', 4), 'double': ('double', 8),
+}
+
+
+def c_type(field):
+    """C type and size in bytes of single element"""
+    if field['type'] in C_TYPES:
+        return C_TYPES[field['type']]
+    if 'size' not in field:
+        sys.exit('field %s of external type %s needs size' % (field['name'], field['type']))
+    return field['type'], field['size']
+
+
+def field_size(field):
+    return c_type(field)[1] * field.get('count', 1)
+
+
+def payload_size(message):
+    return sum(field_size(f) for f in message['fields'])
+
+
+def message_size(spec, message):
+    return payload_size(message) + spec['framing']['overhead']
+
+
+def by_type(messages):
+    """messages are listed in struct cc_data member order, tables are by type"""
+    return sorted(messages, key=lambda m: int(m['type'], 0))
+
+
+def validate(spec):
+    types = set()
+    for m in spec['messages']:
+        t = int(m['type'], 0)
+        if t in types or not 0 < t <= 255:
+            sys.exit('message %s has invalid or duplicate type %s' % (m['name'], m['type']))
+        types.add(t)
+        if message_size(spec, m) > 255:
+            sys.exit('message %s is larger than 255 bytes' % m['name'])
+        if m['fields'][0]['name'] != 'timestamp_us' or m['fields'][0]['type'] != 'uint32':
+            sys.exit('message %s payload has to start with uint32 timestamp_us' % m['name'])
+
+
+def struct_member(field):
+    ctype = c_type(field)[0]
+    count = '[%d]' % field['count'] if 'count' in field else ''
+    return '\t%s %s%s; //!< %s' % (ctype, field['name'], count, field['doc'])
+
+
+def column_member(field):
+    ctype = c_type(field)[0]
+    name = '(*%s)[%d]' % (field['name'], field['count']) if 'count' in field else '*' + field['name']
+    return '\t%s %s; //!< %s' % (ctype, name, field['doc'])
+
+
+def x_macro(spec):
+    out = ['#define CC_PROTOCOL_MESSAGES(X) \\']
+    entries = ['\tX(%s, %s, 0x%02X, %d)' % (m['name'].upper(), m['name'], int(m['type'], 0), message_size(spec, m))
+               for m in spec['messages']]
+    return out + [e + ' \\' for e in entries[:-1]] + [entries[-1], '']
+
+
+def public_header(spec):
+    out = ['/*', ' * Cave Crawler Library protocol messages', LICENSE, ' */', '']
+    out += ['#ifndef CAVE_CRAWLER_PROTOCOL_H_', '#define CAVE_CRAWLER_PROTOCOL_H_', '']
+    out += ['// included from cave_crawler.h', '']
+
+    out += ['/**', ' * @brief Message types', ' * @see cc_message_type', ' */', 'enum cc_message_type_enum {']
+    entries = ['\tCC_MESSAGE_%s=0x%02X, //!< %s' % (m['name'].upper(), int(m['type'], 0), m['brief'])
+               for m in by_type(spec['messages'])]
+    entries[-1] = entries[-1].replace(', //!<', ' //!<')
+    out += entries + ['\t};', '']
+
+    out += ['/**', ' * @brief X(NAME, name, type, size) for each message type',
+            ' *', ' * Expands per type code, e.g. struct cc_data members.',
+            ' * Size is message size including framing.', ' */']
+    out += x_macro(spec)
+
+    for m in spec['messages']:
+        out += ['/**', ' * @struct cc_%s_data' % m['name'], ' * @brief %s' % m['doc'], ' * @see cc_read_all', ' */']
+        out += ['struct cc_%s_data' % m['name'], '{']
+        out += [struct_member(f) for f in m['fields'] + spec['host_fields']]
+        out += ['};', '']
+
+    for m in spec['messages']:
+        out += ['/**', ' * @struct cc_%s_columns' % m['name'],
+                ' * @brief %s data in columns (structure of arrays).' % (m['brief'][0].upper() + m['brief'][1:]), ' *',
+                ' * Each member is user array with capacity from cc_columns size, NULL columns are not written.',
+                ' * @see cc_read_columns', ' */']
+        out += ['struct cc_%s_columns' % m['name'], '{']
+        out += [column_member(f) for f in m['fields'] + spec['host_fields']]
+        out += ['};', '']
+
+    out += ['struct cc_message;', '']
+
+    for m in spec['messages']:
+        out += ['/**', ' * @brief Decode %s message.' % m['brief'], ' * @param msg message view',
+                ' * @param data decoded data returned here',
+                ' * @return CC_OK or CC_ERROR if message is not ::CC_MESSAGE_%s' % m['name'].upper(), ' */']
+        out += ['int cc_message_%s(const struct cc_message *msg, struct cc_%s_data *data);' % (m['name'], m['name']), '']
+
+    out += ['#endif //CAVE_CRAWLER_PROTOCOL_H_', '']
+    return '\n'.join(out)
+
+
+def markdown_table(message):
+    fields = message['fields']
+    rows = [[''] + [f['name'] for f in fields],
+            ['bytes'] + [str(field_size(f)) for f in fields],
+            ['type'] + [f['type'] + (' x %d' % f['count'] if 'count' in f else '') for f in fields],
+            ['unit'] + [f.get('unit', '') for f in fields]]
+    widths = [max(len(row[i]) for row in rows) for i in range(len(rows[0]))]
+    cells = lambda row: '| ' + ' | '.join(v.ljust(w) for v, w in zip(row, widths)) + ' |'
+    out = ['### %s' % message['name'].upper(), '', cells(rows[0])]
+    out.append('|' + '|'.join('-' * (w + 2) for w in widths) + '|')
+    out += [cells(row) for row in rows[1:]]
+    out += [''] + ['- ' + n for n in message.get('notes', [])]
+    return out
+
+
+def decoder(message):
+    out = ['static inline void decode_payload_%s(const uint8_t *payload, struct cc_%s_data *data)' % (message['name'], message['name']), '{']
+    offset = 0
+    for f in message['fields']:
+        out.append('\tmemcpy(&data->%s, payload + %d, %d);' % (f['name'], offset, field_size(f)))
+        offset += field_size(f)
+    out += ['}', '']
+    return out
+
+
+def encoder(message):
+    out = ['static inline void encode_payload_%s(const struct cc_%s_data *data, uint8_t *payload)' % (message['name'], message['name']), '{']
+    offset = 0
+    for f in message['fields']:
+        out.append('\tmemcpy(payload + %d, &data->%s, %d);' % (offset, f['name'], field_size(f)))
+        offset += field_size(f)
+    out += ['}', '']
+    return out
+
+
+def column_decoder(message):
+    out = ['static inline void decode_payload_%s_columns(const uint8_t *payload, const struct cc_%s_columns *columns, int i)' % (message['name'], message['name']), '{']
+    offset = 0
+    for f in message['fields']:
+        out.append('\tif(columns->%s)' % f['name'])
+        out.append('\t\tmemcpy(columns->%s + i, payload + %d, %d);' % (f['name'], offset, field_size(f)))
+        offset += field_size(f)
+    out += ['}', '']
+    return out
+
+
+def decode_header(spec):
+    framing = spec['framing']
+    messages = spec['messages']
+
+    out = ['/*', ' * Cave Crawler Library protocol decoding (internal)', LICENSE, ' */', '']
+    out += ['#ifndef CAVE_CRAWLER_PROTOCOL_DECODE_H_', '#define CAVE_CRAWLER_PROTOCOL_DECODE_H_', '']
+    out += ['#include "cc_protocol.h"', '', '#include <stdint.h> //uint8_t', '#include <string.h> //memcpy', '']
+
+    out += ['/*', '## The packet structure', '']
+    out += ['|          |  Start Byte   |  Size     | Type            |      Payload   | End Byte      |',
+            '| ---------|---------------|-----------|-----------------|----------------|---------------|',
+            '|   bytes  |    1          |      1    |    1            | type dependent |     1         |',
+            '|   value  | fixed %s    |  0-255    | defined set     | type dependent |   fixed %s  |' % (framing['start'], framing['end']),
+            '']
+    out += ['- ' + n for n in framing['notes']]
+    out += ['*/', '']
+
+    out += ['// start end delimeters',
+            'enum {CC_START_OF_MESSAGE=%s, CC_END_OF_MESSAGE=%s};' % (framing['start'], framing['end']),
+            'enum {CC_NON_PAYLOAD_SIZE=%d};' % framing['overhead'], '']
+
+    out += ['// types (the same as public cc_message_type_enum)']
+    out += ['enum {%s};' % ', '.join('CC_%s_TYPE=CC_MESSAGE_%s' % (m['name'].upper(), m['name'].upper()) for m in messages)]
+    out += ['// sizes including framing']
+    out += ['enum {%s};' % ', '.join('CC_%s_SIZE=%d' % (m['name'].upper(), message_size(spec, m)) for m in messages), '']
+
+    out += ['// message size by type, 0 for unknown type',
+            'static const uint8_t CC_MESSAGE_SIZES[256]={']
+    out += ['\t[0x%02X]=%d, //%s' % (int(m['type'], 0), message_size(spec, m), m['name']) for m in by_type(messages)]
+    out += ['};', '']
+
+    out += ['/*', '## Types', '']
+    out += ['|  Type       | Value  | Payload bytes |  Info                                   |',
+            '| ------------|--------|---------------|-----------------------------------------|']
+    out += ['|  %-10s | 0x%02X   |     %3d       |  %-38s |' % (m['name'].upper(), int(m['type'], 0), payload_size(m), m['brief']) for m in by_type(messages)]
+    out += ['*/', '']
+
+    for m in messages:
+        out += ['/*'] + markdown_table(m) + ['*/', '']
+        for f in m['fields']:
+            if f['type'] not in C_TYPES:
+                out.append('_Static_assert(sizeof(((struct cc_%s_data*)0)->%s) == %d, "%s size mismatch");'
+                           % (m['name'], f['name'], field_size(f), f['name']))
+        out += decoder(m)
+        out += column_decoder(m)
+        out += encoder(m)
+
+    out += ['#endif //CAVE_CRAWLER_PROTOCOL_DECODE_H_', '']
+    return '\n'.join(out)
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: %s cc_protocol.json OUTPUT_DIRECTORY' % sys.argv[0])
+
+    with open(sys.argv[1]) as f:
+        spec = json.load(f)
+
+    validate(spec)
+
+    # always written so that build system sees outputs newer than inputs
+    for name, content in (('cc_protocol.h', public_header(spec)), ('cc_protocol_decode.h', decode_header(spec))):
+        with open(os.path.join(sys.argv[2], name), 'w') as f:
+            f.write(content)
+
+
+if __name__ == '__main__':
+    main()
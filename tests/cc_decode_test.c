@@ -0,0 +1,296 @@
+/*
+ * cc-decode-test parallel offline decoding test for cave-crawler-lib library
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+ /*
+  * This test:
+  * - generates random stream of all protocol types with corruption
+  *   (garbage, truncated and damaged messages), mcu timestamp wrap-around
+  *   and MCU restart (timestamps reset) in the middle
+  * - reads it with cc_open_buffer and cc_read_all (reference)
+  * - decodes it with cc_decode_buffer with 1, 2, 4 threads and minimum
+  *   and default chunk size, compares all fields with reference
+  *   (except host_time_us and latency_us, raw stream has no receive times)
+  * - checks that too small arrays are reported with ENOBUFS and required sizes
+  *
+  * Library source is included to reach internal protocol definitions.
+  *
+  * ./cc-decode-test [messages] [seed]
+  *
+  */
+
+#include "../cave_crawler.c"
+
+#include <stdio.h> //printf, fprintf
+#include <stdlib.h> //atoi, rand_r, calloc
+
+enum {TEST_DEFAULT_MESSAGES=30000};
+
+static uint8_t *generate_stream(int messages, size_t *size, unsigned int *seed);
+static int read_reference(const uint8_t *stream, size_t size, int capacity, struct cc_data *out);
+static int test_decode(const uint8_t *stream, size_t size, int threads, int chunk_bytes, int capacity, const struct cc_data *expected);
+static int test_no_space(const uint8_t *stream, size_t size, const struct cc_data *expected);
+static int alloc_data(struct cc_data *data, int capacity);
+static void free_data(struct cc_data *data);
+
+int main(int argc, char **argv)
+{
+	const int messages = argc > 1 ? atoi(argv[1]) : TEST_DEFAULT_MESSAGES;
+	unsigned int seed = argc > 2 ? (unsigned int)atoi(argv[2]) : 1;
+	const int threads[]={1, 2, 4};
+	const int chunk_bytes[]={CC_DECODE_MIN_CHUNK_BYTES, 0};
+	struct cc_data reference={0};
+	uint8_t *stream;
+	size_t size;
+	int capacity, failed=1;
+
+	if(messages < 1 || (stream=generate_stream(messages, &size, &seed)) == NULL)
+	{
+		fprintf(stderr, "usage: %s [messages >= 1] [seed]\n", argv[0]);
+		return 1;
+	}
+
+	//garbage may happen to form valid messages
+	capacity = 2 * messages;
+
+	if(read_reference(stream, size, capacity, &reference) != 0)
+		goto cleanup;
+
+	for(int t=0;t<3;++t)
+		for(int c=0;c<2;++c)
+			if(test_decode(stream, size, threads[t], chunk_bytes[c], capacity, &reference) != 0)
+				goto cleanup;
+
+	if(test_no_space(stream, size, &reference) != 0)
+		goto cleanup;
+
+	failed=0;
+
+cleanup:
+	free(stream);
+	free_data(&reference);
+
+	printf("%s, %zu bytes (%d odometry, %d rplidar, %d xv11lidar)\n", failed ? "FAILED" : "passed",
+	size, reference.size.odometry, reference.size.rplidar, reference.size.xv11lidar);
+
+	return failed ? 1 : 0;
+}
+
+#define TEST_MESSAGE_TYPE(NAME, name, type, bytes) CC_##NAME##_TYPE,
+
+static uint8_t *generate_stream(int messages, size_t *size, unsigned int *seed)
+{
+	static const uint8_t types[]={CC_PROTOCOL_MESSAGES(TEST_MESSAGE_TYPE)};
+	uint32_t timestamp_us[UINT8_MAX+1];
+	uint8_t *stream=malloc((size_t)messages * (2 * UINT8_MAX + 16));
+	size_t offset=0;
+
+	if(stream == NULL)
+		return NULL;
+
+	//wraps around early
+	for(int i=0;i<=UINT8_MAX;++i)
+		timestamp_us[i]=UINT32_MAX - 1000000;
+
+	for(int i=0;i<messages;++i)
+	{
+		const uint8_t type=types[rand_r(seed) % sizeof(types)];
+		const uint8_t bytes=CC_MESSAGE_SIZES[type];
+		uint8_t *msg;
+
+		//MCU restart
+		if(i == messages / 2)
+			for(int t=0;t<=UINT8_MAX;++t)
+				timestamp_us[t]=0;
+
+		//random garbage, may include delimiters
+		if(rand_r(seed) % 32 == 0)
+			for(int g=rand_r(seed) % 64;g>0;--g)
+				stream[offset++] = rand_r(seed) % 4 ? (uint8_t)rand_r(seed) : CC_START_OF_MESSAGE;
+
+		msg=stream + offset;
+		msg[CC_START_OF_MESSAGE_OFFSET]=CC_START_OF_MESSAGE;
+		msg[CC_MESSAGE_SIZE_OFFSET]=bytes;
+		msg[CC_MESSAGE_TYPE_OFFSET]=type;
+
+		for(int b=CC_MSG_PAYLOAD_OFFSET;b<bytes-1;++b)
+			msg[b]=(uint8_t)rand_r(seed);
+
+		msg[bytes-1]=CC_END_OF_MESSAGE;
+
+		timestamp_us[type] += 100 + rand_r(seed) % 10000;
+		memcpy(msg + CC_MSG_PAYLOAD_OFFSET, &timestamp_us[type], sizeof(uint32_t));
+
+		if(type == CC_RPLIDAR_TYPE)
+			msg[CC_MSG_PAYLOAD_OFFSET+4] = rand_r(seed) % 3;
+
+		switch(rand_r(seed) % 64)
+		{
+			case 0: //truncated
+				offset += rand_r(seed) % bytes;
+				break;
+			case 1: //damaged byte
+				msg[rand_r(seed) % bytes] = (uint8_t)rand_r(seed);
+				offset += bytes;
+				break;
+			default:
+				offset += bytes;
+		}
+	}
+
+	*size=offset;
+	return stream;
+}
+
+#undef TEST_MESSAGE_TYPE
+
+#define TEST_BATCH(NAME, name, type, bytes) \
+	batch.name=out->name + out->size.name; \
+	batch.size.name=capacity - out->size.name;
+
+#define TEST_ADVANCE(NAME, name, type, bytes) \
+	out->size.name += batch.size.name;
+
+// raw stream has no receive times, host times of cc_open_buffer are reading times
+#define TEST_CLEAR_HOST_TIME(NAME, name, type, bytes) \
+	for(int i=0;i<out->size.name;++i) \
+		out->name[i].host_time_us = out->name[i].latency_us = 0;
+
+static int read_reference(const uint8_t *stream, size_t size, int capacity, struct cc_data *out)
+{
+	struct cc *c;
+	int ret;
+
+	if(alloc_data(out, capacity) != 0 || (c=cc_open_buffer(stream, size)) == NULL)
+	{
+		fprintf(stderr, "reference: unable to allocate\n");
+		return 1;
+	}
+
+	out->size=(struct cc_size){0};
+
+	do
+	{
+		struct cc_data batch;
+
+		CC_PROTOCOL_MESSAGES(TEST_BATCH)
+		ret=cc_read_all(c, &batch);
+		CC_PROTOCOL_MESSAGES(TEST_ADVANCE)
+	}
+	while(ret != CC_ERROR);
+
+	cc_close(c);
+
+	if(errno != ENODEV)
+	{
+		fprintf(stderr, "reference: reading failed\n");
+		return 1;
+	}
+
+	CC_PROTOCOL_MESSAGES(TEST_CLEAR_HOST_TIME)
+
+	return 0;
+}
+
+#undef TEST_BATCH
+#undef TEST_ADVANCE
+#undef TEST_CLEAR_HOST_TIME
+
+// arrays are zero allocated so padding compares equal
+#define TEST_COMPARE(NAME, name, type, bytes) \
+	if(data.size.name != expected->size.name) \
+	{ \
+		fprintf(stderr, "decode: %d threads, %d chunk bytes: %d %s expected %d\n", threads, chunk_bytes, data.size.name, #name, expected->size.name); \
+		goto cleanup; \
+	} \
+	for(int i=0;i<expected->size.name;++i) \
+		if(memcmp(&expected->name[i], &data.name[i], sizeof(expected->name[i])) != 0) \
+		{ \
+			fprintf(stderr, "decode: %d threads, %d chunk bytes: %s message %d differs\n", threads, chunk_bytes, #name, i); \
+			goto cleanup; \
+		}
+
+static int test_decode(const uint8_t *stream, size_t size, int threads, int chunk_bytes, int capacity, const struct cc_data *expected)
+{
+	const struct cc_decode_config config={threads, chunk_bytes};
+	struct cc_data data={0};
+	int failed=1;
+
+	if(alloc_data(&data, capacity) != 0)
+	{
+		fprintf(stderr, "decode: unable to allocate\n");
+		goto cleanup;
+	}
+
+	if(cc_decode_buffer(stream, size, &config, &data) != CC_OK)
+	{
+		fprintf(stderr, "decode: %d threads, %d chunk bytes: decoding failed\n", threads, chunk_bytes);
+		goto cleanup;
+	}
+
+	CC_PROTOCOL_MESSAGES(TEST_COMPARE)
+
+	failed=0;
+
+cleanup:
+	free_data(&data);
+	return failed;
+}
+
+#undef TEST_COMPARE
+
+static int test_no_space(const uint8_t *stream, size_t size, const struct cc_data *expected)
+{
+	const struct cc_decode_config config={1, CC_DECODE_MIN_CHUNK_BYTES};
+	struct cc_data data={0};
+	int failed=1;
+
+	if(alloc_data(&data, 1) != 0)
+	{
+		fprintf(stderr, "no space: unable to allocate\n");
+		goto cleanup;
+	}
+
+	if(cc_decode_buffer(stream, size, &config, &data) != CC_ERROR || errno != ENOBUFS ||
+		memcmp(&data.size, &expected->size, sizeof(data.size)) != 0)
+	{
+		fprintf(stderr, "no space: expected ENOBUFS with required sizes\n");
+		goto cleanup;
+	}
+
+	failed=0;
+
+cleanup:
+	free_data(&data);
+	return failed;
+}
+
+#define TEST_ALLOC(NAME, name, type, bytes) \
+	data->size.name=capacity; \
+	if( (data->name=calloc(capacity, sizeof(*data->name))) == NULL) \
+		return 1;
+
+static int alloc_data(struct cc_data *data, int capacity)
+{
+	CC_PROTOCOL_MESSAGES(TEST_ALLOC)
+
+	return 0;
+}
+
+#undef TEST_ALLOC
+
+#define TEST_FREE(NAME, name, type, bytes) free(data->name);
+
+static void free_data(struct cc_data *data)
+{
+	CC_PROTOCOL_MESSAGES(TEST_FREE)
+}
+
+#undef TEST_FREE
@@ -0,0 +1,338 @@
+/*
+ * cc-log-test compressed log round trip test for cave-crawler-lib library
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+ /*
+  * This test:
+  * - round trips random payloads of all protocol types through generic log codec
+  *   (used for types without specialized codec)
+  * - generates random stream of all protocol types with garbage between messages
+  * - records it in random size reads (record)
+  * - replays recording with compressed logging (log)
+  * - replays recording and log, compares all fields of all messages (replay)
+  *
+  * Library source is included to reach internal recording and codec functions.
+  *
+  * ./cc-log-test [messages] [seed]
+  *
+  */
+
+#include "../cave_crawler.c"
+
+#include <stdio.h> //printf, fprintf, snprintf, remove
+#include <stdlib.h> //atoi, rand_r, calloc, getenv
+
+enum {TEST_DEFAULT_MESSAGES=50000, TEST_MAX_READ_BYTES=600};
+
+static int test_payload_codec(unsigned int *seed);
+static uint8_t *generate_stream(int messages, size_t *size, struct cc_size *counts, unsigned int *seed);
+static int record_stream(const uint8_t *stream, size_t size, const char *path, unsigned int *seed);
+static int log_recording(const char *recording, const char *log);
+static int replay(const char *path, const struct cc_size *counts, struct cc_data *out);
+static int compare(const struct cc_data *expected, const struct cc_data *actual);
+static void free_stream(struct cc_data *s);
+
+int main(int argc, char **argv)
+{
+	const int messages = argc > 1 ? atoi(argv[1]) : TEST_DEFAULT_MESSAGES;
+	unsigned int seed = argc > 2 ? (unsigned int)atoi(argv[2]) : 1;
+	const char *tmp = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+	struct cc_data recorded={0}, logged={0};
+	struct cc_size counts={0};
+	char recording[256], log[256];
+	uint8_t *stream=NULL;
+	size_t size;
+	int failed=1;
+
+	if(messages < 1)
+	{
+		fprintf(stderr, "usage: %s [messages >= 1] [seed]\n", argv[0]);
+		return 1;
+	}
+
+	snprintf(recording, sizeof(recording), "%s/cc-log-test-%d.ccrec", tmp, (int)getpid());
+	snprintf(log, sizeof(log), "%s/cc-log-test-%d.cclog", tmp, (int)getpid());
+
+	if(test_payload_codec(&seed) != 0)
+		goto cleanup;
+
+	if( (stream=generate_stream(messages, &size, &counts, &seed)) == NULL)
+	{
+		fprintf(stderr, "stream: unable to allocate\n");
+		goto cleanup;
+	}
+
+	if(record_stream(stream, size, recording, &seed) != 0 ||
+		log_recording(recording, log) != 0 ||
+		replay(recording, &counts, &recorded) != 0 ||
+		replay(log, &counts, &logged) != 0 ||
+		compare(&recorded, &logged) != 0)
+		goto cleanup;
+
+	failed=0;
+
+cleanup:
+	free(stream);
+	free_stream(&recorded);
+	free_stream(&logged);
+	remove(recording);
+	remove(log);
+
+	printf("%s, %d messages (%d odometry, %d rplidar, %d xv11lidar)\n", failed ? "FAILED" : "passed",
+	messages, counts.odometry, counts.rplidar, counts.xv11lidar);
+
+	return failed ? 1 : 0;
+}
+
+static void random_payload(uint8_t *payload, int bytes, unsigned int *seed)
+{
+	for(int i=0;i<bytes;++i)
+		payload[i]=(uint8_t)rand_r(seed);
+}
+
+// generic codec has to reproduce the same fields for every type
+#define TEST_PAYLOAD_CODEC(NAME, name, type, bytes) \
+{ \
+	struct cc_##name##_data expected, actual; \
+	uint8_t payload[bytes - CC_NON_PAYLOAD_SIZE], decoded[bytes - CC_NON_PAYLOAD_SIZE]; \
+	uint8_t encoded[bytes]; \
+	const uint8_t *end; \
+	uint32_t timestamp_us; \
+	\
+	random_payload(payload, sizeof(payload), seed); \
+	memcpy(&timestamp_us, payload, sizeof(uint32_t)); \
+	end=log_encode_payload(CC_##NAME##_TYPE, payload, encoded); \
+	\
+	if(log_decode_payload(CC_##NAME##_TYPE, timestamp_us, encoded, end - 1, decoded) != NULL || \
+		log_decode_payload(CC_##NAME##_TYPE, timestamp_us, encoded, end, decoded) != end) \
+	{ \
+		fprintf(stderr, "payload codec: %s truncation\n", #name); \
+		return 1; \
+	} \
+	\
+	memset(&expected, 0, sizeof(expected)); \
+	memset(&actual, 0, sizeof(actual)); \
+	decode_payload_##name(payload, &expected); \
+	decode_payload_##name(decoded, &actual); \
+	\
+	if(memcmp(&expected, &actual, sizeof(expected)) != 0) \
+	{ \
+		fprintf(stderr, "payload codec: %s fields differ\n", #name); \
+		return 1; \
+	} \
+}
+
+static int test_payload_codec(unsigned int *seed)
+{
+	for(int i=0;i<100;++i)
+	{
+		CC_PROTOCOL_MESSAGES(TEST_PAYLOAD_CODEC)
+	}
+
+	return 0;
+}
+
+#undef TEST_PAYLOAD_CODEC
+
+#define TEST_MESSAGE_TYPE(NAME, name, type, bytes) CC_##NAME##_TYPE,
+
+// random payloads with increasing per type timestamps, garbage (without start byte) between some messages
+static uint8_t *generate_stream(int messages, size_t *size, struct cc_size *counts, unsigned int *seed)
+{
+	static const uint8_t types[]={CC_PROTOCOL_MESSAGES(TEST_MESSAGE_TYPE)};
+	uint32_t timestamp_us[UINT8_MAX+1]={0};
+	uint8_t *stream=malloc((size_t)messages * (UINT8_MAX + 8));
+	size_t offset=0;
+
+	if(stream == NULL)
+		return NULL;
+
+	for(int i=0;i<messages;++i)
+	{
+		const uint8_t type=types[rand_r(seed) % sizeof(types)];
+		const uint8_t bytes=CC_MESSAGE_SIZES[type];
+		uint8_t *msg;
+
+		if(rand_r(seed) % 16 == 0)
+			for(int g=rand_r(seed) % 8;g>0;--g)
+				stream[offset++]=CC_END_OF_MESSAGE;
+
+		msg=stream + offset;
+		msg[CC_START_OF_MESSAGE_OFFSET]=CC_START_OF_MESSAGE;
+		msg[CC_MESSAGE_SIZE_OFFSET]=bytes;
+		msg[CC_MESSAGE_TYPE_OFFSET]=type;
+		random_payload(msg + CC_MSG_PAYLOAD_OFFSET, bytes - CC_NON_PAYLOAD_SIZE, seed);
+		msg[bytes-1]=CC_END_OF_MESSAGE;
+
+		timestamp_us[type] += 100 + rand_r(seed) % 10000;
+		memcpy(msg + CC_MSG_PAYLOAD_OFFSET, &timestamp_us[type], sizeof(uint32_t));
+
+		//few rplidar devices
+		if(type == CC_RPLIDAR_TYPE)
+			msg[CC_MSG_PAYLOAD_OFFSET+4] = rand_r(seed) % 3;
+
+		counts->odometry += type == CC_ODOMETRY_TYPE;
+		counts->rplidar += type == CC_RPLIDAR_TYPE;
+		counts->xv11lidar += type == CC_XV11LIDAR_TYPE;
+
+		offset += bytes;
+	}
+
+	*size=offset;
+	return stream;
+}
+
+#undef TEST_MESSAGE_TYPE
+
+// stream in random size reads as if received from device
+static int record_stream(const uint8_t *stream, size_t size, const char *path, unsigned int *seed)
+{
+	struct cc *c=cc_open_buffer(NULL, 0);
+	uint64_t receive_time_us=1000000;
+	size_t offset=0;
+
+	if(c == NULL || cc_record_start(c, path) != CC_OK)
+	{
+		fprintf(stderr, "record: unable to start recording\n");
+		cc_close(c);
+		return 1;
+	}
+
+	while(offset < size)
+	{
+		uint32_t bytes = 1 + rand_r(seed) % TEST_MAX_READ_BYTES;
+
+		if(bytes > size - offset)
+			bytes = size - offset;
+
+		receive_time_us += 100 + rand_r(seed) % 2000;
+		record_append(c->recorder, stream + offset, bytes, receive_time_us);
+		offset += bytes;
+	}
+
+	if(cc_record_stop(c) != CC_OK)
+	{
+		fprintf(stderr, "record: recording failed\n");
+		cc_close(c);
+		return 1;
+	}
+
+	cc_close(c);
+	return 0;
+}
+
+static int log_recording(const char *recording, const char *log)
+{
+	struct cc *c=cc_open_replay(recording, 0);
+	struct cc_data data={0};
+
+	if(c == NULL || cc_log_start(c, log) != CC_OK)
+	{
+		fprintf(stderr, "log: unable to start logging\n");
+		cc_close(c);
+		return 1;
+	}
+
+	//messages are logged while consumed, even if not returned
+	while(cc_read_all(c, &data) != CC_ERROR)
+		data.size=(struct cc_size){0};
+
+	if(errno != ENODEV || cc_log_stop(c) != CC_OK)
+	{
+		fprintf(stderr, "log: logging failed\n");
+		cc_close(c);
+		return 1;
+	}
+
+	cc_close(c);
+	return 0;
+}
+
+#define TEST_ALLOC(NAME, name, type, bytes) \
+	if( (out->name=calloc(counts->name, sizeof(*out->name))) == NULL) \
+		return 1;
+
+#define TEST_BATCH(NAME, name, type, bytes) \
+	batch.name=out->name + out->size.name; \
+	batch.size.name=counts->name - out->size.name;
+
+#define TEST_ADVANCE(NAME, name, type, bytes) \
+	out->size.name += batch.size.name;
+
+static int replay(const char *path, const struct cc_size *counts, struct cc_data *out)
+{
+	struct cc *c;
+	int ret;
+
+	CC_PROTOCOL_MESSAGES(TEST_ALLOC)
+
+	if( (c=cc_open_replay(path, 0)) == NULL)
+	{
+		fprintf(stderr, "replay: unable to open %s\n", path);
+		return 1;
+	}
+
+	do
+	{
+		struct cc_data batch;
+
+		CC_PROTOCOL_MESSAGES(TEST_BATCH)
+		ret=cc_read_all(c, &batch);
+		CC_PROTOCOL_MESSAGES(TEST_ADVANCE)
+	}
+	while(ret != CC_ERROR);
+
+	cc_close(c);
+
+	if(errno != ENODEV)
+	{
+		fprintf(stderr, "replay: %s reading failed\n", path);
+		return 1;
+	}
+
+	if(memcmp(&out->size, counts, sizeof(*counts)) != 0)
+	{
+		fprintf(stderr, "replay: %s message counts differ from stream\n", path);
+		return 1;
+	}
+
+	return 0;
+}
+
+#undef TEST_ALLOC
+#undef TEST_BATCH
+#undef TEST_ADVANCE
+
+// arrays are zero allocated so padding compares equal
+#define TEST_COMPARE(NAME, name, type, bytes) \
+	for(int i=0;i<expected->size.name;++i) \
+		if(memcmp(&expected->name[i], &actual->name[i], sizeof(expected->name[i])) != 0) \
+		{ \
+			fprintf(stderr, "compare: %s message %d differs\n", #name, i); \
+			return 1; \
+		}
+
+static int compare(const struct cc_data *expected, const struct cc_data *actual)
+{
+	CC_PROTOCOL_MESSAGES(TEST_COMPARE)
+
+	return 0;
+}
+
+#undef TEST_COMPARE
+
+#define TEST_FREE(NAME, name, type, bytes) free(s->name);
+
+static void free_stream(struct cc_data *s)
+{
+	CC_PROTOCOL_MESSAGES(TEST_FREE)
+}
+
+#undef TEST_FREE
@@ -0,0 +1,192 @@
+/*
+ * cc-rplidar-test RPLidar decoding test for cave-crawler-lib library
+ *
+ * Copyright 2019 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+ /*
+  * This test:
+  * - generates random and edge case capsules (all scale levels, zero major,
+  *   invalid and extreme predictions, start angle wrap-around)
+  * - compares distances of (vectorized if compiled) kernel with scalar reference
+  * - compares distances decoded by cc_rplidar_decode with scalar reference
+  *   and checks that only capsules wrapping around 0 degrees have (single) sync
+  *
+  * Library source is included to reach internal decoding functions.
+  *
+  * ./cc-rplidar-test [capsules] [seed]
+  *
+  */
+
+#include "../cave_crawler.c"
+
+#include <stdio.h> //printf, fprintf
+#include <stdlib.h> //atoi, rand_r, calloc
+
+enum {TEST_DEFAULT_CAPSULES=100000};
+
+static void generate_capsule(rplidar_response_ultra_capsule_measurement_nodes_t *capsule, uint16_t start_angle_q6, unsigned int *seed);
+static uint32_t generate_cabin(unsigned int *seed);
+static int test_kernel(const rplidar_response_ultra_capsule_measurement_nodes_t *capsules, int size);
+static int test_decode(const rplidar_response_ultra_capsule_measurement_nodes_t *capsules, int size);
+
+int main(int argc, char **argv)
+{
+	const int size = argc > 1 ? atoi(argv[1]) : TEST_DEFAULT_CAPSULES;
+	unsigned int seed = argc > 2 ? (unsigned int)atoi(argv[2]) : 1;
+	rplidar_response_ultra_capsule_measurement_nodes_t *capsules;
+	uint16_t angle_q6=0;
+	int failed;
+
+	if(size < 2 || (capsules=calloc(size, sizeof(*capsules))) == NULL)
+	{
+		fprintf(stderr, "usage: %s [capsules >= 2] [seed]\n", argv[0]);
+		return 1;
+	}
+
+	//full turn in ~25 capsules, random jitter, wraps around many times
+	for(int i=0;i<size;++i)
+	{
+		generate_capsule(&capsules[i], angle_q6, &seed);
+		angle_q6 = (angle_q6 + (14 << 6) + rand_r(&seed) % (2 << 6)) % (360 << 6);
+	}
+
+	failed = test_kernel(capsules, size) + test_decode(capsules, size);
+
+	free(capsules);
+
+	printf("%s, %d capsules, %s kernel\n", failed ? "FAILED" : "passed", size,
+#if defined(__SSE2__)
+	"SSE2"
+#else
+	"scalar"
+#endif
+	);
+
+	return failed ? 1 : 0;
+}
+
+static void generate_capsule(rplidar_response_ultra_capsule_measurement_nodes_t *capsule, uint16_t start_angle_q6, unsigned int *seed)
+{
+	capsule->s_checksum_1=0xA0;
+	capsule->s_checksum_2=0x50;
+	capsule->start_angle_sync_q6=start_angle_q6 | (start_angle_q6 == 0 ? 0x8000 : 0);
+
+	for(int i=0;i<CC_RPLIDAR_CABINS;++i)
+		capsule->ultra_cabins[i].combined_x3=generate_cabin(seed);
+}
+
+// | predict2 10bit | predict1 10bit | major 12bit | with bias to edge cases
+static uint32_t generate_cabin(unsigned int *seed)
+{
+	//scale level boundaries, zero and maximum
+	static const uint32_t majors[]={0, 0, 0, 1, 511, 512, 513, 1279, 1280, 1281, 1791, 1792, 1793, 3327, 3328, 3329, 4095};
+	//invalid measurement markers, extremes and zero
+	static const int32_t predicts[]={-512, 0x1FF, -511, 0x1FE, -1, 0, 1};
+	const int n_majors=sizeof(majors)/sizeof(majors[0]), n_predicts=sizeof(predicts)/sizeof(predicts[0]);
+	uint32_t major, predict1, predict2;
+
+	if(rand_r(seed) % 16 == 0) //all zero
+		return 0;
+
+	major = rand_r(seed) % 2 ? majors[rand_r(seed) % n_majors] : (uint32_t)rand_r(seed) & 0xFFF;
+	predict1 = rand_r(seed) % 2 ? (uint32_t)predicts[rand_r(seed) % n_predicts] : (uint32_t)rand_r(seed);
+	predict2 = rand_r(seed) % 2 ? (uint32_t)predicts[rand_r(seed) % n_predicts] : (uint32_t)rand_r(seed);
+
+	return major | (predict1 & 0x3FF) << 12 | (predict2 & 0x3FF) << 22;
+}
+
+static int test_kernel(const rplidar_response_ultra_capsule_measurement_nodes_t *capsules, int size)
+{
+	int32_t dist_q2[CC_RPLIDAR_CAPSULE_POINTS], expected_q2[CC_RPLIDAR_CAPSULE_POINTS];
+
+	for(int i=0;i<size-1;++i)
+	{
+		decode_rplidar_distances(&capsules[i], &capsules[i+1], dist_q2);
+		decode_rplidar_distances_scalar(&capsules[i], &capsules[i+1], expected_q2, 0);
+
+		for(int p=0;p<CC_RPLIDAR_CAPSULE_POINTS;++p)
+			if(dist_q2[p] != expected_q2[p])
+			{
+				fprintf(stderr, "kernel: capsule %d point %d cabin 0x%08X next 0x%08X: %d expected %d\n", i, p,
+				capsules[i].ultra_cabins[p/3].combined_x3,
+				p/3 + 1 < CC_RPLIDAR_CABINS ? capsules[i].ultra_cabins[p/3+1].combined_x3 : capsules[i+1].ultra_cabins[0].combined_x3,
+				dist_q2[p], expected_q2[p]);
+				return 1;
+			}
+	}
+
+	return 0;
+}
+
+static int test_decode(const rplidar_response_ultra_capsule_measurement_nodes_t *capsules, int size)
+{
+	struct cc_rplidar_data *data=calloc(size, sizeof(struct cc_rplidar_data));
+	const int points_size=size * CC_RPLIDAR_CAPSULE_POINTS;
+	uint16_t *angle_q14=calloc(points_size, sizeof(uint16_t));
+	uint32_t *dist_mm_q2=calloc(points_size, sizeof(uint32_t));
+	uint8_t *sync=calloc(points_size, sizeof(uint8_t));
+	struct cc_rplidar_points points={angle_q14, dist_mm_q2, sync, points_size};
+	int32_t expected_q2[CC_RPLIDAR_CAPSULE_POINTS];
+	int failed=1;
+	struct cc *c=NULL;
+
+	if(!data || !angle_q14 || !dist_mm_q2 || !sync || (c=cc_open_buffer(NULL, 0)) == NULL)
+	{
+		fprintf(stderr, "decode: unable to allocate\n");
+		goto cleanup;
+	}
+
+	for(int i=0;i<size;++i)
+		data[i].capsule=capsules[i];
+
+	if(cc_rplidar_decode(c, data, size, &points) != CC_OK || points.size != (size-1) * CC_RPLIDAR_CAPSULE_POINTS)
+	{
+		fprintf(stderr, "decode: cc_rplidar_decode failed\n");
+		goto cleanup;
+	}
+
+	for(int i=0;i<size-1;++i)
+	{
+		const int wraps = (capsules[i].start_angle_sync_q6 & 0x7FFF) > (capsules[i+1].start_angle_sync_q6 & 0x7FFF);
+		int syncs=0;
+
+		decode_rplidar_distances_scalar(&capsules[i], &capsules[i+1], expected_q2, 0);
+
+		for(int p=0;p<CC_RPLIDAR_CAPSULE_POINTS;++p)
+		{
+			const int point=i*CC_RPLIDAR_CAPSULE_POINTS + p;
+
+			if(dist_mm_q2[point] != (uint32_t)expected_q2[p])
+			{
+				fprintf(stderr, "decode: capsule %d point %d: %u expected %d\n", i, p, dist_mm_q2[point], expected_q2[p]);
+				goto cleanup;
+			}
+
+			syncs += sync[point];
+		}
+
+		//next scan starts at most once, only in capsule spanning 0 degrees
+		if(syncs > wraps)
+		{
+			fprintf(stderr, "decode: capsule %d: %d syncs, wraps around %d\n", i, syncs, wraps);
+			goto cleanup;
+		}
+	}
+
+	failed=0;
+
+cleanup:
+	cc_close(c);
+	free(data);
+	free(angle_q14);
+	free(dist_mm_q2);
+	free(sync);
+
+	return failed;
+}